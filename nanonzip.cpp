@@ -3,6 +3,10 @@
 /// @author (C) 2023 ttsuki
 /// MIT License
 
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64 // 64-bit off_t for pread/mmap on 32-bit platforms
+#endif
+
 #define NANONZIP_EXPORT
 #include "nanonzip.h"
 
@@ -10,26 +14,76 @@
 #include <cstdint>
 #include <ctime>
 #include <climits>
+#include <cerrno>
 #include <cstring>
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <istream>
 #include <fstream>
 #include <filesystem>
 #include <functional>
+#include <future>
+#include <thread>
 #include <stdexcept>
 #include <array>
 #include <vector>
 #include <type_traits>
+#include <typeinfo>
 #include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <limits>
 #include <utility>
+#include <iterator>
+#include <set>
+#include <unordered_map>
+#include <chrono>
+#include <condition_variable>
 
 #ifndef NANONZIP_EXPORT
 #define NANONZIP_EXPORT
 #endif
 
+#if defined(__GNUC__)
+#define NANONZIP_TARGET(features) __attribute__((target(features)))
+#else
+#define NANONZIP_TARGET(features)
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)) || defined(_M_ARM64)
+#define NANONZIP_CRC32_PMULL
+#include <arm_neon.h>
+#if defined(__linux__) || defined(__ANDROID__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #ifdef NANONZIP_ENABLE_ZLIB
 #include <zlib.h>
 #endif
@@ -165,52 +219,123 @@ namespace nanonzip
 #pragma pack(pop)
 
 
-    [[nodiscard]] static file_header file_header_from_central_directory_header(const central_directory_header* cdh)
+    [[nodiscard]] static const central_directory_header* central_directory_header_of(const char* record) noexcept
     {
-        file_header r{};
-        r.general_purpose_bit_flag = cdh->general_purpose_bit_flag;
-        r.compression_method = static_cast<file_header::compression_method_t>(cdh->compression_method);
-        r.crc_32 = cdh->crc_32;
+        return reinterpret_cast<const central_directory_header*>(record);
+    }
 
-        // last_mod_timestamp
-        {
-            std::tm tm{};
-            tm.tm_sec = std::clamp((cdh->last_mod_file_time >> 0 & 0x1f) * 2, 0, 59);
-            tm.tm_min = std::clamp(cdh->last_mod_file_time >> 5 & 0x3f, 0, 59);
-            tm.tm_hour = std::clamp(cdh->last_mod_file_time >> 11 & 0x1f, 0, 23);
-            tm.tm_mday = std::clamp(cdh->last_mod_file_date >> 0 & 0x1f, 1, 31);
-            tm.tm_mon = std::clamp(cdh->last_mod_file_date >> 5 & 0x0f, 1, 12) - 1;
-            tm.tm_year = std::clamp(cdh->last_mod_file_date >> 9 & 0x7f, 0, 128) + 1980 - 1900;
-            r.last_mod_timestamp = std::mktime(&tm);
+    // uncompressed_size, compressed_size, relative_offset_of_local_header
+    [[nodiscard]] static std::array<std::streamoff, 3> sizes_of(const central_directory_header* cdh) noexcept
+    {
+        std::array<std::streamoff, 3> r{
+            static_cast<std::streamoff>(cdh->uncompressed_size),
+            static_cast<std::streamoff>(cdh->compressed_size),
+            static_cast<std::streamoff>(cdh->relative_offset_of_local_header),
+        };
 
-            if (auto ut = cdh->find_extra_field(0x5455)) // Extended Timestamp Extra Field
-            {
-                ptrdiff_t t = 0;
-                uint8_t flag{};
-                if (t + sizeof(uint8_t) <= ut->size) flag = *reinterpret_cast<const uint8_t*>(ut->data() + std::exchange(t, t + sizeof(uint8_t)));
-                if ((flag & 1) && t + sizeof(uint32_t) <= ut->size) r.last_mod_timestamp = static_cast<std::time_t>(*reinterpret_cast<const uint32_t*>(ut->data() + std::exchange(t, t + sizeof(uint32_t))));
-            }
+        if (auto zip64 = cdh->find_extra_field(0x0001)) // ZIP64 Extended Information Extra Field
+        {
+            ptrdiff_t t = 0;
+            if (cdh->uncompressed_size == ~uint32_t{} && t + sizeof(uint64_t) <= zip64->size) r[0] = static_cast<std::streamoff>(*reinterpret_cast<const uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(uint64_t))));
+            if (cdh->compressed_size == ~uint32_t{} && t + sizeof(uint64_t) <= zip64->size) r[1] = static_cast<std::streamoff>(*reinterpret_cast<const uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(uint64_t))));
+            if (cdh->relative_offset_of_local_header == ~uint32_t{} && t + sizeof(uint64_t) <= zip64->size) r[2] = static_cast<std::streamoff>(*reinterpret_cast<const uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(uint64_t))));
         }
 
-        // uncompressed_size, compressed_size, relative_offset_of_local_header
+        return r;
+    }
+
+    [[nodiscard]] static std::filesystem::path path_of(const central_directory_header* cdh)
+    {
+        return cdh->general_purpose_bit_flag & 1 << 11 // utf-8 encoding?
+                   ? std::filesystem::u8path(cdh->filename())
+                   : std::filesystem::path(cdh->filename());
+    }
+
+    NANONZIP_EXPORT std::string_view file_entry::name() const noexcept { return central_directory_header_of(record_)->filename(); }
+    NANONZIP_EXPORT uint16_t file_entry::general_purpose_bit_flag() const noexcept { return central_directory_header_of(record_)->general_purpose_bit_flag; }
+    NANONZIP_EXPORT file_header::compression_method_t file_entry::compression_method() const noexcept { return static_cast<file_header::compression_method_t>(central_directory_header_of(record_)->compression_method); }
+    NANONZIP_EXPORT uint32_t file_entry::crc_32() const noexcept { return central_directory_header_of(record_)->crc_32; }
+    NANONZIP_EXPORT std::streamoff file_entry::uncompressed_size() const noexcept { return sizes_of(central_directory_header_of(record_))[0]; }
+    NANONZIP_EXPORT std::streamoff file_entry::compressed_size() const noexcept { return sizes_of(central_directory_header_of(record_))[1]; }
+    NANONZIP_EXPORT std::streamoff file_entry::relative_offset_of_local_header() const noexcept { return sizes_of(central_directory_header_of(record_))[2]; }
+
+    // Days from 1970-01-01 to the date in proleptic Gregorian calendar.
+    [[nodiscard]] static constexpr int64_t days_from_civil(int64_t y, int m, int d) noexcept
+    {
+        y -= m <= 2;
+        const int64_t era = (y >= 0 ? y : y - 399) / 400;
+        const int64_t yoe = y - era * 400;                                 // [0, 399]
+        const int64_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1; // [0, 365] (day overflowing the month goes to the next month, as mktime does)
+        const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;         // [0, 146096]
+        return era * 146097 + doe - 719468;
+    }
+
+    // Seconds from 1970-01-01 00:00:00 to DOS date and time (as UTC).
+    [[nodiscard]] static constexpr int64_t seconds_from_dos_date_time(uint16_t date, uint16_t time) noexcept
+    {
+        const int sec = std::clamp((time >> 0 & 0x1f) * 2, 0, 59);
+        const int min = std::clamp(time >> 5 & 0x3f, 0, 59);
+        const int hour = std::clamp(time >> 11 & 0x1f, 0, 23);
+        const int day = std::clamp(date >> 0 & 0x1f, 1, 31);
+        const int month = std::clamp(date >> 5 & 0x0f, 1, 12);
+        const int year = (date >> 9 & 0x7f) + 1980;
+        return days_from_civil(year, month, day) * 86400 + hour * 3600 + min * 60 + sec;
+    }
+
+    static_assert(seconds_from_dos_date_time(0 << 9 | 1 << 5 | 1, 0) == 315532800);                                  // 1980-01-01 00:00:00
+    static_assert(seconds_from_dos_date_time((2023 - 1980) << 9 | 1 << 5 | 1, 12 << 11) == 1672574400);              // 2023-01-01 12:00:00
+    static_assert(seconds_from_dos_date_time((2024 - 1980) << 9 | 2 << 5 | 29, 23 << 11 | 59 << 5 | 29) == 1709251198); // 2024-02-29 23:59:58
+    static_assert(seconds_from_dos_date_time((2023 - 1980) << 9 | 2 << 5 | 31, 0) == seconds_from_dos_date_time((2023 - 1980) << 9 | 3 << 5 | 3, 0));
+
+    // Offset of local standard time from UTC, taken once on the first use (as std::mktime with tm_isdst = 0 gives for the current date).
+    [[nodiscard]] static int64_t local_standard_time_offset() noexcept
+    {
+        static const int64_t offset = []
         {
-            r.uncompressed_size = cdh->uncompressed_size;
-            r.compressed_size = cdh->compressed_size;
-            r.relative_offset_of_local_header = cdh->relative_offset_of_local_header;
+            const std::time_t now = std::time(nullptr);
+            std::tm tm{};
+#ifdef _WIN32
+            if (::gmtime_s(&tm, &now) != 0) return int64_t{};
+#else
+            if (!::gmtime_r(&now, &tm)) return int64_t{};
+#endif
+            tm.tm_isdst = 0;
+            const std::time_t local = std::mktime(&tm);
+            return local == static_cast<std::time_t>(-1) ? int64_t{} : static_cast<int64_t>(now - local);
+        }();
+        return offset;
+    }
 
-            if (auto zip64 = cdh->find_extra_field(0x0001)) // ZIP64 Extended Information Extra Field
-            {
-                ptrdiff_t t = 0;
-                if (cdh->uncompressed_size == ~uint32_t{} && t + sizeof(uint64_t) <= zip64->size) r.uncompressed_size = static_cast<std::streamoff>(*reinterpret_cast<const uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(uint64_t))));
-                if (cdh->compressed_size == ~uint32_t{} && t + sizeof(uint64_t) <= zip64->size) r.compressed_size = static_cast<std::streamoff>(*reinterpret_cast<const uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(uint64_t))));
-                if (cdh->relative_offset_of_local_header == ~uint32_t{} && t + sizeof(uint64_t) <= zip64->size) r.relative_offset_of_local_header = static_cast<std::streamoff>(*reinterpret_cast<const uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(uint64_t))));
-            }
+    NANONZIP_EXPORT std::time_t file_entry::last_mod_timestamp(file_header::time_zone_t time_zone) const noexcept
+    {
+        const auto* cdh = central_directory_header_of(record_);
+
+        if (auto ut = cdh->find_extra_field(0x5455)) // Extended Timestamp Extra Field
+        {
+            ptrdiff_t t = 0;
+            uint8_t flag{};
+            if (t + sizeof(uint8_t) <= ut->size) flag = *reinterpret_cast<const uint8_t*>(ut->data() + std::exchange(t, t + sizeof(uint8_t)));
+            if ((flag & 1) && t + sizeof(uint32_t) <= ut->size) return static_cast<std::time_t>(*reinterpret_cast<const uint32_t*>(ut->data() + std::exchange(t, t + sizeof(uint32_t))));
         }
 
-        r.path = cdh->general_purpose_bit_flag & 1 << 11 // utf-8 encoding?
-                     ? std::filesystem::u8path(cdh->filename())
-                     : std::filesystem::path(cdh->filename());
+        const int64_t seconds = seconds_from_dos_date_time(cdh->last_mod_file_date, cdh->last_mod_file_time);
+        return static_cast<std::time_t>(time_zone == file_header::time_zone_t::utc ? seconds : seconds - local_standard_time_offset());
+    }
+
+    NANONZIP_EXPORT file_header file_entry::header(file_header::time_zone_t time_zone) const
+    {
+        const auto* cdh = central_directory_header_of(record_);
+        const auto sizes = sizes_of(cdh);
 
+        file_header r{};
+        r.general_purpose_bit_flag = cdh->general_purpose_bit_flag;
+        r.compression_method = static_cast<file_header::compression_method_t>(cdh->compression_method);
+        r.crc_32 = cdh->crc_32;
+        r.last_mod_timestamp = last_mod_timestamp(time_zone);
+        r.uncompressed_size = sizes[0];
+        r.compressed_size = sizes[1];
+        r.relative_offset_of_local_header = sizes[2];
+        r.path = path_of(cdh);
         return r;
     }
 
@@ -245,6 +370,8 @@ namespace nanonzip
 
         // allocates buffer
         const auto* found = reinterpret_cast<const end_of_central_directory_record*>(buffer.data() + found_offset);
+        if (found_offset + end_of_central_directory_record::fixed_header_size() > buffer.size() || found_offset + found->total_header_size() > buffer.size())
+            return nullptr; // broken record
         auto buf = std::shared_ptr(std::make_unique<char[]>(found->total_header_size()));
         std::memcpy(buf.get(), found, found->total_header_size());
 
@@ -252,9 +379,9 @@ namespace nanonzip
         return std::shared_ptr<end_of_central_directory_record>{buf, reinterpret_cast<end_of_central_directory_record*>(buf.get())};
     }
 
-    // Reads the central directory from a zip file. 
-    template <class end_of_central_directory_record = end_of_central_directory_record>
-    [[nodiscard]] static std::vector<file_header> read_central_directory(const file_seek_read_function& read_zip_file, const end_of_central_directory_record* cd)
+    // Reads the central directory from a zip file, and indexes its headers. If the zip file is on memory, it is referred in place.
+    template <class raw_central_directory, class end_of_central_directory_record>
+    [[nodiscard]] static raw_central_directory read_central_directory(const file_seek_read_function& read_zip_file, const end_of_central_directory_record* cd, std::string_view image)
     {
         if (cd->size_of_the_central_directory > 1073741824) // 1GiB
             throw std::runtime_error("too large central directory");
@@ -263,878 +390,4225 @@ namespace nanonzip
         const size_t directory_size = static_cast<int>(cd->size_of_the_central_directory);
         const size_t count = static_cast<int>(cd->total_number_of_entries_in_the_central_directory);
 
-        // reads whole central directory
-        auto buffer = std::shared_ptr(std::make_unique<char[]>(directory_size));
-        if (read_zip_file(directory_starts_at, buffer.get(), static_cast<int>(directory_size)) != static_cast<int>(directory_size))
-            throw std::runtime_error("failed to read central_directory");
+        // reads whole central directory, or refers it on memory
+        raw_central_directory r{};
+        if (!image.empty())
+        {
+            if (directory_starts_at < 0 || static_cast<size_t>(directory_starts_at) > image.size() || directory_size > image.size() - static_cast<size_t>(directory_starts_at))
+                throw std::runtime_error("failed to read central_directory");
+            r.data = image.data() + directory_starts_at;
+        }
+        else
+        {
+            r.buffer.reset(new char[directory_size]);
+            if (read_zip_file(directory_starts_at, r.buffer.get(), static_cast<int>(directory_size)) != static_cast<int>(directory_size))
+                throw std::runtime_error("failed to read central_directory");
+            r.data = r.buffer.get();
+        }
 
         // splits it to entries
-        std::vector<std::shared_ptr<const central_directory_header>> central_directory;
-        central_directory.reserve(count);
+        const char* directory = r.data;
+        r.size = directory_size;
+        r.offset_buffer.reserve(std::min(count, directory_size / central_directory_header::fixed_header_size()));
 
         size_t offset = 0;
         for (size_t i = 0; i < count && offset < directory_size; ++i)
         {
-            auto cdh = reinterpret_cast<const central_directory_header*>(buffer.get() + offset);
+            auto cdh = reinterpret_cast<const central_directory_header*>(directory + offset);
+            if (offset + central_directory_header::fixed_header_size() > directory_size)
+                throw std::runtime_error("unknown file format");
             if (cdh->central_file_header_signature != central_directory_header::SIGNATURE)
                 throw std::runtime_error("unknown file format");
             if (offset + cdh->total_header_size() > directory_size)
                 throw std::runtime_error("unknown file format");
 
+            r.offset_buffer.push_back(static_cast<uint32_t>(offset));
             offset += cdh->total_header_size();
-            central_directory.emplace_back(buffer, cdh);
         }
 
-        // parses central_directory_headers to file_headers
-        std::vector<file_header> central_directory_parsed;
-        central_directory_parsed.reserve(count);
-        for (const auto& h : central_directory)
-            central_directory_parsed.push_back(file_header_from_central_directory_header(h.get()));
-
-        return central_directory_parsed;
+        r.offsets = r.offset_buffer.data();
+        r.count = r.offset_buffer.size();
+        return r;
     }
 
-    NANONZIP_EXPORT zip_file_reader::zip_file_reader(file_seek_read_function zip_file, std::streamoff length) : read_zip_file_(std::move(zip_file))
+    template <class raw_central_directory>
+    [[nodiscard]] static raw_central_directory read_central_directory(const file_seek_read_function& read_zip_file, std::streamoff length, std::string_view image)
     {
-        if (auto ecd64 = find_end_of_central_directory_record<zip64_end_of_central_directory_record>(read_zip_file_, length))
-            this->central_directory_ = read_central_directory<zip64_end_of_central_directory_record>(read_zip_file_, ecd64.get());
-        else if (auto ecd = find_end_of_central_directory_record<end_of_central_directory_record>(read_zip_file_, length))
-            this->central_directory_ = read_central_directory<end_of_central_directory_record>(read_zip_file_, ecd.get());
+        if (auto ecd64 = find_end_of_central_directory_record<zip64_end_of_central_directory_record>(read_zip_file, length))
+            return read_central_directory<raw_central_directory>(read_zip_file, ecd64.get(), image);
+        else if (auto ecd = find_end_of_central_directory_record<end_of_central_directory_record>(read_zip_file, length))
+            return read_central_directory<raw_central_directory>(read_zip_file, ecd.get(), image);
         else
             throw std::runtime_error("zip_file_reader: failed to read end_of_central_directory_record");
     }
 
+    // Maps a whole file into memory (read only). The returned pointer unmaps it on release.
+    [[nodiscard]] static std::pair<std::shared_ptr<const char>, size_t> map_file(const std::filesystem::path& path)
+    {
+#if defined(_WIN32)
+        HANDLE file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("failed to open " + path.u8string());
 
-    // CRC-32
-    namespace crc32
+        LARGE_INTEGER size{};
+        HANDLE mapping = ::GetFileSizeEx(file, &size) && size.QuadPart > 0 ? ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        ::CloseHandle(file);
+        if (!mapping) throw std::runtime_error("failed to map " + path.u8string());
+
+        const void* view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        ::CloseHandle(mapping);
+        if (!view) throw std::runtime_error("failed to map " + path.u8string());
+
+        return {std::shared_ptr<const char>(static_cast<const char*>(view), [](const char* p) { ::UnmapViewOfFile(p); }), static_cast<size_t>(size.QuadPart)};
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw std::runtime_error("failed to open " + path.u8string());
+
+        struct stat st{};
+        void* view = ::fstat(fd, &st) == 0 && st.st_size > 0 ? ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (view == MAP_FAILED) throw std::runtime_error("failed to map " + path.u8string());
+
+        const auto size = static_cast<size_t>(st.st_size);
+        return {std::shared_ptr<const char>(static_cast<const char*>(view), [size](const char* p) { ::munmap(const_cast<char*>(p), size); }), size};
+#endif
+    }
+
+    // Makes file_seek_read_function reading from memory. (thread-safe)
+    [[nodiscard]] static file_seek_read_function make_file_seek_read_function_for_memory(const void* data, size_t size, std::shared_ptr<const void> owner)
     {
-        using byte = uint8_t;
-        using crc32_t = uint32_t;
-        using crc32_lookup_table = std::array<uint32_t, 256>;
+        return [data = static_cast<const char*>(data), size, owner = std::move(owner)](std::streamoff cursor, void* buf, int len) -> int
+        {
+            if (cursor < 0 || len < 0 || static_cast<size_t>(cursor) > size || static_cast<size_t>(len) > size - static_cast<size_t>(cursor))
+                throw std::out_of_range("cursor + size > total_length");
+            std::memcpy(buf, data + cursor, static_cast<size_t>(len));
+            return len;
+        };
+    }
 
-        template <class E, size_t S, class F>
-        static constexpr crc32_lookup_table generate_table(F&& generate)
+    NANONZIP_EXPORT file_seek_read_function make_file_seek_read_function_for_file(const std::filesystem::path& path)
+    {
+#if defined(_WIN32)
+        HANDLE handle = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) throw std::runtime_error("failed to open " + path.u8string());
+        auto file = std::shared_ptr<void>(handle, ::CloseHandle);
+
+        return [file = std::move(file)](std::streamoff cursor, void* buf, int len) -> int
         {
-            std::array<E, S> t{};
-            for (E i = 0; i < S; ++i) t[i] = generate(i);
-            return t;
-        }
+            for (int done = 0; done < len;)
+            {
+                // the offset in OVERLAPPED makes the read positional; concurrent reads do not share a cursor
+                const auto position = static_cast<std::uint64_t>(cursor + done);
+                OVERLAPPED overlapped{};
+                overlapped.Offset = static_cast<DWORD>(position);
+                overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+                DWORD read = 0;
+                if (!::ReadFile(file.get(), static_cast<char*>(buf) + done, static_cast<DWORD>(len - done), &read, &overlapped) && ::GetLastError() != ERROR_HANDLE_EOF)
+                    throw std::runtime_error("failed to read zip file");
+                if (read == 0) throw std::out_of_range("cursor + size > total_length");
+                done += static_cast<int>(read);
+            }
+            return len;
+        };
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw std::runtime_error("failed to open " + path.u8string());
+        auto file = std::shared_ptr<const int>(new int(fd), [](const int* p) { ::close(*p), delete p; });
 
-        template <uint32_t polynomial, size_t index = 0>
-        static constexpr crc32_lookup_table crc32_table = crc32::generate_table<uint32_t, 256>([](uint32_t i)
+        return [file = std::move(file)](std::streamoff cursor, void* buf, int len) -> int
         {
-            i = crc32_table<polynomial, index - 1>[static_cast<byte>(i)];
-            return (i >> 8) ^ crc32_table<polynomial, 0>[static_cast<byte>(i)];
-        });
+            for (int done = 0; done < len;)
+            {
+                const ssize_t read = ::pread(*file, static_cast<char*>(buf) + done, static_cast<size_t>(len - done), static_cast<off_t>(cursor + done));
+                if (read < 0 && errno == EINTR) continue;
+                if (read < 0) throw std::runtime_error("failed to read zip file");
+                if (read == 0) throw std::out_of_range("cursor + size > total_length");
+                done += static_cast<int>(read);
+            }
+            return len;
+        };
+#endif
+    }
 
-        template <uint32_t polynomial>
-        static constexpr crc32_lookup_table crc32_table<polynomial, 0> = crc32::generate_table<uint32_t, 256>([](uint32_t i)
+    // Index file (written by zip_file_reader::save_index): index_file_header, then sections aligned to 8 bytes:
+    //   tail of the zip file         char[tail_size]
+    //   file data offsets            uint64_t[count] (0 if not resolved)
+    //   central directory offsets    uint32_t[count]
+    //   exact name hash index        uint32_t[name_table_size]
+    //   raw central directory        char[directory_size]
+    struct index_file_header
+    {
+        static inline constexpr char MAGIC[8] = {'N', 'Z', 'I', 'P', 'I', 'D', 'X', '\x1a'};
+        static inline constexpr uint32_t VERSION = 2;
+        static inline constexpr size_t MAX_TAIL_SIZE = 4096; // the range searched for end of central directory record
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t checksum; // CRC-32 of the whole file, with this field 0
+        uint32_t reserved;
+        uint64_t zip_file_size;
+        int64_t zip_file_last_write_time;
+        uint64_t tail_size;
+        uint64_t count;
+        uint64_t name_table_size;
+        uint64_t directory_size;
+
+        [[nodiscard]] static constexpr uint64_t align(uint64_t offset) noexcept { return (offset + 7) & ~uint64_t{7}; }
+        [[nodiscard]] uint64_t tail_offset() const noexcept { return sizeof(index_file_header); }
+        [[nodiscard]] uint64_t data_offsets_offset() const noexcept { return align(tail_offset() + tail_size); }
+        [[nodiscard]] uint64_t offsets_offset() const noexcept { return data_offsets_offset() + count * sizeof(uint64_t); }
+        [[nodiscard]] uint64_t name_table_offset() const noexcept { return align(offsets_offset() + count * sizeof(uint32_t)); }
+        [[nodiscard]] uint64_t directory_offset() const noexcept { return name_table_offset() + name_table_size * sizeof(uint32_t); }
+        [[nodiscard]] uint64_t total_size() const noexcept { return directory_offset() + directory_size; }
+    };
+
+    static_assert(sizeof(index_file_header) == 72 && std::is_trivial_v<index_file_header>);
+
+    [[nodiscard]] static int64_t last_write_time_of(const std::filesystem::path& path)
+    {
+        return static_cast<int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+    }
+
+    [[nodiscard]] static std::string read_tail(const file_seek_read_function& read_zip_file, std::streamoff length)
+    {
+        std::string tail(static_cast<size_t>(std::min<std::streamoff>(length, index_file_header::MAX_TAIL_SIZE)), '\0');
+        if (read_zip_file(length - static_cast<std::streamoff>(tail.size()), tail.data(), static_cast<int>(tail.size())) != static_cast<int>(tail.size()))
+            throw std::runtime_error("failed to read zip file");
+        return tail;
+    }
+
+    // Maps an index file, and checks it against the zip file. Returns nullopt if the index file is missing, broken, or of another zip file.
+    template <class raw_central_directory>
+    [[nodiscard]] static std::optional<raw_central_directory> load_index_file(const std::filesystem::path& index_file, const std::filesystem::path& zip_file, const file_seek_read_function& read_zip_file, std::streamoff length)
+    {
+        try
         {
-            i = (i >> 1) ^ ((i & 1) * polynomial);
-            i = (i >> 1) ^ ((i & 1) * polynomial);
-            i = (i >> 1) ^ ((i & 1) * polynomial);
-            i = (i >> 1) ^ ((i & 1) * polynomial);
-            i = (i >> 1) ^ ((i & 1) * polynomial);
-            i = (i >> 1) ^ ((i & 1) * polynomial);
-            i = (i >> 1) ^ ((i & 1) * polynomial);
-            i = (i >> 1) ^ ((i & 1) * polynomial);
-            return i;
-        });
+            std::error_code ec;
+            if (!std::filesystem::is_regular_file(index_file, ec))
+                return std::nullopt;
+
+            auto [view, size] = map_file(index_file);
+            const char* base = view.get();
+
+            // checks the index file itself
+            if (size < sizeof(index_file_header)) return std::nullopt;
+            index_file_header h{};
+            std::memcpy(&h, base, sizeof(h));
+            if (std::memcmp(h.magic, index_file_header::MAGIC, sizeof(h.magic)) != 0 || h.version != index_file_header::VERSION || h.header_size != sizeof(index_file_header))
+                return std::nullopt;
+            if (h.tail_size > index_file_header::MAX_TAIL_SIZE || h.count > std::numeric_limits<uint32_t>::max() || h.directory_size > 1073741824 ||
+                h.name_table_size > uint64_t{1} << 34 || (h.name_table_size & (h.name_table_size - 1)) != 0 || h.name_table_size <= h.count || h.total_size() != size)
+                return std::nullopt;
+
+            // checks the zip file is the one indexed
+            if (h.zip_file_size != static_cast<uint64_t>(length) || h.zip_file_last_write_time != last_write_time_of(zip_file))
+                return std::nullopt;
+            if (read_tail(read_zip_file, length) != std::string_view(base + h.tail_offset(), static_cast<size_t>(h.tail_size)))
+                return std::nullopt;
+
+            // checks the sections are intact (after the cheap checks above, as this reads the whole file)
+            const uint32_t checksum = std::exchange(h.checksum, 0);
+            if (calculate_crc32(base + sizeof(h), size - sizeof(h), calculate_crc32(&h, sizeof(h))) != checksum)
+                return std::nullopt;
+
+            raw_central_directory r{};
+            r.data = base + h.directory_offset();
+            r.size = static_cast<size_t>(h.directory_size);
+            r.offsets = reinterpret_cast<const uint32_t*>(base + h.offsets_offset());
+            r.count = static_cast<size_t>(h.count);
+            r.data_offsets = reinterpret_cast<const uint64_t*>(base + h.data_offsets_offset());
+            r.name_table = reinterpret_cast<const uint32_t*>(base + h.name_table_offset());
+            r.name_table_size = static_cast<size_t>(h.name_table_size);
+
+            // checks headers are in the central directory (only headers near the end may exceed it)
+            constexpr size_t fixed_size = central_directory_header::fixed_header_size();
+            constexpr size_t max_header_size = fixed_size + 3 * size_t{0xFFFF};
+            for (size_t i = 0; i < r.count; i++)
+            {
+                const size_t offset = r.offsets[i];
+                if (offset + fixed_size > r.size || (i != 0 && offset < r.offsets[i - 1] + fixed_size))
+                    return std::nullopt;
+                if (offset + max_header_size > r.size && offset + central_directory_header_of(r.data + offset)->total_header_size() > r.size)
+                    return std::nullopt;
+            }
 
-        template <uint32_t polynomial>
-        [[nodiscard]] static crc32_t calculate_crc32(const void* data, size_t length, crc32_t current = 0)
+            r.index_file = std::move(view);
+            return r;
+        }
+        catch (const std::exception&)
         {
-            const byte* p = static_cast<const byte*>(data);
-            crc32_t crc = ~current;
+            return std::nullopt;
+        }
+    }
 
-#if 1
-            if (length & ~15)
+    NANONZIP_EXPORT page_cache::page_cache(file_seek_read_function upstream, std::streamoff total_length, options options)
+        : upstream_(std::move(upstream))
+        , total_length_(total_length)
+        , options_(options)
+    {
+        if (options_.page_size == 0) throw std::invalid_argument("page_cache: page_size must not be 0");
+    }
+
+    NANONZIP_EXPORT int page_cache::read(std::streamoff cursor, void* buf, int len)
+    {
+        if (len <= 0) return len;
+        if (cursor < 0 || cursor + len > total_length_) throw std::out_of_range("cursor + size > total_length");
+
+        const std::uint64_t page_size = options_.page_size;
+        const std::uint64_t read_ahead = std::max<size_t>(options_.read_ahead_pages, 1);
+        const std::uint64_t begin = static_cast<std::uint64_t>(cursor);
+        const std::uint64_t end = begin + static_cast<std::uint64_t>(len);
+        const std::uint64_t first = begin / page_size;
+        const std::uint64_t last = (end - 1) / page_size;
+
+        // requests larger than a read-ahead window bypass the cache (the inflater's bulk reads of a page do not)
+        if (static_cast<std::uint64_t>(len) > page_size * read_ahead)
+        {
             {
-                // process unaligned bytes
-                if (size_t pre_unaligned_bytes = reinterpret_cast<intptr_t>(p) & 15)
+                std::lock_guard lock(mutex_);
+                stats_.bypassed_reads++;
+                stats_.upstream_reads++;
+                stats_.upstream_bytes += static_cast<std::uint64_t>(len);
+            }
+            return upstream_(cursor, buf, len);
+        }
+
+        auto out = static_cast<char*>(buf);
+        for (std::uint64_t p = first; p <= last; p++)
+        {
+            std::shared_ptr<const char> data;
+            bool sequential = false;
+            {
+                std::lock_guard lock(mutex_);
+                if (auto it = pages_.find(p); it != pages_.end())
                 {
-                    for (auto last = p + pre_unaligned_bytes; p != last; ++p)
-                        crc = (crc >> 8) ^ crc32::crc32_table<polynomial>[static_cast<byte>(crc ^ *p)];
-                    length -= pre_unaligned_bytes;
+                    stats_.hits++;
+                    lru_.splice(lru_.begin(), lru_, it->second.lru);
+                    data = it->second.data;
                 }
-
-                // process aligned 16-byte blocks
-                for (auto last = p + (length & ~15); p != last; p += 16)
+                else
                 {
-                    uint64_t s[2];
-                    std::memcpy(&s, p, sizeof(s));
-
-                    s[0] ^= crc;
-                    crc = crc32::crc32_table<polynomial, 0>[static_cast<byte>(s[1] >> 56)]
-                        ^ crc32::crc32_table<polynomial, 1>[static_cast<byte>(s[1] >> 48)]
-                        ^ crc32::crc32_table<polynomial, 2>[static_cast<byte>(s[1] >> 40)]
-                        ^ crc32::crc32_table<polynomial, 3>[static_cast<byte>(s[1] >> 32)]
-                        ^ crc32::crc32_table<polynomial, 4>[static_cast<byte>(s[1] >> 24)]
-                        ^ crc32::crc32_table<polynomial, 5>[static_cast<byte>(s[1] >> 16)]
-                        ^ crc32::crc32_table<polynomial, 6>[static_cast<byte>(s[1] >> 8)]
-                        ^ crc32::crc32_table<polynomial, 7>[static_cast<byte>(s[1] >> 0)]
-                        ^ crc32::crc32_table<polynomial, 8>[static_cast<byte>(s[0] >> 56)]
-                        ^ crc32::crc32_table<polynomial, 9>[static_cast<byte>(s[0] >> 48)]
-                        ^ crc32::crc32_table<polynomial, 10>[static_cast<byte>(s[0] >> 40)]
-                        ^ crc32::crc32_table<polynomial, 11>[static_cast<byte>(s[0] >> 32)]
-                        ^ crc32::crc32_table<polynomial, 12>[static_cast<byte>(s[0] >> 24)]
-                        ^ crc32::crc32_table<polynomial, 13>[static_cast<byte>(s[0] >> 16)]
-                        ^ crc32::crc32_table<polynomial, 14>[static_cast<byte>(s[0] >> 8)]
-                        ^ crc32::crc32_table<polynomial, 15>[static_cast<byte>(s[0] >> 0)];
+                    sequential = p == next_sequential_page_;
                 }
-                length &= 15;
             }
-#endif
 
-            // process remain bytes
-            for (auto last = p + length; p != last; ++p)
-                crc = (crc >> 8) ^ crc32::crc32_table<polynomial>[static_cast<byte>(crc ^ *p)];
+            // reads pages up to the end of the request, or read-ahead window if the reading looks sequential
+            if (!data)
+                data = load_pages(p, sequential ? std::max(last, p + read_ahead - 1) : last);
 
-            return ~crc;
+            const std::uint64_t page_begin = p * page_size;
+            const auto from = static_cast<size_t>(std::max(begin, page_begin) - page_begin);
+            const auto to = static_cast<size_t>(std::min(end, page_begin + page_size) - page_begin);
+            std::memcpy(out, data.get() + from, to - from);
+            out += to - from;
         }
+
+        return len;
     }
 
-    /// Traditional PKWARE Decryption
-    struct traditional_pkware_decryption
+    // Reads pages [first, last] from upstream at once, caches them, and returns the first page.
+    std::shared_ptr<const char> page_cache::load_pages(std::uint64_t first, std::uint64_t last)
     {
-        using byte = uint8_t;
-        uint32_t k0_ = 305419896;
-        uint32_t k1_ = 591751049;
-        uint32_t k2_ = 878082192;
+        const std::uint64_t page_size = options_.page_size;
+        last = std::min(last, static_cast<std::uint64_t>(total_length_ - 1) / page_size);
+        const std::uint64_t begin = first * page_size;
+        const auto size = static_cast<size_t>(std::min(static_cast<std::uint64_t>(total_length_), (last + 1) * page_size) - begin);
 
-        static constexpr inline auto crc32_table = crc32::crc32_table<0xEDB88320>;
+        std::shared_ptr<char> block(new char[size], std::default_delete<char[]>());
+        upstream_(static_cast<std::streamoff>(begin), block.get(), static_cast<int>(size));
 
-        traditional_pkware_decryption(std::string_view password)
-        {
-            for (char c : password)
-                update_keys(c);
-        }
+        std::lock_guard lock(mutex_);
+        stats_.misses++;
+        stats_.upstream_reads++;
+        stats_.upstream_bytes += size;
+        next_sequential_page_ = last + 1;
 
-        void update_keys(byte c)
+        for (std::uint64_t p = first; p <= last; p++)
         {
-            k0_ = crc32_table[static_cast<uint8_t>(k0_ ^ c)] ^ k0_ >> 8;
-            k1_ = (k1_ + static_cast<uint8_t>(k0_)) * 134775813 + 1;
-            k2_ = crc32_table[static_cast<uint8_t>(k2_ ^ (k1_ >> 24))] ^ k2_ >> 8;
+            if (pages_.count(p)) continue; // loaded by another thread meanwhile
+            const size_t offset = static_cast<size_t>((p - first) * page_size);
+            const size_t page_bytes = std::min<size_t>(static_cast<size_t>(page_size), size - offset);
+            lru_.push_front(p);
+            pages_.emplace(p, page{std::shared_ptr<const char>(block, block.get() + offset), page_bytes, lru_.begin()});
+            cached_bytes_ += page_bytes;
         }
 
-        byte process_byte(byte b)
+        // evicts least recently used pages
+        while (cached_bytes_ > options_.capacity && !lru_.empty())
         {
-            uint32_t u = k2_ | 2;
-            b ^= static_cast<uint8_t>(u * (u ^ 1) >> 8);
-            update_keys(b);
-            return b;
+            auto it = pages_.find(lru_.back());
+            cached_bytes_ -= it->second.size;
+            pages_.erase(it);
+            lru_.pop_back();
         }
 
-        void process_buffer(void* buffer, size_t sz)
-        {
-            auto buf = static_cast<byte*>(buffer);
-            for (size_t i = 0; i < sz; ++i)
-                buf[i] = process_byte(buf[i]);
-        }
-    };
+        return std::shared_ptr<const char>(block, block.get());
+    }
 
-    // DEFLATE Compressed Data Format Specification version 1.3
-    // https://www.ietf.org/rfc/rfc1951.txt
-    namespace inflate
+    NANONZIP_EXPORT page_cache::statistics page_cache::stats() const
     {
-        // Input bit stream
-        class bit_stream
-        {
-            static constexpr inline size_t input_buffer_size = 65536;
-            std::function<size_t(void* buf, size_t len)> read_{};
-            std::vector<std::byte> input_buffer_{};
-            std::basic_string_view<std::byte> buffered_input_{};
-            std::uintptr_t local{};
-            unsigned local_buffered_{};
+        std::lock_guard lock(mutex_);
+        return stats_;
+    }
 
+    namespace decode
+    {
+        // Cache of decompressed files of a reader, keyed by index. (thread-safe)
+        // Files are spread over shards locked separately, sharing the budget, and evicted from any shard in the order of their priorities:
+        // the tick of the last use (lru), or L + hits * cost / size where L is the priority of the last evicted file (cost_aware, GreedyDual-Size-Frequency).
+        class entry_cache
+        {
         public:
-            bit_stream(std::function<size_t(void* buf, size_t len)> upstream) : read_(std::move(upstream)), input_buffer_(input_buffer_size) {}
-            bit_stream(const bit_stream& other) = delete;
-            bit_stream(bit_stream&& other) noexcept = delete;
-            bit_stream& operator=(const bit_stream& other) = delete;
-            bit_stream& operator=(bit_stream&& other) noexcept = delete;
-            ~bit_stream() = default;
+            using contents_t = std::shared_ptr<const std::vector<std::byte>>;
+            static constexpr size_t shard_count = 16;
 
-            void fill(unsigned n)
+        private:
+            struct cached
             {
-                n = static_cast<unsigned>(std::min<size_t>(CHAR_BIT * (sizeof(local) - 1), n));
-                while (local_buffered_ < n)
-                {
-                    if (buffered_input_.empty())
-                    {
-                        buffered_input_ = std::basic_string_view<std::byte>{
-                            input_buffer_.data(),
-                            read_(input_buffer_.data(), input_buffer_.size())
-                        };
-                    }
+                contents_t contents;
+                size_t password_hash{}; // handed out only for the same password (not kept in plain text)
+                double cost{};        // seconds spent decompressing
+                std::uint64_t hits{};
+                double priority{};
+            };
 
-                    if (!buffered_input_.empty())
-                    {
-                        local |= static_cast<decltype(local)>(buffered_input_.front()) << local_buffered_;
-                        buffered_input_.remove_prefix(1);
-                    }
+            struct shard
+            {
+                std::mutex mutex;
+                entry_cache_options options{};
+                std::unordered_map<size_t, cached> files{};
+                std::set<std::pair<double, size_t>> order{}; // (priority, index), evicted from the lowest
+                std::atomic<double> lowest{std::numeric_limits<double>::infinity()}; // priority at the head of the order, read without the lock
+                size_t bytes{};
+                entry_cache_statistics stats{};
+
+                void update_lowest() { lowest.store(order.empty() ? std::numeric_limits<double>::infinity() : order.begin()->first, std::memory_order_relaxed); }
+            };
 
-                    local_buffered_ += CHAR_BIT;
-                }
+            std::array<shard, shard_count> shards_{};
+            std::atomic<size_t> bytes_{};  // of all shards
+            std::atomic<std::uint64_t> tick_{}; // of the last use (lru), shared so that priorities compare across shards
+            std::atomic<double> inflation_{};   // L (cost_aware), shared likewise
+
+            [[nodiscard]] shard& shard_of(size_t index) noexcept { return shards_[index % shard_count]; }
+            [[nodiscard]] static size_t hash_of(std::string_view password) noexcept { return std::hash<std::string_view>{}(password); }
+
+            [[nodiscard]] double priority_of(const shard& s, const cached& c)
+            {
+                if (s.options.eviction == entry_cache_options::eviction_t::lru)
+                    return static_cast<double>(tick_.fetch_add(1, std::memory_order_relaxed) + 1);
+                return inflation_.load(std::memory_order_relaxed) + static_cast<double>(c.hits + 1) * c.cost / static_cast<double>(std::max<size_t>(c.contents->size(), 1));
             }
 
-            [[nodiscard]] unsigned peek(unsigned n)
+            // Renews the priority of a hit file, moving its node in the order without allocation.
+            void touch(shard& s, size_t index, cached& c)
             {
-                if (n > local_buffered_)
-                {
+                auto node = s.order.extract({c.priority, index});
+                c.priority = priority_of(s, c);
+                node.value().first = c.priority;
+                s.order.insert(std::move(node));
+                s.update_lowest();
+            }
+
+            void erase(shard& s, std::unordered_map<size_t, cached>::iterator it)
+            {
+                s.order.erase({it->second.priority, it->first});
+                s.bytes -= it->second.contents->size();
+                bytes_ -= it->second.contents->size();
+                s.files.erase(it);
+                s.update_lowest();
+            }
+
+            // Evicts the files of the lowest priorities among the shards until all fit in `budget`, locking a shard at a time.
+            void evict_over(size_t budget)
+            {
+                while (bytes_.load(std::memory_order_relaxed) > budget)
+                {
+                    shard* victim = nullptr;
+                    double lowest = std::numeric_limits<double>::infinity();
+                    for (auto& s : shards_)
+                    {
+                        if (const double p = s.lowest.load(std::memory_order_relaxed); p < lowest)
+                        {
+                            lowest = p;
+                            victim = &s;
+                        }
+                    }
+                    if (!victim) return;
+
+                    std::lock_guard lock(victim->mutex);
+                    if (victim->order.empty()) continue; // emptied meanwhile
+                    const auto [priority, index] = *victim->order.begin();
+                    if (victim->options.eviction == entry_cache_options::eviction_t::cost_aware)
+                    {
+                        double inflation = inflation_.load(std::memory_order_relaxed);
+                        while (inflation < priority && !inflation_.compare_exchange_weak(inflation, priority, std::memory_order_relaxed)) { }
+                    }
+                    erase(*victim, victim->files.find(index));
+                    victim->stats.evictions++;
+                }
+            }
+
+        public:
+            void configure(const entry_cache_options& options)
+            {
+                bool emptied = false;
+                for (auto& s : shards_)
+                {
+                    std::lock_guard lock(s.mutex);
+                    if (s.options.eviction != options.eviction)
+                    {
+                        bytes_ -= s.bytes;
+                        s.files.clear();
+                        s.order.clear();
+                        s.bytes = 0;
+                        s.update_lowest();
+                        emptied = true;
+                    }
+                    s.options = options;
+                }
+                if (emptied)
+                {
+                    tick_ = 0;
+                    inflation_ = 0;
+                }
+                evict_over(options.capacity);
+            }
+
+            [[nodiscard]] entry_cache_statistics stats()
+            {
+                entry_cache_statistics r{};
+                for (auto& s : shards_)
+                {
+                    std::lock_guard lock(s.mutex);
+                    r.hits += s.stats.hits;
+                    r.misses += s.stats.misses;
+                    r.evictions += s.stats.evictions;
+                    r.bytes_saved += s.stats.bytes_saved;
+                    r.cached_files += s.files.size();
+                    r.cached_bytes += s.bytes;
+                }
+                return r;
+            }
+
+            // Gets the contents of a file cached with the same password, or nullptr. (passwords of files not encrypted should be empty)
+            [[nodiscard]] contents_t find(size_t index, std::string_view password)
+            {
+                auto& s = shard_of(index);
+                std::lock_guard lock(s.mutex);
+                if (s.options.capacity == 0) return nullptr;
+
+                const auto it = s.files.find(index);
+                if (it == s.files.end() || it->second.password_hash != hash_of(password))
+                {
+                    s.stats.misses++;
+                    return nullptr;
+                }
+
+                s.stats.hits++;
+                s.stats.bytes_saved += it->second.contents->size();
+                it->second.hits++;
+                touch(s, index, it->second);
+                return it->second.contents;
+            }
+
+            // Keeps the contents of a file decompressed in `cost` seconds, then evicts files to fit in the budget.
+            void insert(size_t index, std::string_view password, contents_t contents, double cost)
+            {
+                auto& s = shard_of(index);
+                size_t capacity{};
+                {
+                    std::lock_guard lock(s.mutex);
+                    const size_t size = contents->size();
+                    capacity = s.options.capacity;
+                    if (capacity == 0 || size > capacity) return;
+
+                    if (const auto it = s.files.find(index); it != s.files.end())
+                        erase(s, it); // inserted by another thread meanwhile, or with another password
+
+                    auto& c = s.files[index] = cached{std::move(contents), hash_of(password), cost};
+                    c.priority = priority_of(s, c);
+                    s.order.emplace(c.priority, index);
+                    s.bytes += size;
+                    bytes_ += size;
+                    s.update_lowest();
+                }
+                evict_over(capacity); // the lowest may be the file just inserted (cost_aware)
+            }
+        };
+    }
+
+    // Parts of zip_file_reader built on the first use: decoded files, and hash index of file names (open addressing over indexes of files).
+    namespace decode
+    {
+        class decoder_pool;
+        static std::shared_ptr<decoder_pool> make_decoder_pool();
+        class checkpoint_registry;
+        static std::shared_ptr<checkpoint_registry> make_checkpoint_registry();
+    }
+
+    struct zip_file_reader::lazy_parts
+    {
+        std::shared_ptr<decode::decoder_pool> decoders = decode::make_decoder_pool(); // shared with opened files
+        std::shared_ptr<decode::checkpoint_registry> checkpoints = decode::make_checkpoint_registry(); // shared with opened files
+        decode::entry_cache cache; // decompressed files read by read_file
+
+        std::once_flag files_decoded;
+        std::vector<file_header> files;
+
+        std::once_flag data_offsets_allocated;
+        std::unique_ptr<std::atomic<uint64_t>[]> data_offsets; // resolved file data offsets, 0 for unknown
+
+        std::atomic<uint64_t>* resolved_data_offsets(size_t count)
+        {
+            std::call_once(data_offsets_allocated, [&] { data_offsets.reset(new std::atomic<uint64_t>[count]()); });
+            return data_offsets.get();
+        }
+
+        std::once_flag opened_headers_allocated;
+        std::unique_ptr<std::atomic<const file_header*>[]> opened_headers; // decoded on the first open of each file, then shared by files opened from it
+        size_t opened_header_count{};
+
+        lazy_parts() = default;
+        lazy_parts(const lazy_parts& other) = delete;
+        lazy_parts& operator=(const lazy_parts& other) = delete;
+
+        ~lazy_parts()
+        {
+            for (size_t i = 0; i < opened_header_count; i++) delete opened_headers[i].load();
+        }
+
+        // Gets the header of a file opened from `self`, decoding it by `decode()` on the first open.
+        template <class decode_t>
+        static std::shared_ptr<const file_header> opened_header(const std::shared_ptr<lazy_parts>& self, size_t index, size_t count, decode_t&& decode)
+        {
+            std::call_once(self->opened_headers_allocated, [&]
+            {
+                self->opened_headers.reset(new std::atomic<const file_header*>[count]());
+                self->opened_header_count = count;
+            });
+
+            auto& slot = self->opened_headers[index];
+            const file_header* header = slot.load(std::memory_order_acquire);
+            if (!header)
+            {
+                auto decoded = std::make_unique<const file_header>(decode());
+                if (slot.compare_exchange_strong(header, decoded.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+                    header = decoded.release(); // or decoded by another thread meanwhile
+            }
+            return std::shared_ptr<const file_header>(self, header);
+        }
+
+        static constexpr size_t modes = 2; // name_matching_t
+        std::once_flag built[modes];
+        std::vector<uint32_t> slots[modes]; // (index + 1) of files, 0 for empty
+        const uint32_t* table[modes]{};     // slots, or mapped from index file
+        size_t table_size[modes]{};         // power of 2
+
+        static std::string_view name_of(const raw_central_directory& directory, size_t index) noexcept
+        {
+            return central_directory_header_of(directory.data + directory.offsets[index])->filename();
+        }
+
+        template <name_matching_t matching>
+        static constexpr unsigned char fold(char c) noexcept
+        {
+            auto u = static_cast<unsigned char>(c);
+            if constexpr (matching == name_matching_t::normalized)
+            {
+                if (u >= 'A' && u <= 'Z') return static_cast<unsigned char>(u - 'A' + 'a');
+                if (u == '\\') return '/';
+            }
+            return u;
+        }
+
+        template <name_matching_t matching>
+        static uint64_t hash(std::string_view name) noexcept
+        {
+            uint64_t h = 0xcbf29ce484222325; // FNV-1a
+            for (char c : name) h = (h ^ fold<matching>(c)) * 0x100000001b3;
+            return h;
+        }
+
+        template <name_matching_t matching>
+        static bool equal(std::string_view a, std::string_view b) noexcept
+        {
+            if (a.size() != b.size()) return false;
+            for (size_t i = 0; i < a.size(); i++)
+                if (fold<matching>(a[i]) != fold<matching>(b[i]))
+                    return false;
+            return true;
+        }
+
+        template <name_matching_t matching>
+        std::optional<size_t> find(const raw_central_directory& directory, std::string_view name)
+        {
+            constexpr auto mode = static_cast<size_t>(matching);
+            const size_t count = directory.count;
+            std::call_once(built[mode], [&]
+            {
+                size_t capacity = 16;
+                while (capacity < count * 2) capacity *= 2;
+                auto& t = slots[mode];
+                t.assign(capacity, 0);
+                for (size_t i = 0; i < count; i++)
+                {
+                    const auto n = name_of(directory, i);
+                    for (size_t s = hash<matching>(n) & (capacity - 1);; s = (s + 1) & (capacity - 1))
+                    {
+                        if (t[s] == 0) { t[s] = static_cast<uint32_t>(i + 1); break; }
+                        if (equal<matching>(name_of(directory, t[s] - 1), n)) break; // keeps the first one
+                    }
+                }
+                table[mode] = t.data();
+                table_size[mode] = t.size();
+            });
+
+            const uint32_t* t = table[mode];
+            const size_t mask = table_size[mode] - 1;
+            for (size_t s = hash<matching>(name) & mask, probes = 0; t[s] != 0 && t[s] <= count && probes < table_size[mode]; s = (s + 1) & mask, probes++)
+                if (equal<matching>(name_of(directory, t[s] - 1), name))
+                    return t[s] - 1;
+            return std::nullopt;
+        }
+    };
+
+    NANONZIP_EXPORT zip_file_reader::zip_file_reader(file_seek_read_function zip_file, std::streamoff length)
+        : read_zip_file_(std::make_shared<const file_seek_read_function>(std::move(zip_file)))
+        , length_(length)
+        , central_directory_(read_central_directory<raw_central_directory>(*read_zip_file_, length, {}))
+        , lazy_(std::make_shared<lazy_parts>()) { }
+
+    NANONZIP_EXPORT zip_file_reader::zip_file_reader(const void* data, size_t size, std::shared_ptr<const void> owner)
+        : read_zip_file_(std::make_shared<const file_seek_read_function>(make_file_seek_read_function_for_memory(data, size, std::move(owner))))
+        , image_(static_cast<const char*>(data), size)
+        , length_(static_cast<std::streamoff>(size))
+        , central_directory_(read_central_directory<raw_central_directory>(*read_zip_file_, static_cast<std::streamoff>(size), image_))
+        , lazy_(std::make_shared<lazy_parts>()) { }
+
+    NANONZIP_EXPORT zip_file_reader::zip_file_reader(const std::filesystem::path& zip_file, const std::filesystem::path& index_file)
+        : read_zip_file_(std::make_shared<const file_seek_read_function>(make_file_seek_read_function_for_file(zip_file)))
+        , length_(static_cast<std::streamoff>(std::filesystem::file_size(zip_file)))
+        , central_directory_([&]
+        {
+            if (auto loaded = load_index_file<raw_central_directory>(index_file, zip_file, *read_zip_file_, length_))
+                return std::move(*loaded);
+            return read_central_directory<raw_central_directory>(*read_zip_file_, length_, {});
+        }())
+        , lazy_(std::make_shared<lazy_parts>())
+    {
+        // uses the name hash index in the index file
+        if (central_directory_.name_table)
+        {
+            constexpr auto exact = static_cast<size_t>(name_matching_t::exact);
+            std::call_once(lazy_->built[exact], [&]
+            {
+                lazy_->table[exact] = central_directory_.name_table;
+                lazy_->table_size[exact] = central_directory_.name_table_size;
+            });
+        }
+    }
+
+    NANONZIP_EXPORT zip_file_reader::zip_file_reader(const std::filesystem::path& zip_file, memory_mapped_t)
+        : zip_file_reader([&]
+        {
+            auto [view, size] = map_file(zip_file);
+            return zip_file_reader(view.get(), size, view);
+        }()) { }
+
+
+    // CRC-32
+    namespace crc32
+    {
+        using byte = uint8_t;
+        using crc32_t = uint32_t;
+        using crc32_lookup_table = std::array<uint32_t, 256>;
+
+        template <class E, size_t S, class F>
+        static constexpr crc32_lookup_table generate_table(F&& generate)
+        {
+            std::array<E, S> t{};
+            for (E i = 0; i < S; ++i) t[i] = generate(i);
+            return t;
+        }
+
+        template <uint32_t polynomial, size_t index = 0>
+        static constexpr crc32_lookup_table crc32_table = crc32::generate_table<uint32_t, 256>([](uint32_t i)
+        {
+            i = crc32_table<polynomial, index - 1>[static_cast<byte>(i)];
+            return (i >> 8) ^ crc32_table<polynomial, 0>[static_cast<byte>(i)];
+        });
+
+        template <uint32_t polynomial>
+        static constexpr crc32_lookup_table crc32_table<polynomial, 0> = crc32::generate_table<uint32_t, 256>([](uint32_t i)
+        {
+            i = (i >> 1) ^ ((i & 1) * polynomial);
+            i = (i >> 1) ^ ((i & 1) * polynomial);
+            i = (i >> 1) ^ ((i & 1) * polynomial);
+            i = (i >> 1) ^ ((i & 1) * polynomial);
+            i = (i >> 1) ^ ((i & 1) * polynomial);
+            i = (i >> 1) ^ ((i & 1) * polynomial);
+            i = (i >> 1) ^ ((i & 1) * polynomial);
+            i = (i >> 1) ^ ((i & 1) * polynomial);
+            return i;
+        });
+
+        // Calculates CRC-32 with slicing-by-16 tables (portable)
+        template <uint32_t polynomial>
+        [[nodiscard]] static crc32_t calculate_crc32_table(const void* data, size_t length, crc32_t current = 0)
+        {
+            const byte* p = static_cast<const byte*>(data);
+            crc32_t crc = ~current;
+
+#if 1
+            if (length & ~15)
+            {
+                // process unaligned bytes
+                if (size_t pre_unaligned_bytes = reinterpret_cast<intptr_t>(p) & 15)
+                {
+                    for (auto last = p + pre_unaligned_bytes; p != last; ++p)
+                        crc = (crc >> 8) ^ crc32::crc32_table<polynomial>[static_cast<byte>(crc ^ *p)];
+                    length -= pre_unaligned_bytes;
+                }
+
+                // process aligned 16-byte blocks
+                for (auto last = p + (length & ~15); p != last; p += 16)
+                {
+                    uint64_t s[2];
+                    std::memcpy(&s, p, sizeof(s));
+
+                    s[0] ^= crc;
+                    crc = crc32::crc32_table<polynomial, 0>[static_cast<byte>(s[1] >> 56)]
+                        ^ crc32::crc32_table<polynomial, 1>[static_cast<byte>(s[1] >> 48)]
+                        ^ crc32::crc32_table<polynomial, 2>[static_cast<byte>(s[1] >> 40)]
+                        ^ crc32::crc32_table<polynomial, 3>[static_cast<byte>(s[1] >> 32)]
+                        ^ crc32::crc32_table<polynomial, 4>[static_cast<byte>(s[1] >> 24)]
+                        ^ crc32::crc32_table<polynomial, 5>[static_cast<byte>(s[1] >> 16)]
+                        ^ crc32::crc32_table<polynomial, 6>[static_cast<byte>(s[1] >> 8)]
+                        ^ crc32::crc32_table<polynomial, 7>[static_cast<byte>(s[1] >> 0)]
+                        ^ crc32::crc32_table<polynomial, 8>[static_cast<byte>(s[0] >> 56)]
+                        ^ crc32::crc32_table<polynomial, 9>[static_cast<byte>(s[0] >> 48)]
+                        ^ crc32::crc32_table<polynomial, 10>[static_cast<byte>(s[0] >> 40)]
+                        ^ crc32::crc32_table<polynomial, 11>[static_cast<byte>(s[0] >> 32)]
+                        ^ crc32::crc32_table<polynomial, 12>[static_cast<byte>(s[0] >> 24)]
+                        ^ crc32::crc32_table<polynomial, 13>[static_cast<byte>(s[0] >> 16)]
+                        ^ crc32::crc32_table<polynomial, 14>[static_cast<byte>(s[0] >> 8)]
+                        ^ crc32::crc32_table<polynomial, 15>[static_cast<byte>(s[0] >> 0)];
+                }
+                length &= 15;
+            }
+#endif
+
+            // process remain bytes
+            for (auto last = p + length; p != last; ++p)
+                crc = (crc >> 8) ^ crc32::crc32_table<polynomial>[static_cast<byte>(crc ^ *p)];
+
+            return ~crc;
+        }
+
+        // GF(2) polynomial arithmetic modulo the CRC polynomial (bit-reflected: x^0 is the msb)
+        template <uint32_t polynomial>
+        [[nodiscard]] static constexpr crc32_t multiply_mod_p(crc32_t a, crc32_t b)
+        {
+            crc32_t p = 0;
+            for (crc32_t m = 1u << 31; m; m >>= 1)
+            {
+                if (a & m) p ^= b;
+                b = (b >> 1) ^ ((b & 1) * polynomial);
+            }
+            return p;
+        }
+
+        // x^(2^k) mod P
+        template <uint32_t polynomial>
+        static constexpr std::array<crc32_t, 64> x_pow_2k_table = []
+        {
+            std::array<crc32_t, 64> t{};
+            t[0] = 1u << 30; // x^1
+            for (size_t k = 1; k < t.size(); ++k) t[k] = multiply_mod_p<polynomial>(t[k - 1], t[k - 1]);
+            return t;
+        }();
+
+        // x^n mod P
+        template <uint32_t polynomial>
+        [[nodiscard]] static constexpr crc32_t x_pow_mod_p(uint64_t n)
+        {
+            crc32_t p = 1u << 31; // x^0
+            for (size_t k = 0; n; n >>= 1, ++k)
+                if (n & 1) p = multiply_mod_p<polynomial>(x_pow_2k_table<polynomial>[k], p);
+            return p;
+        }
+
+        // Combines CRC of two adjacent data: crc(A), crc(B), length(B) -> crc(A + B)
+        template <uint32_t polynomial>
+        [[nodiscard]] static constexpr crc32_t combine_crc32(crc32_t crc1, crc32_t crc2, uint64_t length2)
+        {
+            return multiply_mod_p<polynomial>(x_pow_mod_p<polynomial>(length2 * 8), crc1) ^ crc2;
+        }
+
+        // Carry-less multiplication folding (Intel: "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction")
+        // Folding 128-bit lanes forward by D bits multiplies the low and high qwords by x^(D+32) mod P and x^(D-32) mod P.
+        namespace clmul
+        {
+            static constexpr uint32_t polynomial = 0xEDB88320;
+            [[nodiscard]] static constexpr uint64_t fold_constant(uint64_t n) { return uint64_t{x_pow_mod_p<polynomial>(n)} << 1; }
+            static constexpr uint64_t k_fold_128[2] = {fold_constant(128 + 32), fold_constant(128 - 32)};
+            static constexpr uint64_t k_fold_512[2] = {fold_constant(512 + 32), fold_constant(512 - 32)};
+            static constexpr uint64_t k_fold_2048[2] = {fold_constant(2048 + 32), fold_constant(2048 - 32)};
+            static constexpr uint64_t k_fold_64[2] = {fold_constant(64), 0};
+            static constexpr uint64_t k_barrett[2] = {0x1DB710641, 0x1F7011641}; // P', mu = floor(x^64 / P)
+            static_assert(k_fold_512[0] == 0x154442BD4 && k_fold_512[1] == 0x1C6E41596);
+            static_assert(k_fold_128[0] == 0x1751997D0 && k_fold_128[1] == 0x0CCAA009E);
+            static_assert(k_fold_64[0] == 0x163CD6124);
+        }
+
+#if defined(__x86_64__) || defined(_M_X64)
+        // x86-64: PCLMULQDQ
+        NANONZIP_TARGET("pclmul,sse4.1")
+        [[nodiscard]] static inline __m128i clmul_fold(__m128i x, __m128i k, __m128i data)
+        {
+            return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), data);
+        }
+
+        // Reduces a 128-bit remainder to crc32
+        NANONZIP_TARGET("pclmul,sse4.1")
+        [[nodiscard]] static inline crc32_t clmul_reduce(__m128i x)
+        {
+            const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+            // 128 bits -> 64 bits
+            __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(clmul::k_fold_128));
+            x = _mm_xor_si128(_mm_srli_si128(x, 8), _mm_clmulepi64_si128(x, k, 0x10));
+            k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(clmul::k_fold_64));
+            x = _mm_xor_si128(_mm_srli_si128(x, 4), _mm_clmulepi64_si128(_mm_and_si128(x, mask), k, 0x00));
+
+            // Barrett reduction: 64 bits -> 32 bits
+            k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(clmul::k_barrett));
+            __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x, mask), k, 0x10);
+            t = _mm_clmulepi64_si128(_mm_and_si128(t, mask), k, 0x00);
+            return static_cast<crc32_t>(_mm_extract_epi32(_mm_xor_si128(x, t), 1));
+        }
+
+        NANONZIP_TARGET("pclmul,sse4.1")
+        [[nodiscard]] static crc32_t calculate_crc32_pclmul(const void* data, size_t length, crc32_t current = 0)
+        {
+            if (length < 64)
+                return calculate_crc32_table<clmul::polynomial>(data, length, current);
+
+            const byte* p = static_cast<const byte*>(data);
+            const auto load = [](const byte* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); };
+
+            // folds 4 lanes by 512 bits
+            __m128i x0 = _mm_xor_si128(load(p + 0), _mm_cvtsi32_si128(static_cast<int>(~current)));
+            __m128i x1 = load(p + 16);
+            __m128i x2 = load(p + 32);
+            __m128i x3 = load(p + 48);
+            __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(clmul::k_fold_512));
+            for (p += 64, length -= 64; length >= 64; p += 64, length -= 64)
+            {
+                x0 = clmul_fold(x0, k, load(p + 0));
+                x1 = clmul_fold(x1, k, load(p + 16));
+                x2 = clmul_fold(x2, k, load(p + 32));
+                x3 = clmul_fold(x3, k, load(p + 48));
+            }
+
+            // folds into 1 lane by 128 bits
+            k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(clmul::k_fold_128));
+            x0 = clmul_fold(clmul_fold(clmul_fold(x0, k, x1), k, x2), k, x3);
+            for (; length >= 16; p += 16, length -= 16)
+                x0 = clmul_fold(x0, k, load(p));
+
+            return calculate_crc32_table<clmul::polynomial>(p, length, ~clmul_reduce(x0));
+        }
+
+        // x86-64: AVX-512 VPCLMULQDQ
+        NANONZIP_TARGET("avx512f,vpclmulqdq,pclmul,sse4.1")
+        [[nodiscard]] static inline __m512i clmul_fold(__m512i x, __m512i k, __m512i data)
+        {
+            return _mm512_ternarylogic_epi32(_mm512_clmulepi64_epi128(x, k, 0x00), _mm512_clmulepi64_epi128(x, k, 0x11), data, 0x96); // a ^ b ^ c
+        }
+
+        NANONZIP_TARGET("avx512f,vpclmulqdq,pclmul,sse4.1")
+        [[nodiscard]] static inline __m512i clmul_broadcast(const uint64_t (&k)[2])
+        {
+            const auto k0 = static_cast<long long>(k[0]), k1 = static_cast<long long>(k[1]);
+            return _mm512_set_epi64(k1, k0, k1, k0, k1, k0, k1, k0);
+        }
+
+        NANONZIP_TARGET("avx512f,vpclmulqdq,pclmul,sse4.1")
+        [[nodiscard]] static crc32_t calculate_crc32_vpclmul(const void* data, size_t length, crc32_t current = 0)
+        {
+            if (length < 256)
+                return calculate_crc32_pclmul(data, length, current);
+
+            const byte* p = static_cast<const byte*>(data);
+            // folds 16 lanes (4 registers) by 2048 bits
+            __m512i x0 = _mm512_xor_si512(_mm512_loadu_si512(p + 0), _mm512_set_epi64(0, 0, 0, 0, 0, 0, 0, static_cast<long long>(crc32_t{~current})));
+            __m512i x1 = _mm512_loadu_si512(p + 64);
+            __m512i x2 = _mm512_loadu_si512(p + 128);
+            __m512i x3 = _mm512_loadu_si512(p + 192);
+            __m512i k = clmul_broadcast(clmul::k_fold_2048);
+            for (p += 256, length -= 256; length >= 256; p += 256, length -= 256)
+            {
+                x0 = clmul_fold(x0, k, _mm512_loadu_si512(p + 0));
+                x1 = clmul_fold(x1, k, _mm512_loadu_si512(p + 64));
+                x2 = clmul_fold(x2, k, _mm512_loadu_si512(p + 128));
+                x3 = clmul_fold(x3, k, _mm512_loadu_si512(p + 192));
+            }
+
+            // folds into 1 register by 512 bits
+            k = clmul_broadcast(clmul::k_fold_512);
+            x0 = clmul_fold(clmul_fold(clmul_fold(x0, k, x1), k, x2), k, x3);
+            for (; length >= 64; p += 64, length -= 64)
+                x0 = clmul_fold(x0, k, _mm512_loadu_si512(p));
+
+            // folds 4 lanes into the last lane by 384, 256 and 128 bits
+            k = _mm512_set_epi64(
+                0, 0,
+                static_cast<long long>(clmul::k_fold_128[1]), static_cast<long long>(clmul::k_fold_128[0]),
+                static_cast<long long>(clmul::fold_constant(256 - 32)), static_cast<long long>(clmul::fold_constant(256 + 32)),
+                static_cast<long long>(clmul::fold_constant(384 - 32)), static_cast<long long>(clmul::fold_constant(384 + 32)));
+            alignas(64) __m128i lanes[4];
+            _mm512_store_si512(lanes, _mm512_mask_blend_epi64(0xC0, clmul_fold(x0, k, _mm512_setzero_si512()), x0));
+            __m128i x = _mm_xor_si128(_mm_xor_si128(lanes[0], lanes[1]), _mm_xor_si128(lanes[2], lanes[3]));
+
+            const __m128i k128 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(clmul::k_fold_128));
+            for (; length >= 16; p += 16, length -= 16)
+                x = clmul_fold(x, k128, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+
+            return calculate_crc32_table<clmul::polynomial>(p, length, ~clmul_reduce(x));
+        }
+#endif
+
+#if defined(NANONZIP_CRC32_PMULL)
+        // AArch64: PMULL
+        [[nodiscard]] static inline uint64x2_t pmull(uint64_t a, uint64_t b)
+        {
+            return vreinterpretq_u64_p128(vmull_p64(static_cast<poly64_t>(a), static_cast<poly64_t>(b)));
+        }
+
+        [[nodiscard]] static inline uint64x2_t clmul_fold(uint64x2_t x, uint64x2_t k, uint64x2_t data)
+        {
+            return veorq_u64(veorq_u64(pmull(vgetq_lane_u64(x, 0), vgetq_lane_u64(k, 0)), pmull(vgetq_lane_u64(x, 1), vgetq_lane_u64(k, 1))), data);
+        }
+
+        [[nodiscard]] static inline crc32_t clmul_reduce(uint64x2_t x)
+        {
+            const uint64x2_t mask = vdupq_n_u64(0xFFFFFFFF);
+            const uint8x16_t zero = vdupq_n_u8(0);
+
+            // 128 bits -> 64 bits
+            x = veorq_u64(vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(x), zero, 8)), pmull(vgetq_lane_u64(x, 0), clmul::k_fold_128[1]));
+            x = veorq_u64(vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(x), zero, 4)), pmull(vgetq_lane_u64(vandq_u64(x, mask), 0), clmul::k_fold_64[0]));
+
+            // Barrett reduction: 64 bits -> 32 bits
+            uint64x2_t t = pmull(vgetq_lane_u64(vandq_u64(x, mask), 0), clmul::k_barrett[1]);
+            t = pmull(vgetq_lane_u64(vandq_u64(t, mask), 0), clmul::k_barrett[0]);
+            return vgetq_lane_u32(vreinterpretq_u32_u64(veorq_u64(x, t)), 1);
+        }
+
+        [[nodiscard]] static crc32_t calculate_crc32_pmull(const void* data, size_t length, crc32_t current = 0)
+        {
+            if (length < 64)
+                return calculate_crc32_table<clmul::polynomial>(data, length, current);
+
+            const byte* p = static_cast<const byte*>(data);
+            const auto load = [](const byte* p) { return vreinterpretq_u64_u8(vld1q_u8(p)); };
+
+            // folds 4 lanes by 512 bits
+            uint64x2_t x0 = veorq_u64(load(p + 0), vsetq_lane_u64(static_cast<uint64_t>(~current), vdupq_n_u64(0), 0));
+            uint64x2_t x1 = load(p + 16);
+            uint64x2_t x2 = load(p + 32);
+            uint64x2_t x3 = load(p + 48);
+            uint64x2_t k = vld1q_u64(clmul::k_fold_512);
+            for (p += 64, length -= 64; length >= 64; p += 64, length -= 64)
+            {
+                x0 = clmul_fold(x0, k, load(p + 0));
+                x1 = clmul_fold(x1, k, load(p + 16));
+                x2 = clmul_fold(x2, k, load(p + 32));
+                x3 = clmul_fold(x3, k, load(p + 48));
+            }
+
+            // folds into 1 lane by 128 bits
+            k = vld1q_u64(clmul::k_fold_128);
+            x0 = clmul_fold(clmul_fold(clmul_fold(x0, k, x1), k, x2), k, x3);
+            for (; length >= 16; p += 16, length -= 16)
+                x0 = clmul_fold(x0, k, load(p));
+
+            return calculate_crc32_table<clmul::polynomial>(p, length, ~clmul_reduce(x0));
+        }
+#endif
+
+        using crc32_function = crc32_t (*)(const void* data, size_t length, crc32_t current);
+
+        // CPU features of the carry-less multiply implementations.
+        struct clmul_support
+        {
+            bool pclmul{};  // x86-64: PCLMULQDQ, SSE4.1
+            bool vpclmul{}; // x86-64: AVX512F, VPCLMULQDQ (and OS support of zmm state)
+            bool pmull{};   // AArch64: PMULL
+        };
+
+        [[nodiscard]] static clmul_support detect_clmul_support()
+        {
+            clmul_support r{};
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(_MSC_VER) && !defined(__clang__)
+            int id[4]{};
+            __cpuid(id, 1);
+            const bool osxsave = id[2] & (1 << 27);
+            r.pclmul = (id[2] & (1 << 1)) && (id[2] & (1 << 19));
+            __cpuidex(id, 7, 0);
+            r.vpclmul = osxsave && (id[1] & (1 << 16)) && (id[2] & (1 << 10)) && (_xgetbv(0) & 0xE6) == 0xE6;
+#else
+            __builtin_cpu_init();
+            r.pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+            r.vpclmul = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq");
+#endif
+#endif
+
+#if defined(NANONZIP_CRC32_PMULL)
+#if defined(__linux__) || defined(__ANDROID__)
+            r.pmull = ::getauxval(AT_HWCAP) & HWCAP_PMULL;
+#elif defined(_WIN32)
+            r.pmull = ::IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE);
+#else
+            r.pmull = true; // Apple Silicon
+#endif
+#endif
+            return r;
+        }
+
+        // Selects the fastest implementation the running CPU supports.
+        [[nodiscard]] static crc32_function select_crc32_function()
+        {
+            [[maybe_unused]] const clmul_support cpu = detect_clmul_support();
+#if defined(__x86_64__) || defined(_M_X64)
+            if (cpu.vpclmul && cpu.pclmul) return calculate_crc32_vpclmul;
+            if (cpu.pclmul) return calculate_crc32_pclmul;
+#endif
+#if defined(NANONZIP_CRC32_PMULL)
+            if (cpu.pmull) return calculate_crc32_pmull;
+#endif
+            return calculate_crc32_table<0xEDB88320>;
+        }
+
+        // Calculates CRC-32 (polynomial 0xEDB88320) with the fastest implementation.
+        [[nodiscard]] static crc32_t calculate_crc32(const void* data, size_t length, crc32_t current = 0)
+        {
+            static const crc32_function function = select_crc32_function();
+            return function(data, length, current);
+        }
+
+        // Decoders checksum their output every this many bytes right after producing it, while it is still in (L2) cache.
+        static constexpr size_t fused_chunk_size = 262144;
+    }
+
+    NANONZIP_EXPORT uint32_t calculate_crc32(const void* data, size_t length, uint32_t current)
+    {
+        return crc32::calculate_crc32(data, length, current);
+    }
+
+    NANONZIP_EXPORT uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, std::uint64_t length2)
+    {
+        return crc32::combine_crc32<0xEDB88320>(crc1, crc2, length2);
+    }
+
+    /// Traditional PKWARE Decryption
+    struct traditional_pkware_decryption
+    {
+        using byte = uint8_t;
+        uint32_t k0_ = 305419896;
+        uint32_t k1_ = 591751049;
+        uint32_t k2_ = 878082192;
+
+        static constexpr inline auto crc32_table = crc32::crc32_table<0xEDB88320>;
+
+        traditional_pkware_decryption(std::string_view password)
+        {
+            for (char c : password)
+                update_keys(c);
+        }
+
+        void update_keys(byte c)
+        {
+            k0_ = crc32_table[static_cast<uint8_t>(k0_ ^ c)] ^ k0_ >> 8;
+            k1_ = (k1_ + static_cast<uint8_t>(k0_)) * 134775813 + 1;
+            k2_ = crc32_table[static_cast<uint8_t>(k2_ ^ (k1_ >> 24))] ^ k2_ >> 8;
+        }
+
+        byte process_byte(byte b)
+        {
+            uint32_t u = k2_ | 2;
+            b ^= static_cast<uint8_t>(u * (u ^ 1) >> 8);
+            update_keys(b);
+            return b;
+        }
+
+        void process_buffer(void* buffer, size_t sz)
+        {
+            auto buf = static_cast<byte*>(buffer);
+            for (size_t i = 0; i < sz; ++i)
+                buf[i] = process_byte(buf[i]);
+        }
+    };
+
+    // DEFLATE Compressed Data Format Specification version 1.3
+    // https://www.ietf.org/rfc/rfc1951.txt
+    namespace inflate
+    {
+        // Upstream of a bit stream whose whole input is on memory
+        struct no_upstream
+        {
+            size_t operator()(void*, size_t) const { return 0; }
+        };
+
+        // Input bit stream, reading from `upstream_t` (size_t(void* buf, size_t len))
+        template <class upstream_t>
+        class bit_stream
+        {
+            static constexpr inline size_t input_buffer_size = std::is_same_v<upstream_t, no_upstream> ? 0 : 65536;
+            upstream_t read_;
+            std::array<std::byte, input_buffer_size> input_buffer_; // filled by upstream before use
+            std::basic_string_view<std::byte> buffered_input_{};
+            std::uint64_t local{};
+            unsigned local_buffered_{};
+            std::uint64_t input_taken_{}; // bytes taken from upstream (or on memory), and zero bytes read beyond the end of stream
+
+        public:
+            // The bit buffer holds at least this many bits after fill().
+            static constexpr inline unsigned max_fill_bits = 56;
+
+            bit_stream(upstream_t upstream) : read_(std::move(upstream)) {}
+            bit_stream(std::basic_string_view<std::byte> input_on_memory) : read_(), buffered_input_(input_on_memory), input_taken_(input_on_memory.size()) {} // reads the input in place
+            bit_stream(const bit_stream& other) = delete;
+            bit_stream(bit_stream&& other) noexcept = delete;
+            bit_stream& operator=(const bit_stream& other) = delete;
+            bit_stream& operator=(bit_stream&& other) noexcept = delete;
+            ~bit_stream() = default;
+
+            // Restarts reading from another upstream, keeping the buffer.
+            void reset(upstream_t upstream)
+            {
+                read_ = std::move(upstream);
+                buffered_input_ = {};
+                local = 0;
+                local_buffered_ = 0;
+                input_taken_ = 0;
+            }
+
+            // Restarts reading the input on memory in place.
+            void reset(std::basic_string_view<std::byte> input_on_memory)
+            {
+                reset(upstream_t{});
+                buffered_input_ = input_on_memory;
+                input_taken_ = input_on_memory.size();
+            }
+
+            // Gets the count of bits consumed since the start (or the last reset).
+            [[nodiscard]] std::uint64_t position() const
+            {
+                return (input_taken_ - buffered_input_.size()) * CHAR_BIT - local_buffered_;
+            }
+
+            // Tops up the bit buffer to at least n bits. Bits beyond the end of stream are read as zero.
+            void fill(unsigned n = max_fill_bits)
+            {
+                if (buffered_input_.size() >= sizeof(local))
+                {
+                    // loads 8 bytes at once, and consumes the whole bytes fit into the bit buffer (56..63 bits buffered).
+                    // the bits above `local_buffered_` hold the next input bytes, which are loaded again at the same position.
+                    local |= load_le64(buffered_input_.data()) << local_buffered_;
+                    const unsigned bytes = (CHAR_BIT * sizeof(local) - 1 - local_buffered_) / CHAR_BIT;
+                    buffered_input_.remove_prefix(bytes);
+                    local_buffered_ += bytes * CHAR_BIT;
+                    return;
+                }
+
+                // slow path: the last bytes of the input buffer
+                n = std::min(max_fill_bits, n);
+                while (local_buffered_ < n)
+                {
+                    if (buffered_input_.empty())
+                    {
+                        buffered_input_ = std::basic_string_view<std::byte>{
+                            input_buffer_.data(),
+                            read_(input_buffer_.data(), input_buffer_.size())
+                        };
+                        input_taken_ += buffered_input_.size();
+
+                        if (buffered_input_.size() >= sizeof(local))
+                            return fill(n);
+                    }
+
+                    if (!buffered_input_.empty())
+                    {
+                        local |= static_cast<decltype(local)>(buffered_input_.front()) << local_buffered_;
+                        buffered_input_.remove_prefix(1);
+                    }
+                    else
+                    {
+                        input_taken_++; // zero byte beyond the end
+                    }
+
+                    local_buffered_ += CHAR_BIT;
+                }
+            }
+
+            [[nodiscard]] unsigned peek(unsigned n)
+            {
+                if (n > local_buffered_)
+                {
                     fill(n);
                     if (n > local_buffered_) throw std::runtime_error("argument n out of range");
                 }
-                return local & ((1u << n) - 1);
+                return static_cast<unsigned>(local) & ((1u << n) - 1);
+            }
+
+            [[nodiscard]] unsigned read(unsigned n)
+            {
+                auto v = peek(n);
+                local = local >> n;
+                local_buffered_ -= n;
+                return v;
+            }
+
+            // Gets buffered bits (lsb first)
+            [[nodiscard]] std::uint64_t bits() const
+            {
+                return local;
+            }
+
+            // Discards n buffered bits
+            void skip(unsigned n)
+            {
+                if (n > local_buffered_) throw std::runtime_error("argument n out of range");
+                local = local >> n;
+                local_buffered_ -= n;
+            }
+
+            void seek_to_next_byte()
+            {
+                (void)read(local_buffered_ % CHAR_BIT);
+            }
+
+        private:
+            static std::uint64_t load_le64(const std::byte* p)
+            {
+                std::uint64_t v;
+                std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                v = __builtin_bswap64(v);
+#endif
+                return v;
+            }
+
+        public:
+
+            // Reads `length` bytes from byte-aligned position into buffer.
+            // Drains the bit buffer first, then copies whole spans from the input buffer, or straight from upstream for large spans.
+            void read_bytes(void* buffer, size_t length)
+            {
+                if (local_buffered_ % CHAR_BIT) throw std::logic_error("bug: bit stream is not byte-aligned");
+
+                auto out = static_cast<std::byte*>(buffer);
+                for (; length && local_buffered_; --length, local >>= CHAR_BIT, local_buffered_ -= CHAR_BIT)
+                    *out++ = static_cast<std::byte>(local);
+
+                if (length) local = 0; // drops the look-ahead bytes; the input is consumed from buffered_input_ directly
+
+                while (length)
+                {
+                    if (buffered_input_.empty())
+                    {
+                        if (length >= input_buffer_.size())
+                        {
+                            const size_t r = read_(out, length);
+                            if (r == 0) throw std::runtime_error("invalid bit stream: unexpected end of stream");
+                            input_taken_ += r;
+                            out += r;
+                            length -= r;
+                            continue;
+                        }
+
+                        buffered_input_ = std::basic_string_view<std::byte>{
+                            input_buffer_.data(),
+                            read_(input_buffer_.data(), input_buffer_.size())
+                        };
+                        if (buffered_input_.empty()) throw std::runtime_error("invalid bit stream: unexpected end of stream");
+                        input_taken_ += buffered_input_.size();
+                    }
+
+                    const size_t n = std::min(length, buffered_input_.size());
+                    std::memcpy(out, buffered_input_.data(), n);
+                    buffered_input_.remove_prefix(n);
+                    out += n;
+                    length -= n;
+                }
+            }
+        };
+
+        // Huffman code decoding table
+        using symbol_t = unsigned;
+        using code_t = unsigned;
+        using code_length_t = unsigned;
+
+        static inline constexpr code_length_t MAX_BITS = 15;
+
+        enum struct entry_kind : std::uint8_t
+        {
+            invalid,  // not registered code
+            literal,  // value: literal byte or code length symbol
+            length,   // value: base length
+            distance, // value: base distance
+            end_of_block,
+            subtable, // value: offset of subtable
+        };
+
+        struct table_entry
+        {
+            std::uint16_t value;
+            entry_kind kind;
+            std::uint8_t extra_bits; // count of extra bits following the code (index bits for subtable)
+            std::uint8_t length;     // code length
+        };
+
+        // The root table is indexed by the next `root_bits` input bits, and codes longer than that continue into subtables.
+        // Each entry holds the meaning of the symbol: a literal, a base length or distance with its extra bit count, and so on.
+        // `capacity` is the largest table size any valid code needs (computed by zlib's examples/enough.c).
+        template <code_length_t root_bits, size_t capacity>
+        class huffman_table
+        {
+        public:
+            constexpr huffman_table() = default;
+
+            // Builds table from code lengths, in place (no allocations)
+            template <class symbol_to_entry>
+            constexpr void build(const code_length_t code_lengths[], size_t length_count, symbol_to_entry&& to_entry)
+            {
+                // counts codes by length
+                std::array<unsigned, MAX_BITS + 1> count{};
+                for (size_t i = 0; i < length_count; ++i)
+                    ++count[code_lengths[i] <= MAX_BITS ? code_lengths[i] : throw std::runtime_error("invalid bit stream: too long code length")];
+                count[0] = 0;
+
+                int left = 1;
+                for (code_length_t bits = 1; bits <= MAX_BITS; ++bits)
+                    if (left = (left << 1) - static_cast<int>(count[bits]); left < 0)
+                        throw std::runtime_error("invalid bit stream: over-subscribed code lengths set");
+
+                // an incomplete code is allowed only for a single 1-bit code (or no code at all)
+                if (left > 0 && left != (1 << MAX_BITS) && !(count[1] == 1 && left == (1 << (MAX_BITS - 1))))
+                    throw std::runtime_error("invalid bit stream: incomplete code lengths set");
+
+                // sorts symbols by code length (counting sort)
+                std::array<unsigned, MAX_BITS + 2> offset{};
+                for (code_length_t bits = 1; bits <= MAX_BITS; ++bits)
+                    offset[bits + 1] = offset[bits] + count[bits];
+
+                std::array<std::uint16_t, 288> sorted{};
+                for (size_t i = 0; i < length_count && i < sorted.size(); ++i)
+                    if (code_lengths[i] != 0)
+                        sorted[offset[code_lengths[i]]++] = static_cast<std::uint16_t>(i);
+
+                // fills entries in canonical code order
+                constexpr code_t root_mask = (1u << root_bits) - 1;
+                for (code_t i = 0; i <= root_mask; ++i)
+                    table_[i] = table_entry{};
+
+                size_t table_size = size_t{1} << root_bits;
+                code_t subtable_prefix = ~code_t{};
+                size_t subtable_offset = 0;
+                code_length_t subtable_bits = 0;
+
+                code_t code = 0;
+                size_t k = 0;
+                for (code_length_t bits = 1; bits <= MAX_BITS; ++bits, code <<= 1)
+                {
+                    for (; count[bits]; --count[bits], ++k, ++code)
+                    {
+                        table_entry e = to_entry(static_cast<symbol_t>(sorted[k]));
+                        e.length = static_cast<std::uint8_t>(bits);
+
+                        const code_t reversed = reverse_bits(code, bits);
+                        if (bits <= root_bits)
+                        {
+                            for (code_t i = reversed; i <= root_mask; i += 1u << bits)
+                                table_[i] = e;
+                            continue;
+                        }
+
+                        if ((reversed & root_mask) != subtable_prefix)
+                        {
+                            // opens a new subtable large enough for the remaining codes sharing this prefix
+                            subtable_prefix = reversed & root_mask;
+                            subtable_bits = bits - root_bits;
+                            for (int space = 1 << subtable_bits; root_bits + subtable_bits < MAX_BITS; ++subtable_bits, space <<= 1)
+                                if (space -= static_cast<int>(count[root_bits + subtable_bits]); space <= 0)
+                                    break;
+
+                            subtable_offset = table_size;
+                            if (table_size += size_t{1} << subtable_bits; table_size > capacity)
+                                throw std::logic_error("bug: huffman table capacity exceeded");
+
+                            table_[subtable_prefix] = table_entry{static_cast<std::uint16_t>(subtable_offset), entry_kind::subtable, static_cast<std::uint8_t>(subtable_bits), static_cast<std::uint8_t>(root_bits)};
+                        }
+
+                        for (code_t i = reversed >> root_bits; i < 1u << subtable_bits; i += 1u << (bits - root_bits))
+                            table_[subtable_offset + i] = e;
+                    }
+                }
+            }
+
+            // Looks up the entry for the next input bits (lsb first, at least MAX_BITS bits)
+            [[nodiscard]] table_entry lookup(std::uint64_t input) const
+            {
+                table_entry e = table_[input & ((1u << root_bits) - 1)];
+                if (e.kind == entry_kind::subtable)
+                    e = table_[e.value + (static_cast<code_t>(input >> root_bits) & ((1u << e.extra_bits) - 1))];
+                return e;
+            }
+
+            // Reads a symbol without extra bits from bit stream
+            template <class bit_stream_t>
+            symbol_t read_next(bit_stream_t& bit_stream) const
+            {
+                bit_stream.fill(MAX_BITS);
+                const table_entry e = lookup(bit_stream.bits());
+                if (e.kind == entry_kind::invalid) throw std::runtime_error("invalid bit stream: not registered huffman code");
+                bit_stream.skip(e.length);
+                return e.value;
+            }
+
+        private:
+            static constexpr code_t reverse_bits(code_t code, code_length_t bits)
+            {
+                static_assert(MAX_BITS <= 16);
+                unsigned reversed = code;                                         // 16bit bit-reverse
+                reversed = ((reversed & 0x5555) << 1) | (reversed >> 1 & 0x5555); // 0b0101010101010101
+                reversed = ((reversed & 0x3333) << 2) | (reversed >> 2 & 0x3333); // 0b0011001100110011
+                reversed = ((reversed & 0x0F0F) << 4) | (reversed >> 4 & 0x0F0F); // 0b0000111100001111
+                reversed = ((reversed & 0x00FF) << 8) | (reversed >> 8 & 0x00FF); // 0x0000000011111111
+                return static_cast<code_t>(reversed >> (16 - bits));              // lower `bits` bits are bit-reversed code
+            }
+
+            std::array<table_entry, capacity> table_{};
+        };
+
+        // Output history window (the last 32KiB of decompressed bytes)
+        class window
+        {
+            using byte = unsigned char;
+            static constexpr inline size_t window_size_ = 1u << 15;
+            std::array<byte, window_size_> buffer_; // only the bytes written are read back
+            std::uint64_t total_{0};
+
+        public:
+            window() = default;
+            window(const window& other) = delete;
+            window(window&& other) noexcept = delete;
+            window& operator=(const window& other) = delete;
+            window& operator=(window&& other) noexcept = delete;
+            ~window() = default;
+
+            // Forgets the history.
+            void reset() { total_ = 0; }
+
+            // Gets the count of bytes available as history.
+            [[nodiscard]] size_t size() const { return static_cast<size_t>(std::min<std::uint64_t>(total_, window_size_)); }
+
+            // Appends output bytes to the history.
+            void append(const byte* data, size_t length)
+            {
+                total_ += length;
+                if (length > window_size_)
+                {
+                    data += length - window_size_;
+                    length = window_size_;
+                }
+
+                const size_t cursor = static_cast<size_t>((total_ - length) & (window_size_ - 1));
+                const size_t first = std::min(length, window_size_ - cursor);
+                std::memcpy(buffer_.data() + cursor, data, first);
+                std::memcpy(buffer_.data(), data + first, length - first);
+            }
+
+            // Copies `length` bytes starting `distance` bytes back from the end of history. (length <= distance)
+            void copy_to(byte* output, size_t distance, size_t length) const
+            {
+                const size_t cursor = static_cast<size_t>((total_ - distance) & (window_size_ - 1));
+                const size_t first = std::min(length, window_size_ - cursor);
+                std::memcpy(output, buffer_.data() + cursor, first);
+                std::memcpy(output + first, buffer_.data(), length - first);
+            }
+        };
+
+        static constexpr size_t nr_clen_alphabets = 19;
+        static constexpr size_t nr_lit_alphabets = 288; // 286 and 287 are not used, but participate in the fixed code construction
+        static constexpr size_t nr_dist_alphabets = 32; // 30 and 31 are not used, but participate in the fixed code construction
+
+        using clen_table = huffman_table<7, 128>;   // enough 19 7 7
+        using lit_table = huffman_table<11, 2342>;  // enough 288 11 15
+        using dist_table = huffman_table<8, 402>;   // enough 32 8 15
+
+        struct length_code_table_entry
+        {
+            unsigned length : 16;
+            unsigned extra_bits : 16;
+        } static constexpr length_code_table[] = {
+            /* 257 */ {3, 0}, /* 258 */ {4, 0}, /* 259 */ {5, 0}, /* 260 */ {6, 0}, /* 261 */ {7, 0},
+            /* 262 */ {8, 0}, /* 263 */ {9, 0}, /* 264 */ {10, 0}, /* 265 */ {11, 1}, /* 266 */ {13, 1},
+            /* 267 */ {15, 1}, /* 268 */ {17, 1}, /* 269 */ {19, 2}, /* 270 */ {23, 2}, /* 271 */ {27, 2},
+            /* 272 */ {31, 2}, /* 273 */ {35, 3}, /* 274 */ {43, 3}, /* 275 */ {51, 3}, /* 276 */ {59, 3},
+            /* 277 */ {67, 4}, /* 278 */ {83, 4}, /* 279 */ {99, 4}, /* 280 */ {115, 4}, /* 281 */ {131, 5},
+            /* 282 */ {163, 5}, /* 283 */ {195, 5}, /* 284 */ {227, 5}, /* 285 */ {258, 0},
+        };
+
+        struct distance_code_table_entry
+        {
+            unsigned distance : 16;
+            unsigned extra_bits : 16;
+        } static constexpr distance_code_table[] = {
+            /*  0 */ {1, 0}, /*  1 */ {2, 0}, /*  2 */ {3, 0}, /*  3 */ {4, 0}, /*  4 */ {5, 1},
+            /*  5 */ {7, 1}, /*  6 */ {9, 2}, /*  7 */ {13, 2}, /*  8 */ {17, 3}, /*  9 */ {25, 3},
+            /* 10 */ {33, 4}, /* 11 */ {49, 4}, /* 12 */ {65, 5}, /* 13 */ {97, 5}, /* 14 */ {129, 6},
+            /* 15 */ {193, 6}, /* 16 */ {257, 7}, /* 17 */ {385, 7}, /* 18 */ {513, 8}, /* 19 */ {769, 8},
+            /* 20 */ {1025, 9}, /* 21 */ {1537, 9}, /* 22 */ {2049, 10}, /* 23 */ {3073, 10}, /* 24 */ {4097, 11},
+            /* 25 */ {6145, 11}, /* 26 */ {8193, 12}, /* 27 */ {12289, 12}, /* 28 */ {16385, 13}, /* 29 */ {24577, 13},
+        };
+
+        // Maps symbols to table entries
+        static constexpr table_entry clen_entry(symbol_t symbol)
+        {
+            return {static_cast<std::uint16_t>(symbol), entry_kind::literal, 0, 0};
+        }
+
+        static constexpr table_entry lit_entry(symbol_t symbol)
+        {
+            if (symbol <= 255) return {static_cast<std::uint16_t>(symbol), entry_kind::literal, 0, 0};
+            if (symbol == 256) return {0, entry_kind::end_of_block, 0, 0};
+            if (symbol - 257 < std::size(length_code_table))
+                return {static_cast<std::uint16_t>(length_code_table[symbol - 257].length), entry_kind::length, static_cast<std::uint8_t>(length_code_table[symbol - 257].extra_bits), 0};
+            return {0, entry_kind::invalid, 0, 0};
+        }
+
+        static constexpr table_entry dist_entry(symbol_t symbol)
+        {
+            if (symbol < std::size(distance_code_table))
+                return {static_cast<std::uint16_t>(distance_code_table[symbol].distance), entry_kind::distance, static_cast<std::uint8_t>(distance_code_table[symbol].extra_bits), 0};
+            return {0, entry_kind::invalid, 0, 0};
+        }
+
+        // Fixed Huffman codes, built at compile time
+        static constexpr lit_table fixed_lit_table = []
+        {
+            std::array<code_length_t, nr_lit_alphabets> huff_lit_code_len{};
+            size_t i = 0;
+            for (; i < 144; i++) huff_lit_code_len[i] = 8; // 00110000  through 10111111
+            for (; i < 256; i++) huff_lit_code_len[i] = 9; // 110010000 through 111111111
+            for (; i < 280; i++) huff_lit_code_len[i] = 7; // 0000000   through 0010111
+            for (; i < 288; i++) huff_lit_code_len[i] = 8; // 11000000  through 11000111
+
+            lit_table table{};
+            table.build(huff_lit_code_len.data(), nr_lit_alphabets, lit_entry);
+            return table;
+        }();
+
+        static constexpr dist_table fixed_dist_table = []
+        {
+            std::array<code_length_t, nr_dist_alphabets> huff_dist_code_len{};
+            for (auto& v : huff_dist_code_len) v = 5; // Distance codes 0-31 are represented by (fixed-length) 5-bit codes
+
+            dist_table table{};
+            table.build(huff_dist_code_len.data(), nr_dist_alphabets, dist_entry);
+            return table;
+        }();
+
+        template <class bit_stream_t>
+        static std::array<code_length_t, nr_clen_alphabets> read_huffman_length_length_table(bit_stream_t& bit_stream, size_t symbols_from_source)
+        {
+            if (symbols_from_source > nr_clen_alphabets) throw std::runtime_error("invalid argument: symbols_from_source too large");
+
+            std::array<code_length_t, nr_clen_alphabets> result{};
+            static constexpr size_t order[nr_clen_alphabets] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+            for (size_t i = 0; i < symbols_from_source; ++i) result[order[i]] = static_cast<uint8_t>(bit_stream.read(3));
+            return result;
+        }
+
+        template <size_t length_length, class bit_stream_t>
+        static std::array<code_length_t, length_length> read_huffman_length_table(const clen_table& length_decoder, bit_stream_t& bit_stream, size_t symbols_from_source)
+        {
+            if (symbols_from_source > length_length) throw std::runtime_error("invalid argument: symbols_from_source too large");
+
+            std::array<code_length_t, length_length> result{};
+            code_length_t prev = 0; // for running length
+            const auto count = symbols_from_source;
+            const auto check = [count](auto i) { return i < count ? i : throw std::runtime_error("invalid bit stream: invalid code lengths set"); };
+            for (size_t i = 0; i < count;)
+            {
+                code_length_t code = length_decoder.read_next(bit_stream);
+                if (code <= 15) result[check(i++)] = prev = code;                                                        // Represent code lengths of 0 - 15
+                else if (code == 16) for (auto x = i + bit_stream.read(2) + 3; i < x; ++i) result[check(i)] = prev;      // Copy the previous code length 3 - 6 times.
+                else if (code == 17) for (auto x = i + bit_stream.read(3) + 3; i < x; ++i) result[check(i)] = prev = 0;  // Repeat a code length of 0 for 3 - 10 times.
+                else if (code == 18) for (auto x = i + bit_stream.read(7) + 11; i < x; ++i) result[check(i)] = prev = 0; // Repeat a code length of 0 for 11 - 138 times
+                else throw std::runtime_error("invalid sequence: invalid code lengths set");
+            }
+            return result;
+        }
+
+        // Reads dynamic huffman codes into the tables
+        template <class bit_stream_t>
+        static void build_dynamic_huffman_code_decoder(bit_stream_t& bit_stream, lit_table& lit, dist_table& dist)
+        {
+            const unsigned HLIT = bit_stream.read(5) + 257;
+            const unsigned HDIST = bit_stream.read(5) + 1;
+            const unsigned HCLEN = bit_stream.read(4) + 4;
+            if (HLIT < 257 || HLIT > 286) throw std::runtime_error("invalid bit stream: HLIT is out of range.");
+            if (HDIST < 1 || HDIST > 32) throw std::runtime_error("invalid bit stream: HDIST is out of range.");
+            if (HCLEN < 4 || HCLEN > 19) throw std::runtime_error("invalid bit stream: HCLEN is out of range.");
+
+            const auto huff_code_len = read_huffman_length_length_table(bit_stream, HCLEN);
+            clen_table length_decoder{};
+            length_decoder.build(huff_code_len.data(), nr_clen_alphabets, clen_entry);
+            const auto huff_lit_code_len = read_huffman_length_table<nr_lit_alphabets>(length_decoder, bit_stream, HLIT);
+            const auto huff_dist_code_len = read_huffman_length_table<nr_dist_alphabets>(length_decoder, bit_stream, HDIST);
+
+            lit.build(huff_lit_code_len.data(), HLIT, lit_entry);
+            dist.build(huff_dist_code_len.data(), HDIST, dist_entry);
+        }
+
+        template <class upstream_t>
+        class inflate_stream
+        {
+        public:
+            using byte = unsigned char;
+
+        private:
+            bit_stream<upstream_t> input_;
+            window output_window_;
+            lit_table dynamic_lit_table_;
+            dist_table dynamic_dist_table_;
+            const lit_table* lit_decoder_{};
+            const dist_table* dist_decoder_{};
+            size_t pending_length_{};
+            size_t pending_distance_{};
+            bool final_block_{};
+            bool pause_at_block_end_{}; // by read_block
+            bool paused_{};
+
+            enum struct state_t
+            {
+                block_head,
+                stored_block,
+                compressed_block,
+                pending_match,
+                end,
+            } state_{};
+
+            size_t stored_remain_{};
+            bool checksum_{};
+            crc32::crc32_t crc32_{};
+
+        public:
+            inflate_stream(upstream_t upstream, bool checksum = true)
+                : input_(std::move(upstream))
+                , checksum_(checksum) { }
+
+            inflate_stream(std::basic_string_view<std::byte> input_on_memory, bool checksum = true)
+                : input_(input_on_memory)
+                , checksum_(checksum) { }
+
+            // Restarts decompressing another stream, keeping the buffers and the tables.
+            template <class input_t>
+            void reset(input_t input, bool checksum = true)
+            {
+                input_.reset(std::move(input));
+                output_window_.reset();
+                lit_decoder_ = nullptr;
+                dist_decoder_ = nullptr;
+                pending_length_ = 0;
+                pending_distance_ = 0;
+                final_block_ = false;
+                paused_ = false;
+                state_ = state_t{};
+                stored_remain_ = 0;
+                checksum_ = checksum;
+                crc32_ = crc32::crc32_t{};
+            }
+
+            // Restarts decompressing in the middle of a stream: at the block boundary `skip_bits` bits into the input,
+            // with the last `history_size` (up to 32KiB) bytes decompressed before it as the history.
+            template <class input_t>
+            void resume(input_t input, unsigned skip_bits, const byte* history, size_t history_size, bool checksum = true)
+            {
+                reset(std::move(input), checksum);
+                (void)input_.read(skip_bits);
+                output_window_.append(history, history_size);
+            }
+
+            // Reads decompressed bytes into buffer directly.
+            // The bytes already written into the buffer are used as the history for back-references,
+            // so only the bytes beyond the buffer (produced by previous calls) are fetched from the window.
+            size_t read(void* buffer, size_t size)
+            {
+                byte* const first = static_cast<byte*>(buffer);
+                byte* const last = first + size;
+                byte* out = first;
+                paused_ = false;
+
+                // decodes chunk by chunk to checksum each while it is still in cache
+                while (out != last && state_ != state_t::end && !paused_)
+                {
+                    byte* const chunk = out;
+                    out = decode(first, out, chunk + std::min(crc32::fused_chunk_size, static_cast<size_t>(last - out)));
+                    if (checksum_) crc32_ = crc32::calculate_crc32(chunk, static_cast<size_t>(out - chunk), crc32_);
+                }
+
+                output_window_.append(first, static_cast<size_t>(out - first));
+                return static_cast<size_t>(out - first);
+            }
+
+            // Reads like `read`, but stops at the end of a block, where the stream can be resumed later (see `resume`).
+            size_t read_block(void* buffer, size_t size)
+            {
+                pause_at_block_end_ = true;
+                const size_t r = read(buffer, size);
+                pause_at_block_end_ = false;
+                return r;
+            }
+
+            // Whether the next bit of the input starts a block.
+            [[nodiscard]] bool at_block_boundary() const { return state_ == state_t::block_head; }
+
+            // Whether the final block has ended.
+            [[nodiscard]] bool ended() const { return state_ == state_t::end; }
+
+            // Gets the count of input bits consumed since the start (or the last reset).
+            [[nodiscard]] std::uint64_t input_position() const { return input_.position(); }
+
+            // Copies the history (the last up to 32KiB decompressed bytes) into `out`, then returns its size.
+            size_t copy_history(byte* out) const
+            {
+                const size_t n = output_window_.size();
+                output_window_.copy_to(out, n, n);
+                return n;
+            }
+
+            // CRC-32 of the bytes decompressed so far (if checksum is enabled).
+            [[nodiscard]] crc32::crc32_t crc32() const { return crc32_; }
+
+        private:
+            [[nodiscard]] state_t end_of_block()
+            {
+                paused_ = pause_at_block_end_;
+                return !final_block_ ? state_t::block_head : state_t::end;
+            }
+
+            // Decodes into [out, last) until it is filled or the stream ends.
+            byte* decode(byte* first, byte* out, byte* last)
+            {
+                while (out != last && state_ != state_t::end && !paused_)
+                {
+                    switch (state_)
+                    {
+                    case state_t::block_head:
+                        final_block_ = input_.read(1);
+                        switch (unsigned BTYPE = input_.read(2); BTYPE)
+                        {
+                        case 0b00: // Non-compressed blocks
+                            {
+                                input_.seek_to_next_byte();
+                                unsigned LEN = input_.read(16);
+                                unsigned NLEN = input_.read(16);
+                                if ((LEN ^ NLEN) != 0xFFFF) throw std::runtime_error("invalid bit stream: invalid stored block lengths");
+                                stored_remain_ = LEN;
+                                state_ = state_t::stored_block;
+                                break;
+                            }
+                        case 0b01: // Compression with fixed Huffman codes
+                        case 0b10: // Compression with dynamic Huffman codes
+                            {
+                                if (BTYPE == 0b01)
+                                {
+                                    lit_decoder_ = &fixed_lit_table;
+                                    dist_decoder_ = &fixed_dist_table;
+                                }
+                                else
+                                {
+                                    build_dynamic_huffman_code_decoder(input_, dynamic_lit_table_, dynamic_dist_table_);
+                                    lit_decoder_ = &dynamic_lit_table_;
+                                    dist_decoder_ = &dynamic_dist_table_;
+                                }
+                                state_ = state_t::compressed_block;
+                                break;
+                            }
+                        default:
+                            throw std::runtime_error("invalid bit stream: invalid block type");
+                        }
+                        break;
+
+                    case state_t::stored_block:
+                        {
+                            const size_t n = std::min(stored_remain_, static_cast<size_t>(last - out));
+                            input_.read_bytes(out, n);
+                            out += n;
+                            stored_remain_ -= n;
+
+                            if (stored_remain_ == 0)
+                                state_ = end_of_block();
+                            break;
+                        }
+
+                    case state_t::compressed_block:
+                        out = decode_compressed_block(first, out, last);
+                        break;
+
+                    case state_t::pending_match:
+                        state_ = state_t::compressed_block;
+                        out = emit_match(first, out, last, pending_distance_, pending_length_);
+                        break;
+
+                    default:
+                        throw std::logic_error("bug: invalid status");
+                    }
+                }
+                return out;
+            }
+
+            byte* decode_compressed_block(byte* first, byte* out, byte* last)
+            {
+                while (out != last)
+                {
+                    // 56 bits cover a literal/length code, its extra bits, a distance code and its extra bits (15+5+15+13 bits)
+                    input_.fill();
+                    const auto lit = lit_decoder_->lookup(input_.bits());
+
+                    if (lit.kind == entry_kind::literal)
+                    {
+                        input_.skip(lit.length);
+                        *out++ = static_cast<byte>(lit.value);
+                    }
+                    else if (lit.kind == entry_kind::length)
+                    {
+                        const size_t length = lit.value + (static_cast<unsigned>(input_.bits() >> lit.length) & ((1u << lit.extra_bits) - 1));
+                        input_.skip(lit.length + lit.extra_bits);
+
+                        const auto dist = dist_decoder_->lookup(input_.bits());
+                        if (dist.kind != entry_kind::distance) throw std::runtime_error("invalid bit stream: invalid distance code");
+                        const size_t distance = dist.value + (static_cast<unsigned>(input_.bits() >> dist.length) & ((1u << dist.extra_bits) - 1));
+                        input_.skip(dist.length + dist.extra_bits);
+
+                        if (distance > output_window_.size() + static_cast<size_t>(out - first))
+                            throw std::runtime_error("invalid bit stream: invalid distance too far back");
+
+                        out = emit_match(first, out, last, distance, length);
+                    }
+                    else if (lit.kind == entry_kind::end_of_block)
+                    {
+                        input_.skip(lit.length);
+                        state_ = end_of_block();
+                        return out;
+                    }
+                    else
+                    {
+                        throw std::runtime_error("invalid bit stream: not registered huffman code");
+                    }
+                }
+                return out;
+            }
+
+            // Copies a back-reference into [out, last), keeping the rest as pending if the buffer is full.
+            byte* emit_match(byte* first, byte* out, byte* last, size_t distance, size_t length)
+            {
+                const size_t n = std::min(length, static_cast<size_t>(last - out));
+                if (size_t produced = static_cast<size_t>(out - first); distance > produced)
+                {
+                    // the head of the source lies in the history before this buffer
+                    const size_t from_window = std::min(n, distance - produced);
+                    output_window_.copy_to(out, distance - produced, from_window);
+                    out = copy_match(out + from_window, distance, n - from_window);
+                }
+                else
+                {
+                    out = copy_match(out, distance, n);
+                }
+
+                if (n < length)
+                {
+                    pending_length_ = length - n;
+                    pending_distance_ = distance;
+                    state_ = state_t::pending_match;
+                }
+                return out;
+            }
+
+            // Copies `length` bytes from `distance` bytes back in the same buffer.
+            static byte* copy_match(byte* out, size_t distance, size_t length)
+            {
+                const byte* src = out - distance;
+                if (distance >= length)
+                {
+                    // not overlapped
+                    std::memcpy(out, src, length);
+                    return out + length;
+                }
+
+                if (distance >= sizeof(std::uint64_t))
+                {
+                    // overlapped, but each word does not overlap its own source
+                    byte* const end = out + length;
+                    for (; end - out >= static_cast<ptrdiff_t>(sizeof(std::uint64_t)); out += sizeof(std::uint64_t), src += sizeof(std::uint64_t))
+                        std::memcpy(out, src, sizeof(std::uint64_t));
+                    while (out != end) *out++ = *src++;
+                    return out;
+                }
+
+                if (distance == 1)
+                {
+                    // run of a byte
+                    std::memset(out, *src, length);
+                    return out + length;
+                }
+
+                // replicates the short pattern, doubling the copy size each step
+                for (size_t n; length; out += n, length -= n)
+                {
+                    n = std::min(length, static_cast<size_t>(out - src));
+                    std::memcpy(out, src, n);
+                }
+                return out;
+            }
+        };
+
+        // Parallel inflate of a part of a deflate stream on memory.
+        // The part is split into chunks decoded on separate threads. Every chunk but the first starts at a speculative block boundary,
+        // found by trial decoding, without knowing the 32KiB history before it: bytes copied from there are output as markers.
+        // A chunk is used only if it starts exactly where the previous one ended, so the output is the same as serial decoding.
+        namespace parallel
+        {
+            using symbol16_t = std::uint16_t;
+            static constexpr size_t window_size = 32768;
+            static constexpr symbol16_t marker = 256; // marker + i: the i-th byte of the window before the chunk
+
+            // Input bit stream on memory, with the bit position. Bits beyond the end are read as zero.
+            class memory_bit_reader
+            {
+                std::basic_string_view<std::byte> input_;
+                std::uint64_t position_;
+
+            public:
+                memory_bit_reader(std::basic_string_view<std::byte> input, std::uint64_t position) : input_(input), position_(position) { }
+
+                void fill(unsigned = 0) const { }
+
+                // Gets the next 57 bits at least (lsb first)
+                [[nodiscard]] std::uint64_t bits() const
+                {
+                    const std::uint64_t byte = position_ / CHAR_BIT;
+                    if (byte + sizeof(std::uint64_t) <= input_.size())
+                        return load_le64(input_.data() + byte) >> position_ % CHAR_BIT;
+
+                    std::byte tail[sizeof(std::uint64_t)]{};
+                    if (byte < input_.size()) std::memcpy(tail, input_.data() + byte, input_.size() - byte);
+                    return load_le64(tail) >> position_ % CHAR_BIT;
+                }
+
+                void skip(unsigned n) { position_ += n; }
+
+                [[nodiscard]] unsigned read(unsigned n)
+                {
+                    const auto v = static_cast<unsigned>(bits()) & ((1u << n) - 1);
+                    skip(n);
+                    return v;
+                }
+
+                [[nodiscard]] std::uint64_t position() const { return position_; }
+                [[nodiscard]] bool overrun() const { return position_ > input_.size() * CHAR_BIT; }
+
+            private:
+                static std::uint64_t load_le64(const std::byte* p)
+                {
+                    std::uint64_t v;
+                    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                    v = __builtin_bswap64(v);
+#endif
+                    return v;
+                }
+            };
+
+            // A chunk of the stream: its block boundaries and output
+            struct chunk
+            {
+                std::uint64_t begin{};               // bit position of the first block
+                std::uint64_t end{};                 // bit position after the last block
+                bool decoded{};                      // decoded successfully
+                bool final{};                        // ended with the final block
+                bool resolved{};                     // markers referred to the valid history only
+                std::vector<symbol16_t> symbols{};   // bytes (< 256) and markers (allocated size)
+                size_t size{};                       // count of symbols output
+                crc32::crc32_t crc32{};              // of the resolved bytes
+                lit_table lit{};
+                dist_table dist{};
+            };
+
+            // Decodes the symbols of a compressed block, until the end of block.
+            // Returns false on invalid data, on reading beyond the input, or on more output than `max_symbols`.
+            static bool decode_symbols(memory_bit_reader& in, const lit_table& lit_decoder, const dist_table& dist_decoder, size_t history, size_t max_symbols, chunk& c)
+            {
+                for (;;)
+                {
+                    if (in.overrun()) return false;
+                    if (c.size + 258 > c.symbols.size())
+                    {
+                        if (c.size > max_symbols) return false;
+                        c.symbols.resize(std::min(std::max<size_t>(c.symbols.size() * 2, 262144), max_symbols + 258)); // no more than the limit needs
+                    }
+
+                    const std::uint64_t bits = in.bits();
+                    const auto lit = lit_decoder.lookup(bits);
+                    if (lit.kind == entry_kind::literal)
+                    {
+                        in.skip(lit.length);
+                        c.symbols[c.size++] = lit.value;
+                    }
+                    else if (lit.kind == entry_kind::length)
+                    {
+                        const size_t length = lit.value + (static_cast<unsigned>(bits >> lit.length) & ((1u << lit.extra_bits) - 1));
+                        in.skip(lit.length + lit.extra_bits);
+
+                        const std::uint64_t dist_bits = in.bits();
+                        const auto dist = dist_decoder.lookup(dist_bits);
+                        if (dist.kind != entry_kind::distance) return false;
+                        const size_t distance = dist.value + (static_cast<unsigned>(dist_bits >> dist.length) & ((1u << dist.extra_bits) - 1));
+                        in.skip(dist.length + dist.extra_bits);
+
+                        if (distance > c.size + history) return false;
+
+                        // copies symbols: markers are copied as they are, and the bytes before the chunk become markers
+                        symbol16_t* const out = c.symbols.data();
+                        const size_t last = c.size + length;
+                        if (distance >= length && distance <= c.size)
+                        {
+                            std::memcpy(out + c.size, out + c.size - distance, length * sizeof(symbol16_t)); // not overlapped
+                            c.size = last;
+                            continue;
+                        }
+                        for (; c.size < last && distance > c.size; c.size++)
+                            out[c.size] = static_cast<symbol16_t>(marker + window_size - (distance - c.size));
+                        for (; c.size < last; c.size++)
+                            out[c.size] = out[c.size - distance];
+                    }
+                    else if (lit.kind == entry_kind::end_of_block)
+                    {
+                        in.skip(lit.length);
+                        return true;
+                    }
+                    else
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            // Decodes blocks from bit position `begin` up to the first block boundary at or after `stop`, or the end of the final block.
+            // Back-references may reach `history` bytes before the chunk. Fails (returns false) the same way as decode_symbols.
+            static bool decode_chunk(std::basic_string_view<std::byte> input, std::uint64_t begin, std::uint64_t stop, size_t history, size_t max_symbols, chunk& c) noexcept
+            {
+                c.begin = begin;
+                c.decoded = false;
+                c.final = false;
+                c.size = 0;
+
+                memory_bit_reader in(input, begin);
+                try
+                {
+                    do
+                    {
+                        c.final = in.read(1);
+                        switch (in.read(2))
+                        {
+                        case 0b00: // Non-compressed blocks
+                            {
+                                in.skip(static_cast<unsigned>((CHAR_BIT - in.position() % CHAR_BIT) % CHAR_BIT));
+                                const unsigned LEN = in.read(16);
+                                const unsigned NLEN = in.read(16);
+                                const std::uint64_t byte = in.position() / CHAR_BIT;
+                                if ((LEN ^ NLEN) != 0xFFFF || byte + LEN > input.size() || c.size > max_symbols) return false;
+
+                                if (c.size + LEN > c.symbols.size()) c.symbols.resize(std::max<size_t>(std::min(c.symbols.size() * 2, max_symbols + 258), c.size + LEN));
+                                for (unsigned i = 0; i < LEN; i++) c.symbols[c.size++] = static_cast<symbol16_t>(input[byte + i]);
+                                in.skip(LEN * CHAR_BIT);
+                                break;
+                            }
+                        case 0b01: // Compression with fixed Huffman codes
+                            if (!decode_symbols(in, fixed_lit_table, fixed_dist_table, history, max_symbols, c)) return false;
+                            break;
+                        case 0b10: // Compression with dynamic Huffman codes
+                            build_dynamic_huffman_code_decoder(in, c.lit, c.dist);
+                            if (!decode_symbols(in, c.lit, c.dist, history, max_symbols, c)) return false;
+                            break;
+                        default:
+                            return false;
+                        }
+                        if (in.overrun()) return false;
+                    } while (!c.final && in.position() < stop);
+                }
+                catch (const std::exception&)
+                {
+                    return false; // invalid code lengths (or out of memory)
+                }
+
+                c.end = in.position();
+                c.decoded = true;
+                return true;
+            }
+
+            // Checks code lengths as huffman_table::build does, without throwing.
+            static bool is_valid_code(const code_length_t code_lengths[], size_t length_count)
+            {
+                std::array<unsigned, MAX_BITS + 1> count{};
+                for (size_t i = 0; i < length_count; ++i) ++count[code_lengths[i]];
+
+                int left = 1;
+                for (code_length_t bits = 1; bits <= MAX_BITS; ++bits)
+                    if (left = (left << 1) - static_cast<int>(count[bits]); left < 0)
+                        return false;
+                return left == 0 || left == (1 << MAX_BITS) || (count[1] == 1 && left == (1 << (MAX_BITS - 1)));
+            }
+
+            // Checks if a non-final dynamic Huffman block can start at the position, without throwing (as most of the positions cannot).
+            static bool may_start_dynamic_block(memory_bit_reader in)
+            {
+                const auto head = static_cast<unsigned>(in.bits());
+                if ((head & 0b111) != 0b100) return false;                        // BFINAL = 0, BTYPE = 10
+                if ((head >> 3 & 31) > 29 || (head >> 8 & 31) > 29) return false; // HLIT <= 286, HDIST <= 30
+
+                // the code length code must be complete (a cheap test before reading the code lengths)
+                memory_bit_reader clen = in;
+                clen.skip(17);
+                const std::uint64_t clen_bits = clen.bits();
+                int left = 1 << 7;
+                for (unsigned i = 0, count = (head >> 13 & 15) + 4; i < count; i++)
+                    if (const auto length = static_cast<unsigned>(clen_bits >> (3 * i) & 7); length)
+                        left -= (1 << 7) >> length;
+                if (left != 0) return false;
+
+                in.skip(3);
+                const unsigned HLIT = in.read(5) + 257;
+                const unsigned HDIST = in.read(5) + 1;
+                const unsigned HCLEN = in.read(4) + 4;
+                const auto huff_code_len = read_huffman_length_length_table(in, HCLEN);
+                clen_table length_decoder{};
+                length_decoder.build(huff_code_len.data(), nr_clen_alphabets, clen_entry);
+
+                // the literal/length and distance code lengths, as read_huffman_length_table reads them
+                for (const unsigned count : {HLIT, HDIST})
+                {
+                    std::array<code_length_t, nr_lit_alphabets> lengths{};
+                    code_length_t prev = 0;
+                    for (unsigned i = 0; i < count;)
+                    {
+                        const auto e = length_decoder.lookup(in.bits());
+                        if (e.kind != entry_kind::literal) return false;
+                        in.skip(e.length);
+
+                        unsigned repeat = 1;
+                        if (e.value <= 15) prev = e.value;
+                        else if (e.value == 16) repeat = in.read(2) + 3;
+                        else if (e.value == 17) repeat = in.read(3) + 3, prev = 0;
+                        else repeat = in.read(7) + 11, prev = 0;
+
+                        if (i + repeat > count) return false;
+                        for (; repeat; --repeat) lengths[i++] = prev;
+                    }
+                    if (!is_valid_code(lengths.data(), count)) return false;
+                }
+                return !in.overrun();
+            }
+
+            // Checks if a non-final stored block can start at the position.
+            static bool may_start_stored_block(memory_bit_reader in)
+            {
+                if ((in.bits() & 0b111) != 0) return false; // BFINAL = 0, BTYPE = 00
+                in.skip(3 + static_cast<unsigned>((CHAR_BIT - (in.position() + 3) % CHAR_BIT) % CHAR_BIT));
+                const unsigned LEN = in.read(16);
+                const unsigned NLEN = in.read(16);
+                return (LEN ^ NLEN) == 0xFFFF;
+            }
+
+            // Bits searched for a block boundary (zlib makes blocks of up to 64KiB or so)
+            static constexpr std::uint64_t search_range = 262144 * CHAR_BIT;
+
+            // Finds the first position in [from, from + search_range) where a chunk decodes successfully from a dynamic Huffman or stored block, and decodes it.
+            // The chunk may end with the final block only if the input reaches the end of the stream.
+            static bool find_and_decode_chunk(std::basic_string_view<std::byte> input, bool end_of_stream, std::uint64_t from, std::uint64_t stop, size_t max_symbols, chunk& c) noexcept
+            {
+                for (memory_bit_reader in(input, from); in.position() < std::min(stop, from + search_range) && !in.overrun(); in.skip(1))
+                    if ((may_start_dynamic_block(in) || may_start_stored_block(in)) && decode_chunk(input, in.position(), stop, window_size, max_symbols, c) && (!c.final || end_of_stream))
+                        return true;
+                c.decoded = false;
+                return false;
+            }
+
+            // Checks if decoding from `begin` is the same as from the block boundary `boundary`: at the same position,
+            // or at the same stored block (whose header may be found a few bits early, as the padding after it is skipped alike).
+            static bool starts_same(std::basic_string_view<std::byte> input, std::uint64_t boundary, std::uint64_t begin)
+            {
+                if (boundary == begin) return true;
+                const auto stored_at = [input](std::uint64_t p) { return (memory_bit_reader(input, p).bits() & 0b111) == 0; };
+                const auto data_at = [](std::uint64_t p) { return (p + 3 + CHAR_BIT - 1) / CHAR_BIT; };
+                return stored_at(boundary) && stored_at(begin) && data_at(boundary) == data_at(begin);
+            }
+
+            // Resolves symbols into bytes: the identity for bytes, followed by the window before a chunk for markers
+            using symbol_table = std::array<unsigned char, marker + window_size>;
+            static constexpr symbol_table initial_symbol_table = []
+            {
+                symbol_table table{};
+                for (size_t i = 0; i < marker; i++) table[i] = static_cast<unsigned char>(i);
+                return table;
+            }();
+
+            // Resolves `count` symbols into bytes, with the table of the window before them (the last `history` bytes of which are valid).
+            // Returns false if a marker refers to a byte before the valid history.
+            static bool resolve(const symbol16_t* symbols, size_t count, const symbol_table& table, size_t history, unsigned char* out)
+            {
+                for (size_t i = 0; i < count; i++)
+                    out[i] = table[symbols[i]];
+                if (history == window_size) return true;
+
+                // near the start of the stream
+                const size_t lowest = marker + window_size - history;
+                for (size_t i = 0; i < count; i++)
+                    if (symbols[i] >= marker && symbols[i] < lowest) return false;
+                return true;
+            }
+
+            // Threads running fn(0) .. fn(n - 1) at once, fn(0) on the calling thread.
+            // The threads are started by the first run that needs them, and wait for the next run until stopped.
+            class workers
+            {
+                std::mutex mutex_;
+                std::condition_variable wake_;
+                std::condition_variable done_;
+                std::vector<std::thread> threads_{};   // runs fn(1) .. fn(threads_.size())
+                std::uint64_t generation_{};           // count of runs
+                size_t size_{};                        // count of fn the threads run in the current run, plus one
+                size_t pending_{};                     // of them, not finished yet
+                void (*invoke_)(const void* fn, size_t k){};
+                const void* fn_{};
+                bool stopping_{};
+
+            public:
+                workers() = default;
+                workers(const workers& other) = delete;
+                workers(workers&& other) noexcept = delete;
+                workers& operator=(const workers& other) = delete;
+                workers& operator=(workers&& other) noexcept = delete;
+                ~workers() { stop(); }
+
+                // Runs fn(0) .. fn(n - 1) and waits for all. (fn must not throw)
+                template <class F>
+                void run(size_t n, const F& fn)
+                {
+                    while (threads_.size() + 1 < n)
+                    {
+                        try { threads_.emplace_back([this, k = threads_.size() + 1, generation = generation_] { work(k, generation); }); }
+                        catch (const std::system_error&) { break; } // runs the rest here instead
+                    }
+
+                    const size_t m = std::min(n, threads_.size() + 1);
+                    {
+                        std::lock_guard lock(mutex_);
+                        invoke_ = [](const void* f, size_t k) { (*static_cast<const F*>(f))(k); };
+                        fn_ = &fn;
+                        size_ = m;
+                        pending_ = m - 1;
+                        generation_++;
+                    }
+                    wake_.notify_all();
+
+                    fn(0);
+                    for (size_t k = m; k < n; k++) fn(k);
+
+                    std::unique_lock lock(mutex_);
+                    done_.wait(lock, [this] { return pending_ == 0; });
+                }
+
+                // Stops and joins the threads.
+                void stop()
+                {
+                    if (threads_.empty()) return;
+                    {
+                        std::lock_guard lock(mutex_);
+                        stopping_ = true;
+                    }
+                    wake_.notify_all();
+                    for (auto& t : threads_) t.join();
+                    threads_.clear();
+                    stopping_ = false;
+                }
+
+                [[nodiscard]] size_t size() const { return threads_.size(); }
+
+            private:
+                void work(size_t k, std::uint64_t generation)
+                {
+                    std::unique_lock lock(mutex_);
+                    for (;;)
+                    {
+                        wake_.wait(lock, [&] { return stopping_ || generation_ != generation; });
+                        if (stopping_) return;
+                        generation = generation_;
+                        if (k >= size_) continue; // not needed in this run
+
+                        const auto invoke = invoke_;
+                        const auto fn = fn_;
+                        lock.unlock();
+                        invoke(fn, k);
+                        lock.lock();
+                        if (--pending_ == 0) done_.notify_one();
+                    }
+                }
+            };
+        }
+    }
+
+#ifdef NANONZIP_ENABLE_ZLIB
+    /// Inflate stream
+    struct zlib_inflate_stream
+    {
+        using ssize32_t = int32_t;
+        z_stream z_stream_{};
+        std::streamoff output_remain_bytes_{};
+        std::vector<Byte> input_buffer_{};
+        size_t input_buffer_used_{};
+        bool checksum_{};
+        crc32::crc32_t crc32_{};
+        bool on_memory_{};
+        std::basic_string_view<Byte> input_on_memory_{};
+
+        zlib_inflate_stream(std::streamoff output_data_size, bool checksum = true, ssize32_t buffer_size = 262144)
+            : output_remain_bytes_(output_data_size)
+            , input_buffer_(buffer_size)
+            , input_buffer_used_(input_buffer_.size())
+            , checksum_(checksum)
+        {
+            if (auto r = ::inflateInit2(&z_stream_, -MAX_WBITS); r != Z_OK)
+                throw std::runtime_error("zlib::init error");
+        }
+
+        // reads the input in place
+        zlib_inflate_stream(std::streamoff output_data_size, bool checksum, std::string_view input_on_memory)
+            : zlib_inflate_stream(output_data_size, checksum, 0)
+        {
+            on_memory_ = true;
+            input_on_memory_ = {reinterpret_cast<const Byte*>(input_on_memory.data()), input_on_memory.size()};
+        }
+
+        // Restarts inflating another stream, keeping the inflate state and the input buffer (grown if needed).
+        void reset(std::streamoff output_data_size, bool checksum, ssize32_t buffer_size)
+        {
+            if (auto r = ::inflateReset(&z_stream_); r != Z_OK)
+                throw std::runtime_error("zlib::reset error");
+            z_stream_.next_in = nullptr;
+            z_stream_.avail_in = 0;
+            output_remain_bytes_ = output_data_size;
+            if (input_buffer_.size() < static_cast<size_t>(buffer_size)) input_buffer_.resize(buffer_size);
+            input_buffer_used_ = input_buffer_.size();
+            checksum_ = checksum;
+            crc32_ = crc32::crc32_t{};
+            on_memory_ = false;
+            input_on_memory_ = {};
+        }
+
+        // reads the input in place
+        void reset(std::streamoff output_data_size, bool checksum, std::string_view input_on_memory)
+        {
+            reset(output_data_size, checksum, 0);
+            on_memory_ = true;
+            input_on_memory_ = {reinterpret_cast<const Byte*>(input_on_memory.data()), input_on_memory.size()};
+        }
+
+        zlib_inflate_stream(const zlib_inflate_stream& other) = delete;
+        zlib_inflate_stream(zlib_inflate_stream&& other) noexcept = delete;
+        zlib_inflate_stream& operator=(const zlib_inflate_stream& other) = delete;
+        zlib_inflate_stream& operator=(zlib_inflate_stream&& other) noexcept = delete;
+        ~zlib_inflate_stream() { inflateEnd(&z_stream_); }
+
+        template <class read_input_fun = std::function<ssize32_t(void* input_buf, ssize32_t input_len)>,
+                  std::enable_if_t<std::is_invocable_r_v<ssize32_t, read_input_fun, void*, ssize32_t>>* = nullptr>
+        ssize32_t inflate(void* output_buf, ssize32_t output_len, read_input_fun&& read_input)
+        {
+            output_len = static_cast<ssize32_t>(std::min<intmax_t>(output_len, output_remain_bytes_));
+
+            ::Byte* const output_end = static_cast<::Byte*>(output_buf) + output_len;
+            z_stream_.next_out = static_cast<::Byte*>(output_buf);
+            while (z_stream_.next_out != output_end)
+            {
+                if (z_stream_.avail_in == 0 && on_memory_) // need more input, on memory
+                {
+                    const auto n = std::min<size_t>(input_on_memory_.size(), std::numeric_limits<uInt>::max());
+                    z_stream_.next_in = const_cast<Byte*>(input_on_memory_.data());
+                    z_stream_.avail_in = static_cast<uInt>(n);
+                    input_on_memory_.remove_prefix(n);
+                }
+                else if (z_stream_.avail_in == 0) // need more input
+                {
+                    auto input_len = read_input(input_buffer_.data(), static_cast<ssize32_t>(input_buffer_.size()));
+                    z_stream_.next_in = input_buffer_.data();
+                    z_stream_.avail_in = input_len;
+                }
+
+                // inflates chunk by chunk to checksum each while it is still in cache
+                ::Byte* const chunk = z_stream_.next_out;
+                z_stream_.avail_out = static_cast<uInt>(std::min<size_t>(crc32::fused_chunk_size, output_end - chunk));
+                auto result = ::inflate(&z_stream_, Z_SYNC_FLUSH);
+                if (checksum_) crc32_ = crc32::calculate_crc32(chunk, z_stream_.next_out - chunk, crc32_);
+
+                if (result == Z_STREAM_END) break;
+                if (result == Z_BUF_ERROR && z_stream_.avail_in == 0) break; // no more input and no pending output
+                if (result < 0) throw std::runtime_error("zlib::inflate error " + std::to_string(result) + " " + std::string(z_stream_.msg ? z_stream_.msg : ""));
+            }
+
+            auto written_bytes = static_cast<ssize32_t>(z_stream_.next_out - static_cast<::Byte*>(output_buf));
+            output_remain_bytes_ -= written_bytes;
+            return written_bytes;
+        }
+
+        // CRC-32 of the bytes inflated so far (if checksum is enabled).
+        [[nodiscard]] crc32::crc32_t crc32() const { return crc32_; }
+    };
+#endif
+
+#ifdef NANONZIP_ENABLE_BZIP2
+    /// bzip2 decompress stream
+    struct bzip2_decompress_stream
+    {
+        using ssize32_t = int32_t;
+        bz_stream bz_stream_{};
+        std::streamoff output_remain_bytes_{};
+        std::vector<char> input_buffer_{};
+        size_t input_buffer_used_{};
+        bool checksum_{};
+        crc32::crc32_t crc32_{};
+        bool on_memory_{};
+        std::string_view input_on_memory_{};
+
+        bzip2_decompress_stream(std::streamoff output_data_size, bool checksum = true, ssize32_t buffer_size = 262144)
+            : output_remain_bytes_(output_data_size)
+            , input_buffer_(buffer_size)
+            , input_buffer_used_(input_buffer_.size())
+            , checksum_(checksum)
+        {
+            if (auto r = ::BZ2_bzDecompressInit(&bz_stream_, 0, 0); r != BZ_OK)
+                throw std::runtime_error("bzlib2::init error");
+        }
+
+        // reads the input in place
+        bzip2_decompress_stream(std::streamoff output_data_size, bool checksum, std::string_view input_on_memory)
+            : bzip2_decompress_stream(output_data_size, checksum, 0)
+        {
+            on_memory_ = true;
+            input_on_memory_ = input_on_memory;
+        }
+
+        // Restarts decompressing another stream, keeping the input buffer (grown if needed).
+        // (bzlib has no reset; the decompress state is initialized again.)
+        void reset(std::streamoff output_data_size, bool checksum, ssize32_t buffer_size)
+        {
+            ::BZ2_bzDecompressEnd(&bz_stream_);
+            bz_stream_ = bz_stream{};
+            if (auto r = ::BZ2_bzDecompressInit(&bz_stream_, 0, 0); r != BZ_OK)
+                throw std::runtime_error("bzlib2::init error");
+            output_remain_bytes_ = output_data_size;
+            if (input_buffer_.size() < static_cast<size_t>(buffer_size)) input_buffer_.resize(buffer_size);
+            input_buffer_used_ = input_buffer_.size();
+            checksum_ = checksum;
+            crc32_ = crc32::crc32_t{};
+            on_memory_ = false;
+            input_on_memory_ = {};
+        }
+
+        // reads the input in place
+        void reset(std::streamoff output_data_size, bool checksum, std::string_view input_on_memory)
+        {
+            reset(output_data_size, checksum, 0);
+            on_memory_ = true;
+            input_on_memory_ = input_on_memory;
+        }
+
+        bzip2_decompress_stream(const bzip2_decompress_stream& other) = delete;
+        bzip2_decompress_stream(bzip2_decompress_stream&& other) noexcept = delete;
+        bzip2_decompress_stream& operator=(const bzip2_decompress_stream& other) = delete;
+        bzip2_decompress_stream& operator=(bzip2_decompress_stream&& other) noexcept = delete;
+        ~bzip2_decompress_stream() { ::BZ2_bzDecompressEnd(&bz_stream_); }
+
+        template <class read_input_fun = std::function<ssize32_t(void* input_buf, ssize32_t input_len)>,
+            std::enable_if_t<std::is_invocable_r_v<ssize32_t, read_input_fun, void*, ssize32_t>>* = nullptr>
+        ssize32_t decompress(void* output_buf, ssize32_t output_len, read_input_fun&& read_input)
+        {
+            output_len = static_cast<ssize32_t>(std::min<intmax_t>(output_len, output_remain_bytes_));
+
+            char* const output_end = static_cast<char*>(output_buf) + output_len;
+            bz_stream_.next_out = static_cast<char*>(output_buf);
+            while (bz_stream_.next_out != output_end)
+            {
+                bool input_ended = false;
+                if (bz_stream_.avail_in == 0 && on_memory_) // need more input, on memory
+                {
+                    const auto n = std::min<size_t>(input_on_memory_.size(), std::numeric_limits<unsigned>::max());
+                    input_ended = n == 0;
+                    bz_stream_.next_in = const_cast<char*>(input_on_memory_.data());
+                    bz_stream_.avail_in = static_cast<unsigned>(n);
+                    input_on_memory_.remove_prefix(n);
+                }
+                else if (bz_stream_.avail_in == 0) // need more input
+                {
+                    auto input_len = read_input(input_buffer_.data(), static_cast<ssize32_t>(input_buffer_.size()));
+                    input_ended = input_len == 0;
+                    bz_stream_.next_in = input_buffer_.data();
+                    bz_stream_.avail_in = input_len;
+                }
+
+                // decompresses chunk by chunk to checksum each while it is still in cache
+                char* const chunk = bz_stream_.next_out;
+                bz_stream_.avail_out = static_cast<unsigned>(std::min<size_t>(crc32::fused_chunk_size, output_end - chunk));
+                auto result = ::BZ2_bzDecompress(&bz_stream_);
+                if (checksum_) crc32_ = crc32::calculate_crc32(chunk, bz_stream_.next_out - chunk, crc32_);
+
+                if (result == BZ_STREAM_END) break;
+                if (result < 0) throw std::runtime_error("BZ2_bzDecompress error: " + std::to_string(result));
+                if (input_ended && bz_stream_.next_out == chunk) break; // no more input and no pending output
+            }
+
+            auto written_bytes = static_cast<ssize32_t>(bz_stream_.next_out - static_cast<char*>(output_buf));
+            output_remain_bytes_ -= written_bytes;
+            return written_bytes;
+        }
+
+        // CRC-32 of the bytes decompressed so far (if checksum is enabled).
+        [[nodiscard]] crc32::crc32_t crc32() const { return crc32_; }
+    };
+#endif
+
+    // Reads the local file header and returns the position of the file data.
+    [[nodiscard]] static std::streamoff locate_file_data(const file_seek_read_function& read_zip_file, std::streamoff relative_offset_of_local_header)
+    {
+        local_file_header fh{};
+        read_zip_file(relative_offset_of_local_header, &fh, static_cast<int>(local_file_header::fixed_header_size()));
+        if (fh.local_file_header_signature != local_file_header::SIGNATURE)
+            throw std::runtime_error("file corrupted: local file header signature not match.");
+        return relative_offset_of_local_header + static_cast<std::streamoff>(fh.total_header_size());
+    }
+
+    // Gets the (raw) file data on the memory image.
+    [[nodiscard]] static std::string_view file_data_on_memory(std::string_view image, std::streamoff data_position, std::streamoff compressed_size)
+    {
+        if (data_position < 0 || compressed_size < 0 || static_cast<size_t>(data_position) > image.size() || static_cast<size_t>(compressed_size) > image.size() - static_cast<size_t>(data_position))
+            throw std::runtime_error("file corrupted: file data is out of the zip file.");
+        return image.substr(static_cast<size_t>(data_position), static_cast<size_t>(compressed_size));
+    }
+
+    // Decoding pipeline of a file: raw read, decryption, decompression, length and crc32 check, and 1GiB splitting.
+    // Each stage holds the stage below it by value, so the whole pipeline of an opened file is one object, allocated at once.
+    namespace decode
+    {
+        using ssize32_t = int32_t;
+
+        // What a pipeline decodes (kept to build it again for verification)
+        struct source
+        {
+            std::shared_ptr<const file_seek_read_function> read_zip_file;
+            std::string_view image; // whole zip file on memory (if available)
+            std::streamoff data_offset;
+            uint16_t general_purpose_bit_flag;
+            compression_method_t compression_method;
+            uint32_t crc_32;
+            std::streamoff compressed_size;
+            std::streamoff uncompressed_size;
+            std::string password;
+            unsigned inflate_threads;
+            std::shared_ptr<checkpoint_registry> checkpoints; // for random access
+            size_t index;
+        };
+
+        // Reads raw file data.
+        struct raw_reader
+        {
+            std::shared_ptr<const file_seek_read_function> read_zip_file;
+            std::streamoff cursor;
+            std::streamoff remain;
+
+            ssize32_t operator()(void* buffer, ssize32_t size)
+            {
+                auto read_size = static_cast<ssize32_t>(std::min<std::streamoff>(size, remain));
+                if (read_size <= 0) return 0; // no I/O at the end
+                (*read_zip_file)(cursor, buffer, read_size);
+                cursor += read_size;
+                remain -= read_size;
+                return read_size;
+            }
+        };
+
+        // Decrypts the data read from `lower_t`.
+        template <class lower_t>
+        struct decrypting_reader
+        {
+            lower_t lower;
+            traditional_pkware_decryption decrypt;
+
+            decrypting_reader(lower_t lower, std::string_view password, uint32_t crc_32)
+                : lower(std::move(lower))
+                , decrypt(password)
+            {
+                std::byte encryption_header[12]{};
+                (*this)(encryption_header, 12);
+
+                if (encryption_header[11] != static_cast<std::byte>(crc_32 >> 24))
+                    throw std::runtime_error("supplied password is not correct");
+            }
+
+            ssize32_t operator()(void* buffer, ssize32_t size)
+            {
+                ssize32_t r = lower(buffer, size);
+                decrypt.process_buffer(buffer, r);
+                return r;
+            }
+        };
+
+        // Reads nothing: the input is on memory.
+        struct no_reader
+        {
+            ssize32_t operator()(void*, ssize32_t) const { return 0; }
+        };
+
+        // Decompressors: read decompressed bytes, calculating crc32 of the output while it is still in cache.
+
+        template <class lower_t>
+        struct stored_decompressor
+        {
+            lower_t lower;
+            bool checksum;
+
+            stored_decompressor(const source&, bool checksum, lower_t lower) : lower(std::move(lower)), checksum(checksum) { }
+
+            void reset(const source&, bool checksum, lower_t lower)
+            {
+                this->lower = std::move(lower);
+                this->checksum = checksum;
+            }
+
+            [[nodiscard]] size_t buffer_bytes() const { return 0; }
+
+            ssize32_t operator()(void* buffer, ssize32_t size, crc32::crc32_t& crc)
+            {
+                ssize32_t total = 0;
+                while (total < size)
+                {
+                    auto chunk = static_cast<std::byte*>(buffer) + total;
+                    ssize32_t r = lower(chunk, static_cast<ssize32_t>(std::min<size_t>(crc32::fused_chunk_size, size - total)));
+                    if (checksum) crc = crc32::calculate_crc32(chunk, r, crc);
+                    total += r;
+                    if (r == 0) break;
+                }
+                return total;
+            }
+        };
+
+        // Adapts a reader to the upstream of inflate::bit_stream.
+        template <class lower_t>
+        struct bit_stream_upstream
+        {
+            lower_t lower;
+
+            size_t operator()(void* buffer, size_t size)
+            {
+                return static_cast<size_t>(lower(buffer, static_cast<ssize32_t>(std::min<size_t>(size, std::numeric_limits<ssize32_t>::max()))));
+            }
+        };
+
+        template <class upstream_t>
+        struct inflate_decompressor
+        {
+            inflate::inflate_stream<upstream_t> stream;
+
+            template <class lower_t>
+            inflate_decompressor(const source&, bool checksum, lower_t lower) : stream(upstream_t{std::move(lower)}, checksum) { }
+
+            inflate_decompressor(const source&, bool checksum, std::string_view input_on_memory)
+                : stream(std::basic_string_view<std::byte>{reinterpret_cast<const std::byte*>(input_on_memory.data()), input_on_memory.size()}, checksum) { }
+
+            template <class lower_t>
+            void reset(const source&, bool checksum, lower_t lower) { stream.reset(upstream_t{std::move(lower)}, checksum); }
+
+            void reset(const source&, bool checksum, std::string_view input_on_memory)
+            {
+                stream.reset(std::basic_string_view<std::byte>{reinterpret_cast<const std::byte*>(input_on_memory.data()), input_on_memory.size()}, checksum);
+            }
+
+            [[nodiscard]] size_t buffer_bytes() const { return 0; }
+
+            ssize32_t operator()(void* buffer, ssize32_t size, crc32::crc32_t& crc)
+            {
+                size = static_cast<ssize32_t>(stream.read(buffer, static_cast<size_t>(size)));
+                crc = stream.crc32();
+                return size;
+            }
+        };
+
+        // Inflates a large (unencrypted) deflate entry on multiple threads, batch by batch (a chunk of input per thread).
+        // Falls back to the serial inflate_stream for the input of a batch when the chunk at the exact position fails:
+        // a block or an expansion too large for a chunk, or corrupted data, which the serial decoder reports.
+        // The next batch after the fallback is decoded in parallel again.
+        struct parallel_inflate_decompressor
+        {
+            using serial_t = inflate::inflate_stream<bit_stream_upstream<raw_reader>>;
+            static constexpr size_t chunk_bytes = 1048576;               // input per chunk
+            static constexpr size_t max_batch_symbols = 64 * chunk_bytes; // output of all chunks of a batch, split among the threads
+            static constexpr size_t min_symbols = 4 * chunk_bytes;       // output per chunk, at least
+            static constexpr size_t max_symbols = 32 * chunk_bytes;      // output per chunk, at most
+            static constexpr std::streamoff min_compressed_size = 4 * chunk_bytes;
+            static constexpr size_t window_size = inflate::parallel::window_size;
+
+            std::shared_ptr<const file_seek_read_function> read_zip_file;
+            std::string_view input_on_memory;
+            std::streamoff data_offset{};
+            std::streamoff compressed_size{};
+            unsigned threads{};
+            size_t chunk_symbols{};                         // output per chunk, by the count of threads
+            bool checksum{};
+
+            std::uint64_t position{};                       // bit position in the input where the undecoded part starts
+            bool end{};                                     // reached the end of the final block
+            unsigned backoff{};                             // batches to decode the first chunk alone after a failure
+            unsigned solo_batches{};
+            std::vector<std::byte> input_buffer{};          // input of the batch (if not on memory)
+            std::vector<inflate::parallel::chunk> chunks{};
+            std::vector<inflate::parallel::symbol_table> windows{}; // window before each chunk; the first is the history before the batch
+            size_t history_size{};
+            std::vector<unsigned char> output{};            // output of the batch
+            size_t output_cursor{};
+            crc32::crc32_t crc{};                           // of the output of the batches
+            std::unique_ptr<serial_t> serial{};             // decodes a batch in case of fallback
+            bool serial_mode{};
+            std::uint64_t serial_begin{};                   // bit position where the serial decoder started
+            std::uint64_t serial_until{};                   // bit position to return to the batches after
+            std::uint64_t serial_bytes{};
+            inflate::parallel::workers workers{};           // kept while the entry is decoded
+
+            parallel_inflate_decompressor(const source& s, bool checksum, const raw_reader&) { reset(s, checksum, {}); }
+
+            void reset(const source& s, bool checksum, const raw_reader&)
+            {
+                read_zip_file = s.read_zip_file;
+                input_on_memory = s.image.empty() ? std::string_view{} : file_data_on_memory(s.image, s.data_offset, s.compressed_size);
+                data_offset = s.data_offset;
+                compressed_size = s.compressed_size;
+                threads = std::max(s.inflate_threads, 1u);
+                chunk_symbols = std::clamp(max_batch_symbols / threads, min_symbols, max_symbols);
+                this->checksum = checksum;
+                position = 0;
+                end = false;
+                backoff = 0;
+                solo_batches = 0;
+                chunks.resize(threads);
+                windows.resize(threads + 1, inflate::parallel::initial_symbol_table);
+                history_size = 0;
+                output.clear();
+                output_cursor = 0;
+                crc = crc32::crc32_t{};
+                serial_mode = false;
+                serial_bytes = 0;
+                workers.stop(); // of the previous entry, if not read to the end
+            }
+
+            [[nodiscard]] size_t buffer_bytes() const
+            {
+                size_t bytes = input_buffer.capacity() + windows.capacity() * sizeof(inflate::parallel::symbol_table) + output.capacity() + chunks.capacity() * sizeof(inflate::parallel::chunk);
+                for (const auto& c : chunks) bytes += c.symbols.capacity() * sizeof(inflate::parallel::symbol16_t);
+                return bytes + (serial ? sizeof(serial_t) : 0);
+            }
+
+            ssize32_t operator()(void* buffer, ssize32_t size, crc32::crc32_t& current_crc)
+            {
+                const auto out = static_cast<unsigned char*>(buffer);
+                ssize32_t total = 0;
+                while (total < size)
+                {
+                    if (output_cursor < output.size())
+                    {
+                        const size_t n = std::min<size_t>(output.size() - output_cursor, static_cast<size_t>(size - total));
+                        std::memcpy(out + total, output.data() + output_cursor, n);
+                        output_cursor += n;
+                        total += static_cast<ssize32_t>(n);
+                    }
+                    else if (serial_mode)
+                    {
+                        const size_t n = serial->read_block(out + total, static_cast<size_t>(size - total));
+                        serial_bytes += n;
+                        total += static_cast<ssize32_t>(n);
+                        if (serial->ended() || (serial->at_block_boundary() && serial_begin + serial->input_position() >= serial_until)) return_from_serial();
+                        else if (n == 0 && !serial->at_block_boundary()) break;
+                    }
+                    else if (end)
+                    {
+                        workers.stop();
+                        break;
+                    }
+                    else
+                    {
+                        decode_batch();
+                    }
+                }
+
+                current_crc = serial_mode && checksum ? crc32::combine_crc32<0xEDB88320>(crc, serial->crc32(), serial_bytes) : crc;
+                return total;
             }
 
-            [[nodiscard]] unsigned read(unsigned n)
+        private:
+            // Decodes the next batch into `output`, or switches to the serial decoder.
+            void decode_batch()
             {
-                auto v = peek(n);
-                local = local >> n;
-                local_buffered_ -= n;
-                return v;
+                namespace parallel = inflate::parallel;
+
+                // a chunk per thread, or the first chunk alone while backing off
+                const std::uint64_t first = position / CHAR_BIT;
+                const std::uint64_t remain = static_cast<std::uint64_t>(compressed_size) - first;
+                const size_t n = solo_batches ? 1 : std::clamp<size_t>(static_cast<size_t>((remain + chunk_bytes - 1) / chunk_bytes), 1, threads);
+                const auto batch_size = static_cast<size_t>(std::min<std::uint64_t>(remain, chunk_bytes * (n + 1))); // with a chunk of look-ahead
+                solo_batches -= solo_batches != 0;
+                std::basic_string_view<std::byte> input{};
+                if (!input_on_memory.empty())
+                {
+                    input = {reinterpret_cast<const std::byte*>(input_on_memory.data()) + first, batch_size};
+                }
+                else
+                {
+                    input_buffer.resize(batch_size);
+                    (*read_zip_file)(data_offset + static_cast<std::streamoff>(first), input_buffer.data(), static_cast<ssize32_t>(batch_size));
+                    input = {input_buffer.data(), batch_size};
+                }
+
+                // decodes chunks: the first from the exact position, the others from a block boundary found in their range
+                workers.run(n, [&](size_t k)
+                {
+                    const std::uint64_t stop = (k + 1) * chunk_bytes * CHAR_BIT;
+                    if (k == 0) parallel::decode_chunk(input, position % CHAR_BIT, stop, history_size, chunk_symbols, chunks[k]);
+                    else parallel::find_and_decode_chunk(input, first + batch_size == static_cast<std::uint64_t>(compressed_size), k * chunk_bytes * CHAR_BIT, stop, chunk_symbols, chunks[k]);
+                });
+
+                if (!chunks[0].decoded) return fall_back_to_serial(n);
+
+                // uses the chunks continuing from the first
+                size_t m = 1;
+                while (m < n && !chunks[m - 1].final && chunks[m].decoded && parallel::starts_same(input, chunks[m - 1].end, chunks[m].begin)) m++;
+
+                // backs off if no chunk could be split off (e.g. no block boundary to find in fixed Huffman blocks)
+                if (n > 1 && m == 1 && !chunks[0].final) solo_batches = backoff = std::clamp(backoff * 2, 1u, 64u);
+                else if (m > 1) backoff = 0;
+
+                // resolves the last 32KiB of each chunk in order, to get the window before the next one
+                std::vector<size_t> offsets(m + 1), histories(m + 1);
+                histories[0] = history_size;
+                for (size_t k = 0; k < m; k++)
+                {
+                    const auto& c = chunks[k];
+                    const size_t tail = std::min(c.size, window_size);
+                    unsigned char* const next = windows[k + 1].data() + parallel::marker;
+                    std::memcpy(next, windows[k].data() + parallel::marker + tail, window_size - tail);
+                    parallel::resolve(c.symbols.data() + (c.size - tail), tail, windows[k], histories[k], next + window_size - tail);
+                    offsets[k + 1] = offsets[k] + c.size;
+                    histories[k + 1] = std::min(histories[k] + c.size, window_size);
+                }
+
+                // resolves whole chunks at once, checksumming each piece while it is still in cache
+                output.resize(offsets[m]);
+                workers.run(m, [&](size_t k)
+                {
+                    auto& c = chunks[k];
+                    c.resolved = true;
+                    c.crc32 = crc32::crc32_t{};
+                    for (size_t i = 0; i < c.size; i += crc32::fused_chunk_size)
+                    {
+                        const size_t piece = std::min(crc32::fused_chunk_size, c.size - i);
+                        unsigned char* const o = output.data() + offsets[k] + i;
+                        c.resolved &= parallel::resolve(c.symbols.data() + i, piece, windows[k], histories[k], o);
+                        if (checksum) c.crc32 = crc32::calculate_crc32(o, piece, c.crc32);
+                    }
+                });
+
+                for (size_t k = 0; k < m; k++)
+                    if (!chunks[k].resolved) return fall_back_to_serial(n); // back-reference before the start of the stream
+
+                for (size_t k = 0; k < m; k++)
+                    if (checksum) crc = crc32::combine_crc32<0xEDB88320>(crc, chunks[k].crc32, chunks[k].size);
+
+                output_cursor = 0;
+                position = first * CHAR_BIT + chunks[m - 1].end;
+                end = chunks[m - 1].final;
+                history_size = histories[m];
+                windows[0] = windows[m];
             }
 
-            void seek_to_next_byte()
+            // Decodes serially from the block boundary at `position`, up to the first block boundary after the input of `n` chunks.
+            void fall_back_to_serial(size_t n)
             {
-                (void)read(local_buffered_ % CHAR_BIT);
+                const std::uint64_t first = position / CHAR_BIT;
+                raw_reader rest{read_zip_file, data_offset + static_cast<std::streamoff>(first), compressed_size - static_cast<std::streamoff>(first)};
+                if (!serial) serial = std::make_unique<serial_t>(bit_stream_upstream<raw_reader>{rest}, checksum);
+                serial->resume(bit_stream_upstream<raw_reader>{std::move(rest)}, static_cast<unsigned>(position % CHAR_BIT), windows[0].data() + windows[0].size() - history_size, history_size, checksum);
+                output.clear();
+                output_cursor = 0;
+                serial_mode = true;
+                serial_begin = first * CHAR_BIT;
+                serial_until = position + n * chunk_bytes * CHAR_BIT;
+                serial_bytes = 0;
+            }
+
+            // Returns to the batches at the block boundary (or the end of the stream) where the serial decoder stopped.
+            void return_from_serial()
+            {
+                if (checksum) crc = crc32::combine_crc32<0xEDB88320>(crc, serial->crc32(), serial_bytes);
+                history_size = static_cast<size_t>(std::min<std::uint64_t>(history_size + serial_bytes, window_size));
+                (void)serial->copy_history(windows[0].data() + windows[0].size() - history_size);
+                position = serial_begin + serial->input_position();
+                end = serial->ended();
+                serial_mode = false;
+                serial_bytes = 0;
             }
         };
 
-        // Huffman code decoder
-        class huffman_decoder
+#ifdef NANONZIP_ENABLE_ZLIB
+        template <class lower_t>
+        struct zlib_decompressor
         {
-        public:
-            using symbol_t = unsigned;
-            using code_t = unsigned;
-            using code_length_t = unsigned;
+            lower_t lower;
+            zlib_inflate_stream stream;
 
-            huffman_decoder() = default;
+            // the input buffer is no larger than the compressed data
+            zlib_decompressor(const source& s, bool checksum, lower_t lower)
+                : lower(std::move(lower))
+                , stream(s.uncompressed_size, checksum, static_cast<ssize32_t>(std::clamp<std::streamoff>(s.compressed_size, 1, 262144))) { }
 
-            huffman_decoder(const code_length_t code_lengths[], size_t length_count)
-                : symbol_table_(build_symbol_table(code_lengths, length_count))
-                , index_table_(build_index_table(symbol_table_))
-                , lookup_table_(build_symbol_lookup_table(symbol_table_)) { }
+            zlib_decompressor(const source& s, bool checksum, std::string_view input_on_memory)
+                : lower()
+                , stream(s.uncompressed_size, checksum, input_on_memory) { }
 
-            huffman_decoder(const huffman_decoder& other) = default;
-            huffman_decoder(huffman_decoder&& other) noexcept = default;
-            huffman_decoder& operator=(const huffman_decoder& other) = default;
-            huffman_decoder& operator=(huffman_decoder&& other) noexcept = default;
-            ~huffman_decoder() = default;
+            void reset(const source& s, bool checksum, lower_t lower)
+            {
+                this->lower = std::move(lower);
+                stream.reset(s.uncompressed_size, checksum, static_cast<ssize32_t>(std::clamp<std::streamoff>(s.compressed_size, 1, 262144)));
+            }
 
-            symbol_t read_next(bit_stream& bit_stream) const
+            void reset(const source& s, bool checksum, std::string_view input_on_memory)
             {
-                code_t input = bit_stream.peek(MAX_BITS);
-                if (auto e = lookup(lookup_table_, input); e.length) { return (void)bit_stream.read(e.length), e.symbol; }
-                if (auto e = lookup(symbol_table_, index_table_, input); e.length) { return (void)bit_stream.read(e.length), e.symbol; }
-                throw std::runtime_error("invalid bit stream: not registered huffman code");
+                stream.reset(s.uncompressed_size, checksum, input_on_memory);
             }
 
-        private:
-            static inline constexpr code_length_t MAX_BITS = 15;
-            static inline constexpr code_length_t LUT_MAX_BITS = 12; // 4B*(1<<12) = 16KiB table
+            // (not including the library's internal state)
+            [[nodiscard]] size_t buffer_bytes() const { return stream.input_buffer_.capacity(); }
 
-            struct symbol_entry
+            ssize32_t operator()(void* buffer, ssize32_t size, crc32::crc32_t& crc)
             {
-                code_length_t length : 16;
-                symbol_t symbol : 16;
-#ifdef _DEBUG
-                code_t code = code_t{};
+                size = stream.inflate(buffer, size, lower);
+                crc = stream.crc32();
+                return size;
+            }
+        };
 #endif
-            };
 
-            struct range
+#ifdef NANONZIP_ENABLE_BZIP2
+        template <class lower_t>
+        struct bzip2_decompressor
+        {
+            lower_t lower;
+            bzip2_decompress_stream stream;
+
+            // the input buffer is no larger than the compressed data
+            bzip2_decompressor(const source& s, bool checksum, lower_t lower)
+                : lower(std::move(lower))
+                , stream(s.uncompressed_size, checksum, static_cast<ssize32_t>(std::clamp<std::streamoff>(s.compressed_size, 1, 262144))) { }
+
+            bzip2_decompressor(const source& s, bool checksum, std::string_view input_on_memory)
+                : lower()
+                , stream(s.uncompressed_size, checksum, input_on_memory) { }
+
+            void reset(const source& s, bool checksum, lower_t lower)
+            {
+                this->lower = std::move(lower);
+                stream.reset(s.uncompressed_size, checksum, static_cast<ssize32_t>(std::clamp<std::streamoff>(s.compressed_size, 1, 262144)));
+            }
+
+            void reset(const source& s, bool checksum, std::string_view input_on_memory)
+            {
+                stream.reset(s.uncompressed_size, checksum, input_on_memory);
+            }
+
+            // (not including the library's internal state)
+            [[nodiscard]] size_t buffer_bytes() const { return stream.input_buffer_.capacity(); }
+
+            ssize32_t operator()(void* buffer, ssize32_t size, crc32::crc32_t& crc)
+            {
+                size = stream.decompress(buffer, size, lower);
+                crc = stream.crc32();
+                return size;
+            }
+        };
+#endif
+
+        // Checkpoints of a deflate entry, where inflating can resume: block boundaries with the history before them. (thread-safe)
+        // Recorded at most every `spacing` bytes of the output while files of the entry are read at random, or imported.
+        class checkpoint_index
+        {
+        public:
+            static constexpr size_t window_size = inflate::parallel::window_size;
+
+            struct checkpoint
             {
-                code_t first;
-                code_t last;
-                size_t base_index;
+                std::uint64_t output{};              // offset in the decompressed data
+                std::uint64_t input_bits{};          // offset of the block in the compressed data, in bits
+                std::vector<unsigned char> window{}; // the last (up to 32KiB) bytes decompressed before the block
             };
 
-            using symbol_table = std::vector<symbol_entry>;
-            using symbol_index_table = std::vector<range>;
-            using symbol_lookup_table = std::vector<symbol_entry>;
+        private:
+            // Exported checkpoints: exported_header, then each exported_checkpoint followed by its window (padded to 8 bytes).
+            struct exported_header
+            {
+                static inline constexpr char MAGIC[8] = {'N', 'Z', 'I', 'P', 'C', 'K', 'P', '\x1a'};
+                static inline constexpr uint32_t VERSION = 1;
+                char magic[8];
+                uint32_t version;
+                uint32_t crc_32; // of the file
+                uint64_t compressed_size;
+                uint64_t uncompressed_size;
+                uint64_t spacing;
+                uint64_t count;
+                uint32_t checksum; // CRC-32 of the whole, with this field zeroed
+                uint32_t reserved;
+            };
 
-            static symbol_table build_symbol_table(const code_length_t code_lengths[], size_t length_count)
+            struct exported_checkpoint
             {
-                symbol_table symbols;
-                symbols.reserve(length_count);
+                uint64_t output;
+                uint64_t input_bits;
+                uint64_t window_size;
+            };
 
-                for (size_t i = 0; i < length_count; ++i)
-                    if (code_lengths[i] != 0)
-                        symbols.push_back(symbol_entry{code_lengths[i], static_cast<symbol_t>(i),});
+            static_assert(sizeof(exported_header) == 56 && std::is_trivial_v<exported_header>);
+            static_assert(sizeof(exported_checkpoint) == 24 && std::is_trivial_v<exported_checkpoint>);
 
-                // sort by length
-                std::stable_sort(symbols.begin(), symbols.end(), [](symbol_entry a, symbol_entry b) { return a.length < b.length; });
+            [[nodiscard]] static constexpr size_t align(size_t size) noexcept { return (size + 7) & ~size_t{7}; }
 
-#ifdef _DEBUG
-                auto it = symbols.begin();
-                code_t code = 0;
-                for (code_length_t bits = 0; bits <= MAX_BITS; ++bits, code <<= 1)
-                    for (; it != symbols.end() && it->length == bits; ++it, ++code)
-                        it->code = code;
-#endif
-                return symbols;
+            const uint32_t crc_32_;
+            const std::uint64_t compressed_size_;
+            const std::uint64_t uncompressed_size_;
+            const std::uint64_t spacing_;
+            mutable std::mutex mutex_;
+            std::vector<checkpoint> checkpoints_{}; // sorted by output, without the start of the data
+            std::uint64_t decoded_{};               // the output decoded from the start or checkpoints, which covers [0, decoded_)
+
+            // Gets the last checkpoint at or before `output` (the start of the data if none).
+            [[nodiscard]] const checkpoint& last_before(std::uint64_t output) const
+            {
+                static const checkpoint start{};
+                auto it = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), output, [](std::uint64_t o, const checkpoint& c) { return o < c.output; });
+                return it == checkpoints_.begin() ? start : *std::prev(it);
             }
 
-            static symbol_index_table build_index_table(const symbol_table& symbols)
+            [[nodiscard]] bool spaced(std::uint64_t output) const { return output < uncompressed_size_ && output - last_before(output).output >= spacing_; }
+
+        public:
+            checkpoint_index(uint32_t crc_32, std::uint64_t compressed_size, std::uint64_t uncompressed_size, std::uint64_t spacing)
+                : crc_32_(crc_32)
+                , compressed_size_(compressed_size)
+                , uncompressed_size_(uncompressed_size)
+                , spacing_(std::max<std::uint64_t>(spacing, 1)) { }
+
+            // Calls `fn(checkpoint)` with the last checkpoint at or before `output` (the start of the data if none), under the lock.
+            template <class fn_t>
+            void nearest(std::uint64_t output, fn_t&& fn) const
             {
-                symbol_index_table map{};
-                map.reserve(MAX_BITS + 1);
+                std::lock_guard lock(mutex_);
+                fn(last_before(output));
+            }
 
-                code_t code = 0;
-                auto it = symbols.begin();
-                for (code_length_t bits = 0; bits <= MAX_BITS; ++bits, code <<= 1)
-                {
-                    range m{};
-                    m.first = code;
-                    m.base_index = it - symbols.begin();
-                    for (; it != symbols.end() && it->length == bits; ++it, ++code) (void)code;
-                    m.last = code;
-                    map.push_back(m);
-                }
-                return map;
+            // Whether a checkpoint at `output` would be recorded: not at the end, and `spacing` after the previous one.
+            [[nodiscard]] bool wants(std::uint64_t output) const
+            {
+                std::lock_guard lock(mutex_);
+                return spaced(output);
             }
 
-            static symbol_entry lookup(const symbol_table& symbols, const symbol_index_table& map, code_t input)
+            void add(checkpoint c)
             {
-                code_t code = 0;
-                for (code_length_t bits = 0; bits <= MAX_BITS; ++bits)
-                {
-                    if (const auto& m = map[bits]; /* m.first <= code && */ code < m.last)
-                        return symbols[m.base_index + (code - m.first)];
+                std::lock_guard lock(mutex_);
+                if (!spaced(c.output)) return; // recorded by another file meanwhile
+                auto it = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), c.output, [](std::uint64_t o, const checkpoint& e) { return o < e.output; });
+                checkpoints_.insert(it, std::move(c));
+            }
 
-                    code = (code << 1) | (input & 1u);
-                    input = input >> 1;
-                }
-                return symbol_entry{}; // not found
+            // Notes that the output is decoded up to `output`.
+            void reached(std::uint64_t output)
+            {
+                std::lock_guard lock(mutex_);
+                decoded_ = std::max(decoded_, output);
             }
 
-            static symbol_lookup_table build_symbol_lookup_table(const symbol_table& symbols)
+            // Whether the checkpoints cover the whole data.
+            [[nodiscard]] bool complete() const
             {
-                symbol_lookup_table lut(1u << LUT_MAX_BITS);
+                std::lock_guard lock(mutex_);
+                return decoded_ >= uncompressed_size_;
+            }
 
-                code_t code = 0;
-                auto it = symbols.begin();
-                for (code_length_t bits = 0; bits <= LUT_MAX_BITS; ++bits, code <<= 1)
+            [[nodiscard]] std::vector<std::byte> export_all() const
+            {
+                std::lock_guard lock(mutex_);
+                exported_header h{};
+                std::memcpy(h.magic, exported_header::MAGIC, sizeof(h.magic));
+                h.version = exported_header::VERSION;
+                h.crc_32 = crc_32_;
+                h.compressed_size = compressed_size_;
+                h.uncompressed_size = uncompressed_size_;
+                h.spacing = spacing_;
+                h.count = checkpoints_.size();
+
+                size_t size = sizeof(h);
+                for (const auto& c : checkpoints_) size += sizeof(exported_checkpoint) + align(c.window.size());
+
+                std::vector<std::byte> out(size);
+                size_t cursor = sizeof(h);
+                for (const auto& c : checkpoints_)
                 {
-                    for (; it != symbols.end() && it->length == bits; ++it, ++code)
-                    {
-                        static_assert(LUT_MAX_BITS <= 16);
-                        unsigned reversed = code;                                         // 16bit bit-reverse
-                        reversed = ((reversed & 0x5555) << 1) | (reversed >> 1 & 0x5555); // 0b0101010101010101
-                        reversed = ((reversed & 0x3333) << 2) | (reversed >> 2 & 0x3333); // 0b0011001100110011
-                        reversed = ((reversed & 0x0F0F) << 4) | (reversed >> 4 & 0x0F0F); // 0b0000111100001111
-                        reversed = ((reversed & 0x00FF) << 8) | (reversed >> 8 & 0x00FF); // 0x0000000011111111
-
-                        const code_t fixed_bits = static_cast<code_t>(reversed >> (16 - bits)); // lower `bits` bits are bit-reversed code
-                        for (code_t free_bits = 0, inc = 1 << bits; free_bits < lut.size(); free_bits += inc)
-                            lut[free_bits | fixed_bits] = *it;
-                    }
+                    const exported_checkpoint e{c.output, c.input_bits, c.window.size()};
+                    std::memcpy(out.data() + cursor, &e, sizeof(e));
+                    std::memcpy(out.data() + cursor + sizeof(e), c.window.data(), c.window.size());
+                    cursor += sizeof(e) + align(c.window.size());
                 }
-
-                return lut;
+                std::memcpy(out.data(), &h, sizeof(h));
+                h.checksum = crc32::calculate_crc32(out.data(), size);
+                std::memcpy(out.data(), &h, sizeof(h));
+                return out;
             }
 
-            static symbol_entry lookup(const symbol_lookup_table& lut, code_t input)
+            // Merges checkpoints exported by `export_all` of the same entry. Throws std::runtime_error if they are broken or of another entry.
+            void import_all(const void* data, size_t size)
             {
-                constexpr code_t mask = (1u << LUT_MAX_BITS) - 1;
-                return lut[input & mask];
+                const auto bytes = static_cast<const unsigned char*>(data);
+                exported_header h{};
+                if (size < sizeof(h)) throw std::runtime_error("broken checkpoints.");
+                std::memcpy(&h, bytes, sizeof(h));
+                const uint32_t checksum = std::exchange(h.checksum, 0);
+                if (std::memcmp(h.magic, exported_header::MAGIC, sizeof(h.magic)) != 0 || h.version != exported_header::VERSION
+                    || crc32::calculate_crc32(bytes + sizeof(h), size - sizeof(h), crc32::calculate_crc32(&h, sizeof(h))) != checksum)
+                    throw std::runtime_error("broken checkpoints.");
+                if (h.crc_32 != crc_32_ || h.compressed_size != compressed_size_ || h.uncompressed_size != uncompressed_size_)
+                    throw std::runtime_error("checkpoints of another file.");
+
+                std::vector<checkpoint> imported;
+                size_t cursor = sizeof(h);
+                for (uint64_t i = 0; i < h.count; i++)
+                {
+                    exported_checkpoint e{};
+                    if (size - cursor < sizeof(e)) throw std::runtime_error("broken checkpoints.");
+                    std::memcpy(&e, bytes + cursor, sizeof(e));
+                    cursor += sizeof(e);
+
+                    const std::uint64_t previous = imported.empty() ? 0 : imported.back().output;
+                    if (e.output <= previous || e.output >= uncompressed_size_ || e.input_bits >= compressed_size_ * CHAR_BIT
+                        || e.window_size != std::min<std::uint64_t>(e.output, window_size) || size - cursor < align(e.window_size))
+                        throw std::runtime_error("broken checkpoints.");
+
+                    imported.push_back(checkpoint{e.output, e.input_bits, std::vector<unsigned char>(bytes + cursor, bytes + cursor + e.window_size)});
+                    cursor += align(e.window_size);
+                }
+                if (cursor != size) throw std::runtime_error("broken checkpoints.");
+
+                // keeps the recorded ones at the same offsets
+                std::lock_guard lock(mutex_);
+                std::move(imported.begin(), imported.end(), std::back_inserter(checkpoints_));
+                std::stable_sort(checkpoints_.begin(), checkpoints_.end(), [](const checkpoint& a, const checkpoint& b) { return a.output < b.output; });
+                checkpoints_.erase(std::unique(checkpoints_.begin(), checkpoints_.end(), [](const checkpoint& a, const checkpoint& b) { return a.output == b.output; }), checkpoints_.end());
+                decoded_ = uncompressed_size_; // exported after the whole data was covered
             }
-
-            symbol_table symbol_table_{};
-            symbol_index_table index_table_{};
-            symbol_lookup_table lookup_table_{};
         };
 
-        // Output windowed buffer
-        class window
+        // Checkpoint indexes of the deflate entries of a zip file, made on the first use. (thread-safe)
+        class checkpoint_registry
         {
-            using byte = unsigned char;
-            static constexpr inline size_t window_size_ = 1u << 16;
-            std::vector<byte> buffer_ = std::vector<byte>(window_size_, 0);
-            size_t cursor_{0};
+            mutable std::mutex mutex_;
+            std::uint64_t spacing_ = 1048576;
+            std::unordered_map<size_t, std::shared_ptr<checkpoint_index>> indexes_{};
 
         public:
-            window() = default;
-            window(const window& other) = delete;
-            window(window&& other) noexcept = delete;
-            window& operator=(const window& other) = delete;
-            window& operator=(window&& other) noexcept = delete;
-            ~window() = default;
-            byte put(byte b) { return buffer_[cursor_++ & (window_size_ - 1)] = b; }
-            size_t cursor() const { return cursor_; }
-            byte reput(ptrdiff_t distance) { return put(buffer_[(cursor_ + distance) & (window_size_ - 1)]); }
-        };
-
-        static constexpr size_t nr_clen_alphabets = 19;
-        static constexpr size_t nr_lit_alphabets = 286;
-        static constexpr size_t nr_dist_alphabets = 32;
-
-        static std::tuple<huffman_decoder, huffman_decoder> build_fixed_huffman_code_decoder()
-        // -> std::tuple<literals_decoder, distance_decoder>
-        {
-            std::array<huffman_decoder::code_length_t, nr_lit_alphabets> huff_lit_code_len{};
-            std::array<huffman_decoder::code_length_t, nr_dist_alphabets> huff_dist_code_len{};
+            // Sets the spacing of the indexes made after this.
+            void set_spacing(std::uint64_t spacing)
+            {
+                std::lock_guard lock(mutex_);
+                spacing_ = spacing;
+            }
 
-            size_t i = 0;
-            for (; i < 144; i++) huff_lit_code_len[i] = 8; // 00110000  through 10111111
-            for (; i < 256; i++) huff_lit_code_len[i] = 9; // 110010000 through 111111111
-            for (; i < 280; i++) huff_lit_code_len[i] = 7; // 0000000   through 0010111
-            for (; i < 286; i++) huff_lit_code_len[i] = 8; // 11000000  through 11000111
-            for (auto& v : huff_dist_code_len) v = 5;      // Distance codes 0-31 are represented by (fixed-length) 5-bit codes
+            // Gets the index of the entry, or nullptr if not made yet.
+            [[nodiscard]] std::shared_ptr<checkpoint_index> find(size_t index) const
+            {
+                std::lock_guard lock(mutex_);
+                auto it = indexes_.find(index);
+                return it != indexes_.end() ? it->second : nullptr;
+            }
 
-            return std::make_tuple(
-                huffman_decoder(huff_lit_code_len.data(), nr_lit_alphabets),
-                huffman_decoder(huff_dist_code_len.data(), nr_dist_alphabets));
-        }
+            // Gets the index of the entry, making it if not made yet.
+            [[nodiscard]] std::shared_ptr<checkpoint_index> get(size_t index, uint32_t crc_32, std::uint64_t compressed_size, std::uint64_t uncompressed_size)
+            {
+                std::lock_guard lock(mutex_);
+                auto& p = indexes_[index];
+                if (!p) p = std::make_shared<checkpoint_index>(crc_32, compressed_size, uncompressed_size, spacing_);
+                return p;
+            }
+        };
 
-        static std::array<huffman_decoder::code_length_t, nr_clen_alphabets> read_huffman_length_length_table(bit_stream& bit_stream, size_t symbols_from_source)
+        static std::shared_ptr<checkpoint_registry> make_checkpoint_registry()
         {
-            if (symbols_from_source > nr_clen_alphabets) throw std::runtime_error("invalid argument: symbols_from_source too large");
-
-            std::array<huffman_decoder::code_length_t, nr_clen_alphabets> result{};
-            static constexpr size_t order[nr_clen_alphabets] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-            for (size_t i = 0; i < symbols_from_source; ++i) result[order[i]] = static_cast<uint8_t>(bit_stream.read(3));
-            return result;
+            return std::make_shared<checkpoint_registry>();
         }
 
-        template <size_t length_length>
-        static std::array<huffman_decoder::code_length_t, length_length> read_huffman_length_table(const huffman_decoder& length_decoder, bit_stream& bit_stream, size_t symbols_from_source)
+        // Reads an unencrypted deflate entry at any offset with the built-in inflate_stream (not checked by CRC-32):
+        // resumes inflating at the last checkpoint before the offset, or goes on from the current position if it is nearer,
+        // and records checkpoints at block boundaries on the way.
+        class random_access
         {
-            if (symbols_from_source > length_length) throw std::runtime_error("invalid argument: symbols_from_source too large");
-
-            std::array<huffman_decoder::code_length_t, length_length> result{};
-            huffman_decoder::code_length_t prev = 0; // for running length
-            const auto count = symbols_from_source;
-            const auto check = [count](auto i) { return i < count ? i : throw std::runtime_error("invalid bit stream: invalid code lengths set"); };
-            for (size_t i = 0; i < count;)
+            using upstream_t = bit_stream_upstream<raw_reader>;
+            static constexpr size_t window_size = checkpoint_index::window_size;
+
+            std::shared_ptr<const file_seek_read_function> read_zip_file_;
+            std::streamoff data_offset_;
+            std::uint64_t compressed_size_;
+            std::uint64_t uncompressed_size_;
+            std::shared_ptr<checkpoint_index> checkpoints_;
+
+            inflate::inflate_stream<upstream_t> stream_{upstream_t{}, false};
+            std::uint64_t input_base_{}; // input bits before the stream
+            std::uint64_t position_{};   // output of the stream
+            bool valid_{};               // whether the stream is at `position_`
+            std::array<unsigned char, window_size> window_;  // the history to resume with, or to record
+            std::array<unsigned char, 65536> skipped_;       // decompressed bytes before the offset
+
+            // Inflates up to `size` bytes, stopping at the end of a block to record a checkpoint there.
+            size_t inflate(unsigned char* out, size_t size)
             {
-                huffman_decoder::code_length_t code = length_decoder.read_next(bit_stream);
-                if (code <= 15) result[check(i++)] = prev = code;                                                        // Represent code lengths of 0 - 15
-                else if (code == 16) for (auto x = i + bit_stream.read(2) + 3; i < x; ++i) result[check(i)] = prev;      // Copy the previous code length 3 - 6 times.
-                else if (code == 17) for (auto x = i + bit_stream.read(3) + 3; i < x; ++i) result[check(i)] = prev = 0;  // Repeat a code length of 0 for 3 - 10 times.
-                else if (code == 18) for (auto x = i + bit_stream.read(7) + 11; i < x; ++i) result[check(i)] = prev = 0; // Repeat a code length of 0 for 11 - 138 times
-                else throw std::runtime_error("invalid sequence: invalid code lengths set");
+                const size_t n = stream_.read_block(out, size);
+                position_ += n;
+                if (stream_.ended())
+                {
+                    if (position_ < uncompressed_size_) throw std::runtime_error("file length not match!");
+                }
+                else if (stream_.at_block_boundary() && checkpoints_->wants(position_))
+                {
+                    const size_t history = stream_.copy_history(window_.data());
+                    checkpoints_->add(checkpoint_index::checkpoint{position_, input_base_ + stream_.input_position(), std::vector<unsigned char>(window_.data(), window_.data() + history)});
+                }
+                return n;
             }
-            return result;
-        }
 
-        static std::tuple<huffman_decoder, huffman_decoder> build_dynamic_huffman_code_decoder(bit_stream& bit_stream)
-        // -> std::tuple<literals_decoder, distance_decoder>
-        {
-            const unsigned HLIT = bit_stream.read(5) + 257;
-            const unsigned HDIST = bit_stream.read(5) + 1;
-            const unsigned HCLEN = bit_stream.read(4) + 4;
-            if (HLIT < 257 || HLIT > 286) throw std::runtime_error("invalid bit stream: HLIT is out of range.");
-            if (HDIST < 1 || HDIST > 32) throw std::runtime_error("invalid bit stream: HDIST is out of range.");
-            if (HCLEN < 4 || HCLEN > 19) throw std::runtime_error("invalid bit stream: HCLEN is out of range.");
+        public:
+            explicit random_access(const source& s)
+                : read_zip_file_(s.read_zip_file)
+                , data_offset_(s.data_offset)
+                , compressed_size_(static_cast<std::uint64_t>(s.compressed_size))
+                , uncompressed_size_(static_cast<std::uint64_t>(s.uncompressed_size))
+                , checkpoints_(s.checkpoints->get(s.index, s.crc_32, compressed_size_, uncompressed_size_)) { }
+
+            // Reads up to `length` bytes at `offset`, then returns the count of bytes read (0 at the end).
+            size_t read(std::uint64_t offset, void* buffer, size_t length)
+            {
+                if (offset >= uncompressed_size_) return 0;
+                length = static_cast<size_t>(std::min<std::uint64_t>(length, uncompressed_size_ - offset));
 
-            const auto huff_code_len = read_huffman_length_length_table(bit_stream, HCLEN);
-            const auto length_decoder = huffman_decoder(huff_code_len.data(), nr_clen_alphabets);
-            const auto huff_lit_code_len = read_huffman_length_table<nr_lit_alphabets>(length_decoder, bit_stream, HLIT);
-            const auto huff_dist_code_len = read_huffman_length_table<nr_dist_alphabets>(length_decoder, bit_stream, HDIST);
+                bool resuming = false;
+                std::uint64_t output{}, input_bits{};
+                size_t history{};
+                checkpoints_->nearest(offset, [&](const checkpoint_index::checkpoint& c)
+                {
+                    if (valid_ && position_ <= offset && position_ >= c.output) return; // goes on
+                    resuming = true;
+                    output = c.output;
+                    input_bits = c.input_bits;
+                    history = c.window.size();
+                    std::memcpy(window_.data(), c.window.data(), history);
+                });
+
+                valid_ = false; // until the read completes
+                if (resuming)
+                {
+                    const std::uint64_t skipped_bytes = input_bits / CHAR_BIT;
+                    stream_.resume(upstream_t{raw_reader{read_zip_file_, data_offset_ + static_cast<std::streamoff>(skipped_bytes), static_cast<std::streamoff>(compressed_size_ - skipped_bytes)}},
+                                   static_cast<unsigned>(input_bits % CHAR_BIT), window_.data(), history, false);
+                    input_base_ = skipped_bytes * CHAR_BIT;
+                    position_ = output;
+                }
 
-            return std::make_tuple(
-                huffman_decoder(huff_lit_code_len.data(), HLIT),
-                huffman_decoder(huff_dist_code_len.data(), HDIST));
-        }
+                while (position_ < offset)
+                    inflate(skipped_.data(), static_cast<size_t>(std::min<std::uint64_t>(skipped_.size(), offset - position_)));
 
-        struct length_code_table_entry
-        {
-            unsigned length : 16;
-            unsigned extra_bits : 16;
-        } static constexpr length_code_table[] = {
-            /* 257 */ {3, 0}, /* 258 */ {4, 0}, /* 259 */ {5, 0}, /* 260 */ {6, 0}, /* 261 */ {7, 0},
-            /* 262 */ {8, 0}, /* 263 */ {9, 0}, /* 264 */ {10, 0}, /* 265 */ {11, 1}, /* 266 */ {13, 1},
-            /* 267 */ {15, 1}, /* 268 */ {17, 1}, /* 269 */ {19, 2}, /* 270 */ {23, 2}, /* 271 */ {27, 2},
-            /* 272 */ {31, 2}, /* 273 */ {35, 3}, /* 274 */ {43, 3}, /* 275 */ {51, 3}, /* 276 */ {59, 3},
-            /* 277 */ {67, 4}, /* 278 */ {83, 4}, /* 279 */ {99, 4}, /* 280 */ {115, 4}, /* 281 */ {131, 5},
-            /* 282 */ {163, 5}, /* 283 */ {195, 5}, /* 284 */ {227, 5}, /* 285 */ {258, 0},
+                for (size_t done = 0; done < length;)
+                    done += inflate(static_cast<unsigned char*>(buffer) + done, length - done);
+
+                checkpoints_->reached(position_);
+                valid_ = true;
+                return length;
+            }
         };
 
-        struct distance_code_table_entry
+        // CRC-32 of each chunk of a stored entry, for checking reads at random.
+        struct chunk_checksums
         {
-            unsigned distance : 16;
-            unsigned extra_bits : 16;
-        } static constexpr distance_code_table[] = {
-            /*  0 */ {1, 0}, /*  1 */ {2, 0}, /*  2 */ {3, 0}, /*  3 */ {4, 0}, /*  4 */ {5, 1},
-            /*  5 */ {7, 1}, /*  6 */ {9, 2}, /*  7 */ {13, 2}, /*  8 */ {17, 3}, /*  9 */ {25, 3},
-            /* 10 */ {33, 4}, /* 11 */ {49, 4}, /* 12 */ {65, 5}, /* 13 */ {97, 5}, /* 14 */ {129, 6},
-            /* 15 */ {193, 6}, /* 16 */ {257, 7}, /* 17 */ {385, 7}, /* 18 */ {513, 8}, /* 19 */ {769, 8},
-            /* 20 */ {1025, 9}, /* 21 */ {1537, 9}, /* 22 */ {2049, 10}, /* 23 */ {3073, 10}, /* 24 */ {4097, 11},
-            /* 25 */ {6145, 11}, /* 26 */ {8193, 12}, /* 27 */ {12289, 12}, /* 28 */ {16385, 13}, /* 29 */ {24577, 13},
+            std::uint64_t chunk_size;
+            std::once_flag made{}; // by reading the whole entry once, which is checked against its CRC-32
+            std::vector<crc32::crc32_t> crc_32{};
+
+            explicit chunk_checksums(std::uint64_t chunk_size) : chunk_size(chunk_size) { }
         };
 
-        class inflate_stream
+        // Reads an unencrypted stored entry at any offset by positional reads, without state. (thread-safe)
+        // With `checksums`, each read checks the chunks it touches, reading the rest of them.
+        struct stored_random_access
         {
-        public:
-            using byte = unsigned char;
-            using byte_span = std::basic_string_view<byte>;
-
-        private:
-            bit_stream input_;
-            window output_window_;
-            huffman_decoder lit_decoder_;
-            huffman_decoder dist_decoder_;
-            std::vector<byte> output_;
+            const source& s;
+            chunk_checksums* checksums; // null if not checked
 
-            enum struct state_t
+            size_t read(std::uint64_t position, void* buffer, size_t length) const
             {
-                block_head,
-                compressed_block,
-                compressed_last_block,
-                end,
-            } next_state_{};
+                const auto uncompressed_size = static_cast<std::uint64_t>(s.uncompressed_size);
+                if (position >= uncompressed_size) return 0;
+                length = static_cast<size_t>(std::min<std::uint64_t>(length, uncompressed_size - position));
+                read_raw(position, buffer, length);
+                if (checksums) check(position, buffer, length);
+                return length;
+            }
 
-        public:
-            inflate_stream(std::function<size_t(void* buf, size_t len)> upstream)
-                : input_(std::move(upstream))
+        private:
+            void read_raw(std::uint64_t position, void* buffer, size_t length) const
             {
-                output_.reserve(65536);
+                if (position + length > static_cast<std::uint64_t>(s.compressed_size)) throw std::runtime_error("file length not match!");
+                if (!s.image.empty())
+                {
+                    std::memcpy(buffer, file_data_on_memory(s.image, s.data_offset, s.compressed_size).data() + position, length);
+                    return;
+                }
+
+                // divides read calls by 1GiB
+                for (auto out = static_cast<std::byte*>(buffer); length;)
+                {
+                    const auto n = static_cast<int>(std::min<size_t>(length, 1073741824));
+                    (*s.read_zip_file)(s.data_offset + static_cast<std::streamoff>(position), out, n);
+                    out += n;
+                    position += static_cast<size_t>(n);
+                    length -= static_cast<size_t>(n);
+                }
             }
 
-            // Reads a piece of decompressed bytes
-            byte_span next()
+            // Continues `crc` over the raw bytes [position, position + length), read through `scratch` unless on memory.
+            [[nodiscard]] crc32::crc32_t crc_of(std::uint64_t position, std::uint64_t length, crc32::crc32_t crc, std::byte* scratch, size_t scratch_size) const
             {
-                output_.clear();
-                const auto yield = [this] { return byte_span{output_.data(), output_.size()}; };
+                if (!s.image.empty() && position + length <= static_cast<std::uint64_t>(s.compressed_size))
+                    return crc32::calculate_crc32(file_data_on_memory(s.image, s.data_offset, s.compressed_size).data() + position, static_cast<size_t>(length), crc);
+
+                for (size_t n; length; position += n, length -= n)
+                {
+                    n = static_cast<size_t>(std::min<std::uint64_t>(length, scratch_size));
+                    read_raw(position, scratch, n);
+                    crc = crc32::calculate_crc32(scratch, n, crc);
+                }
+                return crc;
+            }
 
-                switch (next_state_)
+            void check(std::uint64_t position, const void* buffer, size_t length) const
+            {
+                const auto uncompressed_size = static_cast<std::uint64_t>(s.uncompressed_size);
+                const std::uint64_t chunk_size = checksums->chunk_size;
+                std::call_once(checksums->made, [&]
                 {
-                case state_t::block_head:
-                    switch (unsigned BFINAL = input_.read(1), BTYPE = input_.read(2); BTYPE)
+                    std::vector<std::byte> scratch(static_cast<size_t>(std::min({chunk_size, uncompressed_size, std::uint64_t{crc32::fused_chunk_size}})));
+                    std::vector<crc32::crc32_t> chunks;
+                    crc32::crc32_t whole{};
+                    for (std::uint64_t chunk = 0; chunk < uncompressed_size; chunk += chunk_size)
                     {
-                    case 0b00: // Non-compressed blocks
-                        {
-                            input_.seek_to_next_byte();
-                            unsigned LEN = input_.read(16);
-                            unsigned NLEN = input_.read(16);
-                            if ((LEN ^ NLEN) != 0xFFFF) throw std::runtime_error("invalid bit stream: invalid stored block lengths");
-                            for (size_t i = 0; i < LEN; ++i)
-                                output_.push_back(output_window_.put(static_cast<byte>(input_.read(8))));
-
-                            next_state_ = !BFINAL ? state_t::block_head : state_t::end;
-                            return yield();
-                        }
-                    case 0b01: // Compression with fixed Huffman codes
-                    case 0b10: // Compression with dynamic Huffman codes
-                        {
-                            auto [lit, dist] = BTYPE == 0b01
-                                                   ? build_fixed_huffman_code_decoder()
-                                                   : build_dynamic_huffman_code_decoder(input_);
-                            lit_decoder_ = std::move(lit);
-                            dist_decoder_ = std::move(dist);
-                            next_state_ = !BFINAL ? state_t::compressed_block : state_t::compressed_last_block;
-                            return next(); // fallthrough
-                        }
-                    default:
-                        throw std::runtime_error("invalid bit stream: invalid block type");
+                        const std::uint64_t n = std::min(chunk_size, uncompressed_size - chunk);
+                        chunks.push_back(crc_of(chunk, n, 0, scratch.data(), scratch.size()));
+                        whole = crc32::combine_crc32<0xEDB88320>(whole, chunks.back(), n);
                     }
+                    if (whole != s.crc_32) throw std::runtime_error("crc32 is not match!");
+                    checksums->crc_32 = std::move(chunks);
+                });
+
+                // the head and the tail of the chunks out of the buffer are read into the stack
+                std::array<std::byte, 16384> scratch;
+                const std::uint64_t end = position + length;
+                for (std::uint64_t chunk = position - position % chunk_size; chunk < end; chunk += chunk_size)
+                {
+                    const std::uint64_t chunk_end = std::min(chunk + chunk_size, uncompressed_size);
+                    const std::uint64_t first = std::max(chunk, position);
+                    const std::uint64_t last = std::min(chunk_end, end);
+                    auto crc = crc_of(chunk, first - chunk, 0, scratch.data(), scratch.size());
+                    crc = crc32::calculate_crc32(static_cast<const std::byte*>(buffer) + (first - position), static_cast<size_t>(last - first), crc);
+                    crc = crc_of(last, chunk_end - last, crc, scratch.data(), scratch.size());
+                    if (crc != checksums->crc_32[static_cast<size_t>(chunk / chunk_size)])
+                        throw std::runtime_error("crc32 is not match!");
+                }
+            }
+        };
 
-                case state_t::compressed_block:
-                case state_t::compressed_last_block:
-                    while (true)
-                    {
-                        input_.fill(32);
-                        unsigned value = lit_decoder_.read_next(input_);
+        // Type-erased pipeline
+        struct pipeline
+        {
+            source source_;
+            std::shared_ptr<decoder_pool> pool_{}; // while handed out
+            size_t accounted_bytes_{}; // by the pool
+            std::mutex random_access_mutex_;
+            std::unique_ptr<random_access> random_access_{}; // made on the first read_at, and freed on release
+            std::unique_ptr<chunk_checksums> checksums_{};   // of read_at on stored data (if opted in), freed on release
+
+            explicit pipeline(source s) : source_(std::move(s)) { }
+            pipeline(const pipeline& other) = delete;
+            pipeline(pipeline&& other) noexcept = delete;
+            pipeline& operator=(const pipeline& other) = delete;
+            pipeline& operator=(pipeline&& other) noexcept = delete;
+            virtual ~pipeline() = default;
+
+            virtual size_t read(void* buffer, size_t length) = 0;
+
+            // Reads decompressed bytes at `offset`, independently of `read`. (thread-safe)
+            size_t read_at(std::uint64_t offset, void* buffer, size_t length)
+            {
+                std::lock_guard lock(random_access_mutex_);
+                if (!random_access_) random_access_ = std::make_unique<random_access>(source_);
+                return random_access_->read(offset, buffer, length);
+            }
+
+            // Memory of the object and the buffers it owns
+            [[nodiscard]] virtual size_t footprint() const = 0;
+
+            // Stops the threads the pipeline keeps while in use, when released to the pool.
+            virtual void idle() { }
+        };
+
+        // Returns a pipeline to the pool it came from.
+        struct pipeline_releaser
+        {
+            void operator()(pipeline* released) const;
+        };
+
+        using pipeline_ptr = std::unique_ptr<pipeline, pipeline_releaser>;
+
+        template <class decompressor_t>
+        struct composed_pipeline final : pipeline
+        {
+            decompressor_t decompress;
+            std::streamoff length;
+            crc32::crc32_t current_crc32{};
+            bool checksum;
+
+            template <class input_t>
+            composed_pipeline(source s, bool checksum, input_t input)
+                : pipeline(std::move(s))
+                , decompress(source_, checksum, std::move(input))
+                , length(source_.uncompressed_size)
+                , checksum(checksum) { }
+
+            // Restarts as if constructed with the arguments, keeping the buffers.
+            template <class input_t>
+            void reset(source s, bool checksum, input_t input)
+            {
+                source_ = std::move(s);
+                decompress.reset(source_, checksum, std::move(input));
+                length = source_.uncompressed_size;
+                current_crc32 = crc32::crc32_t{};
+                this->checksum = checksum;
+            }
 
-                        if (value <= 255)
-                        {
-                            output_.push_back(output_window_.put(static_cast<byte>(value)));
-                        }
-                        else if (value == 256)
-                        {
-                            next_state_ = (next_state_ != state_t::compressed_last_block) ? state_t::block_head : state_t::end;
-                            return !output_.empty() ? yield() : next();
-                        }
-                        else if (value <= 285) // 257..285
-                        {
-                            value -= 257;
-                            const auto l = value < std::size(length_code_table) ? length_code_table[value] : throw std::runtime_error("invalid bit stream: out of length code table");
-                            const auto length = l.length + input_.read(l.extra_bits);
+            [[nodiscard]] size_t footprint() const override { return sizeof(*this) + decompress.buffer_bytes(); }
 
-                            value = dist_decoder_.read_next(input_);
-                            const auto d = value < std::size(distance_code_table) ? distance_code_table[value] : throw std::runtime_error("invalid bit stream: out of distance code table");
-                            const auto distance = -static_cast<ptrdiff_t>(d.distance + input_.read(d.extra_bits));
+            void idle() override
+            {
+                if constexpr (std::is_same_v<decompressor_t, parallel_inflate_decompressor>) decompress.workers.stop();
+            }
 
-                            if (std::min<ptrdiff_t>(static_cast<ptrdiff_t>(output_window_.cursor()), 32768) + distance < 0)
-                                throw std::runtime_error("invalid bit stream: invalid distance too far back");
+            // checks length and crc32
+            ssize32_t read_checked(void* buffer, ssize32_t size)
+            {
+                size = decompress(buffer, size, current_crc32);
 
-                            for (size_t i = 0; i < length; ++i) // max 258 bytes
-                                output_.push_back(output_window_.reput(distance));
-                        }
-                        else
-                        {
-                            throw std::runtime_error("invalid bit stream: invalid alphabet");
-                        }
+                if ((size == 0 && length > 0) || size > length)
+                {
+                    throw std::runtime_error("file length not match!");
+                }
 
-                        if (output_.size() >= 65000)
-                            return yield();
-                    }
+                if (length -= size; length == 0)
+                {
+                    if (checksum && current_crc32 != source_.crc_32)
+                        throw std::runtime_error("crc32 is not match!");
+                }
 
-                case state_t::end:
-                    return yield(); // empty
+                return size;
+            }
 
-                default:
-                    throw std::logic_error("bug: invalid status");
+            // divides read calls by 1GiB
+            size_t read(void* buffer, size_t length) override
+            {
+                size_t cursor = 0;
+                while (cursor < length)
+                {
+                    auto r = read_checked(
+                        static_cast<std::byte*>(buffer) + cursor,
+                        static_cast<ssize32_t>(std::min<size_t>(length - cursor, 1073741824))); // 1GiB
+                    cursor += r;
+                    if (r == 0) break;
                 }
+                return cursor;
             }
         };
 
-        class inflate_stream_buffered
+        // Recycles pipelines released by files. (thread-safe)
+        // Pipelines are kept by their concrete type, which is determined by compression method, encryption and where the input is.
+        class decoder_pool
         {
-            inflate_stream stream_;
-            inflate_stream::byte_span current_;
+            mutable std::mutex mutex_;
+            decoder_pool_options options_{};
+            std::vector<std::unique_ptr<pipeline>> idle_{}; // most recently released last
+            size_t idle_bytes_{};
+            size_t in_use_bytes_{};
+            decoder_pool_statistics stats_{};
 
         public:
-            inflate_stream_buffered(std::function<size_t(void* buf, size_t len)> upstream) : stream_(std::move(upstream)) { }
+            explicit decoder_pool(const decoder_pool_options& options) { configure(options); }
+
+            void configure(const decoder_pool_options& options)
+            {
+                std::vector<std::unique_ptr<pipeline>> freed{}; // outside the lock
+                std::lock_guard lock(mutex_);
+                options_ = options;
+                while (!idle_.empty() && (idle_.size() > options_.max_idle_decoders || idle_bytes_ > options_.capacity))
+                {
+                    idle_bytes_ -= idle_.front()->accounted_bytes_;
+                    freed.push_back(std::move(idle_.front()));
+                    idle_.erase(idle_.begin()); // the least recently released
+                }
+                idle_.reserve(std::min<size_t>(options_.max_idle_decoders, 1024));
+            }
+
+            [[nodiscard]] decoder_pool_statistics stats() const
+            {
+                std::lock_guard lock(mutex_);
+                auto r = stats_;
+                r.idle_decoders = idle_.size();
+                r.idle_bytes = idle_bytes_;
+                r.in_use_bytes = in_use_bytes_;
+                return r;
+            }
+
+            // Takes an idle pipeline of the type out of the pool (most recently released first), or returns nullptr.
+            template <class pipeline_t>
+            [[nodiscard]] std::unique_ptr<pipeline_t> acquire()
+            {
+                std::lock_guard lock(mutex_);
+                for (auto i = idle_.size(); i-- > 0;)
+                {
+                    if (typeid(*idle_[i]) != typeid(pipeline_t)) continue;
+                    std::unique_ptr<pipeline_t> p(static_cast<pipeline_t*>(idle_[i].release()));
+                    idle_.erase(idle_.begin() + static_cast<std::ptrdiff_t>(i));
+                    idle_bytes_ -= p->accounted_bytes_;
+                    return p;
+                }
+                return nullptr;
+            }
+
+            // Accounts a pipeline handed out to a file.
+            void check_out(pipeline& p, bool reused)
+            {
+                const size_t bytes = p.footprint();
+                std::lock_guard lock(mutex_);
+                stats_.acquired++;
+                stats_.reused += reused;
+                p.accounted_bytes_ = bytes;
+                in_use_bytes_ += bytes;
+                stats_.peak_bytes = std::max(stats_.peak_bytes, in_use_bytes_ + idle_bytes_);
+            }
 
-            size_t read(void* buf, size_t len)
+            // Keeps a pipeline released by a file for reuse, or frees it if over the caps.
+            void release(std::unique_ptr<pipeline> p)
             {
-                size_t tot = 0;
-                while (len - tot)
+                p->idle();
+                p->random_access_.reset();
+                p->checksums_.reset();
+                p->source_ = source{}; // drops the password and the zip file
+                const size_t bytes = p->footprint(); // buffers may have grown while in use
+                std::lock_guard lock(mutex_);
+                in_use_bytes_ -= std::exchange(p->accounted_bytes_, bytes);
+                if (idle_.size() < options_.max_idle_decoders && idle_bytes_ + p->accounted_bytes_ <= options_.capacity)
                 {
-                    if (current_.empty()) current_ = stream_.next();
-                    if (current_.empty()) break;
-                    auto sz = std::min(len - tot, current_.size());
-                    memcpy(buf, current_.data(), sz);
-                    current_ = current_.substr(sz);
-                    buf = static_cast<unsigned char*>(buf) + sz;
-                    tot += sz;
+                    idle_bytes_ += p->accounted_bytes_;
+                    idle_.push_back(std::move(p));
+                    return;
                 }
-                return tot;
+                stats_.discarded++; // freed after unlocking
             }
         };
-    }
 
-#ifdef NANONZIP_ENABLE_ZLIB
-    /// Inflate stream
-    struct zlib_inflate_stream
-    {
-        using ssize32_t = int32_t;
-        z_stream z_stream_{};
-        std::streamoff output_remain_bytes_{};
-        std::vector<Byte> input_buffer_{};
-        size_t input_buffer_used_{};
+        static std::shared_ptr<decoder_pool> make_decoder_pool()
+        {
+            return std::make_shared<decoder_pool>(decoder_pool_options{});
+        }
 
-        zlib_inflate_stream(std::streamoff output_data_size, ssize32_t buffer_size = 262144)
-            : output_remain_bytes_(output_data_size)
-            , input_buffer_(buffer_size)
-            , input_buffer_used_(input_buffer_.size())
+        inline void pipeline_releaser::operator()(pipeline* released) const
         {
-            if (auto r = ::inflateInit2(&z_stream_, -MAX_WBITS); r != Z_OK)
-                throw std::runtime_error("zlib::init error");
+            const auto pool = std::move(released->pool_); // kept until the release completes, even if the reader is gone
+            pool->release(std::unique_ptr<pipeline>(released));
         }
 
-        zlib_inflate_stream(const zlib_inflate_stream& other) = delete;
-        zlib_inflate_stream(zlib_inflate_stream&& other) noexcept = delete;
-        zlib_inflate_stream& operator=(const zlib_inflate_stream& other) = delete;
-        zlib_inflate_stream& operator=(zlib_inflate_stream&& other) noexcept = delete;
-        ~zlib_inflate_stream() { inflateEnd(&z_stream_); }
+        // Makes a pipeline, reusing an idle one in the pool if any. The pipeline returns to the pool when released.
+        template <class pipeline_t, class input_t>
+        static pipeline_ptr make(const std::shared_ptr<decoder_pool>& pool, source s, bool checksum, input_t input)
+        {
+            auto p = pool->acquire<pipeline_t>();
+            const bool reused = p != nullptr;
+            if (reused) p->reset(std::move(s), checksum, std::move(input));
+            else p = std::make_unique<pipeline_t>(std::move(s), checksum, std::move(input));
+
+            pool->check_out(*p, reused);
+            p->pool_ = pool;
+            return pipeline_ptr(p.release());
+        }
 
-        template <class read_input_fun = std::function<ssize32_t(void* input_buf, ssize32_t input_len)>,
-                  std::enable_if_t<std::is_invocable_r_v<ssize32_t, read_input_fun, void*, ssize32_t>>* = nullptr>
-        ssize32_t inflate(void* output_buf, ssize32_t output_len, read_input_fun&& read_input)
+        // Composes the decompressor reading from `input` (a reader, or the input on memory).
+        template <class input_t>
+        static pipeline_ptr compose(const std::shared_ptr<decoder_pool>& pool, source s, bool checksum, input_t input)
         {
-            output_len = static_cast<ssize32_t>(std::min<intmax_t>(output_len, output_remain_bytes_));
+            [[maybe_unused]] constexpr bool on_memory = std::is_same_v<input_t, std::string_view>;
+            using reader_t = std::conditional_t<on_memory, no_reader, input_t>;
 
-            z_stream_.next_out = static_cast<::Byte*>(output_buf);
-            z_stream_.avail_out = static_cast<uInt>(output_len);
-            while (z_stream_.avail_out > 0)
+            switch (s.compression_method)
             {
-                if (z_stream_.avail_in == 0) // need more input
-                {
-                    auto input_len = read_input(input_buffer_.data(), static_cast<ssize32_t>(input_buffer_.size()));
-                    if (input_len == 0) break;
-                    z_stream_.next_in = input_buffer_.data();
-                    z_stream_.avail_in = input_len;
-                }
+            case compression_method_t::stored: // no compress
+                if constexpr (!on_memory) return make<composed_pipeline<stored_decompressor<reader_t>>>(pool, std::move(s), checksum, std::move(input));
+                break; // stored data on memory is read by the raw reader
 
-                auto result = ::inflate(&z_stream_, Z_SYNC_FLUSH);
-                if (result == Z_STREAM_END) break;
-                if (result < 0) throw std::runtime_error("zlib::inflate error " + std::to_string(result) + " " + std::string(z_stream_.msg ? z_stream_.msg : ""));
-            }
-
-            auto written_bytes = static_cast<ssize32_t>(z_stream_.next_out - static_cast<::Byte*>(output_buf));
-            output_remain_bytes_ -= written_bytes;
-            return written_bytes;
-        }
-    };
+            case compression_method_t::deflate:
+#ifdef NANONZIP_ENABLE_ZLIB
+                // uses zlib_inflate_stream
+                return make<composed_pipeline<zlib_decompressor<reader_t>>>(pool, std::move(s), checksum, std::move(input));
+#else
+                // uses inflate::inflate_stream
+                return make<composed_pipeline<inflate_decompressor<std::conditional_t<on_memory, inflate::no_upstream, bit_stream_upstream<reader_t>>>>>(pool, std::move(s), checksum, std::move(input));
 #endif
 
 #ifdef NANONZIP_ENABLE_BZIP2
-    /// bzip2 decompress stream
-    struct bzip2_decompress_stream
-    {
-        using ssize32_t = int32_t;
-        bz_stream bz_stream_{};
-        std::streamoff output_remain_bytes_{};
-        std::vector<char> input_buffer_{};
-        size_t input_buffer_used_{};
+            case compression_method_t::bzip2:
+                // uses bzip2_decompress_stream
+                return make<composed_pipeline<bzip2_decompressor<reader_t>>>(pool, std::move(s), checksum, std::move(input));
+#endif
 
-        bzip2_decompress_stream(std::streamoff output_data_size, ssize32_t buffer_size = 262144)
-            : output_remain_bytes_(output_data_size)
-            , input_buffer_(buffer_size)
-            , input_buffer_used_(input_buffer_.size())
-        {
-            if (auto r = ::BZ2_bzDecompressInit(&bz_stream_, 0, 0); r != BZ_OK)
-                throw std::runtime_error("bzlib2::init error");
+            default:
+                break;
+            }
+            throw std::runtime_error("compression_method " + std::to_string(static_cast<int>(s.compression_method)) + " is not supported.");
         }
 
-        bzip2_decompress_stream(const bzip2_decompress_stream& other) = delete;
-        bzip2_decompress_stream(bzip2_decompress_stream&& other) noexcept = delete;
-        bzip2_decompress_stream& operator=(const bzip2_decompress_stream& other) = delete;
-        bzip2_decompress_stream& operator=(bzip2_decompress_stream&& other) noexcept = delete;
-        ~bzip2_decompress_stream() { ::BZ2_bzDecompressEnd(&bz_stream_); }
-
-        template <class read_input_fun = std::function<ssize32_t(void* input_buf, ssize32_t input_len)>,
-            std::enable_if_t<std::is_invocable_r_v<ssize32_t, read_input_fun, void*, ssize32_t>>* = nullptr>
-        ssize32_t decompress(void* output_buf, ssize32_t output_len, read_input_fun&& read_input)
+        // Makes the pipeline reading decompressed contents of the file.
+        // If the zip file is on memory, decoders read the (unencrypted) input in place.
+        static pipeline_ptr make_pipeline(const std::shared_ptr<decoder_pool>& pool, source s, open_options::integrity_t integrity)
         {
-            output_len = static_cast<ssize32_t>(std::min<intmax_t>(output_len, output_remain_bytes_));
+            const bool checksum = integrity == open_options::integrity_t::verify;
+            raw_reader raw{s.read_zip_file, s.data_offset, s.compressed_size};
 
-            bz_stream_.next_out = static_cast<char*>(output_buf);
-            bz_stream_.avail_out = static_cast<unsigned>(output_len);
-            while (bz_stream_.avail_out > 0)
+            // file is encrypted
+            if (s.general_purpose_bit_flag & 1)
             {
-                if (bz_stream_.avail_in == 0) // need more input
-                {
-                    auto input_len = read_input(input_buffer_.data(), static_cast<ssize32_t>(input_buffer_.size()));
-                    if (input_len == 0) break;
-                    bz_stream_.next_in = input_buffer_.data();
-                    bz_stream_.avail_in = input_len;
-                }
+                decrypting_reader<raw_reader> decrypting(std::move(raw), s.password, s.crc_32);
+                return compose(pool, std::move(s), checksum, std::move(decrypting));
+            }
 
-                auto result = ::BZ2_bzDecompress(&bz_stream_);
-                if (result == BZ_STREAM_END) break;
-                if (result < 0) throw std::runtime_error("BZ2_bzDecompress error: " + std::to_string(result));
+            // large deflate data, inflated on multiple threads
+            if (s.compression_method == compression_method_t::deflate && s.inflate_threads > 1 && s.compressed_size >= parallel_inflate_decompressor::min_compressed_size)
+                return make<composed_pipeline<parallel_inflate_decompressor>>(pool, std::move(s), checksum, std::move(raw));
+
+            // input on memory
+            if (!s.image.empty() && s.compression_method != compression_method_t::stored)
+            {
+                const auto input_on_memory = file_data_on_memory(s.image, s.data_offset, s.compressed_size);
+                return compose(pool, std::move(s), checksum, input_on_memory);
             }
 
-            auto written_bytes = static_cast<ssize32_t>(bz_stream_.next_out - static_cast<char*>(output_buf));
-            output_remain_bytes_ -= written_bytes;
-            return written_bytes;
+            return compose(pool, std::move(s), checksum, std::move(raw));
         }
-    };
-#endif
+    }
 
-    NANONZIP_EXPORT file zip_file_reader::open_file_stream(const file_header& file_header, [[maybe_unused]] std::string_view password) const
+    NANONZIP_EXPORT std::optional<size_t> zip_file_reader::find(std::string_view name, name_matching_t matching) const
     {
-        using ssize32_t = int32_t;
-        const std::streamoff uncompressed_size{file_header.uncompressed_size};
-        const std::streamoff compressed_size{file_header.compressed_size};
-        std::streamoff cursor{file_header.relative_offset_of_local_header};
-
-        // local file header
+        if (!lazy_) return std::nullopt;
+        switch (matching)
         {
-            local_file_header fh{};
-            read_zip_file_(cursor, &fh, static_cast<ssize32_t>(local_file_header::fixed_header_size()));
-            if (fh.local_file_header_signature != local_file_header::SIGNATURE)
-                throw std::runtime_error("file corrupted: local file header signature not match.");
-            cursor = file_header.relative_offset_of_local_header + static_cast<std::streamoff>(fh.total_header_size());
+        case name_matching_t::exact: return lazy_->find<name_matching_t::exact>(central_directory_, name);
+        case name_matching_t::normalized: return lazy_->find<name_matching_t::normalized>(central_directory_, name);
         }
+        return std::nullopt;
+    }
 
-        // raw reading function
-        using read_file_function = std::function<ssize32_t(void* buf, ssize32_t len)>;
-        read_file_function read_file = [read_zip_file_ = read_zip_file_, cursor, remain = compressed_size](void* buffer, ssize32_t size) mutable -> ssize32_t
+    NANONZIP_EXPORT void zip_file_reader::save_index(const std::filesystem::path& zip_file, const std::filesystem::path& index_file) const
+    {
+        if (!lazy_) throw std::runtime_error("no zip file to index.");
+
+        constexpr auto exact = static_cast<size_t>(name_matching_t::exact);
+        (void)find({}, name_matching_t::exact); // builds the name hash index
+
+        index_file_header h{};
+        std::memcpy(h.magic, index_file_header::MAGIC, sizeof(h.magic));
+        h.version = index_file_header::VERSION;
+        h.header_size = sizeof(index_file_header);
+        h.zip_file_size = static_cast<uint64_t>(std::filesystem::file_size(zip_file));
+        h.zip_file_last_write_time = last_write_time_of(zip_file);
+        const auto tail = read_tail(make_file_seek_read_function_for_file(zip_file), static_cast<std::streamoff>(h.zip_file_size));
+        h.tail_size = tail.size();
+        h.count = file_count();
+        h.name_table_size = lazy_->table_size[exact];
+        h.directory_size = central_directory_.size;
+
+        // resolves the local headers in batched reads, then copies the offsets (0 for broken ones, which fail on opening as usual)
+        resolve_data_offsets();
+        std::vector<uint64_t> data_offsets(file_count());
+        if (central_directory_.data_offsets)
         {
-            auto read_size = static_cast<ssize32_t>(std::min<std::streamoff>(size, remain));
-            read_zip_file_(cursor, buffer, read_size);
-            cursor += read_size;
-            remain -= read_size;
-            return read_size;
-        };
+            std::copy_n(central_directory_.data_offsets, file_count(), data_offsets.begin());
+        }
+        else
+        {
+            const auto* resolved = lazy_->resolved_data_offsets(file_count());
+            for (size_t i = 0; i < file_count(); i++)
+                data_offsets[i] = resolved[i].load(std::memory_order_relaxed);
+        }
 
-        // file is encrypted
-        if (file_header.general_purpose_bit_flag & 1)
+        // writes to a temporary file, then replaces the index file with it
+        auto temporary = index_file;
+        temporary += ".tmp";
         {
-            read_file = [lower = std::move(read_file), decrypt = traditional_pkware_decryption(password)](void* buffer, ssize32_t size) mutable -> ssize32_t
+            std::ofstream out(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+            uint32_t checksum = 0;
+            const auto write_at = [&](uint64_t offset, const void* data, size_t size)
             {
-                ssize32_t r = lower(buffer, size);
-                decrypt.process_buffer(buffer, r);
-                return r;
+                static constexpr char zeros[8]{};
+                const auto padding = static_cast<size_t>(offset - static_cast<uint64_t>(out.tellp())); // alignment padding (less than 8 bytes)
+                out.write(zeros, static_cast<std::streamsize>(padding));
+                checksum = calculate_crc32(zeros, padding, checksum);
+                out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+                checksum = calculate_crc32(data, size, checksum);
             };
+            write_at(0, &h, sizeof(h));
+            write_at(h.tail_offset(), tail.data(), tail.size());
+            write_at(h.data_offsets_offset(), data_offsets.data(), data_offsets.size() * sizeof(uint64_t));
+            write_at(h.offsets_offset(), central_directory_.offsets, file_count() * sizeof(uint32_t));
+            write_at(h.name_table_offset(), lazy_->table[exact], lazy_->table_size[exact] * sizeof(uint32_t));
+            write_at(h.directory_offset(), central_directory_.data, central_directory_.size);
+            h.checksum = checksum;
+            out.seekp(0);
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            if (!out.flush()) throw std::runtime_error("failed to write " + temporary.u8string());
+        }
+        std::filesystem::rename(temporary, index_file);
+    }
+
+    NANONZIP_EXPORT const std::vector<file_header>& zip_file_reader::files(unsigned threads) const
+    {
+        static const std::vector<file_header> empty{};
+        if (!lazy_) return empty;
 
-            std::byte encryption_header[12]{};
-            read_file(encryption_header, 12);
+        std::call_once(lazy_->files_decoded, [&]
+        {
+            // decodes slices of entries in parallel (the boundaries of entries are already known)
+            constexpr size_t min_entries_per_thread = 4096;
+            const size_t count = file_count();
+            const size_t workers = std::clamp<size_t>(threads, 1, count / min_entries_per_thread + 1);
+            const size_t slice = (count + workers - 1) / workers;
+
+            std::vector<file_header> decoded(count);
+            const auto decode = [&](size_t begin, size_t end) { for (size_t i = begin; i < end; i++) decoded[i] = entry(i).header(); };
+
+            std::vector<std::future<void>> futures;
+            for (size_t w = 1; w < workers; w++)
+                futures.push_back(std::async(std::launch::async, decode, std::min(count, w * slice), std::min(count, (w + 1) * slice)));
+            decode(0, std::min(count, slice));
+            for (auto& f : futures) f.get();
+
+            lazy_->files = std::move(decoded);
+        });
+        return lazy_->files;
+    }
+
+    std::optional<size_t> zip_file_reader::find_path(const std::filesystem::path& path) const
+    {
+        // a hit is confirmed by comparing paths, unless it is a utf-8 name (general purpose bit 11) looked up in utf-8
+        const auto normal = path.lexically_normal();
+        const auto confirmed = [&](std::optional<size_t> index, bool utf8_lookup) -> std::optional<size_t>
+        {
+            if (!index) return std::nullopt;
+            const auto* cdh = central_directory_header_of(entry(*index).record_);
+            const bool utf8_name = cdh->general_purpose_bit_flag & 1 << 11;
+            if (utf8_name ? utf8_lookup : path_of(cdh).lexically_normal() == normal) return index;
+            return std::nullopt;
+        };
+
+        // looks up the name in utf-8 by its normal spelling ("a//b", "./a" and, on Windows, "a\\b" find "a/b"), then as spelled if that differs
+        const auto key = normal.generic_u8string();
+        if (auto index = confirmed(find(key), true)) return index;
+        const auto name = path.u8string();
+        if (name != key)
+            if (auto index = confirmed(find(name), true)) return index;
+
+        // names not in utf-8 (general purpose bit 11 clear) are decoded in the native narrow encoding, which differs from utf-8 on Windows
+        std::string native_key, native_name;
+        try { native_key = normal.generic_string(), native_name = path.string(); }
+        catch (const std::exception&) { return std::nullopt; } // not representable in the encoding: not such a name
+        if (native_key != key)
+            if (auto index = confirmed(find(native_key), false)) return index;
+        if (native_name != name && native_name != native_key)
+            if (auto index = confirmed(find(native_name), false)) return index;
+        return std::nullopt;
+    }
+
+    std::streamoff zip_file_reader::file_data_offset(size_t index) const
+    {
+        if (central_directory_.data_offsets && central_directory_.data_offsets[index])
+            return static_cast<std::streamoff>(central_directory_.data_offsets[index]);
+
+        auto& resolved = lazy_->resolved_data_offsets(file_count())[index];
+        if (const auto offset = resolved.load(std::memory_order_relaxed))
+            return static_cast<std::streamoff>(offset);
 
-            if (encryption_header[11] != static_cast<std::byte>(file_header.crc_32 >> 24))
-                throw std::runtime_error("supplied password is not correct");
+        const auto offset = locate_file_data(*read_zip_file_, entry(index).relative_offset_of_local_header());
+        resolved.store(static_cast<uint64_t>(offset), std::memory_order_relaxed);
+        return offset;
+    }
+
+    NANONZIP_EXPORT void zip_file_reader::resolve_data_offsets(const std::vector<size_t>& indexes) const
+    {
+        if (!lazy_ || central_directory_.data_offsets || indexes.empty()) return;
+        auto* resolved = lazy_->resolved_data_offsets(file_count());
+
+        // local headers not resolved yet, sorted by offset (those past the end of the zip file are left unresolved, to fail on opening as usual)
+        constexpr auto header_size = static_cast<std::streamoff>(local_file_header::fixed_header_size());
+        std::vector<std::pair<std::streamoff, size_t>> headers;
+        headers.reserve(indexes.size());
+        for (size_t index : indexes)
+        {
+            if (index >= file_count()) throw std::runtime_error("no such file.");
+            const std::streamoff offset = entry(index).relative_offset_of_local_header();
+            if (resolved[index].load(std::memory_order_relaxed) == 0 && offset >= 0 && offset <= length_ - header_size)
+                headers.emplace_back(offset, index);
         }
+        std::sort(headers.begin(), headers.end());
 
-        // decompress file
-        switch (file_header.compression_method)
+        // reads runs of local headers close to each other at once
+        constexpr std::streamoff max_chunk_size = 1048576;
+        constexpr std::streamoff max_gap = 65536;
+        std::vector<char> chunk;
+        for (size_t first = 0, last; first < headers.size(); first = last)
         {
-        case compression_method_t::stored: // no compress
-            break;
+            const std::streamoff chunk_begin = headers[first].first;
+            for (last = first + 1; last < headers.size(); last++)
+                if (headers[last].first + header_size - chunk_begin > max_chunk_size || headers[last].first - (headers[last - 1].first + header_size) > max_gap)
+                    break;
 
-        case compression_method_t::deflate:
-#ifdef NANONZIP_ENABLE_ZLIB
-            // uses zlib_inflate_stream
-            read_file = [lower = std::move(read_file), stream = std::make_shared<zlib_inflate_stream>(uncompressed_size)](void* buffer, ssize32_t size) mutable -> ssize32_t
-            {
-                return stream->inflate(buffer, size, lower);
-            };
-#else
-            // uses inflate::inflate_stream_buffered
-            read_file = [stream = std::make_shared<inflate::inflate_stream_buffered>(
-                    [upstream = std::move(read_file)](void* buf, size_t len)-> size_t { return static_cast<size_t>(upstream(buf, static_cast<int>(len))); }
-                )](void* buf, ssize32_t sz) mutable -> ssize32_t
-                {
-                    return static_cast<ssize32_t>(stream->read(buf, static_cast<size_t>(sz)));
-                };
-#endif
-            break;
+            const std::streamoff chunk_end = headers[last - 1].first + header_size;
+            chunk.resize(static_cast<size_t>(chunk_end - chunk_begin));
+            if ((*read_zip_file_)(chunk_begin, chunk.data(), static_cast<int>(chunk.size())) != static_cast<int>(chunk.size()))
+                throw std::runtime_error("failed to read local_file_header");
 
-#ifdef NANONZIP_ENABLE_BZIP2
-        case compression_method_t::bzip2:
-            // uses bzip2_decompress_stream
-            read_file = [lower = std::move(read_file), bzlib2 = std::make_shared<bzip2_decompress_stream>(uncompressed_size)](void* buffer, ssize32_t size) mutable -> ssize32_t
+            for (size_t i = first; i < last; i++)
             {
-                return bzlib2->decompress(buffer, size, lower);
-            };
-            break;
-#endif
+                local_file_header fh{};
+                std::memcpy(&fh, chunk.data() + (headers[i].first - chunk_begin), sizeof(fh));
+                if (fh.local_file_header_signature != local_file_header::SIGNATURE)
+                    continue; // left unresolved, to fail on opening as usual
+                resolved[headers[i].second].store(static_cast<uint64_t>(headers[i].first + static_cast<std::streamoff>(fh.total_header_size())), std::memory_order_relaxed);
+            }
+        }
+    }
+
+    NANONZIP_EXPORT void zip_file_reader::resolve_data_offsets() const
+    {
+        std::vector<size_t> indexes(file_count());
+        std::iota(indexes.begin(), indexes.end(), size_t{0});
+        resolve_data_offsets(indexes);
+    }
+
+    // Whether files are read at random through checkpoints: deflate, not encrypted.
+    [[nodiscard]] static bool has_checkpoints(compression_method_t compression_method, uint16_t general_purpose_bit_flag) noexcept
+    {
+        return compression_method == compression_method_t::deflate && !(general_purpose_bit_flag & 1);
+    }
+
+    NANONZIP_EXPORT file zip_file_reader::open_file_stream(const file_header& file_header, const open_options& options) const
+    {
+        // looks up the entry by path, then by local header offset if the path is duplicated (or the header is edited)
+        auto index = find_path(file_header.path);
+        if (!index || entry(*index).relative_offset_of_local_header() != file_header.relative_offset_of_local_header)
+        {
+            index.reset();
+            for (size_t i = 0; i < file_count() && !index; i++)
+                if (entry(i).relative_offset_of_local_header() == file_header.relative_offset_of_local_header)
+                    index = i;
+        }
+
+        if (!index) throw std::runtime_error("no such file.");
+        return open_file_stream(*index, options);
+    }
 
-        default:
-            throw std::runtime_error("compression_method " + std::to_string(static_cast<int>(file_header.compression_method)) + " is not supported.");
+    NANONZIP_EXPORT file zip_file_reader::open_file_stream(size_t index, const open_options& options) const
+    {
+        auto header = lazy_parts::opened_header(lazy_, index, file_count(), [&] { return entry(index).header(); });
+        auto pipeline = decode::make_pipeline(
+            lazy_->decoders,
+            decode::source{
+                read_zip_file_, image_, file_data_offset(index),
+                header->general_purpose_bit_flag, header->compression_method, header->crc_32,
+                header->compressed_size, header->uncompressed_size,
+                std::string(options.password),
+                options.inflate_threads ? options.inflate_threads : std::thread::hardware_concurrency(),
+                lazy_->checkpoints, index,
+            },
+            options.integrity);
+
+        // The file owns the pipeline, and the functions refer to it by a plain pointer, which std::function keeps without allocation.
+        decode::pipeline* p = pipeline.get();
+
+        // decompresses the whole file again into a scratch buffer, independently of `read`
+        auto verify = [p]
+        {
+            auto verifying = decode::make_pipeline(p->pool_, p->source_, open_options::integrity_t::verify);
+            std::vector<std::byte> buffer(static_cast<size_t>(std::min<std::streamoff>(crc32::fused_chunk_size, p->source_.uncompressed_size)));
+            while (verifying->read(buffer.data(), buffer.size()) != 0) { }
+        };
+
+        // reads at random (unencrypted files): stored data by positional reads without state, deflate data with another decoder through checkpoints
+        file::file_read_at_function read_at{};
+        if (header->compression_method == compression_method_t::stored && !(header->general_purpose_bit_flag & 1))
+        {
+            if (options.read_at_checksum_chunk_size) p->checksums_ = std::make_unique<decode::chunk_checksums>(options.read_at_checksum_chunk_size);
+            read_at = [p](std::streamoff offset, void* buffer, size_t length) { return decode::stored_random_access{p->source_, p->checksums_.get()}.read(static_cast<std::uint64_t>(offset), buffer, length); };
+        }
+        else if (has_checkpoints(header->compression_method, header->general_purpose_bit_flag))
+        {
+            read_at = [p](std::streamoff offset, void* buffer, size_t length) { return p->read_at(static_cast<std::uint64_t>(offset), buffer, length); };
         }
 
-        // calculates crc32
-        read_file = [lower = std::move(read_file), length = uncompressed_size, current_crc32 = uint32_t(), expected = file_header.crc_32](void* buffer, ssize32_t size) mutable -> ssize32_t
+        auto read = [p](void* buffer, size_t length) { return p->read(buffer, length); };
+        file::file_owner owner(pipeline.release(), [](void* released) { decode::pipeline_releaser{}(static_cast<decode::pipeline*>(released)); });
+        return file{std::move(header), std::move(read), std::move(verify), std::move(read_at), std::move(owner)};
+    }
+
+    NANONZIP_EXPORT void zip_file_reader::set_decoder_pool_options(const decoder_pool_options& options)
+    {
+        if (lazy_) lazy_->decoders->configure(options);
+    }
+
+    NANONZIP_EXPORT decoder_pool_statistics zip_file_reader::decoder_pool_stats() const
+    {
+        return lazy_ ? lazy_->decoders->stats() : decoder_pool_statistics{};
+    }
+
+    NANONZIP_EXPORT void zip_file_reader::set_entry_cache_options(const entry_cache_options& options)
+    {
+        if (lazy_) lazy_->cache.configure(options);
+    }
+
+    NANONZIP_EXPORT entry_cache_statistics zip_file_reader::entry_cache_stats() const
+    {
+        return lazy_ ? lazy_->cache.stats() : entry_cache_statistics{};
+    }
+
+    NANONZIP_EXPORT void zip_file_reader::set_checkpoint_spacing(std::streamoff spacing)
+    {
+        if (spacing <= 0) throw std::out_of_range("spacing out of range.");
+        if (lazy_) lazy_->checkpoints->set_spacing(static_cast<std::uint64_t>(spacing));
+    }
+
+    NANONZIP_EXPORT std::vector<std::byte> zip_file_reader::export_checkpoints(size_t index) const
+    {
+        const auto e = entry(index);
+        if (!has_checkpoints(e.compression_method(), e.general_purpose_bit_flag())) throw std::runtime_error("file has no checkpoints: not deflate, or encrypted.");
+
+        // inflates from the last checkpoint to the end, recording the rest
+        auto checkpoints = lazy_->checkpoints->find(index);
+        if (!checkpoints || !checkpoints->complete())
         {
-            size = lower(buffer, size);
-            current_crc32 = crc32::calculate_crc32<0xEDB88320>(buffer, size, current_crc32);
+            const auto f = open_file_stream(index, open_options{{}, open_options::integrity_t::none});
+            std::byte last{};
+            (void)f.read_at(std::max<std::streamoff>(f.size(), 1) - 1, &last, 1);
+            checkpoints = lazy_->checkpoints->find(index);
+        }
+        return checkpoints->export_all();
+    }
+
+    NANONZIP_EXPORT void zip_file_reader::import_checkpoints(size_t index, const void* data, size_t size) const
+    {
+        const auto e = entry(index);
+        if (!has_checkpoints(e.compression_method(), e.general_purpose_bit_flag())) throw std::runtime_error("file has no checkpoints: not deflate, or encrypted.");
+        lazy_->checkpoints->get(index, e.crc_32(), static_cast<std::uint64_t>(e.compressed_size()), static_cast<std::uint64_t>(e.uncompressed_size()))->import_all(data, size);
+    }
+
+    // Gets the number of workers for `tasks` tasks on up to `threads` threads (0 for hardware concurrency).
+    [[nodiscard]] static unsigned worker_count(unsigned threads, size_t tasks)
+    {
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        return static_cast<unsigned>(std::clamp<size_t>(threads, 1, std::max<size_t>(tasks, 1)));
+    }
 
-            if ((size == 0 && length > 0) || size > length)
+    NANONZIP_EXPORT void zip_file_reader::for_each_entry_parallel(const std::function<void(size_t index, unsigned worker)>& fn, unsigned threads) const
+    {
+        // larger entries first: they start early, and small ones fill the gaps at the end
+        std::vector<std::pair<std::streamoff, size_t>> order(file_count());
+        for (size_t i = 0; i < order.size(); i++) order[i] = {entry(i).compressed_size(), i};
+        std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        std::atomic<size_t> next{0};
+        std::atomic<bool> stopped{false};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        // each idle worker takes the next entry
+        const auto work = [&](unsigned worker)
+        {
+            try
             {
-                throw std::runtime_error("file length not match!");
+                for (size_t i; !stopped.load(std::memory_order_relaxed) && (i = next++) < order.size();)
+                    fn(order[i].second, worker);
             }
-
-            if (length -= size; length == 0)
+            catch (...)
             {
-                if (current_crc32 != expected)
-                    throw std::runtime_error("crc32 is not match!");
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+                stopped = true;
             }
-
-            return size;
         };
 
-        // divides read calls by 1GiB
-        auto file_read_func = [read_file = std::move(read_file)](void* buf, size_t len) -> size_t
+        std::vector<std::thread> workers;
+        for (unsigned w = 1, n = worker_count(threads, order.size()); w < n; w++)
+        {
+            try { workers.emplace_back(work, w); }
+            catch (const std::system_error&) { break; } // goes on with fewer workers
+        }
+        work(0);
+        for (auto& t : workers) t.join();
+
+        if (error) std::rethrow_exception(error);
+    }
+
+    // Creates a directory and its parents, which other threads may be creating at the same time.
+    static void create_directories_shared(const std::filesystem::path& path)
+    {
+        std::error_code ec;
+        if (!std::filesystem::create_directories(path, ec) && ec && !std::filesystem::is_directory(path))
+            throw std::filesystem::filesystem_error("failed to create directory", path, ec);
+    }
+
+    NANONZIP_EXPORT void zip_file_reader::extract_all(const std::filesystem::path& destination, const extract_options& options) const
+    {
+        create_directories_shared(destination);
+        auto root = std::filesystem::weakly_canonical(destination);
+        if (!root.has_filename()) root = root.parent_path(); // without the trailing separator
+
+        extract_progress progress{};
+        progress.entries_total = file_count();
+        for (size_t i = 0; i < file_count(); i++) progress.bytes_total += static_cast<std::uint64_t>(entry(i).uncompressed_size());
+        std::mutex progress_mutex;
+
+        // reading buffers, reused by each worker
+        const size_t buffer_size = std::max<size_t>(options.buffer_size, 1);
+        std::vector<std::unique_ptr<char[]>> buffers(worker_count(options.threads, file_count()));
+
+        for_each_entry_parallel([&](size_t index, unsigned worker)
         {
-            size_t cursor = 0;
-            while (cursor < len)
+            std::exception_ptr error{};
+            std::uint64_t bytes = 0;
+            try
+            {
+                const auto* cdh = central_directory_header_of(entry(index).record_);
+                const auto target = std::filesystem::weakly_canonical(root / path_of(cdh));
+                if (std::mismatch(root.begin(), root.end(), target.begin(), target.end()).first != root.end())
+                    throw std::runtime_error("target path is out side of extract_root directory.");
+
+                if (const auto name = cdh->filename(); !name.empty() && name.back() == '/')
+                {
+                    // directory
+                    create_directories_shared(target);
+                }
+                else
+                {
+                    // file
+                    auto file = open_file_stream(index, options.open);
+                    create_directories_shared(target.parent_path());
+                    std::ofstream out(target, std::ios::out | std::ios::binary | std::ios::trunc);
+
+                    auto& buffer = buffers[worker];
+                    if (!buffer) buffer = std::make_unique<char[]>(buffer_size);
+                    while (size_t r = file.read(buffer.get(), buffer_size))
+                    {
+                        out.write(buffer.get(), static_cast<std::streamsize>(r));
+                        bytes += r;
+                    }
+                    if (!out.flush()) throw std::runtime_error("failed to write " + target.u8string());
+                    if (options.open.integrity == open_options::integrity_t::deferred) file.verify();
+                }
+            }
+            catch (...)
             {
-                auto r = read_file(
-                    static_cast<std::byte*>(buf) + cursor,
-                    static_cast<ssize32_t>(std::min<size_t>(len - cursor, 1073741824))); // 1GiB
-                cursor += r;
-                if (r == 0) break;
+                error = std::current_exception();
             }
-            return cursor;
-        };
 
-        return file{file_header, std::move(file_read_func)};
+            std::lock_guard lock(progress_mutex);
+            progress.index = index;
+            progress.error = error;
+            progress.entries_done++;
+            progress.bytes_done += bytes;
+            if (options.on_progress) options.on_progress(progress);
+            else if (error) std::rethrow_exception(error);
+        }, static_cast<unsigned>(buffers.size()));
+    }
+
+    NANONZIP_EXPORT std::shared_ptr<const std::vector<std::byte>> zip_file_reader::read_file_data(size_t index, std::string_view password) const
+    {
+        // the password tells cached contents apart only for encrypted files
+        const std::string_view key = entry(index).general_purpose_bit_flag() & 1 ? password : std::string_view{};
+        if (auto cached = lazy_->cache.find(index, key))
+            return cached;
+
+        // reads to the end, where the pipeline checks CRC-32
+        const auto start = std::chrono::steady_clock::now();
+        auto f = open_file_stream(index, open_options{password});
+        auto contents = std::make_shared<std::vector<std::byte>>(static_cast<size_t>(f.size()));
+        for (size_t done = 0; done < contents->size();)
+        {
+            const size_t read = f.read(contents->data() + done, contents->size() - done);
+            if (read == 0) throw std::runtime_error("file length not match!");
+            done += read;
+        }
+
+        lazy_->cache.insert(index, key, contents, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        return contents;
+    }
+
+    NANONZIP_EXPORT std::optional<std::string_view> zip_file_reader::view_file_data(size_t index, bool verify_crc32) const
+    {
+        const auto* cdh = central_directory_header_of(entry(index).record_);
+        if (image_.empty() || cdh->compression_method != static_cast<uint16_t>(compression_method_t::stored) || (cdh->general_purpose_bit_flag & 1))
+            return std::nullopt;
+
+        const auto [uncompressed_size, compressed_size, relative_offset_of_local_header] = sizes_of(cdh);
+        if (compressed_size != uncompressed_size)
+            throw std::runtime_error("file length not match!");
+
+        const auto data = file_data_on_memory(image_, file_data_offset(index), compressed_size);
+        if (verify_crc32 && crc32::calculate_crc32(data.data(), data.size()) != cdh->crc_32)
+            throw std::runtime_error("crc32 is not match!");
+
+        return data;
     }
 }
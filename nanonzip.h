@@ -15,13 +15,17 @@
 #include <ctime>
 
 #include <memory>
+#include <optional>
 #include <string_view>
 #include <istream>
 #include <fstream>
 #include <filesystem>
 #include <functional>
 #include <stdexcept>
+#include <exception>
 #include <vector>
+#include <list>
+#include <unordered_map>
 #include <utility>
 #include <mutex>
 
@@ -37,6 +41,13 @@ namespace nanonzip
             bzip2 = 12,
         };
 
+        /// How DOS date and time (without time zone) are interpreted.
+        enum struct time_zone_t
+        {
+            local, ///< local standard time (default)
+            utc,   ///< UTC
+        };
+
         uint16_t general_purpose_bit_flag{};
         compression_method_t compression_method{};
         uint32_t crc_32{};
@@ -47,33 +58,215 @@ namespace nanonzip
         std::filesystem::path path{};
     };
 
+    /// Represents a raw central directory entry kept by zip_file_reader, decoded on each access and valid while the reader is alive.
+    class file_entry
+    {
+    public:
+        file_entry() = default;
+
+        /// Gets raw file name bytes (a view into the central directory).
+        [[nodiscard]] std::string_view name() const noexcept;
+        [[nodiscard]] uint16_t general_purpose_bit_flag() const noexcept;
+        [[nodiscard]] file_header::compression_method_t compression_method() const noexcept;
+        [[nodiscard]] uint32_t crc_32() const noexcept;
+        [[nodiscard]] std::time_t last_mod_timestamp(file_header::time_zone_t time_zone = file_header::time_zone_t::local) const noexcept;
+        [[nodiscard]] std::streamoff uncompressed_size() const noexcept;
+        [[nodiscard]] std::streamoff compressed_size() const noexcept;
+        [[nodiscard]] std::streamoff relative_offset_of_local_header() const noexcept;
+
+        /// Decodes all fields into file_header.
+        [[nodiscard]] file_header header(file_header::time_zone_t time_zone = file_header::time_zone_t::local) const;
+
+    private:
+        friend class zip_file_reader;
+        explicit file_entry(const char* record) noexcept : record_(record) { }
+        const char* record_{}; // central directory header
+    };
+
+    /// Options for opening a file in zip.
+    struct open_options
+    {
+        /// How the CRC-32 of the file contents is checked.
+        enum struct integrity_t
+        {
+            verify,   ///< checked while reading; `read` throws at the end of the file on mismatch. (default)
+            deferred, ///< not checked while reading; `file::verify()` checks the file in a separate pass.
+            none,     ///< not checked at all (e.g. the archive is already authenticated as a whole).
+        };
+
+        std::string_view password{};
+        integrity_t integrity = integrity_t::verify;
+
+        /// Threads inflating a large (4MiB+ compressed, unencrypted) deflate file chunk by chunk, with the same output as serial inflating (0 for hardware concurrency).
+        unsigned inflate_threads = 1;
+
+        /// Chunk size of CRC-32 checks of `file::read_at` on stored files, checking the chunks each read touches (0 for no checks).
+        size_t read_at_checksum_chunk_size = 0;
+    };
+
+    /// Caps of the pool recycling decoders (decompressor states and buffers) of files opened from a reader.
+    struct decoder_pool_options
+    {
+        size_t max_idle_decoders = 16; ///< decoders kept for reuse after their files are closed (0 disables reuse)
+        size_t capacity = 16777216;    ///< byte budget of the kept decoders
+    };
+
+    /// Counters of a decoder pool, whose memory counts decoder objects and their buffers but not the internal state of zlib/bzip2.
+    struct decoder_pool_statistics
+    {
+        std::uint64_t acquired{};  ///< decoders handed out to opened files (and verifications)
+        std::uint64_t reused{};    ///< of them, recycled from the pool
+        std::uint64_t discarded{}; ///< decoders freed on release, over the caps
+        size_t idle_decoders{};    ///< decoders kept in the pool
+        size_t idle_bytes{};       ///< memory of the kept decoders
+        size_t in_use_bytes{};     ///< memory of the decoders of open files
+        size_t peak_bytes{};       ///< max of in_use_bytes + idle_bytes
+    };
+
+    /// Budget and eviction policy of the cache of decompressed files of a reader (`zip_file_reader::read_file`).
+    struct entry_cache_options
+    {
+        /// Which file is evicted first when the cache is over its budget.
+        enum struct eviction_t
+        {
+            lru,        ///< the least recently used one
+            cost_aware, ///< the one least worth keeping by GreedyDual-Size-Frequency: time spent decompressing it per byte, times its hits, aged by evictions since its last use
+        };
+
+        size_t capacity = 0;                   ///< byte budget of the decompressed contents (0 disables the cache), shared by 16 shards locked separately; a file up to the whole budget is cached
+        eviction_t eviction = eviction_t::lru; ///< changing the policy empties the cache
+    };
+
+    /// Counters of the cache of decompressed files of a reader.
+    struct entry_cache_statistics
+    {
+        std::uint64_t hits{};        ///< reads served from the cache
+        std::uint64_t misses{};      ///< reads decompressing the file (with the cache enabled)
+        std::uint64_t evictions{};   ///< files evicted to stay in the budget
+        std::uint64_t bytes_saved{}; ///< decompressed bytes served from the cache
+        size_t cached_files{};       ///< files kept in the cache
+        size_t cached_bytes{};       ///< decompressed bytes kept in the cache
+
+        /// hits / (hits + misses), or 0 before any read.
+        [[nodiscard]] double hit_rate() const noexcept { return hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0; }
+    };
+
+    /// Progress of `zip_file_reader::extract_all`, reported after each entry.
+    struct extract_progress
+    {
+        size_t index{};             ///< the entry just finished
+        std::exception_ptr error{}; ///< why the entry failed (null on success)
+        size_t entries_done{};      ///< finished entries, including this one
+        size_t entries_total{};     ///< all entries
+        std::uint64_t bytes_done{}; ///< bytes written so far
+        std::uint64_t bytes_total{}; ///< uncompressed size of all entries
+    };
+
+    /// Options for `zip_file_reader::extract_all`.
+    struct extract_options
+    {
+        open_options open{};          ///< password and integrity check of the files (deferred: checked by `file::verify()` after the file is written)
+        unsigned threads = 0;         ///< worker threads (0 for std::thread::hardware_concurrency())
+        size_t buffer_size = 1048576; ///< reading buffer of each worker
+
+        /// Called after each entry, one call at a time; if set, failed entries are reported by `error` instead of stopping the extraction.
+        std::function<void(const extract_progress& progress)> on_progress{};
+    };
+
     /// Represents a file stream in zip file.
     class file
     {
     public:
         using file_read_function = std::function<size_t(void* buf, size_t len)>;
+        using file_verify_function = std::function<void()>;
+        using file_read_at_function = std::function<size_t(std::streamoff offset, void* buf, size_t len)>;
 
         file() = default;
-        file(file_header header, file_read_function read) : header_(std::move(header)), read_(std::move(read)) { }
+        file(file_header header, file_read_function read, file_verify_function verify = {}, file_read_at_function read_at = {}) : header_(std::make_shared<const file_header>(std::move(header))), read_(std::move(read)), verify_(std::move(verify)), read_at_(std::move(read_at)) { }
         file(const file& other) = delete;
         file(file&& other) noexcept = default;
         file& operator=(const file& other) = delete;
         file& operator=(file&& other) noexcept = default;
         ~file() = default;
 
-        [[nodiscard]] const file_header& header() const noexcept { return header_; }
-        [[nodiscard]] const std::filesystem::path& path() const noexcept { return header_.path; }
-        [[nodiscard]] const std::streamoff& size() const noexcept { return header_.uncompressed_size; }
-        [[nodiscard]] size_t read(void* buffer, size_t size) { return read_(buffer, size); }
+        [[nodiscard]] const file_header& header() const noexcept { return header_ ? *header_ : no_header(); }
+        [[nodiscard]] const std::filesystem::path& path() const noexcept { return header().path; }
+        [[nodiscard]] const std::streamoff& size() const noexcept { return header().uncompressed_size; }
+
+        /// Reads from the current position, then advances it.
+        [[nodiscard]] size_t read(void* buffer, size_t size)
+        {
+            const size_t r = seeked_ ? read_at_(position_, buffer, size) : read_(buffer, size);
+            position_ += static_cast<std::streamoff>(r);
+            return r;
+        }
+
+        /// Gets the current position.
+        [[nodiscard]] std::streamoff tell() const noexcept { return position_; }
+
+        /// Whether `seek` and `read_at` are supported: stored or deflate files, not encrypted.
+        [[nodiscard]] bool seekable() const noexcept { return static_cast<bool>(read_at_); }
+
+        /// Moves the current position to `offset` (0 to `size()`), from where `read` reads as `read_at`.
+        void seek(std::streamoff offset)
+        {
+            if (!seekable()) throw std::runtime_error("file is not seekable.");
+            if (offset < 0 || offset > size()) throw std::out_of_range("offset out of range.");
+            position_ = offset;
+            seeked_ = true;
+        }
+
+        /// Reads up to `size` bytes at `offset` without moving the current position or checking CRC-32 (see `open_options::read_at_checksum_chunk_size`), and returns the count read (0 at the end). (thread-safe)
+        [[nodiscard]] size_t read_at(std::streamoff offset, void* buffer, size_t size) const
+        {
+            if (!seekable()) throw std::runtime_error("file is not seekable.");
+            if (offset < 0) throw std::out_of_range("offset out of range.");
+            return read_at_(offset, buffer, size);
+        }
+
+        /// Decompresses the whole file again in a separate pass and checks its length and CRC-32 (throws on mismatch).
+        void verify() const { verify_ ? verify_() : throw std::runtime_error("no file to verify."); }
 
     private:
-        file_header header_{};
+        friend class zip_file_reader;
+        using file_owner = std::unique_ptr<void, void (*)(void*)>; // keeps what the functions refer to alive while the file is open
+        file(std::shared_ptr<const file_header> header, file_read_function read, file_verify_function verify, file_read_at_function read_at, file_owner owner) : header_(std::move(header)), read_(std::move(read)), verify_(std::move(verify)), read_at_(std::move(read_at)), owner_(std::move(owner)) { }
+
+        std::shared_ptr<const file_header> header_{}; // shared by files of the same entry opened from a reader
         file_read_function read_{};
+        file_verify_function verify_{};
+        file_read_at_function read_at_{};
+        file_owner owner_{nullptr, nullptr};
+        std::streamoff position_{};
+        bool seeked_{};
+
+        static const file_header& no_header() noexcept
+        {
+            static const file_header empty{};
+            return empty;
+        }
     };
 
+    /// Calculates CRC-32 (as used in zip) of `data`, continuing from `current` (the CRC-32 of preceding data).
+    uint32_t calculate_crc32(const void* data, size_t length, uint32_t current = 0);
+
+    /// Combines CRC-32 of two adjacent chunks A and B into CRC-32 of (A + B) from crc(A), crc(B) and length of B.
+    uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, std::uint64_t length2);
+
     /// Function reads the file `len` bytes from the position represented by `cursor` and stores into `buf`, then returns `len`
     using file_seek_read_function = std::function<int(std::streamoff cursor, void* buf, int len)>;
 
+    /// Makes thread-safe file_seek_read_function reading a file by positional reads (pread / ReadFile with offset) on one shared descriptor, without locks.
+    file_seek_read_function make_file_seek_read_function_for_file(const std::filesystem::path& path);
+
+    /// Tag to open a zip file by mapping it into memory.
+    struct memory_mapped_t
+    {
+        explicit memory_mapped_t() = default;
+    };
+
+    inline constexpr memory_mapped_t memory_mapped{};
+
     /// ZIP file reader
     class zip_file_reader
     {
@@ -92,22 +285,98 @@ namespace nanonzip
         /// Opens and parses a zip file from istream.
         zip_file_reader(const std::shared_ptr<std::istream>& zip_file, std::streamoff length);
 
+        /// Opens a zip file by mapping it into memory, and parses the central directory in place.
+        zip_file_reader(const std::filesystem::path& zip_file, memory_mapped_t);
+
+        /// Opens and parses a zip file image on memory, kept alive by `owner` (optional) while the reader and its files are alive.
+        zip_file_reader(const void* data, size_t size, std::shared_ptr<const void> owner = {});
+
+        /// Opens a zip file with its index file written by `save_index`, or parses the zip file if the index file is missing, broken or of another zip file.
+        zip_file_reader(const std::filesystem::path& zip_file, const std::filesystem::path& index_file);
+
         zip_file_reader(const zip_file_reader& other) = delete;
         zip_file_reader(zip_file_reader&& other) noexcept = default;
         zip_file_reader& operator=(const zip_file_reader& other) = delete;
         zip_file_reader& operator=(zip_file_reader&& other) noexcept = default;
         ~zip_file_reader() = default;
 
-        /// Gets parsed central directory.
-        [[nodiscard]] const std::vector<file_header>& files() const noexcept { return central_directory_; }
+        /// Gets the number of files.
+        [[nodiscard]] size_t file_count() const noexcept { return central_directory_.count; }
+
+        /// Gets a file entry, decoded on access without allocations.
+        [[nodiscard]] file_entry entry(size_t index) const
+        {
+            if (index < file_count())
+                return file_entry(central_directory_.data + central_directory_.offsets[index]);
+
+            throw std::runtime_error("no such file.");
+        }
+
+        /// Gets parsed central directory, decoded on the first call. (timestamps in local time, thread-safe)
+        [[nodiscard]] const std::vector<file_header>& files() const { return files(1); }
+
+        /// Gets parsed central directory, decoded with up to `threads` threads on the first call.
+        [[nodiscard]] const std::vector<file_header>& files(unsigned threads) const;
+
+        /// How `find` matches file names.
+        enum struct name_matching_t
+        {
+            exact,      ///< raw file name bytes as stored. (default)
+            normalized, ///< ASCII case-insensitive, and '\\' matches '/'.
+        };
+
+        /// Finds a file by its raw name without constructing a path, and returns its index (the first one if duplicated) or nullopt. (thread-safe)
+        [[nodiscard]] std::optional<size_t> find(std::string_view name, name_matching_t matching = name_matching_t::exact) const;
+
+        /// Resolves where file data start (past local headers) for all files at once, reading local headers in coalesced chunks. (thread-safe)
+        void resolve_data_offsets(const std::vector<size_t>& indexes) const;
+
+        /// Resolves where file data start for all files. (thread-safe)
+        void resolve_data_offsets() const;
+
+        /// Writes an index file of `zip_file`, the zip file this reader reads, for `zip_file_reader(zip_file, index_file)`.
+        void save_index(const std::filesystem::path& zip_file, const std::filesystem::path& index_file) const;
+
+        /// Sets the caps of the pool recycling decoders of closed files for the next files of the same kind. (thread-safe)
+        void set_decoder_pool_options(const decoder_pool_options& options);
+
+        /// Gets the counters of the decoder pool. (thread-safe)
+        [[nodiscard]] decoder_pool_statistics decoder_pool_stats() const;
+
+        /// Sets the budget and the eviction policy of the cache of decompressed files read by `read_file` (disabled by default). (thread-safe)
+        void set_entry_cache_options(const entry_cache_options& options);
+
+        /// Gets the counters of the cache of decompressed files, e.g. to size its budget. (thread-safe)
+        [[nodiscard]] entry_cache_statistics entry_cache_stats() const;
+
+        /// Sets the spacing (in decompressed bytes, 1MiB by default) of checkpoints recorded for `file::seek` and `file::read_at`, for entries not read at random yet. (thread-safe)
+        void set_checkpoint_spacing(std::streamoff spacing);
+
+        /// Exports the checkpoints of a deflate (not encrypted) file for `import_checkpoints`, inflating the rest of the file first if the checkpoints do not cover it yet. (thread-safe)
+        [[nodiscard]] std::vector<std::byte> export_checkpoints(size_t index) const;
+
+        /// Imports the checkpoints of a file exported by `export_checkpoints` (throws if they are broken or of another file). (thread-safe)
+        void import_checkpoints(size_t index, const void* data, size_t size) const;
+
+        /// Calls `fn(index, worker)` for every entry once on up to `threads` threads (0 for hardware concurrency), larger entries first, then throws the first exception thrown by `fn`.
+        void for_each_entry_parallel(const std::function<void(size_t index, unsigned worker)>& fn, unsigned threads = 0) const;
+
+        /// Extracts all entries under `destination` in parallel, failing the entries whose paths resolve outside of it.
+        void extract_all(const std::filesystem::path& destination, const extract_options& options = {}) const;
 
         /// Opens file stream in archive for read.
         // the thread-safety of between files is guaranteed if base seek_and_read_file_function provides thread-safety.
         [[nodiscard]] file open_file(const std::filesystem::path& path, std::string_view password = {}) const
         {
-            for (const auto& f : files())
-                if (path == f.path)
-                    return open_file_stream(f, password);
+            return open_file(path, open_options{password});
+        }
+
+        /// Opens file stream in archive for read with options.
+        // the thread-safety of between files is guaranteed if base seek_and_read_file_function provides thread-safety.
+        [[nodiscard]] file open_file(const std::filesystem::path& path, const open_options& options) const
+        {
+            if (auto index = find_path(path))
+                return open_file_stream(*index, options);
 
             throw std::runtime_error("no such file.");
         }
@@ -116,16 +385,94 @@ namespace nanonzip
         // the thread-safety of between files is guaranteed if base seek_and_read_file_function provides thread-safety.
         [[nodiscard]] file open_file_by_index(size_t index, std::string_view password = {}) const
         {
-            if (index < files().size())
-                return open_file_stream(files()[index], password);
+            return open_file_by_index(index, open_options{password});
+        }
+
+        /// Opens file stream in archive for read with options.
+        // the thread-safety of between files is guaranteed if base seek_and_read_file_function provides thread-safety.
+        [[nodiscard]] file open_file_by_index(size_t index, const open_options& options) const
+        {
+            if (index < file_count())
+                return open_file_stream(index, options);
+
+            throw std::runtime_error("no such file.");
+        }
+
+        /// Opens file stream in archive for read, of a header from `files()` or `entry(i).header()`.
+        // the thread-safety of between files is guaranteed if base seek_and_read_file_function provides thread-safety.
+        [[nodiscard]] file open_file_stream(const file_header& file_header, std::string_view password = {}) const
+        {
+            return open_file_stream(file_header, open_options{password});
+        }
+
+        /// Opens file stream in archive for read with options, of a header from `files()` or `entry(i).header()`.
+        // the thread-safety of between files is guaranteed if base seek_and_read_file_function provides thread-safety.
+        [[nodiscard]] file open_file_stream(const file_header& file_header, const open_options& options) const;
+
+        /// Views a stored, unencrypted file on the memory image without copying (valid while this reader is alive), or returns nullopt; CRC-32 is checked if `verify_crc32`.
+        [[nodiscard]] std::optional<std::string_view> view_file(const std::filesystem::path& path, bool verify_crc32 = false) const
+        {
+            if (auto index = find_path(path))
+                return view_file_data(*index, verify_crc32);
+
+            throw std::runtime_error("no such file.");
+        }
+
+        /// Views a stored, unencrypted file on the memory image without copying (valid while this reader is alive), or returns nullopt; CRC-32 is checked if `verify_crc32`.
+        [[nodiscard]] std::optional<std::string_view> view_file_by_index(size_t index, bool verify_crc32 = false) const
+        {
+            if (index < file_count())
+                return view_file_data(index, verify_crc32);
+
+            throw std::runtime_error("no such file.");
+        }
+
+        /// Reads the whole contents of a file into a shared read-only buffer checked by CRC-32, from the cache (by the password, if encrypted) if enabled by `set_entry_cache_options`. (thread-safe)
+        [[nodiscard]] std::shared_ptr<const std::vector<std::byte>> read_file(const std::filesystem::path& path, std::string_view password = {}) const
+        {
+            if (auto index = find_path(path))
+                return read_file_data(*index, password);
+
+            throw std::runtime_error("no such file.");
+        }
+
+        /// Reads the whole contents of a file into a shared read-only buffer checked by CRC-32, from the cache (by the password, if encrypted) if enabled by `set_entry_cache_options`. (thread-safe)
+        [[nodiscard]] std::shared_ptr<const std::vector<std::byte>> read_file_by_index(size_t index, std::string_view password = {}) const
+        {
+            if (index < file_count())
+                return read_file_data(index, password);
 
             throw std::runtime_error("no such file.");
         }
 
     private:
-        file_seek_read_function read_zip_file_{};
-        std::vector<file_header> central_directory_{};
-        [[nodiscard]] file open_file_stream(const file_header& file_header, std::string_view password) const;
+        std::shared_ptr<const file_seek_read_function> read_zip_file_{}; // shared with opened files
+        std::string_view image_{}; // whole zip file on memory (if available)
+        std::streamoff length_{}; // of the zip file
+
+        struct raw_central_directory
+        {
+            std::unique_ptr<char[]> buffer{};        // read from the file (if not on memory)
+            std::vector<uint32_t> offset_buffer{};   // offsets found by parsing
+            std::shared_ptr<const void> index_file{}; // mapped index file (if loaded from it)
+            const char* data{};
+            size_t size{};
+            const uint32_t* offsets{}; // of each central directory header
+            size_t count{};
+            const uint64_t* data_offsets{};    // of each file data (from index file)
+            const uint32_t* name_table{};      // exact name hash index (from index file)
+            size_t name_table_size{};
+        };
+        raw_central_directory central_directory_{};
+
+        struct lazy_parts; // decoded files and name index
+        std::shared_ptr<lazy_parts> lazy_{};
+
+        [[nodiscard]] std::optional<size_t> find_path(const std::filesystem::path& path) const;
+        [[nodiscard]] std::streamoff file_data_offset(size_t index) const;
+        [[nodiscard]] file open_file_stream(size_t index, const open_options& options) const;
+        [[nodiscard]] std::optional<std::string_view> view_file_data(size_t index, bool verify_crc32) const;
+        [[nodiscard]] std::shared_ptr<const std::vector<std::byte>> read_file_data(size_t index, std::string_view password) const;
     };
 
     /// a sample of istream interface
@@ -150,7 +497,69 @@ namespace nanonzip
         };
     }
 
-    inline zip_file_reader::zip_file_reader(const std::filesystem::path& zip_file) : zip_file_reader(std::make_shared<std::ifstream>(zip_file, std::ios::in | std::ios::binary)) { }
+    /// Page cache beneath a file_seek_read_function, with LRU eviction under a byte budget and read-ahead on sequential misses. (thread-safe)
+    class page_cache
+    {
+    public:
+        struct options
+        {
+            size_t page_size = 65536;      ///< size of a cached page (aligned in the file)
+            size_t capacity = 33554432;    ///< byte budget of cached pages
+            size_t read_ahead_pages = 16;  ///< pages read at once on a sequential miss
+        };
+
+        struct statistics
+        {
+            std::uint64_t hits{};           ///< pages served from the cache
+            std::uint64_t misses{};         ///< pages read from upstream
+            std::uint64_t bypassed_reads{}; ///< large requests sent to upstream directly
+            std::uint64_t upstream_reads{}; ///< calls to upstream
+            std::uint64_t upstream_bytes{}; ///< bytes read from upstream
+        };
+
+        page_cache(file_seek_read_function upstream, std::streamoff total_length, options options);
+        page_cache(file_seek_read_function upstream, std::streamoff total_length) : page_cache(std::move(upstream), total_length, options{}) { }
+        page_cache(const page_cache& other) = delete;
+        page_cache(page_cache&& other) noexcept = delete;
+        page_cache& operator=(const page_cache& other) = delete;
+        page_cache& operator=(page_cache&& other) noexcept = delete;
+        ~page_cache() = default;
+
+        /// Reads `len` bytes at `cursor` through the cache, then returns `len`. (file_seek_read_function)
+        int read(std::streamoff cursor, void* buf, int len);
+
+        /// Gets the counters.
+        [[nodiscard]] statistics stats() const;
+
+    private:
+        struct page
+        {
+            std::shared_ptr<const char> data; // a slice of the block read at once
+            size_t size;
+            std::list<std::uint64_t>::iterator lru;
+        };
+
+        const file_seek_read_function upstream_;
+        const std::streamoff total_length_;
+        const options options_;
+
+        mutable std::mutex mutex_;
+        std::unordered_map<std::uint64_t, page> pages_;
+        std::list<std::uint64_t> lru_; // most recently used first
+        size_t cached_bytes_{};
+        std::uint64_t next_sequential_page_{};
+        statistics stats_{};
+
+        std::shared_ptr<const char> load_pages(std::uint64_t first, std::uint64_t last);
+    };
+
+    /// Makes thread-safe file_seek_read_function reading through a page cache.
+    inline file_seek_read_function make_file_seek_read_function_for_page_cache(std::shared_ptr<page_cache> cache)
+    {
+        return [cache = std::move(cache)](std::streamoff cursor, void* buf, int len) -> int { return cache->read(cursor, buf, len); };
+    }
+
+    inline zip_file_reader::zip_file_reader(const std::filesystem::path& zip_file) : zip_file_reader(make_file_seek_read_function_for_file(zip_file), static_cast<std::streamoff>(std::filesystem::file_size(zip_file))) { }
     inline zip_file_reader::zip_file_reader(const std::shared_ptr<std::istream>& zip_file) : zip_file_reader(zip_file, static_cast<std::streamoff>(zip_file->seekg(0, std::ios::end).tellg())) { }
     inline zip_file_reader::zip_file_reader(const std::shared_ptr<std::istream>& zip_file, std::streamoff length) : zip_file_reader(nanonzip::make_file_seek_read_function_for_istream<std::istream>(zip_file, length), length) { }
 
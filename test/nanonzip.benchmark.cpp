@@ -0,0 +1,1628 @@
+/// @file
+/// @brief  nanonzip.benchmark.cpp
+/// @author (C) 2023 ttsuki
+/// MIT License
+
+// End-to-end throughput benchmark.
+// Generates zip corpora deterministically (no network, no external tools), then reads every entry
+// with 1..N threads sharing one zip_file_reader and prints the results as JSON to stdout.
+// Large deflate entries are also read one at a time with 1..N inflate threads each ("inflate_results"),
+// and at random offsets through checkpoints, built on the way or imported ("seek_results").
+// Large stored entries are read at random offsets by 1..N threads sharing one opened file ("read_at_results").
+// Archives of many files are read whole at random (skewed to some files) through the entry cache, by budget and eviction policy ("cache_results").
+// Literal-heavy and match-heavy deflate streams are inflated by the library and by a reference inflater with the former Huffman decoder ("huffman_results").
+//
+// usage: nanonzip.benchmark [--dir <corpus directory>] [--scale <factor>] [--threads <max>] [--scaling] [--repeat <count>] [--filter <corpus name part>]
+//   --threads <max>  measures with 1, 2, 4, ... <max> threads (default: hardware concurrency); "speedup" is relative to 1 thread.
+//   --scaling        measures with every thread count 1..<max>, for a scaling curve.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <optional>
+
+#include <nanonzip.h>
+
+#ifdef NANONZIP_ENABLE_BZIP2
+#include <bzlib.h>
+#endif
+
+namespace
+{
+    using byte = std::uint8_t;
+
+    // Deterministic pseudo random numbers (splitmix64).
+    struct random_engine
+    {
+        std::uint64_t state;
+
+        std::uint64_t next()
+        {
+            std::uint64_t z = state += 0x9E3779B97F4A7C15;
+            z = (z ^ z >> 30) * 0xBF58476D1CE4E5B9;
+            z = (z ^ z >> 27) * 0x94D049BB133111EB;
+            return z ^ z >> 31;
+        }
+
+        std::uint32_t below(std::uint32_t n) { return static_cast<std::uint32_t>((next() >> 32) * n >> 32); }
+    };
+
+    // Corpus data generators
+    namespace generate
+    {
+        // English-like text: words from a fixed vocabulary with a skewed distribution.
+        std::string text(size_t size, std::uint64_t seed)
+        {
+            static const std::vector<std::string> vocabulary = []
+            {
+                random_engine random{0};
+                std::vector<std::string> words(4096);
+                for (auto& word : words)
+                    for (auto n = 2 + random.below(9); n--;)
+                        word += static_cast<char>('a' + random.below(26));
+                return words;
+            }();
+
+            random_engine random{seed};
+            std::string result;
+            result.reserve(size + 16);
+            while (result.size() < size)
+            {
+                const auto u = random.below(4096);
+                result += vocabulary[static_cast<size_t>(u) * u / 4096 * u / 4096];
+                const auto p = random.below(64);
+                result += p == 0 ? ".\n" : p < 4 ? ", " : " ";
+            }
+            result.resize(size);
+            return result;
+        }
+
+        // Small JSON-like records.
+        std::string json(size_t size, std::uint64_t seed)
+        {
+            random_engine random{seed};
+            std::string result;
+            result.reserve(size + 128);
+            result += "[\n";
+            for (unsigned id = 0; result.size() < size; id++)
+            {
+                result += "  {\"id\": " + std::to_string(seed * 1000 + id)
+                    + ", \"name\": \"" + text(4 + random.below(24), random.next()) + "\""
+                    + ", \"value\": " + std::to_string(random.below(1000000)) + "." + std::to_string(random.below(1000))
+                    + ", \"enabled\": " + (random.below(2) ? "true" : "false") + "},\n";
+            }
+            result.resize(size);
+            return result;
+        }
+
+        // Incompressible bytes.
+        std::string incompressible(size_t size, std::uint64_t seed)
+        {
+            random_engine random{seed};
+            std::string result(size, '\0');
+            for (size_t i = 0; i < size; i += 8)
+            {
+                const std::uint64_t r = random.next();
+                std::memcpy(result.data() + i, &r, std::min<size_t>(8, size - i));
+            }
+            return result;
+        }
+
+        // Runs of short patterns and copies of earlier spans: long matches at short and long distances.
+        std::string repetitive(size_t size, std::uint64_t seed)
+        {
+            random_engine random{seed};
+            std::string result;
+            result.reserve(size);
+            while (result.size() < size)
+            {
+                const size_t run = std::min<size_t>(1024 + random.below(65536), size - result.size());
+                if (result.size() > 65536 && random.below(4) == 0)
+                {
+                    // copies an earlier span
+                    const size_t from = random.below(static_cast<std::uint32_t>(result.size() - 32768));
+                    for (size_t i = 0; i < run; i++) result += result[from + i % 32768];
+                }
+                else
+                {
+                    // repeats a pattern of 1..64 bytes
+                    std::string pattern(1 + random.below(64), '\0');
+                    for (auto& c : pattern) c = static_cast<char>(random.below(256));
+                    for (size_t i = 0; i < run; i++) result += pattern[i % pattern.size()];
+                }
+            }
+            return result;
+        }
+    }
+
+    // Minimal deflate (RFC 1951) encoder: greedy LZ77 with hash chains and a dynamic Huffman or stored block per 64KiB.
+    // Used instead of zlib, so that corpora are identical regardless of the backend being benchmarked.
+    namespace deflate
+    {
+        constexpr std::array<std::uint16_t, 29> length_base{3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        constexpr std::array<std::uint8_t, 29> length_extra{0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        constexpr std::array<std::uint16_t, 30> distance_base{1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        constexpr std::array<std::uint8_t, 30> distance_extra{0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        constexpr std::array<std::uint8_t, 19> code_length_order{16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        template <size_t N>
+        size_t find_code(const std::array<std::uint16_t, N>& base, size_t value) { return static_cast<size_t>(std::upper_bound(base.begin(), base.end(), value) - base.begin()) - 1; }
+
+        // A literal (distance == 0) or a match.
+        struct token
+        {
+            std::uint16_t length_or_literal;
+            std::uint16_t distance;
+        };
+
+        class bit_writer
+        {
+        public:
+            std::string out;
+
+            void put(std::uint32_t bits, unsigned count)
+            {
+                buffer_ |= static_cast<std::uint64_t>(bits) << count_;
+                for (count_ += count; count_ >= 8; count_ -= 8, buffer_ >>= 8)
+                    out += static_cast<char>(buffer_ & 0xFF);
+            }
+
+            void align() { if (count_) put(0, 8 - count_); }
+
+        private:
+            std::uint64_t buffer_{};
+            unsigned count_{};
+        };
+
+        // Builds code lengths of a Huffman code limited to `limit` bits, flattening the frequencies until it fits.
+        std::vector<std::uint8_t> build_code_lengths(std::vector<std::uint32_t> frequencies, unsigned limit)
+        {
+            // keeps at least 2 codes, so that the code is complete
+            for (size_t i = 0, used = std::count_if(frequencies.begin(), frequencies.end(), [](auto f) { return f != 0; }); used < 2; i++)
+                if (!frequencies[i]) frequencies[i] = 1, used++;
+
+            while (true)
+            {
+                using node = std::pair<std::uint64_t, size_t>; // weight, index
+                std::priority_queue<node, std::vector<node>, std::greater<>> queue;
+                std::vector<size_t> parent(frequencies.size() * 2, ~size_t{});
+                for (size_t i = 0; i < frequencies.size(); i++)
+                    if (frequencies[i]) queue.emplace(frequencies[i], i);
+
+                for (size_t next = frequencies.size(); queue.size() > 1; next++)
+                {
+                    const auto a = queue.top();
+                    queue.pop();
+                    const auto b = queue.top();
+                    queue.pop();
+                    parent[a.second] = parent[b.second] = next;
+                    queue.emplace(a.first + b.first, next);
+                }
+
+                std::vector<std::uint8_t> lengths(frequencies.size());
+                unsigned longest = 0;
+                for (size_t i = 0; i < frequencies.size(); i++)
+                {
+                    if (!frequencies[i]) continue;
+                    unsigned depth = 0;
+                    for (size_t n = i; parent[n] != ~size_t{}; n = parent[n]) depth++;
+                    lengths[i] = static_cast<std::uint8_t>(depth);
+                    longest = std::max(longest, depth);
+                }
+
+                if (longest <= limit)
+                    return lengths;
+
+                for (auto& f : frequencies)
+                    if (f) f = f / 2 + 1;
+            }
+        }
+
+        // Makes canonical codes, bit-reversed to be written LSB first.
+        std::vector<std::uint16_t> canonical_codes(const std::vector<std::uint8_t>& lengths)
+        {
+            std::array<std::uint16_t, 16> count{};
+            for (auto l : lengths) if (l) count[l]++;
+
+            std::array<std::uint16_t, 16> next{};
+            for (unsigned bits = 1, code = 0; bits < 16; bits++)
+                next[bits] = static_cast<std::uint16_t>(code = (code + count[bits - 1]) << 1);
+
+            std::vector<std::uint16_t> codes(lengths.size());
+            for (size_t i = 0; i < lengths.size(); i++)
+            {
+                if (!lengths[i]) continue;
+                unsigned code = next[lengths[i]]++, reversed = 0;
+                for (unsigned b = 0; b < lengths[i]; b++) reversed |= (code >> b & 1) << (lengths[i] - 1 - b);
+                codes[i] = static_cast<std::uint16_t>(reversed);
+            }
+            return codes;
+        }
+
+        // Run-length encodes code lengths with symbols 16, 17, 18: pairs of (symbol, extra bits value).
+        void encode_code_lengths(const std::uint8_t* lengths, size_t count, std::vector<std::pair<std::uint8_t, std::uint8_t>>& out)
+        {
+            for (size_t i = 0; i < count;)
+            {
+                const std::uint8_t value = lengths[i];
+                size_t run = 1;
+                while (i + run < count && lengths[i + run] == value) run++;
+                i += run;
+
+                if (value == 0)
+                {
+                    for (; run >= 11; run -= std::min<size_t>(run, 138)) out.emplace_back(18, static_cast<std::uint8_t>(std::min<size_t>(run, 138) - 11));
+                    if (run >= 3) out.emplace_back(17, static_cast<std::uint8_t>(run - 3)), run = 0;
+                }
+                else
+                {
+                    out.emplace_back(value, 0), run--;
+                    for (; run >= 3; run -= std::min<size_t>(run, 6)) out.emplace_back(16, static_cast<std::uint8_t>(std::min<size_t>(run, 6) - 3));
+                }
+                for (; run; run--) out.emplace_back(value, 0);
+            }
+        }
+
+        void write_stored_blocks(bit_writer& w, const byte* data, size_t size, bool final)
+        {
+            do
+            {
+                const size_t n = std::min<size_t>(size, 65535);
+                w.put(final && n == size, 1);
+                w.put(0b00, 2);
+                w.align();
+                w.put(static_cast<std::uint32_t>(n), 16);
+                w.put(static_cast<std::uint32_t>(~n & 0xFFFF), 16);
+                w.out.append(reinterpret_cast<const char*>(data), n);
+                data += n, size -= n;
+            } while (size);
+        }
+
+        // Writes a block as dynamic Huffman codes, or as stored blocks if it is smaller.
+        void write_block(bit_writer& w, const byte* data, size_t size, const std::vector<token>& tokens, bool final)
+        {
+            std::vector<std::uint32_t> lit_frequencies(286), dist_frequencies(30);
+            for (const auto& t : tokens)
+            {
+                if (t.distance == 0) lit_frequencies[t.length_or_literal]++;
+                else lit_frequencies[257 + find_code(length_base, t.length_or_literal)]++, dist_frequencies[find_code(distance_base, t.distance)]++;
+            }
+            lit_frequencies[256]++;
+
+            const auto lit_lengths = build_code_lengths(lit_frequencies, 15);
+            const auto dist_lengths = build_code_lengths(dist_frequencies, 15);
+            size_t hlit = 286, hdist = 30;
+            while (hlit > 257 && !lit_lengths[hlit - 1]) hlit--;
+            while (hdist > 1 && !dist_lengths[hdist - 1]) hdist--;
+
+            // literal/length and distance code lengths are encoded separately (runs do not cross the boundary)
+            std::vector<std::pair<std::uint8_t, std::uint8_t>> rle;
+            encode_code_lengths(lit_lengths.data(), hlit, rle);
+            encode_code_lengths(dist_lengths.data(), hdist, rle);
+            std::vector<std::uint32_t> clen_frequencies(19);
+            for (auto [symbol, extra] : rle) clen_frequencies[symbol]++;
+            const auto clen_lengths = build_code_lengths(clen_frequencies, 7);
+            size_t hclen = 19;
+            while (hclen > 4 && !clen_lengths[code_length_order[hclen - 1]]) hclen--;
+
+            constexpr std::uint8_t rle_extra_bits[19]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+            size_t bits = 3 + 5 + 5 + 4 + 3 * hclen;
+            for (auto [symbol, extra] : rle) bits += clen_lengths[symbol] + rle_extra_bits[symbol];
+            for (const auto& t : tokens)
+            {
+                if (t.distance == 0) bits += lit_lengths[t.length_or_literal];
+                else
+                {
+                    const auto l = find_code(length_base, t.length_or_literal), d = find_code(distance_base, t.distance);
+                    bits += lit_lengths[257 + l] + length_extra[l] + dist_lengths[d] + distance_extra[d];
+                }
+            }
+            bits += lit_lengths[256];
+
+            if (bits >= (size + 5 * (size / 65535 + 1)) * 8)
+                return write_stored_blocks(w, data, size, final);
+
+            const auto lit_codes = canonical_codes(lit_lengths);
+            const auto dist_codes = canonical_codes(dist_lengths);
+            const auto clen_codes = canonical_codes(clen_lengths);
+
+            w.put(final, 1);
+            w.put(0b10, 2);
+            w.put(static_cast<std::uint32_t>(hlit - 257), 5);
+            w.put(static_cast<std::uint32_t>(hdist - 1), 5);
+            w.put(static_cast<std::uint32_t>(hclen - 4), 4);
+            for (size_t i = 0; i < hclen; i++) w.put(clen_lengths[code_length_order[i]], 3);
+            for (auto [symbol, extra] : rle)
+            {
+                w.put(clen_codes[symbol], clen_lengths[symbol]);
+                w.put(extra, rle_extra_bits[symbol]);
+            }
+
+            for (const auto& t : tokens)
+            {
+                if (t.distance == 0)
+                {
+                    w.put(lit_codes[t.length_or_literal], lit_lengths[t.length_or_literal]);
+                }
+                else
+                {
+                    const auto l = find_code(length_base, t.length_or_literal), d = find_code(distance_base, t.distance);
+                    w.put(lit_codes[257 + l], lit_lengths[257 + l]);
+                    w.put(static_cast<std::uint32_t>(t.length_or_literal - length_base[l]), length_extra[l]);
+                    w.put(dist_codes[d], dist_lengths[d]);
+                    w.put(static_cast<std::uint32_t>(t.distance - distance_base[d]), distance_extra[d]);
+                }
+            }
+            w.put(lit_codes[256], lit_lengths[256]);
+        }
+
+        std::string compress(std::string_view input)
+        {
+            constexpr size_t window_size = 32768, block_size = 65536, max_chain = 16;
+            constexpr unsigned hash_bits = 15;
+            const auto* data = reinterpret_cast<const byte*>(input.data());
+            const size_t size = input.size();
+            const auto hash = [data](size_t p) { return (data[p] << 10 ^ data[p + 1] << 5 ^ data[p + 2]) & ((1u << hash_bits) - 1); };
+
+            std::vector<std::int64_t> head(size_t{1} << hash_bits, -1);
+            std::vector<std::int64_t> prev(window_size, -1);
+            const auto insert = [&](size_t p)
+            {
+                if (p + 3 > size) return;
+                auto& h = head[hash(p)];
+                prev[p % window_size] = h;
+                h = static_cast<std::int64_t>(p);
+            };
+
+            bit_writer w;
+            std::vector<token> tokens;
+            size_t block = 0;
+            do
+            {
+                const size_t block_end = std::min(size, block + block_size);
+                tokens.clear();
+                for (size_t p = block; p < block_end;)
+                {
+                    size_t best_length = 0, best_distance = 0;
+                    if (p + 3 <= block_end)
+                    {
+                        const size_t max_length = std::min<size_t>(258, block_end - p);
+                        size_t chain = max_chain;
+                        for (auto c = head[hash(p)]; c >= 0 && p - static_cast<size_t>(c) <= window_size && chain--; c = prev[static_cast<size_t>(c) % window_size])
+                        {
+                            size_t length = 0;
+                            while (length < max_length && data[static_cast<size_t>(c) + length] == data[p + length]) length++;
+                            if (length > best_length) best_length = length, best_distance = p - static_cast<size_t>(c);
+                            if (length == max_length) break;
+                        }
+                    }
+
+                    if (best_length >= 3)
+                    {
+                        tokens.push_back({static_cast<std::uint16_t>(best_length), static_cast<std::uint16_t>(best_distance)});
+                        for (size_t end = p + best_length; p < end; p++) insert(p);
+                    }
+                    else
+                    {
+                        tokens.push_back({data[p], 0});
+                        insert(p++);
+                    }
+                }
+                write_block(w, data + block, block_end - block, tokens, block_end == size);
+                block = block_end;
+            } while (block < size);
+
+            w.align();
+            return std::move(w.out);
+        }
+    }
+
+    // Reference inflater with the Huffman decoder nanonzip used before two-level tables ("huffman_results"):
+    // a 12-bit lookup table of whole codes, then a search by code length for longer codes, and extra bits read separately.
+    namespace legacy
+    {
+        class bit_reader
+        {
+        public:
+            explicit bit_reader(std::string_view input) : p_(reinterpret_cast<const std::uint8_t*>(input.data())), end_(p_ + input.size()) { }
+
+            unsigned peek(unsigned n)
+            {
+                while (count_ < n)
+                {
+                    buffer_ |= std::uint64_t{p_ < end_ ? *p_++ : std::uint8_t{}} << count_;
+                    count_ += 8;
+                }
+                return static_cast<unsigned>(buffer_ & ((std::uint64_t{1} << n) - 1));
+            }
+
+            unsigned read(unsigned n)
+            {
+                const unsigned v = peek(n);
+                buffer_ >>= n;
+                count_ -= n;
+                return v;
+            }
+
+            void align() { (void)read(count_ % 8); }
+
+        private:
+            const std::uint8_t* p_;
+            const std::uint8_t* end_;
+            std::uint64_t buffer_{};
+            unsigned count_{};
+        };
+
+        class huffman_decoder
+        {
+        public:
+            huffman_decoder(const unsigned code_lengths[], size_t count)
+            {
+                for (size_t i = 0; i < count; i++)
+                    if (code_lengths[i]) symbols_.push_back({code_lengths[i], static_cast<unsigned>(i)});
+                std::stable_sort(symbols_.begin(), symbols_.end(), [](entry a, entry b) { return a.length < b.length; });
+
+                // ranges of canonical codes by length, and the lookup table of bit-reversed codes up to lut_bits
+                unsigned code = 0;
+                auto it = symbols_.begin();
+                lut_.resize(size_t{1} << lut_bits);
+                for (unsigned bits = 0; bits <= max_bits; bits++, code <<= 1)
+                {
+                    range r{code, code, static_cast<size_t>(it - symbols_.begin())};
+                    for (; it != symbols_.end() && it->length == bits; ++it, ++code)
+                    {
+                        if (bits > lut_bits) continue;
+                        unsigned reversed = 0;
+                        for (unsigned b = 0; b < bits; b++) reversed |= (code >> b & 1) << (bits - 1 - b);
+                        for (unsigned free_bits = 0; free_bits < lut_.size(); free_bits += 1u << bits) lut_[free_bits | reversed] = *it;
+                    }
+                    r.last = code;
+                    ranges_[bits] = r;
+                }
+            }
+
+            unsigned read_next(bit_reader& in) const
+            {
+                unsigned input = in.peek(max_bits);
+                if (const auto e = lut_[input & ((1u << lut_bits) - 1)]; e.length) return (void)in.read(e.length), e.symbol;
+
+                unsigned code = 0;
+                for (unsigned bits = 0; bits <= max_bits; bits++)
+                {
+                    if (const auto& r = ranges_[bits]; code < r.last)
+                    {
+                        const auto e = symbols_[r.base_index + (code - r.first)];
+                        return (void)in.read(e.length), e.symbol;
+                    }
+                    code = code << 1 | (input & 1);
+                    input >>= 1;
+                }
+                throw std::runtime_error("legacy inflate: invalid huffman code");
+            }
+
+        private:
+            static constexpr unsigned max_bits = 15;
+            static constexpr unsigned lut_bits = 12;
+
+            struct entry
+            {
+                unsigned length;
+                unsigned symbol;
+            };
+
+            struct range
+            {
+                unsigned first;
+                unsigned last;
+                size_t base_index;
+            };
+
+            std::vector<entry> symbols_{};
+            std::array<range, max_bits + 1> ranges_{};
+            std::vector<entry> lut_{};
+        };
+
+        // Inflates a raw deflate stream of `size` bytes.
+        std::string inflate(std::string_view input, size_t size)
+        {
+            std::string out(size, '\0');
+            size_t position = 0;
+            bit_reader in(input);
+            for (bool final = false; !final;)
+            {
+                final = in.read(1);
+                const unsigned type = in.read(2);
+                if (type == 0)
+                {
+                    in.align();
+                    const unsigned length = in.read(16);
+                    (void)in.read(16);
+                    for (unsigned i = 0; i < length; i++) out.at(position++) = static_cast<char>(in.read(8));
+                    continue;
+                }
+                if (type == 3) throw std::runtime_error("legacy inflate: invalid block type");
+
+                unsigned lengths[288 + 32]{};
+                unsigned literals = 288, distances = 32;
+                if (type == 1)
+                {
+                    std::fill(lengths, lengths + 144, 8);
+                    std::fill(lengths + 144, lengths + 256, 9);
+                    std::fill(lengths + 256, lengths + 280, 7);
+                    std::fill(lengths + 280, lengths + 288, 8);
+                    std::fill(lengths + 288, lengths + 320, 5);
+                }
+                else
+                {
+                    literals = in.read(5) + 257;
+                    distances = in.read(5) + 1;
+                    const unsigned code_lengths = in.read(4) + 4;
+                    unsigned code_length_lengths[19]{};
+                    for (unsigned i = 0; i < code_lengths; i++) code_length_lengths[deflate::code_length_order[i]] = in.read(3);
+                    const huffman_decoder code_length_decoder(code_length_lengths, 19);
+                    for (unsigned i = 0; i < literals + distances;)
+                    {
+                        const unsigned symbol = code_length_decoder.read_next(in);
+                        if (symbol < 16) lengths[i++] = symbol;
+                        else if (symbol == 16) for (unsigned n = in.read(2) + 3, previous = lengths[i - 1]; n--;) lengths[i++] = previous;
+                        else for (unsigned n = symbol == 17 ? in.read(3) + 3 : in.read(7) + 11; n--;) lengths[i++] = 0;
+                    }
+                    std::copy(lengths + literals, lengths + literals + distances, lengths + 288);
+                }
+
+                const huffman_decoder literal_decoder(lengths, literals);
+                const huffman_decoder distance_decoder(lengths + 288, distances);
+                for (;;)
+                {
+                    const unsigned symbol = literal_decoder.read_next(in);
+                    if (symbol < 256)
+                    {
+                        out.at(position++) = static_cast<char>(symbol);
+                        continue;
+                    }
+                    if (symbol == 256) break;
+
+                    const unsigned length = deflate::length_base[symbol - 257] + in.read(deflate::length_extra[symbol - 257]);
+                    const unsigned code = distance_decoder.read_next(in);
+                    const unsigned distance = deflate::distance_base[code] + in.read(deflate::distance_extra[code]);
+                    if (distance > position || position + length > size) throw std::runtime_error("legacy inflate: invalid match");
+                    for (unsigned i = 0; i < length; i++, position++) out[position] = out[position - distance];
+                }
+            }
+
+            if (position != size) throw std::runtime_error("legacy inflate: size not match");
+            return out;
+        }
+    }
+
+    // Traditional PKWARE encryption
+    class traditional_pkware_encryption
+    {
+    public:
+        explicit traditional_pkware_encryption(std::string_view password)
+        {
+            for (char c : password) update_keys(static_cast<byte>(c));
+        }
+
+        void process(std::string& buffer)
+        {
+            for (auto& c : buffer)
+            {
+                const auto plain = static_cast<byte>(c);
+                const unsigned t = key_[2] | 2;
+                c = static_cast<char>(plain ^ static_cast<byte>(t * (t ^ 1) >> 8));
+                update_keys(plain);
+            }
+        }
+
+    private:
+        std::uint32_t key_[3]{0x12345678, 0x23456789, 0x34567890};
+
+        static std::uint32_t crc32_byte(std::uint32_t crc, byte b) { return ~nanonzip::calculate_crc32(&b, 1, ~crc); }
+
+        void update_keys(byte c)
+        {
+            key_[0] = crc32_byte(key_[0], c);
+            key_[1] = (key_[1] + (key_[0] & 0xFF)) * 134775813 + 1;
+            key_[2] = crc32_byte(key_[2], static_cast<byte>(key_[1] >> 24));
+        }
+    };
+
+    // Writes a zip file.
+    class zip_writer
+    {
+    public:
+        explicit zip_writer(const std::filesystem::path& path, bool zip64)
+            : out_(path, std::ios::out | std::ios::binary | std::ios::trunc)
+            , zip64_(zip64)
+        {
+            if (!out_) throw std::runtime_error("failed to create " + path.u8string());
+        }
+
+        void add(const std::string& name, std::string_view data, nanonzip::compression_method_t method, std::string_view password = {}, std::uint64_t seed = 0)
+        {
+            entry e{};
+            e.name = name;
+            e.method = static_cast<std::uint16_t>(method);
+            e.flags = password.empty() ? 0 : 1;
+            e.crc32 = nanonzip::calculate_crc32(data.data(), data.size());
+            e.uncompressed_size = data.size();
+            e.offset = static_cast<std::uint64_t>(out_.tellp());
+
+            std::string compressed;
+            switch (method)
+            {
+            case nanonzip::compression_method_t::stored:
+                compressed = data;
+                break;
+
+            case nanonzip::compression_method_t::deflate:
+                compressed = deflate::compress(data);
+                break;
+
+#ifdef NANONZIP_ENABLE_BZIP2
+            case nanonzip::compression_method_t::bzip2:
+                {
+                    compressed.resize(data.size() + data.size() / 100 + 600);
+                    auto length = static_cast<unsigned>(compressed.size());
+                    if (::BZ2_bzBuffToBuffCompress(compressed.data(), &length, const_cast<char*>(data.data()), static_cast<unsigned>(data.size()), 9, 0, 30) != BZ_OK)
+                        throw std::runtime_error("BZ2_bzBuffToBuffCompress failed");
+                    compressed.resize(length);
+                    break;
+                }
+#endif
+
+            default:
+                throw std::runtime_error("unsupported compression method");
+            }
+
+            if (e.flags & 1)
+            {
+                // 12 bytes encryption header, the last byte of which is the high byte of crc32
+                random_engine random{seed};
+                std::string header(12, '\0');
+                for (auto& c : header) c = static_cast<char>(random.below(256));
+                header[11] = static_cast<char>(e.crc32 >> 24);
+
+                traditional_pkware_encryption encryption(password);
+                encryption.process(header);
+                encryption.process(compressed);
+                compressed.insert(0, header);
+            }
+            e.compressed_size = compressed.size();
+
+            // local file header
+            std::string extra;
+            if (zip64_) put64(put16(put16(extra, 0x0001), 16), e.uncompressed_size), put64(extra, e.compressed_size);
+            std::string h;
+            put32(h, 0x04034b50);
+            put16(h, zip64_ ? 45 : 20);
+            put16(h, e.flags);
+            put16(h, e.method);
+            put16(h, dos_time(entries_.size())), put16(h, dos_date(entries_.size()));
+            put32(h, e.crc32);
+            put32(h, zip64_ ? ~std::uint32_t{} : static_cast<std::uint32_t>(e.compressed_size));
+            put32(h, zip64_ ? ~std::uint32_t{} : static_cast<std::uint32_t>(e.uncompressed_size));
+            put16(h, static_cast<std::uint16_t>(e.name.size()));
+            put16(h, static_cast<std::uint16_t>(extra.size()));
+            out_ << h << e.name << extra << compressed;
+
+            entries_.push_back(std::move(e));
+        }
+
+        void finish()
+        {
+            const auto directory_offset = static_cast<std::uint64_t>(out_.tellp());
+            for (const auto& e : entries_)
+            {
+                std::string extra;
+                if (zip64_) put64(put64(put64(put16(put16(extra, 0x0001), 24), e.uncompressed_size), e.compressed_size), e.offset);
+                std::string h;
+                put32(h, 0x02014b50);
+                put16(h, zip64_ ? 45 : 20);
+                put16(h, zip64_ ? 45 : 20);
+                put16(h, e.flags);
+                put16(h, e.method);
+                put16(h, dos_time(static_cast<size_t>(&e - entries_.data()))), put16(h, dos_date(static_cast<size_t>(&e - entries_.data())));
+                put32(h, e.crc32);
+                put32(h, zip64_ ? ~std::uint32_t{} : static_cast<std::uint32_t>(e.compressed_size));
+                put32(h, zip64_ ? ~std::uint32_t{} : static_cast<std::uint32_t>(e.uncompressed_size));
+                put16(h, static_cast<std::uint16_t>(e.name.size()));
+                put16(h, static_cast<std::uint16_t>(extra.size()));
+                put16(h, 0), put16(h, 0), put16(h, 0); // comment length, disk number, internal attributes
+                put32(h, 0);                           // external attributes
+                put32(h, zip64_ ? ~std::uint32_t{} : static_cast<std::uint32_t>(e.offset));
+                out_ << h << e.name << extra;
+            }
+            const auto directory_size = static_cast<std::uint64_t>(out_.tellp()) - directory_offset;
+
+            std::string t;
+            const bool large = zip64_ || entries_.size() >= 0xFFFF;
+            if (large)
+            {
+                // zip64 end of central directory record and locator
+                const auto record_offset = static_cast<std::uint64_t>(out_.tellp());
+                put32(t, 0x06064b50);
+                put64(t, 44);
+                put16(t, 45), put16(t, 45);
+                put32(t, 0), put32(t, 0);
+                put64(t, entries_.size()), put64(t, entries_.size());
+                put64(t, directory_size), put64(t, directory_offset);
+                put32(t, 0x07064b50);
+                put32(t, 0);
+                put64(t, record_offset);
+                put32(t, 1);
+            }
+
+            put32(t, 0x06054b50);
+            put16(t, 0), put16(t, 0);
+            put16(t, large ? 0xFFFF : static_cast<std::uint16_t>(entries_.size()));
+            put16(t, large ? 0xFFFF : static_cast<std::uint16_t>(entries_.size()));
+            put32(t, zip64_ ? ~std::uint32_t{} : static_cast<std::uint32_t>(directory_size));
+            put32(t, zip64_ ? ~std::uint32_t{} : static_cast<std::uint32_t>(directory_offset));
+            put16(t, 0);
+            out_ << t;
+            out_.close();
+        }
+
+    private:
+        struct entry
+        {
+            std::string name;
+            std::uint16_t method;
+            std::uint16_t flags;
+            std::uint32_t crc32;
+            std::uint64_t uncompressed_size;
+            std::uint64_t compressed_size;
+            std::uint64_t offset;
+        };
+
+    public:
+        // last modified date and time of the i-th entry: varied over 2000-01-01 .. 2031-12-28
+        static constexpr std::uint16_t dos_time(size_t i) { return static_cast<std::uint16_t>(i % 24 << 11 | i % 60 << 5 | i % 30); }
+        static constexpr std::uint16_t dos_date(size_t i) { return static_cast<std::uint16_t>((20 + i % 32) << 9 | (i % 12 + 1) << 5 | (i % 28 + 1)); }
+
+    private:
+        std::ofstream out_;
+        bool zip64_;
+        std::vector<entry> entries_;
+
+        static std::string& put16(std::string& s, std::uint16_t v) { return s.append({static_cast<char>(v), static_cast<char>(v >> 8)}); }
+        static std::string& put32(std::string& s, std::uint32_t v) { return put16(put16(s, static_cast<std::uint16_t>(v)), static_cast<std::uint16_t>(v >> 16)); }
+        static std::string& put64(std::string& s, std::uint64_t v) { return put32(put32(s, static_cast<std::uint32_t>(v)), static_cast<std::uint32_t>(v >> 32)); }
+    };
+
+    // A generated zip file
+    struct corpus
+    {
+        std::string name;
+        std::string password;
+        std::function<void(const std::filesystem::path&)> generate;
+    };
+
+    std::vector<corpus> make_corpora(double scale)
+    {
+        using method = nanonzip::compression_method_t;
+        const auto scaled = [scale](size_t n) { return std::max<size_t>(1, static_cast<size_t>(static_cast<double>(n) * scale)); };
+
+        // many small files
+        const auto tiny = [scaled](method m)
+        {
+            return [=](const std::filesystem::path& path)
+            {
+                zip_writer zip(path, false);
+                random_engine random{1};
+                for (size_t i = 0, n = scaled(20000); i < n; i++)
+                    zip.add("tiny/" + std::to_string(i / 1000) + "/" + std::to_string(i) + ".json", generate::json(64 + random.below(2048), i), m);
+                zip.finish();
+            };
+        };
+
+        // a few large files
+        const auto huge = [scaled](method m, size_t count, size_t size)
+        {
+            return [=](const std::filesystem::path& path)
+            {
+                zip_writer zip(path, false);
+                for (size_t i = 0; i < count; i++)
+                    zip.add("huge/" + std::to_string(i) + ".txt", generate::text(scaled(size), i), m);
+                zip.finish();
+            };
+        };
+
+        std::vector<corpus> corpora;
+        corpora.push_back({"tiny-stored", {}, tiny(method::stored)});
+        corpora.push_back({"tiny-deflate", {}, tiny(method::deflate)});
+        corpora.push_back({"huge-stored", {}, huge(method::stored, 2, 64 << 20)});
+        corpora.push_back({"huge-deflate", {}, huge(method::deflate, 2, 64 << 20)});
+        corpora.push_back({
+            "mixed-deflate", {}, [scaled](const std::filesystem::path& path)
+            {
+                // many small files, then a few large files at the end of the archive
+                zip_writer zip(path, false);
+                random_engine random{1};
+                for (size_t i = 0, n = scaled(2000); i < n; i++)
+                    zip.add("mixed/small/" + std::to_string(i) + ".json", generate::json(64 + random.below(2048), i), method::deflate);
+                for (size_t i = 0; i < 4; i++)
+                    zip.add("mixed/large/" + std::to_string(i) + ".txt", generate::text(scaled(16 << 20), i), method::deflate);
+                zip.finish();
+            }
+        });
+#ifdef NANONZIP_ENABLE_BZIP2
+        corpora.push_back({"huge-bzip2", {}, huge(method::bzip2, 1, 16 << 20)});
+#endif
+        corpora.push_back({
+            "incompressible-deflate", {}, [scaled](const std::filesystem::path& path)
+            {
+                zip_writer zip(path, false);
+                for (size_t i = 0; i < 4; i++)
+                    zip.add("incompressible/" + std::to_string(i) + ".bin", generate::incompressible(scaled(8 << 20), i), method::deflate);
+                zip.finish();
+            }
+        });
+        corpora.push_back({
+            "repetitive-deflate", {}, [scaled](const std::filesystem::path& path)
+            {
+                zip_writer zip(path, false);
+                for (size_t i = 0; i < 4; i++)
+                    zip.add("repetitive/" + std::to_string(i) + ".bin", generate::repetitive(scaled(16 << 20), i), method::deflate);
+                zip.finish();
+            }
+        });
+        corpora.push_back({
+            "zip64-deflate", {}, [scaled](const std::filesystem::path& path)
+            {
+                zip_writer zip(path, true);
+                for (size_t i = 0, n = scaled(64); i < n; i++)
+                    zip.add("zip64/" + std::to_string(i) + ".txt", generate::text(256 << 10, i), method::deflate);
+                zip.finish();
+            }
+        });
+        corpora.push_back({
+            "encrypted-deflate", "nanonzip", [scaled](const std::filesystem::path& path)
+            {
+                zip_writer zip(path, false);
+                for (size_t i = 0, n = scaled(64); i < n; i++)
+                    zip.add("encrypted/" + std::to_string(i) + ".txt", generate::text(512 << 10, i), method::deflate, "nanonzip", i);
+                zip.finish();
+            }
+        });
+        return corpora;
+    }
+
+    struct measurement
+    {
+        double seconds;
+        std::uint64_t bytes;
+        size_t entries;
+        std::uint64_t file_reads{}; // set by the caller
+    };
+
+    // How the zip file is opened and how its entries are accessed
+    enum struct reader_t
+    {
+        istream,       // zip_file_reader(std::shared_ptr<std::istream>): seekg + read under a mutex
+        file,          // zip_file_reader(path): positional reads without locks
+        file_cached,   // positional reads through a page_cache
+        file_resolved, // positional reads, with data offsets of all files resolved at once beforehand (not timed)
+        memory_mapped, // zip_file_reader(path, memory_mapped): read from the mapping
+        memory_view,   // memory_mapped, viewing stored entries in place instead of reading them
+    };
+
+    struct opened_zip_file
+    {
+        nanonzip::zip_file_reader zip;
+        std::shared_ptr<std::atomic<std::uint64_t>> file_reads; // calls to the file read function (file readers only)
+    };
+
+    opened_zip_file open_zip_file(const std::filesystem::path& path, reader_t reader)
+    {
+        const auto length = static_cast<std::streamoff>(std::filesystem::file_size(path));
+        auto file_reads = std::make_shared<std::atomic<std::uint64_t>>(0);
+        auto counted_file = [file_reads, read = nanonzip::make_file_seek_read_function_for_file(path)](std::streamoff cursor, void* buf, int len)
+        {
+            ++*file_reads;
+            return read(cursor, buf, len);
+        };
+
+        switch (reader)
+        {
+        case reader_t::istream: return {nanonzip::zip_file_reader(std::make_shared<std::ifstream>(path, std::ios::in | std::ios::binary)), nullptr};
+        case reader_t::file: return {nanonzip::zip_file_reader(counted_file, length), file_reads};
+        case reader_t::file_resolved:
+            {
+                nanonzip::zip_file_reader zip(counted_file, length);
+                zip.resolve_data_offsets();
+                return {std::move(zip), file_reads};
+            }
+        case reader_t::file_cached: return {nanonzip::zip_file_reader(nanonzip::make_file_seek_read_function_for_page_cache(std::make_shared<nanonzip::page_cache>(counted_file, length)), length), file_reads};
+        case reader_t::memory_mapped: return {nanonzip::zip_file_reader(path, nanonzip::memory_mapped), nullptr};
+        case reader_t::memory_view: return {nanonzip::zip_file_reader(path, nanonzip::memory_mapped), nullptr};
+        }
+        throw std::logic_error("unknown reader");
+    }
+
+    const char* to_string(reader_t reader)
+    {
+        switch (reader)
+        {
+        case reader_t::istream: return "istream";
+        case reader_t::file: return "file";
+        case reader_t::file_cached: return "file_cached";
+        case reader_t::file_resolved: return "file_resolved";
+        case reader_t::memory_mapped: return "memory_mapped";
+        case reader_t::memory_view: return "memory_view";
+        }
+        return "unknown";
+    }
+
+    // Reads all entries with `threads` threads sharing `zip`.
+    measurement read_all(const nanonzip::zip_file_reader& zip, const nanonzip::open_options& options, reader_t reader, unsigned threads)
+    {
+        std::atomic<size_t> next{0};
+        std::atomic<std::uint64_t> total_bytes{0};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        const auto worker = [&]
+        {
+            try
+            {
+                std::vector<std::byte> buffer(1048576);
+                std::uint64_t bytes = 0;
+                for (size_t i; (i = next++) < zip.file_count();)
+                {
+                    if (reader == reader_t::memory_view)
+                    {
+                        if (auto view = zip.view_file_by_index(i, options.integrity == nanonzip::open_options::integrity_t::verify))
+                        {
+                            bytes += view->size();
+                            continue;
+                        }
+                    }
+
+                    auto file = zip.open_file_by_index(i, options);
+                    while (size_t r = file.read(buffer.data(), buffer.size())) bytes += r;
+                    if (options.integrity == nanonzip::open_options::integrity_t::deferred) file.verify();
+                }
+                total_bytes += bytes;
+            }
+            catch (...)
+            {
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+            }
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; t++) workers.emplace_back(worker);
+        worker();
+        for (auto& t : workers) t.join();
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (error) std::rethrow_exception(error);
+        return {seconds, total_bytes, zip.file_count()};
+    }
+
+    // Opening a zip file with many entries, and decoding its central directory
+    struct open_measurement
+    {
+        double open_seconds;           // zip_file_reader(path)
+        double open_indexed_seconds;   // zip_file_reader(path, index_path) with the index file written by save_index
+        double timestamps_seconds;     // entry(i).last_mod_timestamp() of all entries (local time)
+        double timestamps_utc_seconds; // entry(i).last_mod_timestamp(utc) of all entries
+        double mktime_seconds;         // std::mktime for all entries (as timestamps had been converted)
+        double files_seconds;          // files(threads): decodes all entries into file_header
+    };
+
+    open_measurement open_all(const std::filesystem::path& path, const std::filesystem::path& index_path, unsigned threads)
+    {
+        const auto seconds_of = [](auto&& f)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            f();
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        open_measurement m{};
+        std::optional<nanonzip::zip_file_reader> zip;
+        m.open_seconds = seconds_of([&] { zip.emplace(path); });
+        m.open_indexed_seconds = seconds_of([&] { nanonzip::zip_file_reader indexed(path, index_path); });
+
+        std::vector<std::time_t> timestamps(zip->file_count());
+        m.timestamps_seconds = seconds_of([&]
+        {
+            for (size_t i = 0; i < zip->file_count(); i++)
+                timestamps[i] = zip->entry(i).last_mod_timestamp();
+        });
+
+        std::vector<std::time_t> utc_timestamps(zip->file_count());
+        m.timestamps_utc_seconds = seconds_of([&]
+        {
+            for (size_t i = 0; i < zip->file_count(); i++)
+                utc_timestamps[i] = zip->entry(i).last_mod_timestamp(nanonzip::file_header::time_zone_t::utc);
+        });
+
+        std::vector<std::time_t> mktime_timestamps(zip->file_count());
+        m.mktime_seconds = seconds_of([&]
+        {
+            for (size_t i = 0; i < zip->file_count(); i++)
+            {
+                const auto date = zip_writer::dos_date(i), time = zip_writer::dos_time(i);
+                std::tm tm{};
+                tm.tm_sec = std::clamp((time >> 0 & 0x1f) * 2, 0, 59);
+                tm.tm_min = std::clamp(time >> 5 & 0x3f, 0, 59);
+                tm.tm_hour = std::clamp(time >> 11 & 0x1f, 0, 23);
+                tm.tm_mday = std::clamp(date >> 0 & 0x1f, 1, 31);
+                tm.tm_mon = std::clamp(date >> 5 & 0x0f, 1, 12) - 1;
+                tm.tm_year = std::clamp(date >> 9 & 0x7f, 0, 128) + 1980 - 1900;
+                mktime_timestamps[i] = std::mktime(&tm);
+            }
+        });
+        if (timestamps != mktime_timestamps) throw std::runtime_error("timestamps not match with std::mktime");
+        for (size_t i = 0; i < timestamps.size(); i++)
+            if (utc_timestamps[i] - timestamps[i] != utc_timestamps[0] - timestamps[0])
+                throw std::runtime_error("utc timestamps not match");
+
+        m.files_seconds = seconds_of([&] { (void)zip->files(threads); });
+        if (zip->files().size() != zip->file_count()) throw std::runtime_error("files() not match");
+        if (threads > 1)
+        {
+            // compares with serial decoding
+            const nanonzip::zip_file_reader serial(path);
+            for (size_t i = 0; i < zip->file_count(); i++)
+            {
+                const auto& a = zip->files()[i];
+                const auto& b = serial.files()[i];
+                if (a.general_purpose_bit_flag != b.general_purpose_bit_flag || a.compression_method != b.compression_method || a.crc_32 != b.crc_32 ||
+                    a.last_mod_timestamp != b.last_mod_timestamp || a.uncompressed_size != b.uncompressed_size || a.compressed_size != b.compressed_size ||
+                    a.relative_offset_of_local_header != b.relative_offset_of_local_header || a.path != b.path)
+                    throw std::runtime_error("files(threads) not match with files()");
+            }
+        }
+        return m;
+    }
+
+    const char* to_string(nanonzip::open_options::integrity_t integrity)
+    {
+        switch (integrity)
+        {
+        case nanonzip::open_options::integrity_t::verify: return "verify";
+        case nanonzip::open_options::integrity_t::deferred: return "deferred";
+        case nanonzip::open_options::integrity_t::none: return "none";
+        }
+        return "unknown";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "nanonzip-benchmark";
+    double scale = 1.0;
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    bool scaling = false;
+    int repeat = 3;
+    std::string filter;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "--dir" && value) directory = std::filesystem::u8path(argv[++i]);
+        else if (arg == "--scale" && value) scale = std::stod(argv[++i]);
+        else if (arg == "--threads" && value) max_threads = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--scaling") scaling = true;
+        else if (arg == "--repeat" && value) repeat = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--filter" && value) filter = argv[++i];
+        else
+        {
+            std::clog << "usage: " << argv[0] << " [--dir <corpus directory>] [--scale <factor>] [--threads <max>] [--scaling] [--repeat <count>] [--filter <corpus name part>]\n";
+            return 1;
+        }
+    }
+
+    // 1, 2, 4, ... and max_threads (or every count with --scaling)
+    std::vector<unsigned> thread_counts;
+    for (unsigned t = 1; t < max_threads; t = scaling ? t + 1 : t * 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    using integrity_t = nanonzip::open_options::integrity_t;
+
+    try
+    {
+        std::filesystem::create_directories(directory);
+
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(6);
+        json << "{\n";
+#ifdef NANONZIP_ENABLE_ZLIB
+        json << "  \"inflate\": \"zlib\",\n";
+#else
+        json << "  \"inflate\": \"built-in\",\n";
+#endif
+#ifdef NANONZIP_ENABLE_BZIP2
+        json << "  \"bzip2\": true,\n";
+#else
+        json << "  \"bzip2\": false,\n";
+#endif
+        json << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+        json << "  \"scale\": " << scale << ",\n";
+        json << "  \"results\": [";
+
+        // extract_all of each corpus to disk
+        std::ostringstream extract_json;
+        extract_json << std::fixed << std::setprecision(6);
+        bool first_extract = true;
+
+        // parallel inflate of large entries
+        std::ostringstream inflate_json;
+        inflate_json << std::fixed << std::setprecision(6);
+        bool first_inflate = true;
+
+        // random reads of large entries
+        std::ostringstream seek_json;
+        seek_json << std::fixed << std::setprecision(6);
+        bool first_seek = true;
+
+        // concurrent random reads of large stored entries
+        std::ostringstream read_at_json;
+        read_at_json << std::fixed << std::setprecision(6);
+        bool first_read_at = true;
+
+        // skewed reads of whole files through the entry cache
+        std::ostringstream cache_json;
+        cache_json << std::fixed << std::setprecision(6);
+        bool first_cache = true;
+
+        bool first = true;
+        for (const auto& corpus : make_corpora(scale))
+        {
+            if (corpus.name.find(filter) == std::string::npos) continue;
+
+            const auto path = directory / (corpus.name + ".zip");
+            std::clog << "generating " << path.u8string() << "...\n";
+            corpus.generate(path);
+
+            for (reader_t reader : {reader_t::istream, reader_t::file, reader_t::file_cached, reader_t::file_resolved, reader_t::memory_mapped, reader_t::memory_view})
+            {
+                for (integrity_t integrity : {integrity_t::verify, integrity_t::deferred, integrity_t::none})
+                {
+                    if (reader == reader_t::memory_view && (integrity == integrity_t::deferred || corpus.name.find("stored") == std::string::npos))
+                        continue; // views are of stored entries, and are checked on the spot or not at all
+
+                    std::uint64_t uncompressed = 0;
+                    const nanonzip::zip_file_reader listing(path);
+                    for (const auto& f : listing.files()) uncompressed += static_cast<std::uint64_t>(f.uncompressed_size);
+
+                    double single_thread_seconds{};
+                    for (unsigned threads : thread_counts)
+                    {
+                        std::clog << "  " << corpus.name << " " << to_string(reader) << " " << to_string(integrity) << " threads=" << threads << "... ";
+                        measurement best{1e300, 0, 0};
+                        for (int r = 0; r < repeat; r++)
+                        {
+                            // reopens every run to start with a cold page cache
+                            const auto opened = open_zip_file(path, reader);
+                            const auto reads_on_open = opened.file_reads ? opened.file_reads->load() : 0;
+                            auto m = read_all(opened.zip, {corpus.password, integrity}, reader, threads);
+                            if (opened.file_reads) m.file_reads = opened.file_reads->load() - reads_on_open;
+                            if (m.seconds < best.seconds) best = m;
+                        }
+                        if (best.bytes != uncompressed) throw std::runtime_error(corpus.name + ": read size not match");
+
+                        const double mb_per_s = static_cast<double>(best.bytes) / best.seconds / 1e6;
+                        const double entries_per_s = static_cast<double>(best.entries) / best.seconds;
+                        if (threads == 1) single_thread_seconds = best.seconds;
+                        const double speedup = single_thread_seconds / best.seconds;
+                        std::clog << mb_per_s << " MB/s, " << entries_per_s << " entries/s, x" << speedup << ", " << best.file_reads << " file reads\n";
+
+                        json << (std::exchange(first, false) ? "\n" : ",\n")
+                            << "    {\"corpus\": \"" << corpus.name << "\""
+                            << ", \"reader\": \"" << to_string(reader) << "\""
+                            << ", \"integrity\": \"" << to_string(integrity) << "\""
+                            << ", \"threads\": " << threads
+                            << ", \"entries\": " << best.entries
+                            << ", \"uncompressed_bytes\": " << best.bytes
+                            << ", \"zip_bytes\": " << std::filesystem::file_size(path)
+                            << ", \"seconds\": " << best.seconds
+                            << ", \"mb_per_s\": " << mb_per_s
+                            << ", \"entries_per_s\": " << entries_per_s
+                            << ", \"speedup\": " << speedup
+                            << ", \"file_reads\": " << best.file_reads << "}";
+                    }
+                }
+            }
+
+            {
+                std::uint64_t uncompressed = 0;
+                const nanonzip::zip_file_reader zip(path, nanonzip::memory_mapped);
+                for (size_t i = 0; i < zip.file_count(); i++) uncompressed += static_cast<std::uint64_t>(zip.entry(i).uncompressed_size());
+
+                const auto destination = directory / "extracted" / corpus.name;
+                double single_thread_seconds{};
+                for (unsigned threads : thread_counts)
+                {
+                    std::clog << "  " << corpus.name << " extract_all threads=" << threads << "... ";
+                    double best = 1e300;
+                    for (int r = 0; r < repeat; r++)
+                    {
+                        std::filesystem::remove_all(destination);
+                        nanonzip::extract_options options;
+                        options.open.password = corpus.password;
+                        options.threads = threads;
+                        const auto start = std::chrono::steady_clock::now();
+                        zip.extract_all(destination, options);
+                        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                    }
+                    std::filesystem::remove_all(destination);
+
+                    const double mb_per_s = static_cast<double>(uncompressed) / best / 1e6;
+                    if (threads == 1) single_thread_seconds = best;
+                    const double speedup = single_thread_seconds / best;
+                    std::clog << mb_per_s << " MB/s, x" << speedup << "\n";
+
+                    extract_json << (std::exchange(first_extract, false) ? "\n" : ",\n")
+                        << "    {\"corpus\": \"" << corpus.name << "\""
+                        << ", \"threads\": " << threads
+                        << ", \"entries\": " << zip.file_count()
+                        << ", \"uncompressed_bytes\": " << uncompressed
+                        << ", \"seconds\": " << best
+                        << ", \"mb_per_s\": " << mb_per_s
+                        << ", \"speedup\": " << speedup << "}";
+                }
+            }
+
+            if (const nanonzip::zip_file_reader zip(path, nanonzip::memory_mapped); corpus.password.empty() && std::any_of(zip.files().begin(), zip.files().end(), [](const auto& f)
+            {
+                return f.compression_method == nanonzip::compression_method_t::deflate && f.compressed_size >= 4194304;
+            }))
+            {
+                double single_thread_seconds{};
+                for (unsigned threads : thread_counts)
+                {
+                    std::clog << "  " << corpus.name << " inflate_threads=" << threads << "... ";
+                    measurement best{1e300, 0, 0};
+                    for (int r = 0; r < repeat; r++)
+                    {
+                        nanonzip::open_options options;
+                        options.inflate_threads = threads;
+                        auto m = read_all(zip, options, reader_t::memory_mapped, 1);
+                        if (m.seconds < best.seconds) best = m;
+                    }
+
+                    const double mb_per_s = static_cast<double>(best.bytes) / best.seconds / 1e6;
+                    if (threads == 1) single_thread_seconds = best.seconds;
+                    const double speedup = single_thread_seconds / best.seconds;
+                    std::clog << mb_per_s << " MB/s, x" << speedup << "\n";
+
+                    inflate_json << (std::exchange(first_inflate, false) ? "\n" : ",\n")
+                        << "    {\"corpus\": \"" << corpus.name << "\""
+                        << ", \"inflate_threads\": " << threads
+                        << ", \"entries\": " << best.entries
+                        << ", \"uncompressed_bytes\": " << best.bytes
+                        << ", \"seconds\": " << best.seconds
+                        << ", \"mb_per_s\": " << mb_per_s
+                        << ", \"speedup\": " << speedup << "}";
+                }
+
+                // 4KiB reads at random offsets of the largest deflate entry: checkpoints built on the way, then imported into another reader
+                size_t largest{};
+                std::streamoff largest_size{};
+                for (size_t i = 0; i < zip.file_count(); i++)
+                {
+                    if (zip.entry(i).compression_method() == nanonzip::compression_method_t::deflate && zip.entry(i).compressed_size() > largest_size)
+                    {
+                        largest = i;
+                        largest_size = zip.entry(i).compressed_size();
+                    }
+                }
+
+                std::vector<std::byte> checkpoints;
+                for (const char* checkpoints_from : {"built", "imported"})
+                {
+                    constexpr int reads = 256;
+                    std::clog << "  " << corpus.name << " read_at checkpoints=" << checkpoints_from << "... ";
+                    const nanonzip::zip_file_reader seeking(path, nanonzip::memory_mapped);
+                    if (!checkpoints.empty()) seeking.import_checkpoints(largest, checkpoints.data(), checkpoints.size());
+                    const auto f = seeking.open_file_by_index(largest);
+
+                    random_engine random{largest};
+                    std::vector<std::byte> buffer(4096);
+                    const auto start = std::chrono::steady_clock::now();
+                    for (int r = 0; r < reads; r++)
+                        (void)f.read_at(static_cast<std::streamoff>(random.next() % static_cast<std::uint64_t>(f.size())), buffer.data(), buffer.size());
+                    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    if (checkpoints.empty()) checkpoints = seeking.export_checkpoints(largest);
+
+                    const double reads_per_s = reads / seconds;
+                    std::clog << reads_per_s << " reads/s, " << checkpoints.size() << " bytes of checkpoints\n";
+
+                    seek_json << (std::exchange(first_seek, false) ? "\n" : ",\n")
+                        << "    {\"corpus\": \"" << corpus.name << "\""
+                        << ", \"checkpoints\": \"" << checkpoints_from << "\""
+                        << ", \"uncompressed_bytes\": " << f.size()
+                        << ", \"checkpoint_bytes\": " << checkpoints.size()
+                        << ", \"reads\": " << reads
+                        << ", \"seconds\": " << seconds
+                        << ", \"reads_per_s\": " << reads_per_s << "}";
+                }
+            }
+
+            if (const nanonzip::zip_file_reader zip(path); corpus.password.empty() && std::any_of(zip.files().begin(), zip.files().end(), [](const auto& f)
+            {
+                return f.compression_method == nanonzip::compression_method_t::stored && f.uncompressed_size >= 4194304;
+            }))
+            {
+                // 64KiB reads at random offsets of the largest stored entry, through one file (positional reads of the zip file)
+                size_t largest{};
+                for (size_t i = 0; i < zip.file_count(); i++)
+                {
+                    if (zip.entry(i).compression_method() == nanonzip::compression_method_t::stored && zip.entry(i).uncompressed_size() > zip.entry(largest).uncompressed_size())
+                        largest = i;
+                }
+
+                for (size_t checksum_chunk_size : {size_t{0}, size_t{65536}})
+                {
+                    nanonzip::open_options options;
+                    options.read_at_checksum_chunk_size = checksum_chunk_size;
+                    const auto f = zip.open_file_by_index(largest, options);
+                    std::byte first{};
+                    (void)f.read_at(0, &first, 1); // records the chunk checksums
+
+                    double single_thread_seconds{};
+                    for (unsigned threads : thread_counts)
+                    {
+                        constexpr int reads_per_thread = 1024;
+                        std::clog << "  " << corpus.name << " read_at checksum_chunk_size=" << checksum_chunk_size << " threads=" << threads << "... ";
+                        const auto start = std::chrono::steady_clock::now();
+                        std::vector<std::thread> workers;
+                        for (unsigned t = 0; t < threads; t++)
+                        {
+                            workers.emplace_back([&f, t]
+                            {
+                                random_engine random{t};
+                                std::vector<std::byte> buffer(65536);
+                                for (int r = 0; r < reads_per_thread; r++)
+                                    (void)f.read_at(static_cast<std::streamoff>(random.next() % static_cast<std::uint64_t>(f.size())), buffer.data(), buffer.size());
+                            });
+                        }
+                        for (auto& w : workers) w.join();
+                        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                        const double reads_per_s = reads_per_thread * threads / seconds;
+                        if (threads == 1) single_thread_seconds = seconds;
+                        const double speedup = single_thread_seconds * threads / seconds;
+                        std::clog << reads_per_s << " reads/s, x" << speedup << "\n";
+
+                        read_at_json << (std::exchange(first_read_at, false) ? "\n" : ",\n")
+                            << "    {\"corpus\": \"" << corpus.name << "\""
+                            << ", \"checksum_chunk_size\": " << checksum_chunk_size
+                            << ", \"threads\": " << threads
+                            << ", \"reads\": " << reads_per_thread * threads
+                            << ", \"read_bytes\": " << 65536
+                            << ", \"seconds\": " << seconds
+                            << ", \"reads_per_s\": " << reads_per_s
+                            << ", \"speedup\": " << speedup << "}";
+                    }
+                }
+            }
+
+            if (nanonzip::zip_file_reader zip(path); zip.file_count() >= 1000)
+            {
+                // reads whole files by max threads, the index drawn as n * u^3 (u uniform in [0, 1)) so that a few files take most reads
+                std::uint64_t total_bytes{};
+                for (const auto& f : zip.files()) total_bytes += f.uncompressed_size;
+
+                double uncached_seconds{};
+                for (size_t budget_fraction : {size_t{0}, size_t{64}, size_t{16}, size_t{4}, size_t{1}})
+                {
+                    for (auto eviction : {nanonzip::entry_cache_options::eviction_t::lru, nanonzip::entry_cache_options::eviction_t::cost_aware})
+                    {
+                        if (budget_fraction == 0 && eviction != nanonzip::entry_cache_options::eviction_t::lru) continue;
+
+                        const size_t capacity = budget_fraction ? static_cast<size_t>(total_bytes / budget_fraction) : 0;
+                        const char* eviction_name = eviction == nanonzip::entry_cache_options::eviction_t::lru ? "lru" : "cost_aware";
+                        zip.set_entry_cache_options({0, eviction}); // empties the cache
+                        zip.set_entry_cache_options({capacity, eviction});
+                        const auto before = zip.entry_cache_stats();
+
+                        const unsigned threads = thread_counts.back();
+                        constexpr int reads_per_thread = 4096;
+                        std::clog << "  " << corpus.name << " cache capacity=" << capacity << " eviction=" << eviction_name << " threads=" << threads << "... ";
+                        const auto start = std::chrono::steady_clock::now();
+                        std::vector<std::thread> workers;
+                        for (unsigned t = 0; t < threads; t++)
+                        {
+                            workers.emplace_back([&zip, &corpus, t]
+                            {
+                                random_engine random{t};
+                                for (int r = 0; r < reads_per_thread; r++)
+                                {
+                                    const double u = static_cast<double>(random.next() >> 11) / 9007199254740992.0;
+                                    const auto index = static_cast<size_t>(u * u * u * static_cast<double>(zip.file_count()));
+                                    (void)zip.read_file_by_index(index, corpus.password);
+                                }
+                            });
+                        }
+                        for (auto& w : workers) w.join();
+                        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                        const auto after = zip.entry_cache_stats();
+                        const double reads_per_s = reads_per_thread * threads / seconds;
+                        if (capacity == 0) uncached_seconds = seconds;
+                        const double hits = static_cast<double>(after.hits - before.hits);
+                        const double hit_rate = hits / (reads_per_thread * threads);
+                        std::clog << reads_per_s << " reads/s, hit rate " << hit_rate << ", x" << uncached_seconds / seconds << "\n";
+
+                        cache_json << (std::exchange(first_cache, false) ? "\n" : ",\n")
+                            << "    {\"corpus\": \"" << corpus.name << "\""
+                            << ", \"capacity\": " << capacity
+                            << ", \"total_bytes\": " << total_bytes
+                            << ", \"eviction\": \"" << eviction_name << "\""
+                            << ", \"threads\": " << threads
+                            << ", \"reads\": " << reads_per_thread * threads
+                            << ", \"seconds\": " << seconds
+                            << ", \"reads_per_s\": " << reads_per_s
+                            << ", \"hit_rate\": " << hit_rate
+                            << ", \"bytes_saved\": " << after.bytes_saved - before.bytes_saved
+                            << ", \"evictions\": " << after.evictions - before.evictions
+                            << ", \"cached_bytes\": " << after.cached_bytes
+                            << ", \"speedup\": " << uncached_seconds / seconds << "}";
+                    }
+                }
+            }
+        }
+
+        json << "\n  ],\n";
+        json << "  \"extract_results\": [" << extract_json.str() << "\n  ],\n";
+        json << "  \"inflate_results\": [" << inflate_json.str() << "\n  ],\n";
+        json << "  \"seek_results\": [" << seek_json.str() << "\n  ],\n";
+        json << "  \"read_at_results\": [" << read_at_json.str() << "\n  ],\n";
+        json << "  \"cache_results\": [" << cache_json.str() << "\n  ],\n";
+
+        // Huffman decoding: literal-heavy (random alphanumerics) and match-heavy (word text) streams, by the library (on memory, 1MiB reads) and the former decoder
+        json << "  \"huffman_results\": [";
+        first = true;
+        for (const std::string name : {"huffman-literal", "huffman-match"})
+        {
+            if (name.find(filter) == std::string::npos) continue;
+
+            std::string data;
+            if (name == "huffman-literal")
+            {
+                static constexpr char alphanumerics[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+                random_engine random{3};
+                data.resize(static_cast<size_t>(8000000 * scale));
+                for (auto& c : data) c = alphanumerics[random.below(62)];
+            }
+            else
+            {
+                data = generate::text(static_cast<size_t>(15000000 * scale), 3);
+            }
+
+            const auto path = directory / (name + ".zip");
+            std::clog << "generating " << path.u8string() << "...\n";
+            const std::string compressed = deflate::compress(data);
+            {
+                zip_writer zip(path, false);
+                zip.add("data.txt", data, nanonzip::compression_method_t::deflate);
+                zip.finish();
+            }
+
+            const nanonzip::zip_file_reader zip(path, nanonzip::memory_mapped);
+            std::vector<char> buffer(1048576);
+            double seconds = 1e300, legacy_seconds = 1e300;
+            for (int r = 0; r < repeat; r++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                auto f = zip.open_file_by_index(0, {{}, integrity_t::none});
+                size_t total{};
+                while (const size_t read = f.read(buffer.data(), buffer.size())) total += read;
+                seconds = std::min(seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                if (total != data.size()) throw std::runtime_error(name + ": size not match");
+
+                start = std::chrono::steady_clock::now();
+                const auto inflated = legacy::inflate(compressed, data.size());
+                legacy_seconds = std::min(legacy_seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                if (inflated != data) throw std::runtime_error(name + ": legacy inflate not match");
+            }
+
+            const double mb_per_s = static_cast<double>(data.size()) / 1e6 / seconds;
+            const double legacy_mb_per_s = static_cast<double>(data.size()) / 1e6 / legacy_seconds;
+            std::clog << "  " << name << ": " << mb_per_s << " MB/s, former decoder " << legacy_mb_per_s << " MB/s, x" << legacy_seconds / seconds << "\n";
+
+            json << (std::exchange(first, false) ? "\n" : ",\n")
+                << "    {\"corpus\": \"" << name << "\""
+                << ", \"bytes\": " << data.size()
+                << ", \"compressed_bytes\": " << compressed.size()
+                << ", \"seconds\": " << seconds
+                << ", \"mb_per_s\": " << mb_per_s
+                << ", \"legacy_seconds\": " << legacy_seconds
+                << ", \"legacy_mb_per_s\": " << legacy_mb_per_s
+                << ", \"speedup\": " << legacy_seconds / seconds << "}";
+        }
+        json << "\n  ],\n";
+
+        // a central directory of 1M entries
+        json << "  \"open_results\": [";
+        first = true;
+        if (std::string name = "central-directory-1m"; name.find(filter) != std::string::npos)
+        {
+            const auto path = directory / (name + ".zip");
+            const auto entries = static_cast<size_t>(1000000 * scale);
+            std::clog << "generating " << path.u8string() << "...\n";
+            {
+                zip_writer zip(path, false);
+                for (size_t i = 0; i < entries; i++)
+                    zip.add("assets/" + std::to_string(i / 1000) + "/" + std::to_string(i) + ".dat", {}, nanonzip::compression_method_t::stored);
+                zip.finish();
+            }
+            auto index_path = path;
+            index_path += ".index";
+            nanonzip::zip_file_reader(path).save_index(path, index_path);
+
+            double single_thread_seconds{};
+            for (unsigned threads : thread_counts)
+            {
+                std::clog << "  " << name << " threads=" << threads << "... ";
+                open_measurement best{1e300, 1e300, 1e300, 1e300, 1e300, 1e300};
+                for (int r = 0; r < repeat; r++)
+                {
+                    const auto m = open_all(path, index_path, threads);
+                    best.open_seconds = std::min(best.open_seconds, m.open_seconds);
+                    best.open_indexed_seconds = std::min(best.open_indexed_seconds, m.open_indexed_seconds);
+                    best.timestamps_seconds = std::min(best.timestamps_seconds, m.timestamps_seconds);
+                    best.timestamps_utc_seconds = std::min(best.timestamps_utc_seconds, m.timestamps_utc_seconds);
+                    best.mktime_seconds = std::min(best.mktime_seconds, m.mktime_seconds);
+                    best.files_seconds = std::min(best.files_seconds, m.files_seconds);
+                }
+                if (threads == 1) single_thread_seconds = best.files_seconds;
+                const double speedup = single_thread_seconds / best.files_seconds;
+                std::clog << "open " << best.open_seconds << "s (with index " << best.open_indexed_seconds << "s), timestamps " << best.timestamps_seconds << "s (utc " << best.timestamps_utc_seconds << "s, std::mktime " << best.mktime_seconds << "s), files() " << best.files_seconds << "s, x" << speedup << "\n";
+
+                json << (std::exchange(first, false) ? "\n" : ",\n")
+                    << "    {\"corpus\": \"" << name << "\""
+                    << ", \"threads\": " << threads
+                    << ", \"entries\": " << entries
+                    << ", \"zip_bytes\": " << std::filesystem::file_size(path)
+                    << ", \"open_seconds\": " << best.open_seconds
+                    << ", \"open_indexed_seconds\": " << best.open_indexed_seconds
+                    << ", \"timestamps_seconds\": " << best.timestamps_seconds
+                    << ", \"timestamps_utc_seconds\": " << best.timestamps_utc_seconds
+                    << ", \"mktime_seconds\": " << best.mktime_seconds
+                    << ", \"files_seconds\": " << best.files_seconds
+                    << ", \"speedup\": " << speedup << "}";
+            }
+        }
+
+        json << "\n  ]\n}\n";
+        std::cout << json.str();
+    }
+    catch (const std::exception& e)
+    {
+        std::clog << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
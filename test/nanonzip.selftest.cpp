@@ -0,0 +1,1811 @@
+/// @file
+/// @brief  nanonzip.selftest.cpp
+/// @author (C) 2023 ttsuki
+/// MIT License
+
+// Self checks of internals that the sample programs cannot see.
+// Compiles the library into this translation unit to reach its internal functions.
+// Prints failed checks to stderr and returns non-zero if any check fails.
+//
+// usage: nanonzip.selftest
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <chrono>
+
+#include <nanonzip.cpp>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string& what)
+    {
+        if (ok) return;
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+
+    // Cross-checks every CRC-32 implementation the CPU runs, and crc32_combine, against the slicing-by-16 table.
+    void check_crc32()
+    {
+        using namespace nanonzip::crc32;
+        using implementation = std::pair<const char*, crc32_function>;
+
+        [[maybe_unused]] const clmul_support cpu = detect_clmul_support();
+        std::vector<implementation> implementations{{"dispatched", calculate_crc32}};
+#if defined(__x86_64__) || defined(_M_X64)
+        if (cpu.pclmul) implementations.emplace_back("pclmul", calculate_crc32_pclmul);
+        if (cpu.pclmul && cpu.vpclmul) implementations.emplace_back("vpclmul", calculate_crc32_vpclmul);
+#endif
+#if defined(NANONZIP_CRC32_PMULL)
+        if (cpu.pmull) implementations.emplace_back("pmull", calculate_crc32_pmull);
+#endif
+        for (const auto& [name, function] : implementations) std::clog << "crc32: checking " << name << "\n";
+
+        std::mt19937_64 random{1};
+        std::vector<byte> buffer(64 + 8192);
+        for (auto& b : buffer) b = static_cast<byte>(random());
+
+        const auto reference = calculate_crc32_table<0xEDB88320>;
+        for (int round = 0; round < 4096; round++)
+        {
+            // every alignment, short lengths thoroughly, and lengths up to 8KiB across the fold block sizes
+            const size_t offset = round % 64;
+            const size_t length = round < 1024 ? round / 4 : random() % 8193;
+            const byte* data = buffer.data() + offset;
+            const auto seed = static_cast<crc32_t>(round & 1 ? random() : 0);
+            const crc32_t expected = reference(data, length, seed);
+
+            for (const auto& [name, function] : implementations)
+                check(function(data, length, seed) == expected, std::string("crc32 ") + name + " offset " + std::to_string(offset) + " length " + std::to_string(length));
+
+            // crc(A + B) from crc(A), crc(B) and length of B, at a random split
+            const size_t split = length ? random() % (length + 1) : 0;
+            const crc32_t a = reference(data, split, 0);
+            const crc32_t b = reference(data + split, length - split, 0);
+            check(nanonzip::crc32_combine(a, b, length - split) == reference(data, length, 0), "crc32_combine length " + std::to_string(length) + " split " + std::to_string(split));
+        }
+    }
+
+    // A file of a zip file made on memory: `data` is written as it is, compressed by `method` if not stored, and encrypted if `password` is not empty.
+    struct zip_entry
+    {
+        std::string name;
+        std::string contents;
+        std::uint16_t method{};
+        std::string data{};
+        std::string password{};
+    };
+
+    // Encrypts by the traditional PKWARE encryption, with the 12-byte encryption header checked by the high byte of `crc`.
+    std::string encrypt(std::string_view data, std::string_view password, std::uint32_t crc)
+    {
+        std::string header(12, '\x5A');
+        header[11] = static_cast<char>(crc >> 24);
+        nanonzip::traditional_pkware_decryption keys(password);
+        std::string out;
+        for (char c : header + std::string(data))
+        {
+            const std::uint32_t u = keys.k2_ | 2;
+            keys.update_keys(static_cast<std::uint8_t>(c));
+            out += static_cast<char>(c ^ static_cast<char>(u * (u ^ 1) >> 8));
+        }
+        return out;
+    }
+
+    // Makes a zip file of the files on memory.
+    std::string make_zip(const std::vector<zip_entry>& files)
+    {
+        std::string zip, directory;
+        const auto put = [](std::string& out, std::uint64_t value, int bytes) { for (int i = 0; i < bytes; i++) out += static_cast<char>(value >> i * 8); };
+        for (const auto& file : files)
+        {
+            const auto offset = zip.size();
+            const auto crc = nanonzip::calculate_crc32(file.contents.data(), file.contents.size());
+            const auto data = file.password.empty() ? (file.method ? file.data : file.contents) : encrypt(file.method ? file.data : file.contents, file.password, crc);
+            for (std::string* out : {&zip, &directory})
+            {
+                const bool central = out == &directory;
+                put(*out, central ? 0x02014b50 : 0x04034b50, 4);
+                if (central) put(*out, 20, 2);                                   // version made by
+                put(*out, file.method || !file.password.empty() ? 20 : 10, 2); // version needed
+                put(*out, !file.password.empty(), 2);                           // flags: encrypted
+                put(*out, file.method, 2);
+                put(*out, 0, 2);    // time
+                put(*out, 0x21, 2); // date: 1980-01-01
+                put(*out, crc, 4);
+                put(*out, data.size(), 4);
+                put(*out, file.contents.size(), 4);
+                put(*out, file.name.size(), 2);
+                put(*out, 0, 2); // extra field
+                if (central)
+                {
+                    put(*out, 0, 2); // comment
+                    put(*out, 0, 2); // disk
+                    put(*out, 0, 2); // internal attributes
+                    put(*out, 0, 4); // external attributes
+                    put(*out, offset, 4);
+                }
+                *out += file.name;
+            }
+            zip += data;
+        }
+
+        const auto directory_offset = zip.size();
+        zip += directory;
+        put(zip, 0x06054b50, 4);
+        put(zip, 0, 4); // disks
+        put(zip, files.size(), 2);
+        put(zip, files.size(), 2);
+        put(zip, directory.size(), 4);
+        put(zip, directory_offset, 4);
+        put(zip, 0, 2); // comment
+        return zip;
+    }
+
+    // Makes a zip file of stored files on memory.
+    std::string make_stored_zip(const std::vector<std::pair<std::string, std::string>>& files)
+    {
+        std::vector<zip_entry> entries;
+        for (const auto& [name, data] : files) entries.push_back({name, data});
+        return make_zip(entries);
+    }
+
+    // Fields of a central directory header, written as they are.
+    struct raw_header
+    {
+        std::string name;
+        std::uint16_t flags{};
+        std::uint16_t method{};
+        std::uint16_t time{};
+        std::uint16_t date{};
+        std::uint32_t crc{};
+        std::uint32_t compressed{};
+        std::uint32_t uncompressed{};
+        std::uint32_t offset{};
+        std::string extra{};
+        std::string comment{};
+    };
+
+    // Makes a zip file of a central directory only (without local headers or file data).
+    std::string make_directory_zip(const std::vector<raw_header>& headers)
+    {
+        std::string zip;
+        const auto put = [&](std::uint64_t value, int bytes) { for (int i = 0; i < bytes; i++) zip += static_cast<char>(value >> i * 8); };
+        for (const auto& h : headers)
+        {
+            put(0x02014b50, 4);
+            put(45, 2); // version made by
+            put(45, 2); // version needed
+            put(h.flags, 2);
+            put(h.method, 2);
+            put(h.time, 2);
+            put(h.date, 2);
+            put(h.crc, 4);
+            put(h.compressed, 4);
+            put(h.uncompressed, 4);
+            put(h.name.size(), 2);
+            put(h.extra.size(), 2);
+            put(h.comment.size(), 2);
+            put(0, 2); // disk
+            put(0, 2); // internal attributes
+            put(0, 4); // external attributes
+            put(h.offset, 4);
+            zip += h.name + h.extra + h.comment;
+        }
+
+        const auto directory_size = zip.size();
+        put(0x06054b50, 4);
+        put(0, 4); // disks
+        put(headers.size(), 2);
+        put(headers.size(), 2);
+        put(directory_size, 4);
+        put(0, 4); // directory offset
+        put(0, 2); // comment
+        return zip;
+    }
+
+    // Converts a central directory header as the eager parser before the lazy central directory did, with std::mktime.
+    nanonzip::file_header eager_header_of(const nanonzip::central_directory_header* cdh)
+    {
+        nanonzip::file_header r{};
+        r.general_purpose_bit_flag = cdh->general_purpose_bit_flag;
+        r.compression_method = static_cast<nanonzip::file_header::compression_method_t>(cdh->compression_method);
+        r.crc_32 = cdh->crc_32;
+
+        std::tm tm{};
+        tm.tm_sec = std::clamp((cdh->last_mod_file_time >> 0 & 0x1f) * 2, 0, 59);
+        tm.tm_min = std::clamp(cdh->last_mod_file_time >> 5 & 0x3f, 0, 59);
+        tm.tm_hour = std::clamp(cdh->last_mod_file_time >> 11 & 0x1f, 0, 23);
+        tm.tm_mday = std::clamp(cdh->last_mod_file_date >> 0 & 0x1f, 1, 31);
+        tm.tm_mon = std::clamp(cdh->last_mod_file_date >> 5 & 0x0f, 1, 12) - 1;
+        tm.tm_year = std::clamp(cdh->last_mod_file_date >> 9 & 0x7f, 0, 128) + 1980 - 1900;
+        r.last_mod_timestamp = std::mktime(&tm);
+        if (auto ut = cdh->find_extra_field(0x5455)) // Extended Timestamp Extra Field
+        {
+            std::ptrdiff_t t = 0;
+            std::uint8_t flag{};
+            if (t + sizeof(std::uint8_t) <= ut->size) flag = *reinterpret_cast<const std::uint8_t*>(ut->data() + std::exchange(t, t + sizeof(std::uint8_t)));
+            if ((flag & 1) && t + sizeof(std::uint32_t) <= ut->size) r.last_mod_timestamp = static_cast<std::time_t>(*reinterpret_cast<const std::uint32_t*>(ut->data() + std::exchange(t, t + sizeof(std::uint32_t))));
+        }
+
+        r.uncompressed_size = cdh->uncompressed_size;
+        r.compressed_size = cdh->compressed_size;
+        r.relative_offset_of_local_header = cdh->relative_offset_of_local_header;
+        if (auto zip64 = cdh->find_extra_field(0x0001)) // ZIP64 Extended Information Extra Field
+        {
+            std::ptrdiff_t t = 0;
+            if (cdh->uncompressed_size == ~std::uint32_t{} && t + sizeof(std::uint64_t) <= zip64->size) r.uncompressed_size = static_cast<std::streamoff>(*reinterpret_cast<const std::uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(std::uint64_t))));
+            if (cdh->compressed_size == ~std::uint32_t{} && t + sizeof(std::uint64_t) <= zip64->size) r.compressed_size = static_cast<std::streamoff>(*reinterpret_cast<const std::uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(std::uint64_t))));
+            if (cdh->relative_offset_of_local_header == ~std::uint32_t{} && t + sizeof(std::uint64_t) <= zip64->size) r.relative_offset_of_local_header = static_cast<std::streamoff>(*reinterpret_cast<const std::uint64_t*>(zip64->data() + std::exchange(t, t + sizeof(std::uint64_t))));
+        }
+
+        r.path = cdh->general_purpose_bit_flag & 1 << 11 // utf-8 encoding?
+                     ? std::filesystem::u8path(cdh->filename())
+                     : std::filesystem::path(cdh->filename());
+        return r;
+    }
+
+    bool same_header(const nanonzip::file_header& a, const nanonzip::file_header& b)
+    {
+        return a.general_purpose_bit_flag == b.general_purpose_bit_flag && a.compression_method == b.compression_method && a.crc_32 == b.crc_32
+            && a.last_mod_timestamp == b.last_mod_timestamp && a.uncompressed_size == b.uncompressed_size && a.compressed_size == b.compressed_size
+            && a.relative_offset_of_local_header == b.relative_offset_of_local_header && a.path == b.path && a.path.native() == b.path.native();
+    }
+
+    // Central directory headers of random fields, names and extra fields: zip64 (whole, partial or cut short), extended timestamps, and others.
+    std::vector<raw_header> random_headers(size_t count, std::uint64_t seed)
+    {
+        std::mt19937_64 random{seed};
+        const auto bytes = [](std::uint64_t value, int n) { std::string s; for (int i = 0; i < n; i++) s += static_cast<char>(value >> i * 8); return s; };
+        const auto field = [&](std::uint16_t tag, const std::string& data) { return bytes(tag, 2) + bytes(data.size(), 2) + data; };
+
+        std::vector<raw_header> headers(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            auto& h = headers[i];
+            h.name = "dir" + std::to_string(random() % 10) + "/" + (random() % 4 ? "" : "sub/") + "file" + std::to_string(i) + (random() % 2 ? ".txt" : "");
+            if (random() % 8 == 0) h.name += "/";
+            if (random() % 4 == 0) h.flags |= 1 << 11, h.name += "\xE3\x81\x82"; // utf-8
+            if (random() % 8 == 0) h.flags |= 1;
+            h.method = random() % 3 ? 8 : 0;
+            h.time = static_cast<std::uint16_t>(random());
+            h.date = static_cast<std::uint16_t>(random());
+            h.crc = static_cast<std::uint32_t>(random());
+            h.compressed = static_cast<std::uint32_t>(random());
+            h.uncompressed = static_cast<std::uint32_t>(random());
+            h.offset = static_cast<std::uint32_t>(random() >> 34);
+
+            if (random() % 4 == 0) h.extra += field(0xCAFE, bytes(random(), static_cast<int>(random() % 8))); // unknown field before
+            if (random() % 3 == 0)
+            {
+                std::string zip64;
+                for (auto* value : {&h.uncompressed, &h.compressed, &h.offset})
+                    if (random() % 2) *value = ~std::uint32_t{}, zip64 += bytes(random() >> 20, 8);
+                if (random() % 4 == 0 && !zip64.empty()) zip64.resize(zip64.size() - 4); // cut short
+                h.extra += field(0x0001, zip64);
+            }
+            if (random() % 3 == 0)
+            {
+                const std::uint8_t flag = random() % 4 ? 0x07 : 0x06;
+                h.extra += field(0x5455, bytes(flag, 1) + (random() % 6 ? bytes(random() >> 33, 4) : bytes(random(), 2)));
+            }
+            if (random() % 8 == 0) h.comment = "comment " + std::to_string(i);
+        }
+        return headers;
+    }
+
+    // Checks that entries decode to the same headers as the eager parser did, through entry() and files().
+    void check_headers()
+    {
+        const auto headers = random_headers(5000, 3);
+        const auto zip = std::make_shared<const std::string>(make_directory_zip(headers));
+        const nanonzip::zip_file_reader reader(zip->data(), zip->size(), zip);
+        check(reader.file_count() == headers.size(), "headers count " + std::to_string(reader.file_count()));
+
+        const auto& files = reader.files();
+        size_t record = 0;
+        for (size_t i = 0; i < std::min(reader.file_count(), headers.size()); i++)
+        {
+            const auto e = reader.entry(i);
+            const auto expected = eager_header_of(nanonzip::central_directory_header_of(zip->data() + record));
+            record += nanonzip::central_directory_header::fixed_header_size() + headers[i].name.size() + headers[i].extra.size() + headers[i].comment.size();
+            const auto header = e.header();
+            const std::string what = "header " + std::to_string(i) + " (" + headers[i].name + ")";
+            check(same_header(header, expected), what + " of entry");
+            check(same_header(files[i], expected), what + " of files()");
+            check(e.name() == headers[i].name && e.general_purpose_bit_flag() == header.general_purpose_bit_flag && e.compression_method() == header.compression_method
+                      && e.crc_32() == header.crc_32 && e.last_mod_timestamp() == header.last_mod_timestamp && e.uncompressed_size() == header.uncompressed_size
+                      && e.compressed_size() == header.compressed_size && e.relative_offset_of_local_header() == header.relative_offset_of_local_header,
+                  what + " fields of entry");
+        }
+    }
+
+    // Checks that files(threads) decodes the same headers as files(), at thread counts splitting the entries unevenly.
+    void check_parallel_files()
+    {
+        const auto headers = random_headers(60000, 4);
+        const auto zip = std::make_shared<const std::string>(make_directory_zip(headers));
+        const nanonzip::zip_file_reader serial(zip->data(), zip->size(), zip);
+        const auto& expected = serial.files();
+        check(expected.size() == headers.size(), "files() count " + std::to_string(expected.size()));
+
+        for (unsigned threads : {0u, 2u, 3u, 4u, 7u, 16u, 64u})
+        {
+            const nanonzip::zip_file_reader reader(zip->data(), zip->size(), zip);
+            const auto& files = reader.files(threads);
+            size_t mismatches = files.size() == expected.size() ? 0 : 1;
+            for (size_t i = 0; i < std::min(files.size(), expected.size()); i++)
+                mismatches += !same_header(files[i], expected[i]);
+            check(mismatches == 0, "files(" + std::to_string(threads) + "): " + std::to_string(mismatches) + " mismatches");
+            check(&reader.files() == &files && &reader.files(1) == &files, "files(" + std::to_string(threads) + ") decoded once");
+        }
+
+        // a reader of no files
+        const auto empty = std::make_shared<const std::string>(make_directory_zip({}));
+        check(nanonzip::zip_file_reader(empty->data(), empty->size(), empty).files(8).empty(), "files(8) of no files");
+    }
+
+    // Checks DOS date and time conversion against std::mktime (local) and timegm (utc), for every date and edge cases of time.
+    void check_dos_dates()
+    {
+        // the fields as the eager parser clamped them
+        const auto tm_of = [](std::uint16_t date, std::uint16_t time)
+        {
+            std::tm tm{};
+            tm.tm_sec = std::clamp((time >> 0 & 0x1f) * 2, 0, 59);
+            tm.tm_min = std::clamp(time >> 5 & 0x3f, 0, 59);
+            tm.tm_hour = std::clamp(time >> 11 & 0x1f, 0, 23);
+            tm.tm_mday = std::clamp(date >> 0 & 0x1f, 1, 31);
+            tm.tm_mon = std::clamp(date >> 5 & 0x0f, 1, 12) - 1;
+            tm.tm_year = (date >> 9 & 0x7f) + 1980 - 1900;
+            return tm;
+        };
+        const auto utc_of = [](std::tm tm)
+        {
+#ifdef _WIN32
+            return ::_mkgmtime(&tm);
+#else
+            return ::timegm(&tm);
+#endif
+        };
+        const auto dos_date = [](int year, int month, int day) { return static_cast<std::uint16_t>((year - 1980) << 9 | month << 5 | day); };
+        const auto dos_time = [](int hour, int minute, int second) { return static_cast<std::uint16_t>(hour << 11 | minute << 5 | second / 2); };
+
+        // every date (including month 0 and 13-15, day 0, and days past the end of months), and times out of range
+        std::vector<raw_header> headers;
+        for (std::uint32_t date = 0; date <= 0xFFFF; date++)
+            headers.push_back({"d" + std::to_string(date), 0, 0, static_cast<std::uint16_t>(date * 0x9E37u), static_cast<std::uint16_t>(date)});
+        for (std::uint16_t time : {dos_time(0, 0, 0), dos_time(23, 59, 58), dos_time(24, 0, 0), dos_time(31, 63, 62), dos_time(12, 60, 60)})
+        {
+            for (std::uint16_t date : {dos_date(1980, 1, 1), dos_date(2000, 2, 29), dos_date(2023, 2, 29), dos_date(2100, 2, 29), dos_date(2024, 13, 1), dos_date(2024, 0, 0),
+                                       dos_date(2038, 1, 19), dos_date(2106, 2, 7), dos_date(2107, 12, 31), dos_date(2107, 15, 31)})
+                headers.push_back({"t" + std::to_string(headers.size()), 0, 0, time, date});
+        }
+
+        // in zip files of 16384 entries (under the 65535 of an end of central directory record)
+        size_t local_mismatches = 0, utc_mismatches = 0;
+        std::shared_ptr<const std::string> zip;
+        std::optional<nanonzip::zip_file_reader> reader;
+        for (size_t i = 0; i < headers.size(); i++)
+        {
+            if (i % 16384 == 0)
+            {
+                zip = std::make_shared<const std::string>(make_directory_zip({headers.begin() + static_cast<std::ptrdiff_t>(i), headers.begin() + static_cast<std::ptrdiff_t>(std::min(i + 16384, headers.size()))}));
+                reader.emplace(zip->data(), zip->size(), zip);
+            }
+
+            auto tm = tm_of(headers[i].date, headers[i].time);
+            const auto utc = utc_of(tm);
+            const auto local = std::mktime(&tm);
+            const auto e = reader->entry(i % 16384);
+            if (e.last_mod_timestamp() != local && local_mismatches++ < 5)
+                check(false, "dos date " + std::to_string(headers[i].date) + " time " + std::to_string(headers[i].time) + " local: " + std::to_string(e.last_mod_timestamp()) + " != mktime " + std::to_string(local));
+            if (e.last_mod_timestamp(nanonzip::file_header::time_zone_t::utc) != utc && utc_mismatches++ < 5)
+                check(false, "dos date " + std::to_string(headers[i].date) + " time " + std::to_string(headers[i].time) + " utc: " + std::to_string(e.last_mod_timestamp(nanonzip::file_header::time_zone_t::utc)) + " != timegm " + std::to_string(utc));
+        }
+        check(local_mismatches == 0 && utc_mismatches == 0, "dos dates: " + std::to_string(local_mismatches) + " local and " + std::to_string(utc_mismatches) + " utc mismatches");
+
+        // known values at the edges
+        check(nanonzip::seconds_from_dos_date_time(dos_date(2107, 12, 31), dos_time(23, 59, 58)) == 4354819198, "dos date 2107-12-31 23:59:58");
+        check(nanonzip::seconds_from_dos_date_time(dos_date(2100, 2, 29), 0) == nanonzip::seconds_from_dos_date_time(dos_date(2100, 3, 1), 0), "dos date 2100-02-29 (not a leap year)");
+        check(nanonzip::seconds_from_dos_date_time(dos_date(2000, 2, 29), 0) + 86400 == nanonzip::seconds_from_dos_date_time(dos_date(2000, 3, 1), 0), "dos date 2000-02-29 (a leap year)");
+        check(nanonzip::seconds_from_dos_date_time(dos_date(2024, 13, 1), 0) == nanonzip::seconds_from_dos_date_time(dos_date(2024, 12, 1), 0), "dos date month 13 clamped to 12");
+        check(nanonzip::seconds_from_dos_date_time(dos_date(2024, 0, 0), 0) == nanonzip::seconds_from_dos_date_time(dos_date(2024, 1, 1), 0), "dos date month and day 0 clamped to 1");
+    }
+
+    // Checks that the page cache serves adjacent small files, and sequential page-sized reads, by a few upstream reads.
+    void check_page_cache()
+    {
+        std::mt19937_64 random{2};
+        std::vector<std::pair<std::string, std::string>> files;
+        for (int i = 0; i < 2000; i++)
+        {
+            std::string data(64 + random() % 2048, '\0');
+            for (auto& c : data) c = static_cast<char>('a' + random() % 26);
+            files.emplace_back("small/" + std::to_string(i) + ".txt", std::move(data));
+        }
+
+        const auto zip = std::make_shared<const std::string>(make_stored_zip(files));
+        const auto upstream_reads = std::make_shared<std::atomic<int>>();
+        const auto length = static_cast<std::streamoff>(zip->size());
+        const nanonzip::file_seek_read_function upstream = [zip, upstream_reads](std::streamoff cursor, void* buf, int len)
+        {
+            ++*upstream_reads;
+            std::memcpy(buf, zip->data() + cursor, static_cast<size_t>(len));
+            return len;
+        };
+
+        // reads every file: windows of 16 pages of 64KiB cover the whole zip in a few reads
+        {
+            const auto cache = std::make_shared<nanonzip::page_cache>(upstream, length);
+            const nanonzip::zip_file_reader reader(nanonzip::make_file_seek_read_function_for_page_cache(cache), length);
+            *upstream_reads = 0;
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                auto f = reader.open_file_by_index(i);
+                std::string data(static_cast<size_t>(f.size()), '\0');
+                check(f.read(data.data(), data.size()) == data.size() && data == files[i].second, "page_cache contents of " + files[i].first);
+            }
+
+            const auto windows = static_cast<int>(zip->size() / (65536 * 16) + 1);
+            check(*upstream_reads <= windows + 2, "page_cache small files: " + std::to_string(*upstream_reads) + " upstream reads for " + std::to_string(files.size()) + " files");
+            check(cache->stats().bypassed_reads == 0, "page_cache small files bypassed");
+        }
+
+        // sequential reads of a page each (as the inflater reads) go through the cache and its read-ahead
+        {
+            nanonzip::page_cache cache(upstream, length);
+            *upstream_reads = 0;
+            std::vector<char> buffer(65536);
+            for (std::streamoff cursor = 0; cursor + 65536 <= length; cursor += 65536)
+            {
+                (void)cache.read(cursor, buffer.data(), 65536);
+                check(std::memcmp(buffer.data(), zip->data() + cursor, buffer.size()) == 0, "page_cache sequential contents");
+            }
+            check(cache.stats().bypassed_reads == 0 && *upstream_reads <= static_cast<int>(zip->size() / (65536 * 16) + 1), "page_cache sequential pages: " + std::to_string(*upstream_reads) + " upstream reads");
+        }
+
+        // concurrent readers at random
+        {
+            nanonzip::page_cache cache(upstream, length, {4096, 65536, 4});
+            std::atomic<int> mismatches{0};
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < 4; t++)
+            {
+                threads.emplace_back([&, t]
+                {
+                    std::mt19937_64 r{t};
+                    std::vector<char> buffer(20000);
+                    for (int i = 0; i < 2000; i++)
+                    {
+                        const auto len = static_cast<int>(r() % buffer.size());
+                        const auto cursor = static_cast<std::streamoff>(r() % static_cast<std::uint64_t>(length - len));
+                        (void)cache.read(cursor, buffer.data(), len);
+                        if (std::memcmp(buffer.data(), zip->data() + cursor, static_cast<size_t>(len)) != 0) ++mismatches;
+                    }
+                });
+            }
+            for (auto& t : threads) t.join();
+            check(mismatches == 0, "page_cache concurrent contents");
+        }
+    }
+
+    // Writes a deflate stream, LSB first.
+    struct deflate_writer
+    {
+        using codes_t = std::vector<std::pair<std::uint32_t, int>>; // (code, length) of each symbol
+
+        std::string out;
+        std::uint64_t bits{};
+        int count{};
+        codes_t lit_codes{};  // of the current block
+        codes_t dist_codes{};
+
+        static constexpr unsigned length_base[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static constexpr unsigned dist_base[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+
+        void put(std::uint32_t value, int n)
+        {
+            bits |= static_cast<std::uint64_t>(value) << count;
+            for (count += n; count >= 8; count -= 8, bits >>= 8) out += static_cast<char>(bits);
+        }
+
+        // Huffman codes are written MSB first.
+        void put_code(std::uint32_t code, int n) { for (int i = n; i-- > 0;) put(code >> i & 1, 1); }
+
+        void stored_block(std::string_view data, bool final)
+        {
+            put(final, 1);
+            put(0b00, 2);
+            if (count) put(0, 8 - count);
+            put(static_cast<std::uint32_t>(data.size()), 16);
+            put(static_cast<std::uint32_t>(~data.size() & 0xFFFF), 16);
+            out += data;
+        }
+
+        // Canonical Huffman codes of code lengths (RFC 1951 3.2.2).
+        static codes_t canonical(const std::vector<int>& lengths)
+        {
+            std::uint32_t count[16]{}, next[16]{};
+            for (int l : lengths) count[l]++;
+            count[0] = 0;
+            for (std::uint32_t bits = 1, code = 0; bits < 16; bits++) next[bits] = code = (code + count[bits - 1]) << 1;
+
+            codes_t codes;
+            for (int l : lengths) codes.emplace_back(l ? next[l]++ : 0, l);
+            return codes;
+        }
+
+        static std::vector<int> fixed_lit_lengths()
+        {
+            std::vector<int> lengths(288);
+            for (size_t i = 0; i < lengths.size(); i++) lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            return lengths;
+        }
+
+        void fixed_block(bool final)
+        {
+            put(final, 1);
+            put(0b01, 2);
+            lit_codes = canonical(fixed_lit_lengths());
+            dist_codes = canonical(std::vector<int>(32, 5));
+        }
+
+        // A dynamic Huffman block of the code lengths, each written by a 4-bit code (the code length code of 0-15 is 4 bits each).
+        void dynamic_block(bool final, const std::vector<int>& lit_lengths, const std::vector<int>& dist_lengths)
+        {
+            put(final, 1);
+            put(0b10, 2);
+            put(static_cast<std::uint32_t>(lit_lengths.size() - 257), 5);
+            put(static_cast<std::uint32_t>(dist_lengths.size() - 1), 5);
+            put(19 - 4, 4);
+            for (int symbol : {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15}) put(symbol < 16 ? 4 : 0, 3);
+            for (int l : lit_lengths) put_code(static_cast<std::uint32_t>(l), 4);
+            for (int l : dist_lengths) put_code(static_cast<std::uint32_t>(l), 4);
+            lit_codes = canonical(lit_lengths);
+            dist_codes = canonical(dist_lengths);
+        }
+
+        void symbol(const codes_t& codes, size_t symbol) { put_code(codes.at(symbol).first, codes.at(symbol).second); }
+        void literal(unsigned char c) { symbol(lit_codes, c); }
+        void end_block() { symbol(lit_codes, 256); }
+
+        void match(unsigned length, unsigned distance)
+        {
+            const size_t l = length == 258 ? 28 : std::upper_bound(std::begin(length_base), std::end(length_base) - 1, length) - std::begin(length_base) - 1;
+            symbol(lit_codes, 257 + l);
+            put(length - length_base[l], l < 8 || l == 28 ? 0 : static_cast<int>(l - 4) / 4);
+
+            const size_t d = std::upper_bound(std::begin(dist_base), std::end(dist_base), distance) - std::begin(dist_base) - 1;
+            symbol(dist_codes, d);
+            put(distance - dist_base[d], d < 4 ? 0 : static_cast<int>(d) / 2 - 1);
+        }
+
+        // A fixed Huffman block of a zero byte and `matches` copies of 258 bytes at distance 1.
+        void zeros_block(size_t matches)
+        {
+            put(0, 1);
+            put(0b01, 2);
+            put_code(0x30, 8); // literal 0
+            for (size_t i = 0; i < matches; i++)
+            {
+                put_code(0xC5, 8); // length 258
+                put_code(0, 5);    // distance 1
+            }
+            put_code(0, 7); // end of block
+        }
+    };
+
+    // Upstream handing out a string in pieces of up to `piece` bytes.
+    struct piecewise_upstream
+    {
+        std::string_view data{};
+        size_t piece{};
+
+        size_t operator()(void* buffer, size_t size)
+        {
+            const size_t n = std::min({size, piece, data.size()});
+            std::memcpy(buffer, data.data(), n);
+            data.remove_prefix(n);
+            return n;
+        }
+    };
+
+    // Inflates a deflate stream by reads of `read_size(i)` bytes, from the input on memory (piece 0), or from an upstream handing out pieces of it.
+    template <class read_size_t>
+    std::string inflate_all(std::string_view input, size_t piece, read_size_t&& read_size, nanonzip::crc32::crc32_t* crc = nullptr)
+    {
+        using namespace nanonzip::inflate;
+        std::string output;
+        std::vector<char> buffer;
+        const auto run = [&](auto& stream)
+        {
+            for (size_t i = 0;; i++)
+            {
+                buffer.resize(std::max<size_t>(read_size(i), 1));
+                const size_t n = stream.read(buffer.data(), buffer.size());
+                output.append(buffer.data(), n);
+                if (n < buffer.size() && !stream.ended()) throw std::logic_error("short read before the end");
+                if (stream.ended()) break;
+            }
+            if (crc) *crc = stream.crc32();
+        };
+
+        if (piece == 0)
+        {
+            const auto stream = std::make_unique<inflate_stream<no_upstream>>(std::basic_string_view<std::byte>{reinterpret_cast<const std::byte*>(input.data()), input.size()});
+            run(*stream);
+        }
+        else
+        {
+            const auto stream = std::make_unique<inflate_stream<piecewise_upstream>>(piecewise_upstream{input, piece});
+            run(*stream);
+        }
+        return output;
+    }
+
+    // Inflates a stream by reads of various sizes, from memory and from upstreams of various pieces, comparing to the expected output.
+    void check_inflate_output(const std::string& name, std::string_view input, const std::string& expected)
+    {
+        std::mt19937_64 random{4};
+        const std::pair<const char*, std::function<size_t(size_t)>> read_sizes[] = {
+            {"whole", [&](size_t) { return expected.size() + 1; }},
+            {"1", [](size_t) { return size_t{1}; }},
+            {"7", [](size_t) { return size_t{7}; }},
+            {"257", [](size_t) { return size_t{257}; }},
+            {"32768", [](size_t) { return size_t{32768}; }},
+            {"random", [&](size_t) { return static_cast<size_t>(random() % 3 ? random() % 600 : random() % 70000); }},
+        };
+        for (size_t piece : {size_t{0}, size_t{1}, size_t{13}, size_t{65536}})
+        {
+            for (const auto& [read_name, read_size] : read_sizes)
+            {
+                const std::string what = "inflate " + name + " by reads of " + read_name + " bytes, pieces of " + std::to_string(piece);
+                try
+                {
+                    nanonzip::crc32::crc32_t crc{};
+                    const auto output = inflate_all(input, piece, read_size, &crc);
+                    check(output == expected, what + ": contents");
+                    check(crc == nanonzip::calculate_crc32(expected.data(), expected.size()), what + ": crc32");
+                }
+                catch (const std::exception& e)
+                {
+                    check(false, what + ": " + e.what());
+                }
+            }
+        }
+    }
+
+    // Writes a block of random literals and matches, appending its output to `expected`.
+    void random_block(deflate_writer& stream, std::string& expected, std::mt19937_64& random, size_t symbols, unsigned max_length, unsigned max_distance)
+    {
+        for (size_t i = 0; i < symbols; i++)
+        {
+            if (expected.empty() || random() % 2)
+            {
+                const auto c = static_cast<unsigned char>(random() % 4 ? 'a' + random() % 8 : random());
+                stream.literal(c);
+                expected += static_cast<char>(c);
+                continue;
+            }
+
+            // short and overlapping, long and far, and the longest
+            const unsigned limit = static_cast<unsigned>(std::min<size_t>(expected.size(), max_distance));
+            const unsigned distance = random() % 3 == 0 ? 1 + random() % std::min(limit, 9u) : limit - random() % std::min(limit, 300u);
+            const unsigned length = random() % 4 == 0 ? max_length : 3 + random() % (max_length - 2);
+            stream.match(length, distance);
+            for (unsigned k = 0; k < length; k++) expected += expected[expected.size() - distance];
+        }
+        stream.end_block();
+    }
+
+    // Checks the inflater against known output: a stream of zlib, and streams of every block type with matches spanning the caller's buffers and the 32KiB window.
+    void check_inflate()
+    {
+        // zlib 1.2 (level 9, a dynamic Huffman block)
+        {
+            static constexpr char zlib_stream[] =
+            "\xdd\x99\x4b\x6e\xdc\x30\x10\x05\xf7\x39\x85\x8e\x30\x14\x3f\xa2\x8e\x13\x20\x0a\x62\xc4\x18\x1b\xc9\x00\xc9\xf1\x93\x20\xcb\x79\xef\x41\xa5\xa5\xb7\x1e\xa1\x4d\xb2\xc9\x66\x75\xf1\xf5\xe5\x7e\x2c\xb7\xe5\xe5\xe7\xf2\xe3\x78\x3f\x3e\x3f\x8e\x2f\x9f\x5e\xff"
+            "\xfd\xa9\x2c\x6f\x5f\x97\xc7\xb7\x63\xf9\x7e\x7f\xfb\x75\x5f\x1e\xc7\xef\xc7\xff\x1f\x9a\xfb\x61\x17\x41\x86\xfb\x78\xed\xee\x97\x3a\x9e\xe3\xb4\xdd\x7d\x3d\xec\x70\x66\x79\x8e\x53\xed\x70\x6c\x98\xb6\x3d\x87\xd9\x56\x1b\xc7\xce\x4a\x8c\x66\xd8\xaf\x77\xbf"
+            "\x3a\x55\x0c\xe7\xe6\xbe\x2e\xf6\x3f\x74\x11\x67\xb7\xd9\x6a\x3e\xe9\x62\x5e\xcd\x2e\xf3\x6e\xe3\x74\xb1\x05\xa7\x4d\xba\x5d\x9e\x55\x64\x6b\xda\x38\xdd\x0e\x67\x5d\x45\x1c\xbf\x09\xed\x61\xa9\x5d\x1c\x0a\xfb\xf5\xb4\x09\x18\xea\x50\xd8\x79\x55\x9b\xf6\x32"
+            "\xc5\x36\xb4\xd9\xb2\x79\x9c\x62\x5a\x9b\x5d\x9e\xcd\xa6\x6b\x53\xbb\xb9\x5e\x88\x23\x6a\xcf\xec\x7c\x5e\x62\x95\xcb\x85\x55\x6e\x6a\x95\x07\xcf\x7a\x51\x25\xac\xf3\x5d\x38\xc5\xf2\xac\x2b\x3f\x15\x53\xcc\xeb\xef\x89\xc3\xa7\x54\x84\xe9\x37\x5e\x33\x9a\xaa"
+            "\x61\xe5\x42\x0d\x13\x69\xef\x95\xd7\xd4\x4d\xd4\xb0\x5a\x79\x8d\x1f\xa2\xf8\xd4\x82\xaf\x9c\x4d\x84\x69\x1b\xbf\x01\xc5\x2a\xcf\xc2\xef\xe3\x26\x36\x61\xbd\xc0\x07\x45\x64\x6b\xc7\xb0\x22\x4e\x96\xbf\x45\x7d\xf4\xf3\x23\x89\x28\x04\x16\x26\xa2\x10\x48\x54"
+            "\x42\x21\xb0\x6d\x12\x0a\x81\x4d\x1c\x51\x08\x1c\xaa\x88\x42\xe0\x90\x47\x14\x22\x45\x27\xa1\x10\x28\x82\x09\x85\x40\x49\x8e\x28\x04\xae\x88\x88\x42\xe0\xca\x8a\x28\x04\xae\xd0\x88\x42\xe0\x4a\x4f\x28\x04\x00\x23\xa2\x10\x01\x9e\x8a\xe2\xec\x01\xd7\xc0\xbc"
+            "\x46\x80\x47\xb0\xca\x3e\x27\x11\x85\x00\x2e\x47\x14\x02\xf8\x1e\x51\x08\xb4\x13\x11\x85\xce\x77\x37\x11\x85\x48\xb3\x55\x50\x0d\x1b\xa1\x55\x04\x35\xd5\x57\xe0\x88\x42\xa0\x39\x4e\x28\x04\x5a\xf5\x88\x42\xe7\xcd\x41\x44\x21\x20\x32\x2a\xe2\x03\x4f\x13\x3b"
+            "\x80\x15\x3b\xf4\x1b\xc0\xa6\x86\x47\xa2\x08\x2e\xfa\x20\x40\x94\xd1\x07\x9d\x07\xdc\xe8\x83\x00\x6f\x5f\xd8\xc4\x8a\xfe\xa3\x0f\x02\xdd\x48\xf4\x41\xa0\x3b\x8a\x3e\x88\x74\x6b\x8d\x17\x41\xd5\x5b\x77\x5e\x92\x55\x2f\x1b\x7d\x10\xe8\xad\xc7\x85\x2b\x4b\xf5"
+            "\xfa\xd1\x07\x01\xf7\x10\x7d\xd0\x79\x15\x12\x7d\x10\x30\x33\xd1\x07\x11\x53\x74\x01\xc0\x94\xb9\x4a\x3e\x08\x78\xb4\xe8\x83\x80\xd7\x8b\x3e\x08\x78\xc6\xe8\x83\x80\xf7\x8c\x3e\x08\x78\xd8\xe4\x83\x80\x15\x8e\x3e\x88\x58\xea\xc6\x9b\x3f\x65\xcd\xa3\x0f\x02"
+            "\x16\x3f\xfa\x20\xf0\xaa\xb0\xf2\x56\x5d\xbd\x71\x24\x1f\x04\x5e\x5c\xa2\x0f\x02\x2f\x40\xd1\x07\x9d\x7f\x90\x6a\xd8\xf1\x7c\xb0\xa7\xb1\x3f";
+            std::string expected;
+            for (int i = 0; i < 300; i++) expected += "line " + std::to_string(i * i % 97) + (i % 3 ? " of the known text\n" : " is repeated\n");
+            check(nanonzip::calculate_crc32(expected.data(), expected.size()) == 0x9e47d68a, "inflate zlib: expected output");
+            check_inflate_output("zlib", {zlib_stream, sizeof(zlib_stream) - 1}, expected);
+        }
+
+        // every block type: fixed, dynamic with short codes, dynamic with codes up to 15 bits (in subtables), stored
+        {
+            std::vector<int> short_lit(286), short_dist(30);
+            for (size_t i = 0; i < short_lit.size(); i++) short_lit[i] = i < 256 ? 9 : i < 284 ? 6 : 5;  // 1/2 + 28/64 + 2/32
+            for (size_t i = 0; i < short_dist.size(); i++) short_dist[i] = i < 28 ? 5 : 4;          // 28/32 + 2/16
+            std::vector<int> long_lit(271, 0), long_dist(16);
+            for (size_t i = 0; i < 256; i++) long_lit[i] = 9;                                   // 1/2
+            for (size_t i = 256; i < 269; i++) long_lit[i] = static_cast<int>(i - 254);         // 2..14: 1/4 + 1/4 - 1/2^14
+            long_lit[269] = long_lit[270] = 15;                                                 // 2/2^15
+            for (size_t i = 0; i < long_dist.size(); i++) long_dist[i] = std::min<int>(static_cast<int>(i) + 1, 15); // 1..15, 15
+
+            std::mt19937_64 random{5};
+            deflate_writer stream;
+            std::string expected, stored(40000, '\0');
+            for (int i = 0; i < 12; i++)
+            {
+                switch (i % 4)
+                {
+                case 0:
+                    stream.fixed_block(false);
+                    random_block(stream, expected, random, 20000, 258, 32768);
+                    break;
+                case 1:
+                    stream.dynamic_block(false, short_lit, short_dist);
+                    random_block(stream, expected, random, 20000, 258, 32768);
+                    break;
+                case 2:
+                    stream.dynamic_block(false, long_lit, long_dist);
+                    random_block(stream, expected, random, 20000, 26, 256); // the lengths and distances with codes
+                    break;
+                default:
+                    for (auto& c : stored) c = static_cast<char>(random());
+                    stream.stored_block(stored, false);
+                    expected += stored;
+                    break;
+                }
+            }
+            stream.stored_block({}, true);
+            check_inflate_output("random blocks", stream.out, expected);
+        }
+
+        // matches from the history before the caller's buffer, across the end of the 32KiB ring of the window
+        {
+            std::mt19937_64 random{6};
+            deflate_writer stream;
+            std::string expected;
+            stream.fixed_block(true);
+            for (int i = 0; i < 40000; i++)
+            {
+                const auto c = static_cast<unsigned char>(random());
+                stream.literal(c);
+                expected += static_cast<char>(c);
+            }
+            for (const auto& [length, distance] : {std::pair{258u, 7242u}, {258u, 32768u}, {3u, 32768u}, {258u, 32758u}, {100u, 7300u}})
+            {
+                stream.match(length, distance);
+                for (unsigned k = 0; k < length; k++) expected += expected[expected.size() - distance];
+            }
+            stream.end_block();
+
+            // reads the literals first, then the matches in pieces
+            for (size_t size : {size_t{1}, size_t{10}, size_t{258}, size_t{300}})
+            {
+                const std::string what = "inflate window wrap by reads of " + std::to_string(size) + " bytes";
+                try
+                {
+                    check(inflate_all(stream.out, 0, [&](size_t i) { return i == 0 ? 40000 : size; }) == expected, what);
+                    check(inflate_all(stream.out, 0, [&](size_t i) { return i == 0 ? 39990 : size; }) == expected, what + " from 10 bytes before");
+                }
+                catch (const std::exception& e)
+                {
+                    check(false, what + ": " + e.what());
+                }
+            }
+            check_inflate_output("window wrap", stream.out, expected);
+        }
+    }
+
+    // Gets the message of the error inflating a stream, or an empty string.
+    std::string inflate_error(std::string_view input, size_t piece, size_t read_size)
+    {
+        try
+        {
+            (void)inflate_all(input, piece, [=](size_t) { return read_size; });
+            return {};
+        }
+        catch (const std::exception& e)
+        {
+            return e.what();
+        }
+    }
+
+    // Checks that Huffman tables reject over-subscribed and incomplete codes but a single 1-bit code, and that the fixed tables decode 286/287 and 30/31 as invalid.
+    void check_huffman()
+    {
+        using namespace nanonzip::inflate;
+
+        // looks up the symbol of a canonical code, fed lsb first
+        const auto lookup = [](const auto& table, std::pair<std::uint32_t, int> code)
+        {
+            std::uint64_t input = 0;
+            for (int i = 0; i < code.second; i++) input |= static_cast<std::uint64_t>(code.first >> i & 1) << (code.second - 1 - i);
+            return table.lookup(input);
+        };
+
+        const auto build_error = [](std::vector<code_length_t> lengths)
+        {
+            try
+            {
+                lit_table table{};
+                table.build(lengths.data(), lengths.size(), lit_entry);
+                return std::string{};
+            }
+            catch (const std::exception& e)
+            {
+                return std::string(e.what());
+            }
+        };
+
+        check(build_error({1, 1, 1}).find("over-subscribed") != std::string::npos, "huffman over-subscribed 1-bit codes");
+        check(build_error({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 15, 15}).find("over-subscribed") != std::string::npos, "huffman over-subscribed 15-bit codes");
+        check(build_error({1, 2}).find("incomplete") != std::string::npos, "huffman incomplete code");
+        check(build_error({0, 0, 2, 2, 2}).find("incomplete") != std::string::npos, "huffman incomplete 2-bit code");
+        check(build_error({2, 0, 0}).find("incomplete") != std::string::npos, "huffman single 2-bit code");
+        check(build_error({0, 1, 0}).empty(), "huffman single 1-bit code");
+        check(build_error({0, 0, 0}).empty(), "huffman no code");
+        check(build_error({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 15}).empty(), "huffman complete 15-bit code");
+
+        // a single 1-bit code decodes its symbol from bit 0, and nothing from bit 1
+        {
+            lit_table table{};
+            const code_length_t lengths[] = {0, 1};
+            table.build(lengths, std::size(lengths), lit_entry);
+            const auto zero = table.lookup(0), one = table.lookup(1);
+            check(zero.kind == entry_kind::literal && zero.value == 1 && zero.length == 1, "huffman single 1-bit code bit 0");
+            check(one.kind == entry_kind::invalid, "huffman single 1-bit code bit 1");
+        }
+
+        // fixed codes, built from all 288 literal/length and 32 distance code lengths
+        {
+            const auto lit = deflate_writer::canonical(deflate_writer::fixed_lit_lengths());
+            const auto dist = deflate_writer::canonical(std::vector<int>(32, 5));
+            bool literals = true;
+            for (unsigned c = 0; c < 256; c++)
+            {
+                const auto e = lookup(fixed_lit_table, lit[c]);
+                literals &= e.kind == entry_kind::literal && e.value == c && e.length == static_cast<unsigned>(lit[c].second);
+            }
+            check(literals, "huffman fixed literals 0-255");
+            check(lookup(fixed_lit_table, lit[256]).kind == entry_kind::end_of_block, "huffman fixed end of block");
+            const auto l285 = lookup(fixed_lit_table, lit[285]);
+            check(l285.kind == entry_kind::length && l285.value == 258 && l285.extra_bits == 0 && l285.length == 8, "huffman fixed length 258");
+            check(lookup(fixed_lit_table, lit[286]).kind == entry_kind::invalid && lookup(fixed_lit_table, lit[287]).kind == entry_kind::invalid, "huffman fixed 286/287 invalid");
+            const auto d29 = lookup(fixed_dist_table, dist[29]);
+            check(d29.kind == entry_kind::distance && d29.value == 24577 && d29.extra_bits == 13, "huffman fixed distance 29");
+            check(lookup(fixed_dist_table, dist[30]).kind == entry_kind::invalid && lookup(fixed_dist_table, dist[31]).kind == entry_kind::invalid, "huffman fixed distance 30/31 invalid");
+        }
+
+        // the same through streams
+        const auto error_of = [](deflate_writer& stream)
+        {
+            if (stream.count) stream.put(0, 8 - stream.count);
+            stream.out += std::string(16, '\0');
+            return inflate_error(stream.out, 0, 100);
+        };
+        const auto expect_error = [&](deflate_writer& stream, const char* message, const std::string& what)
+        {
+            const auto error = error_of(stream);
+            check(error.find(message) != std::string::npos, what + ": " + (error.empty() ? "no error" : error));
+        };
+
+        {
+            deflate_writer stream;
+            stream.fixed_block(true);
+            stream.symbol(stream.lit_codes, 286);
+            expect_error(stream, "not registered huffman code", "inflate fixed literal/length 286");
+        }
+        {
+            deflate_writer stream;
+            stream.fixed_block(true);
+            stream.literal('a');
+            stream.symbol(stream.lit_codes, 257);
+            stream.symbol(stream.dist_codes, 30);
+            expect_error(stream, "invalid distance code", "inflate fixed distance 30");
+        }
+        {
+            deflate_writer stream;
+            stream.dynamic_block(true, std::vector<int>(257, 8), {1});
+            expect_error(stream, "over-subscribed", "inflate dynamic over-subscribed literal/length code");
+        }
+        {
+            std::vector<int> lit(257);
+            lit[0] = 1, lit[256] = 2;
+            deflate_writer stream;
+            stream.dynamic_block(true, lit, {1});
+            expect_error(stream, "incomplete", "inflate dynamic incomplete literal/length code");
+        }
+        {
+            // a single 1-bit code for distance 1, and one for end of block in the next block
+            std::vector<int> lit(258);
+            lit['x'] = 1, lit[256] = 2, lit[257] = 2;
+            deflate_writer stream;
+            stream.dynamic_block(false, lit, {1});
+            stream.literal('x');
+            stream.match(3, 1);
+            stream.end_block();
+            std::vector<int> eob(257);
+            eob[256] = 1;
+            stream.dynamic_block(true, eob, {0});
+            stream.end_block();
+            check(error_of(stream).empty(), "inflate dynamic single 1-bit codes");
+            check(inflate_all(stream.out, 0, [](size_t) { return 100; }) == "xxxx", "inflate dynamic single 1-bit codes output");
+        }
+    }
+
+    // Checks stored blocks: copied in bulk across refills of the input buffer, and rejected if broken or truncated.
+    void check_inflate_stored()
+    {
+        // blocks straddling refills, after a fixed Huffman block leaving the stream unaligned
+        {
+            std::mt19937_64 random{7};
+            deflate_writer stream;
+            std::string expected, stored;
+            stream.fixed_block(false);
+            random_block(stream, expected, random, 1001, 258, 32768);
+            for (size_t size : {65535, 1, 0, 65535, 40000, 65535})
+            {
+                stored.resize(size);
+                for (auto& c : stored) c = static_cast<char>(random());
+                stream.stored_block(stored, false);
+                expected += stored;
+            }
+            stream.stored_block("end", true);
+            expected += "end";
+            check_inflate_output("stored blocks", stream.out, expected);
+        }
+
+        for (size_t piece : {size_t{0}, size_t{1}, size_t{13}, size_t{65536}})
+        {
+            for (size_t read_size : {size_t{1}, size_t{100}, size_t{100000}})
+            {
+                const std::string what = " (pieces of " + std::to_string(piece) + ", reads of " + std::to_string(read_size) + ")";
+
+                // LEN and NLEN not complementing each other
+                deflate_writer mismatch;
+                mismatch.put(1, 1);
+                mismatch.put(0b00, 2);
+                mismatch.put(0, 5);
+                mismatch.put(5, 16);
+                mismatch.put(0, 16);
+                mismatch.out += "hello";
+                check(inflate_error(mismatch.out, piece, read_size).find("invalid stored block lengths") != std::string::npos, "inflate stored LEN/NLEN mismatch" + what);
+
+                // truncated in the payload, and right after the header
+                deflate_writer truncated;
+                truncated.stored_block(std::string(1000, 'x'), true);
+                for (size_t size : {truncated.out.size() - 500, size_t{5}, truncated.out.size() - 1})
+                {
+                    const auto error = inflate_error(std::string_view(truncated.out).substr(0, size), piece, read_size);
+                    check(error.find("unexpected end of stream") != std::string::npos, "inflate stored truncated to " + std::to_string(size) + " bytes" + what + ": " + (error.empty() ? "no error" : error));
+                }
+            }
+        }
+    }
+
+    // Checks that paths find files however they are spelled: with redundant separators, "." elements, or (on Windows) backslashes, and that headers find their entry.
+    void check_find_path()
+    {
+        const auto zip = std::make_shared<const std::string>(make_stored_zip({
+            {"a/b.txt", "b"},
+            {"c.txt", "c"},
+            {"./dot//stored.txt", "stored"},
+            {"back\\slash.txt", "backslash"},
+            {"c.txt", "duplicated c"},
+        }));
+        const nanonzip::zip_file_reader reader(zip->data(), zip->size(), zip);
+
+        const auto contents_of = [&](const std::filesystem::path& path) -> std::string
+        {
+            try
+            {
+                auto f = reader.open_file(path);
+                std::string data(static_cast<size_t>(f.size()), '\0');
+                data.resize(f.read(data.data(), data.size()));
+                return data;
+            }
+            catch (const std::exception& e)
+            {
+                return std::string("<") + e.what() + ">";
+            }
+        };
+
+        for (const char* path : {"a/b.txt", "a//b.txt", "./a/b.txt", "a/./b.txt", "a/x/../b.txt", "./a//./b.txt"})
+            check(contents_of(path) == "b", std::string("find_path ") + path + ": " + contents_of(path));
+        for (const char* path : {"c.txt", "./c.txt", ".//c.txt"})
+            check(contents_of(path) == "c", std::string("find_path ") + path + ": " + contents_of(path));
+
+        // a name stored unnormalized is found as stored
+        check(contents_of("./dot//stored.txt") == "stored", "find_path ./dot//stored.txt: " + contents_of("./dot//stored.txt"));
+
+        // backslashes are separators only on Windows
+#if defined(_WIN32)
+        check(contents_of("a\\b.txt") == "b", "find_path a\\b.txt: " + contents_of("a\\b.txt"));
+        check(contents_of("back/slash.txt") == "backslash", "find_path back/slash.txt: " + contents_of("back/slash.txt"));
+#else
+        check(contents_of("back\\slash.txt") == "backslash", "find_path back\\slash.txt: " + contents_of("back\\slash.txt"));
+        check(contents_of("a\\b.txt") == "<no such file.>", "find_path a\\b.txt: " + contents_of("a\\b.txt"));
+#endif
+
+        for (const char* path : {"b.txt", "a/c.txt", "../c.txt", "a/b.txt/", "A/B.TXT", ""})
+            check(contents_of(path) == "<no such file.>", std::string("find_path ") + path + ": " + contents_of(path));
+
+        // headers open their own entry, even if the path is duplicated
+        for (size_t i = 0; i < reader.file_count(); i++)
+        {
+            auto f = reader.open_file_stream(reader.files()[i]);
+            std::string data(static_cast<size_t>(f.size()), '\0');
+            data.resize(f.read(data.data(), data.size()));
+            auto g = reader.open_file_by_index(i);
+            std::string expected(static_cast<size_t>(g.size()), '\0');
+            expected.resize(g.read(expected.data(), expected.size()));
+            check(data == expected, "open_file_stream of header " + std::to_string(i) + ": " + data);
+        }
+        auto edited = reader.files()[0];
+        edited.relative_offset_of_local_header = 1;
+        bool thrown = false;
+        try { (void)reader.open_file_stream(edited); }
+        catch (const std::exception&) { thrown = true; }
+        check(thrown, "open_file_stream of no entry");
+    }
+
+    // Checks that index files are used only if intact and of the zip file, and that readers fall back to parsing otherwise.
+    void check_index_file()
+    {
+        // the parts of zip_file_reader::raw_central_directory that load_index_file fills
+        struct loaded_directory
+        {
+            std::shared_ptr<const void> index_file{};
+            const char* data{};
+            size_t size{};
+            const std::uint32_t* offsets{};
+            size_t count{};
+            const std::uint64_t* data_offsets{};
+            const std::uint32_t* name_table{};
+            size_t name_table_size{};
+        };
+
+        std::vector<std::pair<std::string, std::string>> files;
+        for (int i = 0; i < 100; i++) files.emplace_back("dir/" + std::to_string(i) + ".txt", std::string(static_cast<size_t>(i * 37), static_cast<char>('a' + i % 26)));
+
+        const auto directory = std::filesystem::temp_directory_path() / "nanonzip.selftest.index";
+        std::filesystem::create_directories(directory);
+        const auto zip = directory / "files.zip", index = directory / "files.zip.nzidx";
+        const auto write = [](const std::filesystem::path& path, const std::string& data) { std::ofstream(path, std::ios::binary | std::ios::trunc) << data; };
+        const auto read = [](const std::filesystem::path& path) { std::ifstream in(path, std::ios::binary); return std::string(std::istreambuf_iterator<char>(in), {}); };
+        write(zip, make_stored_zip(files));
+
+        const auto loaded = [&]
+        {
+            const auto length = static_cast<std::streamoff>(std::filesystem::file_size(zip));
+            return nanonzip::load_index_file<loaded_directory>(index, zip, nanonzip::make_file_seek_read_function_for_file(zip), length).has_value();
+        };
+        const auto contents_match = [&]
+        {
+            const nanonzip::zip_file_reader reader(zip, index);
+            bool ok = reader.file_count() == files.size();
+            for (size_t i = 0; ok && i < files.size(); i++)
+            {
+                auto f = reader.open_file(files[i].first);
+                std::string data(static_cast<size_t>(f.size()), '\0');
+                data.resize(f.read(data.data(), data.size()));
+                ok = data == files[i].second && reader.find(files[i].first) == i;
+            }
+            return ok;
+        };
+        const auto save = [&] { nanonzip::zip_file_reader(zip).save_index(zip, index); };
+
+        save();
+        const auto saved = read(index);
+        check(loaded() && contents_match(), "index file fresh");
+
+        // a byte changed in each section (and the header), or the file cut short
+        nanonzip::index_file_header h{};
+        std::memcpy(&h, saved.data(), sizeof(h));
+        for (const auto offset : {std::uint64_t{20}, h.tail_offset() + 1, h.data_offsets_offset(), h.offsets_offset() + 4, h.name_table_offset() + 8, h.directory_offset() + 50, h.total_size() - 1})
+        {
+            auto broken = saved;
+            broken[static_cast<size_t>(offset)] ^= 0x10;
+            write(index, broken);
+            check(!loaded() && contents_match(), "index file broken at " + std::to_string(offset));
+        }
+        for (const auto size : {size_t{0}, size_t{40}, sizeof(h), saved.size() / 2, saved.size() - 1})
+        {
+            write(index, saved.substr(0, size));
+            check(!loaded() && contents_match(), "index file truncated to " + std::to_string(size));
+        }
+
+        // the zip file rewritten (same size, another tail), and touched
+        write(index, saved);
+        check(loaded(), "index file restored");
+        const auto last_write_time = std::filesystem::last_write_time(zip);
+        files.back().second.back() = '!';
+        write(zip, make_stored_zip(files));
+        std::filesystem::last_write_time(zip, last_write_time);
+        check(!loaded() && contents_match(), "index file of rewritten zip");
+        save();
+        check(loaded(), "index file saved again");
+        std::filesystem::last_write_time(zip, last_write_time + std::chrono::seconds(2));
+        check(!loaded() && contents_match(), "index file of touched zip");
+
+        // a local header offset past the end of the zip file is left unresolved, failing only its own file
+        {
+            auto broken = make_stored_zip(files);
+            size_t header = 0;
+            for (int i = 0; i <= 10; i++) header = broken.find("PK\x01\x02", header + 1);
+            const std::uint32_t past_end = static_cast<std::uint32_t>(broken.size() + 1000);
+            std::memcpy(broken.data() + header + 42, &past_end, sizeof(past_end));
+            write(zip, broken);
+
+            const auto opens = [&](const nanonzip::zip_file_reader& reader, size_t i)
+            {
+                try { return reader.read_file_by_index(i)->size() == files[i].second.size(); }
+                catch (const std::exception&) { return false; }
+            };
+            std::string error;
+            try { nanonzip::zip_file_reader(zip).save_index(zip, index); }
+            catch (const std::exception& e) { error = e.what(); }
+            check(error.empty(), "index file of a header past the end: " + error);
+            if (error.empty())
+            {
+                check(loaded(), "index file of a header past the end not loaded");
+                const nanonzip::zip_file_reader reader(zip, index);
+                bool others = true;
+                for (size_t i = 0; i < files.size(); i++) others &= i == 10 || opens(reader, i);
+                check(others && !opens(reader, 10), "index file of a header past the end: files opened");
+            }
+        }
+
+        std::filesystem::remove_all(directory);
+    }
+
+    // Checks that the parallel inflater returns to batches after the serial fallback of a chunk expanding too far.
+    void check_parallel_inflate()
+    {
+        using namespace nanonzip::decode;
+
+        std::mt19937_64 random{3};
+        std::string expected, random_data(65535, '\0');
+        deflate_writer stream;
+        for (int i = 0; i < 240; i++)
+        {
+            if (i == 48)
+            {
+                // 50MB from 300KB: more than a chunk can hold
+                stream.zeros_block(200000);
+                expected.append(1 + 200000 * 258, '\0');
+            }
+            for (auto& c : random_data) c = static_cast<char>(random());
+            stream.stored_block(random_data, i == 239);
+            expected += random_data;
+        }
+
+        const auto data = std::make_shared<const std::string>(std::move(stream.out));
+        const auto read = std::make_shared<const nanonzip::file_seek_read_function>([data](std::streamoff cursor, void* buf, int len)
+        {
+            std::memcpy(buf, data->data() + cursor, static_cast<size_t>(len));
+            return len;
+        });
+
+        const auto compressed_size = static_cast<std::streamoff>(data->size());
+        const source s{read, {}, 0, 0, nanonzip::file_header::compression_method_t::deflate, nanonzip::calculate_crc32(expected.data(), expected.size()), compressed_size, static_cast<std::streamoff>(expected.size()), {}, 4, nullptr, 0};
+        parallel_inflate_decompressor decompressor(s, true, raw_reader{read, 0, compressed_size});
+
+        std::string output;
+        std::vector<char> buffer(1048576);
+        nanonzip::crc32::crc32_t crc{};
+        int fallbacks = 0, batches_after_fallback = 0;
+        size_t max_workers = 0;
+        for (bool was_serial = false;;)
+        {
+            const auto n = decompressor(buffer.data(), static_cast<int>(buffer.size()), crc);
+            if (n == 0) break;
+            output.append(buffer.data(), static_cast<size_t>(n));
+            fallbacks += !was_serial && decompressor.serial_mode;
+            batches_after_fallback += fallbacks && !decompressor.serial_mode && !decompressor.end;
+            was_serial = decompressor.serial_mode;
+            max_workers = std::max(max_workers, decompressor.workers.size());
+        }
+
+        check(output == expected, "parallel inflate contents");
+        check(crc == s.crc_32, "parallel inflate crc32");
+        check(fallbacks == 1, "parallel inflate fallbacks: " + std::to_string(fallbacks));
+        check(batches_after_fallback > 0, "parallel inflate no batches after the fallback");
+        check(max_workers == 3 && decompressor.workers.size() == 0, "parallel inflate workers: " + std::to_string(max_workers) + " while decoding, " + std::to_string(decompressor.workers.size()) + " at the end");
+    }
+
+    // Checks that pipelines recycled by the decoder pool read every file as a fresh one does, across compression methods and passwords.
+    void check_decoder_pool()
+    {
+        // `text` repeated `times` times, deflated by a stored block of the first copy, then a fixed Huffman block of literals of the second copy and matches of the rest
+        const auto deflated = [](std::string name, std::string_view text, size_t times, std::string password = {})
+        {
+            deflate_writer stream;
+            stream.stored_block(text, false);
+            stream.fixed_block(true);
+            for (char c : text) stream.literal(static_cast<unsigned char>(c));
+            for (size_t rest = text.size() * (times - 2); rest > 0;)
+            {
+                const auto length = static_cast<unsigned>(std::min<size_t>(rest, 258));
+                stream.match(length, static_cast<unsigned>(text.size()));
+                rest -= length;
+            }
+            stream.end_block();
+            if (stream.count) stream.put(0, 8 - stream.count);
+
+            std::string contents;
+            for (size_t i = 0; i < times; i++) contents += text;
+            return zip_entry{std::move(name), std::move(contents), 8, std::move(stream.out), std::move(password)};
+        };
+
+        const std::vector<zip_entry> entries = {
+            {"stored.txt", "stored text"},
+            deflated("deflate.txt", "the quick brown fox ", 500),
+            deflated("other.txt", "jumps over the lazy dog. ", 3000),
+            {"stored.enc", "stored secret text", 0, {}, "secret"},
+            deflated("deflate.enc", "encrypted deflate ", 700, "secret"),
+            deflated("other.enc", "encrypted by another password ", 2000, "another"),
+        };
+        const auto zip = std::make_shared<const std::string>(make_zip(entries));
+        const auto length = static_cast<std::streamoff>(zip->size());
+        const nanonzip::file_seek_read_function read_zip = [zip](std::streamoff cursor, void* buf, int len)
+        {
+            std::memcpy(buf, zip->data() + cursor, static_cast<size_t>(len));
+            return len;
+        };
+
+        const auto read_all = [](nanonzip::file& f)
+        {
+            std::string data;
+            std::vector<char> buffer(1000);
+            while (const auto n = f.read(buffer.data(), buffer.size())) data.append(buffer.data(), n);
+            return data;
+        };
+
+        for (bool on_memory : {false, true})
+        {
+            const std::string what = on_memory ? "decoder pool (on memory) " : "decoder pool ";
+            const nanonzip::zip_file_reader reader = on_memory ? nanonzip::zip_file_reader(zip->data(), zip->size(), zip) : nanonzip::zip_file_reader(read_zip, length);
+
+            std::mt19937_64 random{7};
+            std::vector<size_t> order(entries.size());
+            for (size_t i = 0; i < order.size(); i++) order[i] = i;
+
+            nanonzip::decoder_pool_statistics last{};
+            for (int round = 0; round < 6; round++)
+            {
+                std::shuffle(order.begin(), order.end(), random);
+                for (size_t i : order)
+                {
+                    const auto& e = entries[i];
+                    try
+                    {
+                        if (round % 2)
+                        {
+                            // released half-read: the next file of the pipeline starts over
+                            auto partial = reader.open_file(e.name, e.password);
+                            std::vector<char> buffer(100);
+                            (void)partial.read(buffer.data(), buffer.size());
+                        }
+                        auto f = reader.open_file(e.name, e.password);
+                        check(read_all(f) == e.contents, what + "contents of " + e.name + " in round " + std::to_string(round));
+                    }
+                    catch (const std::exception& ex)
+                    {
+                        check(false, what + "reading " + e.name + " in round " + std::to_string(round) + ": " + ex.what());
+                    }
+                }
+
+                // two files of the same method at once, read alternately
+                try
+                {
+                    auto a = reader.open_file("deflate.txt");
+                    auto b = reader.open_file("other.txt");
+                    std::string data_a, data_b;
+                    std::vector<char> buffer(777);
+                    for (size_t n = 1; n;)
+                    {
+                        n = a.read(buffer.data(), buffer.size());
+                        data_a.append(buffer.data(), n);
+                        const auto m = b.read(buffer.data(), buffer.size());
+                        data_b.append(buffer.data(), m);
+                        n += m;
+                    }
+                    check(data_a == entries[1].contents && data_b == entries[2].contents, what + "contents of files open at once in round " + std::to_string(round));
+                }
+                catch (const std::exception& ex)
+                {
+                    check(false, what + "reading files open at once in round " + std::to_string(round) + ": " + ex.what());
+                }
+
+                // wrong passwords are rejected before a pipeline is taken, and leave the pool usable
+                const auto acquired = reader.decoder_pool_stats().acquired;
+                for (const auto& [name, password] : {std::pair{"deflate.enc", "another"}, {"other.enc", "secret"}, {"stored.enc", "another"}})
+                {
+                    bool thrown = false;
+                    try { (void)reader.open_file(name, password); }
+                    catch (const std::runtime_error&) { thrown = true; }
+                    check(thrown, what + name + " opened by a wrong password");
+                }
+                check(reader.decoder_pool_stats().acquired == acquired, what + "pipelines taken by wrong passwords");
+
+                // every pipeline is back in the pool, and reused from the second round on
+                const auto stats = reader.decoder_pool_stats();
+                check(stats.in_use_bytes == 0, what + "in use bytes after round " + std::to_string(round) + ": " + std::to_string(stats.in_use_bytes));
+                if (round == 0)
+                {
+                    check(stats.acquired > 0 && stats.reused < stats.acquired && stats.idle_decoders > 0, what + "first round");
+                }
+                else
+                {
+                    check(stats.acquired - last.acquired == stats.reused - last.reused, what + "fresh pipelines in round " + std::to_string(round) + ": " + std::to_string((stats.acquired - last.acquired) - (stats.reused - last.reused)));
+                    check(stats.idle_decoders == last.idle_decoders && stats.discarded == 0, what + "idle pipelines in round " + std::to_string(round));
+                }
+                last = stats;
+            }
+        }
+    }
+
+    // Checks that extract_all rejects entries resolving outside of the destination, and with on_progress set, reports failed entries and extracts the others.
+    void check_extract_all()
+    {
+        const std::vector<zip_entry> entries = {
+            {"a.txt", "alpha"},
+            {"dir/", ""},
+            {"dir/b.txt", "beta"},
+            {"dir/../c.txt", "gamma"},
+            {"../escape.txt", "escaped"},
+            {"dir/../../escape2.txt", "escaped too"},
+            {"bad.txt", "corrupted contents"},
+        };
+        auto image = make_zip(entries);
+        image[image.find("corrupted contents")] ^= 1; // crc32 mismatch
+        const auto zip = std::make_shared<const std::string>(std::move(image));
+        const nanonzip::zip_file_reader reader(zip->data(), zip->size(), zip);
+
+        const auto base = std::filesystem::temp_directory_path() / "nanonzip.selftest.extract";
+        const auto destination = base / "out";
+        const auto read = [](const std::filesystem::path& path) { std::ifstream in(path, std::ios::binary); return std::string(std::istreambuf_iterator<char>(in), {}); };
+        const auto message_of = [](const std::exception_ptr& error)
+        {
+            try { if (error) std::rethrow_exception(error); }
+            catch (const std::exception& e) { return std::string(e.what()); }
+            return std::string();
+        };
+        const auto escaped = [&] { return std::filesystem::exists(base / "escape.txt") || std::filesystem::exists(base / "escape2.txt"); };
+
+        for (unsigned threads : {1u, 4u})
+        {
+            const std::string what = "extract_all on " + std::to_string(threads) + " threads: ";
+
+            // without on_progress, the first failure is thrown
+            std::filesystem::remove_all(base);
+            {
+                std::string error;
+                try { reader.extract_all(destination, {{}, threads}); }
+                catch (const std::exception& e) { error = e.what(); }
+                check(!error.empty(), what + "failures not thrown");
+                check(!escaped(), what + "wrote outside of the destination");
+            }
+
+            // with on_progress, every entry is reported once, and the others are extracted
+            std::filesystem::remove_all(base);
+            {
+                std::vector<std::string> errors(entries.size());
+                std::vector<int> reports(entries.size());
+                size_t calls = 0;
+                bool in_order = true;
+                std::uint64_t bytes_total = 0;
+                nanonzip::extract_options options{{}, threads};
+                options.on_progress = [&](const nanonzip::extract_progress& progress)
+                {
+                    in_order &= progress.entries_done == ++calls && progress.entries_total == entries.size();
+                    reports.at(progress.index)++;
+                    errors.at(progress.index) = message_of(progress.error);
+                    bytes_total = progress.bytes_total;
+                };
+
+                std::string error;
+                try { reader.extract_all(destination, options); }
+                catch (const std::exception& e) { error = e.what(); }
+                check(error.empty(), what + "failures thrown with on_progress: " + error);
+                check(calls == entries.size() && in_order && std::count(reports.begin(), reports.end(), 1) == static_cast<std::ptrdiff_t>(entries.size()), what + "progress reports");
+                check(bytes_total == 5 + 4 + 5 + 7 + 11 + 18, what + "bytes_total " + std::to_string(bytes_total));
+                check(!escaped(), what + "wrote outside of the destination");
+
+                for (size_t i = 0; i < entries.size(); i++)
+                {
+                    const auto& e = entries[i];
+                    const bool fails = e.name.find("escape") != std::string::npos || e.name == "bad.txt";
+                    check(errors[i].empty() != fails, what + e.name + (fails ? " not failed" : " failed: " + errors[i]));
+                    if (e.name.find("escape") != std::string::npos)
+                        check(errors[i].find("out side") != std::string::npos, what + e.name + " failed by: " + errors[i]);
+                }
+                check(read(destination / "a.txt") == "alpha" && read(destination / "dir" / "b.txt") == "beta" && read(destination / "c.txt") == "gamma", what + "extracted contents");
+                check(std::filesystem::is_directory(destination / "dir"), what + "extracted directory");
+            }
+
+            // an exception thrown by on_progress stops the extraction
+            std::filesystem::remove_all(base);
+            {
+                size_t calls = 0;
+                nanonzip::extract_options options{{}, threads};
+                options.on_progress = [&](const nanonzip::extract_progress&)
+                {
+                    calls++;
+                    throw std::logic_error("stopped by on_progress");
+                };
+
+                std::string error;
+                try { reader.extract_all(destination, options); }
+                catch (const std::logic_error& e) { error = e.what(); }
+                check(error == "stopped by on_progress", what + "on_progress exception not thrown: " + error);
+                check(calls >= 1 && calls <= threads, what + "on_progress calls after it threw: " + std::to_string(calls));
+            }
+        }
+        std::filesystem::remove_all(base);
+    }
+
+    // Checks that concurrent read_at of a stored file with chunk checksums reads the file, and catches a byte corrupted after the checksums are made.
+    void check_stored_read_at()
+    {
+        std::mt19937_64 random{8};
+        std::string contents(1000000, '\0');
+        for (auto& c : contents) c = static_cast<char>(random());
+        const std::string name = "stored.bin";
+        const auto zip = std::make_shared<std::string>(make_zip({{name, contents}}));
+        const size_t data_offset = 30 + name.size();
+        const nanonzip::file_seek_read_function read_zip = [zip](std::streamoff cursor, void* buf, int len)
+        {
+            std::memcpy(buf, zip->data() + cursor, static_cast<size_t>(len));
+            return len;
+        };
+        const nanonzip::zip_file_reader reader(read_zip, static_cast<std::streamoff>(zip->size()));
+
+        for (size_t chunk_size : {size_t{65536}, size_t{10007}})
+        {
+            const std::string what = "stored read_at by chunks of " + std::to_string(chunk_size) + ": ";
+            nanonzip::open_options options{};
+            options.read_at_checksum_chunk_size = chunk_size;
+            const auto f = reader.open_file(name, options);
+
+            // reads at random ranges on 8 threads, expecting an error exactly if the range touches the chunk of `corrupted`
+            const auto read_concurrently = [&](std::optional<size_t> corrupted)
+            {
+                std::atomic<int> wrong{0}, thrown{0};
+                std::vector<std::thread> threads;
+                for (unsigned t = 0; t < 8; t++)
+                {
+                    threads.emplace_back([&, t]
+                    {
+                        std::mt19937_64 random{t};
+                        std::vector<char> buffer(3 * chunk_size);
+                        for (int i = 0; i < 100; i++)
+                        {
+                            const size_t offset = random() % contents.size();
+                            const size_t length = std::min(random() % buffer.size() + 1, contents.size() - offset);
+                            const bool touched = corrupted && offset / chunk_size <= *corrupted / chunk_size && *corrupted / chunk_size <= (offset + length - 1) / chunk_size;
+                            try
+                            {
+                                const auto n = f.read_at(static_cast<std::streamoff>(offset), buffer.data(), length);
+                                wrong += touched || n != length || std::memcmp(buffer.data(), contents.data() + offset, length) != 0;
+                            }
+                            catch (const std::runtime_error&)
+                            {
+                                thrown++;
+                                wrong += !touched;
+                            }
+                        }
+                    });
+                }
+                for (auto& t : threads) t.join();
+                return std::pair{wrong.load(), thrown.load()};
+            };
+
+            const auto [wrong, thrown] = read_concurrently(std::nullopt);
+            check(wrong == 0 && thrown == 0, what + std::to_string(wrong) + " wrong reads of the intact file");
+
+            // corrupts a byte after the checksums are made
+            const size_t corrupted = 3 * chunk_size + 123;
+            (*zip)[data_offset + corrupted] ^= 0x40;
+            const auto [wrong_corrupted, thrown_corrupted] = read_concurrently(corrupted);
+            check(wrong_corrupted == 0 && thrown_corrupted > 0, what + std::to_string(wrong_corrupted) + " wrong reads of the corrupted file, " + std::to_string(thrown_corrupted) + " thrown");
+
+            char byte{};
+            bool thrown_at_byte = false;
+            try { (void)f.read_at(static_cast<std::streamoff>(corrupted), &byte, 1); }
+            catch (const std::runtime_error&) { thrown_at_byte = true; }
+            check(thrown_at_byte, what + "read of the corrupted byte not thrown");
+            (*zip)[data_offset + corrupted] ^= 0x40;
+        }
+
+        // corrupted from the start: the first read_at checks the whole file; without checksums, the byte is read as it is
+        (*zip)[data_offset + 500000] ^= 0x40;
+        {
+            nanonzip::open_options options{};
+            options.read_at_checksum_chunk_size = 65536;
+            const auto f = reader.open_file(name, options);
+            char byte{};
+            bool thrown = false;
+            try { (void)f.read_at(0, &byte, 1); }
+            catch (const std::runtime_error&) { thrown = true; }
+            check(thrown, "stored read_at of a file corrupted from the start not thrown");
+
+            const auto unchecked = reader.open_file(name);
+            check(unchecked.read_at(500000, &byte, 1) == 1 && byte == static_cast<char>(contents[500000] ^ 0x40), "stored read_at without checksums");
+        }
+        (*zip)[data_offset + 500000] ^= 0x40;
+    }
+
+    // Checks that checkpoints exported by a reader and imported into a fresh one serve read_at, and that broken or foreign checkpoints are rejected as a whole.
+    void check_checkpoints()
+    {
+        // blocks of about 40KB: stored blocks of random bytes, and fixed Huffman blocks of random literals and matches
+        const auto deflated = [](std::string name, std::uint64_t seed)
+        {
+            std::mt19937_64 random{seed};
+            deflate_writer stream;
+            std::string contents;
+            for (int block = 0; block < 60; block++)
+            {
+                const bool final = block == 59;
+                if (block % 2)
+                {
+                    std::string data(40000, '\0');
+                    for (auto& c : data) c = static_cast<char>(random());
+                    stream.stored_block(data, final);
+                    contents += data;
+                    continue;
+                }
+
+                stream.fixed_block(final);
+                for (int i = 0; i < 2000; i++)
+                {
+                    const auto c = static_cast<unsigned char>(random());
+                    stream.literal(c);
+                    contents += static_cast<char>(c);
+                }
+                for (int i = 0; i < 150; i++)
+                {
+                    const auto length = static_cast<unsigned>(3 + random() % 256);
+                    const auto distance = static_cast<unsigned>(1 + random() % std::min<size_t>(contents.size(), 32768));
+                    stream.match(length, distance);
+                    for (unsigned k = 0; k < length; k++) contents += contents[contents.size() - distance];
+                }
+                stream.end_block();
+            }
+            if (stream.count) stream.put(0, 8 - stream.count);
+            return zip_entry{std::move(name), std::move(contents), 8, std::move(stream.out)};
+        };
+
+        const std::vector<zip_entry> entries = {deflated("a.bin", 1), deflated("b.bin", 2), {"stored.txt", "stored"}};
+        const auto zip = std::make_shared<const std::string>(make_zip(entries));
+        const auto bytes_read = std::make_shared<std::atomic<std::uint64_t>>();
+        const nanonzip::file_seek_read_function read_zip = [zip, bytes_read](std::streamoff cursor, void* buf, int len)
+        {
+            *bytes_read += static_cast<std::uint64_t>(len);
+            std::memcpy(buf, zip->data() + cursor, static_cast<size_t>(len));
+            return len;
+        };
+        const auto length = static_cast<std::streamoff>(zip->size());
+        const auto& contents = entries[0].contents;
+        const auto compressed_size = static_cast<std::uint64_t>(entries[0].data.size());
+
+        nanonzip::zip_file_reader exporter(read_zip, length);
+        exporter.set_checkpoint_spacing(65536);
+        const auto exported = exporter.export_checkpoints(0);
+        check(exported.size() > 56 + 10 * (24 + 32768), "checkpoints exported: " + std::to_string(exported.size()) + " bytes");
+
+        // a fresh reader seeks by the imported checkpoints, without inflating the file up to the offset
+        {
+            nanonzip::zip_file_reader reader(read_zip, length);
+            reader.set_checkpoint_spacing(65536);
+            reader.import_checkpoints(0, exported.data(), exported.size());
+            *bytes_read = 0;
+            check(reader.export_checkpoints(0) == exported && *bytes_read == 0, "checkpoints exported again after import, reading " + std::to_string(bytes_read->load()) + " bytes");
+            const auto f = reader.open_file("a.bin", nanonzip::open_options{{}, nanonzip::open_options::integrity_t::none});
+
+            std::string sequential(contents.size(), '\0');
+            check(reader.open_file("a.bin").read(sequential.data(), sequential.size()) == sequential.size() && sequential == contents, "checkpoints sequential read");
+
+            *bytes_read = 0;
+            char tail[10]{};
+            check(f.read_at(static_cast<std::streamoff>(contents.size() - sizeof(tail)), tail, sizeof(tail)) == sizeof(tail) && std::memcmp(tail, contents.data() + contents.size() - sizeof(tail), sizeof(tail)) == 0, "checkpoints read_at of the tail");
+            check(*bytes_read < compressed_size / 8, "checkpoints read_at of the tail read " + std::to_string(bytes_read->load()) + " of " + std::to_string(compressed_size) + " compressed bytes");
+
+            std::mt19937_64 random{9};
+            std::vector<char> buffer(100000);
+            bool same = true;
+            for (int i = 0; i < 200; i++)
+            {
+                const size_t offset = random() % contents.size();
+                const size_t n = f.read_at(static_cast<std::streamoff>(offset), buffer.data(), random() % buffer.size() + 1);
+                same &= n > 0 && std::memcmp(buffer.data(), sequential.data() + offset, n) == 0;
+            }
+            check(same, "checkpoints random read_at after import");
+        }
+
+        // without the checkpoints, the first read_at of the tail inflates the whole file
+        {
+            const nanonzip::zip_file_reader reader(read_zip, length);
+            const auto f = reader.open_file("a.bin");
+            *bytes_read = 0;
+            char tail[10]{};
+            (void)f.read_at(static_cast<std::streamoff>(contents.size() - sizeof(tail)), tail, sizeof(tail));
+            check(*bytes_read >= compressed_size, "checkpoints read_at of the tail without checkpoints read " + std::to_string(bytes_read->load()) + " compressed bytes");
+        }
+
+        // rejected imports: the message, then read_at from scratch as if nothing was imported
+        const auto rejected = [&](std::vector<std::byte> data, size_t index, const std::string& expected, const std::string& what)
+        {
+            const nanonzip::zip_file_reader reader(read_zip, length);
+            std::string error;
+            try { reader.import_checkpoints(index, data.data(), data.size()); }
+            catch (const std::runtime_error& e) { error = e.what(); }
+            check(error == expected, "checkpoints " + what + ": " + (error.empty() ? "imported" : error));
+
+            if (entries[index].method != 8) return;
+            const auto f = reader.open_file_by_index(index);
+            *bytes_read = 0;
+            char tail[10]{};
+            const auto& c = entries[index].contents;
+            check(f.read_at(static_cast<std::streamoff>(c.size() - sizeof(tail)), tail, sizeof(tail)) == sizeof(tail) && std::memcmp(tail, c.data() + c.size() - sizeof(tail), sizeof(tail)) == 0, "checkpoints read_at after " + what);
+            check(*bytes_read >= entries[index].data.size(), "checkpoints " + what + " partly imported");
+        };
+
+        // rewrites the checksum of the header (at offset 48) over edited checkpoints, so that the checks behind it are reached
+        const auto signed_again = [](std::vector<std::byte> data)
+        {
+            std::memset(data.data() + 48, 0, 4);
+            const auto checksum = nanonzip::calculate_crc32(data.data(), data.size());
+            std::memcpy(data.data() + 48, &checksum, 4);
+            return data;
+        };
+        const auto with = [](std::vector<std::byte> data, size_t offset, std::uint64_t value, size_t size = 8)
+        {
+            std::memcpy(data.data() + offset, &value, size); // little endian
+            return data;
+        };
+        const auto field = [&](size_t offset)
+        {
+            std::uint64_t value{};
+            std::memcpy(&value, exported.data() + offset, sizeof(value));
+            return value;
+        };
+
+        const std::string broken = "broken checkpoints.", another = "checkpoints of another file.";
+        rejected({}, 0, broken, "empty");
+        rejected({exported.begin(), exported.begin() + 55}, 0, broken, "shorter than the header");
+        rejected({exported.begin(), exported.end() - 1}, 0, broken, "truncated");
+        rejected(with(exported, 0, 0), 0, broken, "of broken magic");
+        rejected(with(exported, 4096, field(4096) ^ 1), 0, broken, "of a broken window");
+        rejected(exported, 1, another, "of another entry");
+        rejected(exported, 2, "file has no checkpoints: not deflate, or encrypted.", "of a stored entry");
+        // header: crc_32 at 12, compressed_size at 16, uncompressed_size at 24, count at 40; each checkpoint: output, input_bits, window_size, then the window (32KiB here)
+        const size_t last = 56 + (field(40) - 1) * (24 + 32768);
+        rejected(signed_again(with(exported, 12, ~field(12), 4)), 0, another, "of another crc32");
+        rejected(signed_again(with(exported, 16, compressed_size + 1)), 0, another, "of another compressed size");
+        rejected(signed_again(with(exported, 24, contents.size() + 1)), 0, another, "of another uncompressed size");
+        rejected(signed_again(with(exported, 40, field(40) + 1)), 0, broken, "of a count past the end");
+        rejected(signed_again(with(exported, 40, field(40) - 1)), 0, broken, "of a count short of the end");
+        rejected(signed_again(with(exported, 56, 0)), 0, broken, "of a checkpoint at offset 0");
+        rejected(signed_again(with(exported, last, contents.size())), 0, broken, "of a checkpoint past the end");
+        rejected(signed_again(with(exported, 64, compressed_size * 8)), 0, broken, "of a checkpoint past the input");
+        rejected(signed_again(with(exported, 56, 1000)), 0, broken, "of a window longer than the output before it");
+        rejected(signed_again(with(exported, 56 + 24 + 32768, field(56))), 0, broken, "of checkpoints out of order");
+    }
+
+    // Checks that the cache of decompressed files admits a file up to the whole budget, and evicts in the order of priorities across its shards.
+    void check_entry_cache()
+    {
+        using nanonzip::decode::entry_cache;
+        const auto contents = [](size_t size) { return std::make_shared<const std::vector<std::byte>>(size); };
+
+        for (auto eviction : {nanonzip::entry_cache_options::eviction_t::lru, nanonzip::entry_cache_options::eviction_t::cost_aware})
+        {
+            const std::string name = eviction == nanonzip::entry_cache_options::eviction_t::lru ? "lru" : "cost_aware";
+            entry_cache cache;
+            cache.configure({1000, eviction});
+
+            // larger than a shard's share of the budget
+            cache.insert(0, {}, contents(900), 1.0);
+            check(cache.find(0, {}) != nullptr, "entry_cache " + name + ": a file of 90% of the budget is not cached");
+            cache.insert(1, {}, contents(1001), 1.0);
+            check(cache.find(1, {}) == nullptr, "entry_cache " + name + ": a file over the budget is cached");
+
+            // a file in another shard (and of a higher priority) evicts it
+            cache.insert(2, {}, contents(500), 10.0);
+            check(cache.find(0, {}) == nullptr && cache.find(2, {}) != nullptr, "entry_cache " + name + ": not evicted across shards");
+
+            // the least recently used (lru), or the least hit (cost_aware) of files in different shards
+            cache.configure({0, eviction});
+            cache.configure({1000, eviction});
+            for (size_t i = 0; i < 10; i++) cache.insert(i, {}, contents(100), 1.0);
+            (void)cache.find(0, {});
+            const auto evictions = cache.stats().evictions;
+            cache.insert(10, {}, contents(100), 1.0);
+            const auto stats = cache.stats();
+            check(cache.find(0, {}) != nullptr && cache.find(1, {}) == nullptr && cache.find(10, {}) != nullptr, "entry_cache " + name + ": evicted out of order");
+            check(stats.cached_files == 10 && stats.cached_bytes == 1000 && stats.evictions == evictions + 1, "entry_cache " + name + ": " + std::to_string(stats.cached_files) + " files of " + std::to_string(stats.cached_bytes) + " bytes cached");
+        }
+
+        // contents are handed out only for the same password, and one with another password replaces them
+        {
+            entry_cache cache;
+            cache.configure({1000, nanonzip::entry_cache_options::eviction_t::lru});
+            cache.insert(0, "secret", contents(10), 1.0);
+            check(cache.find(0, "secret") != nullptr && cache.find(0, "other") == nullptr && cache.find(0, {}) == nullptr, "entry_cache password");
+            cache.insert(0, "other", contents(10), 1.0);
+            check(cache.find(0, "other") != nullptr && cache.find(0, "secret") == nullptr && cache.stats().cached_files == 1, "entry_cache password replaced");
+        }
+
+        // files not encrypted are cached whatever password they are read with
+        {
+            const auto zip = std::make_shared<const std::string>(make_stored_zip({{"a.txt", "plain"}}));
+            nanonzip::zip_file_reader reader(zip->data(), zip->size(), zip);
+            reader.set_entry_cache_options({1000, nanonzip::entry_cache_options::eviction_t::lru});
+            const auto first = reader.read_file("a.txt", "secret");
+            check(reader.read_file("a.txt") == first && reader.read_file("a.txt", "other") == first, "entry_cache file not encrypted read with other passwords");
+            const auto stats = reader.entry_cache_stats();
+            check(stats.hits == 2 && stats.misses == 1 && stats.evictions == 0, "entry_cache file not encrypted: " + std::to_string(stats.hits) + " hits");
+        }
+
+        // concurrent readers keep the budget
+        entry_cache cache;
+        cache.configure({100000, nanonzip::entry_cache_options::eviction_t::lru});
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < 4; t++)
+        {
+            threads.emplace_back([&, t]
+            {
+                std::mt19937_64 r{t};
+                for (int i = 0; i < 20000; i++)
+                {
+                    const size_t index = r() % 200;
+                    if (!cache.find(index, {})) cache.insert(index, {}, contents(r() % 20000), 1.0);
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        const auto stats = cache.stats();
+        check(stats.cached_bytes <= 100000 && stats.cached_bytes > 50000, "entry_cache concurrent: " + std::to_string(stats.cached_bytes) + " bytes cached");
+    }
+}
+
+int main()
+{
+    check_crc32();
+    check_inflate();
+    check_inflate_stored();
+    check_huffman();
+    check_headers();
+    check_dos_dates();
+    check_parallel_files();
+    check_page_cache();
+    check_find_path();
+    check_index_file();
+    check_parallel_inflate();
+    check_decoder_pool();
+    check_extract_all();
+    check_stored_read_at();
+    check_checkpoints();
+    check_entry_cache();
+
+    if (failures) std::cerr << failures << " checks failed.\n";
+    else std::clog << "all checks passed.\n";
+    return failures ? 1 : 0;
+}
@@ -57,9 +57,9 @@ int main(int argc, char* argv[])
                     std::ofstream out(target_path, std::ios::out | std::ios::binary);
 
                     std::streamoff total = 0;
+                    std::vector<char> buf(1048576); // reading buffer
                     while (total < file.size())
                     {
-                        std::vector<char> buf(1048576); // reading buffer
                         size_t r = file.read(buf.data(), buf.size());
                         out.write(buf.data(), static_cast<std::streamsize>(r));
                         total += static_cast<std::streamsize>(r);